@@ -26,12 +26,20 @@
 
 enum
 {
-  /* pick a number small enough for common tracker software:
+  /* how many info_hashes to scrape at once from a tracker we don't know yet.
+   * pick a number small enough for common tracker software:
    *  - ocelot has no upper bound
    *  - opentracker has an upper bound of 64
    *  - udp protocol has an upper bound of 74
-   *  - xbtt has no upper bound */
-  TR_MULTISCRAPE_MAX = 64
+   *  - xbtt has no upper bound
+   * the announcer raises or lowers this per tracker as it learns more. */
+  TR_MULTISCRAPE_DEFAULT = 64,
+
+  /* the most info_hashes that will fit in a tr_scrape_request */
+  TR_MULTISCRAPE_MAX = 128,
+
+  /* the most info_hashes that will fit in a udp scrape packet */
+  TR_MULTISCRAPE_UDP_MAX = 74
 };
 
 typedef struct
@@ -109,6 +117,45 @@ void tr_tracker_udp_scrape( tr_session               * session,
                             tr_scrape_response_func    response_func,
                             void                     * user_data );
 
+/***
+****  MULTISCRAPE SIZE
+***/
+
+enum
+{
+  /* how many full-size scrapes in a row a tracker has to answer
+     before we try sending it a bigger one */
+  TR_MULTISCRAPE_GROW_AFTER = 4
+};
+
+/** How many info_hashes a tracker will take in one scrape,
+    as learned from its scrape responses */
+typedef struct
+{
+    /* how many info_hashes to put in a scrape request */
+    int max;
+
+    /* the smallest number of info_hashes the tracker has turned down */
+    int ceiling;
+
+    /* full-size scrapes answered in a row since max changed */
+    int successes;
+
+    /* if true, the next scrape request may be bigger than max */
+    bool probe;
+}
+tr_multiscrape_size;
+
+void tr_multiscrapeSizeInit( tr_multiscrape_size * size, const char * url );
+
+/** @brief learn from a scrape response.
+    @return true if the scrape had too many info_hashes in it */
+bool tr_multiscrapeSizeOnResponse( tr_multiscrape_size       * size,
+                                   const tr_scrape_response  * response );
+
+/** @return how many info_hashes the next full scrape request may hold */
+int tr_multiscrapeSizeNext( tr_multiscrape_size * size );
+
 /***
 ****  ANNOUNCE
 ***/
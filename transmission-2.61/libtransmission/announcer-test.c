@@ -0,0 +1,191 @@
+#include <stdio.h> /* fprintf */
+#include <string.h> /* memset */
+
+#define __LIBTRANSMISSION_ANNOUNCER_MODULE___
+
+#include "transmission.h"
+#include "announcer-common.h"
+#include "utils.h"
+
+#undef VERBOSE
+
+static int test = 0;
+
+#ifdef VERBOSE
+  #define check( A ) \
+    { \
+        ++test; \
+        if( A ){ \
+            fprintf( stderr, "PASS test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+        } else { \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#else
+  #define check( A ) \
+    { \
+        ++test; \
+        if( !( A ) ){ \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#endif
+
+static tr_scrape_response response;
+
+/* build a response to a scrape of `row_count' torrents,
+   of which the tracker answered the first `answered' */
+static const tr_scrape_response*
+makeResponse( int row_count, int answered, const char * errmsg )
+{
+    int i;
+
+    memset( &response, 0, sizeof( response ) );
+    response.did_connect = true;
+    response.row_count = row_count;
+    response.errmsg = (char*) errmsg;
+
+    for( i=0; i<row_count; ++i )
+    {
+        struct tr_scrape_response_row * row = &response.rows[i];
+        row->seeders = row->leechers = row->downloads = i<answered ? 1 : -1;
+        row->downloaders = -1;
+    }
+
+    return &response;
+}
+
+/* answer enough full-size scrapes for the next one to be a probe */
+static void
+growToProbe( tr_multiscrape_size * size )
+{
+    int i;
+
+    for( i=0; i<TR_MULTISCRAPE_GROW_AFTER; ++i )
+        tr_multiscrapeSizeOnResponse( size, makeResponse( size->max, size->max, NULL ) );
+}
+
+static int
+testGrowth( void )
+{
+    tr_multiscrape_size size;
+
+    tr_multiscrapeSizeInit( &size, "http://example.com/announce" );
+    check( size.max == TR_MULTISCRAPE_DEFAULT );
+    check( tr_multiscrapeSizeNext( &size ) == TR_MULTISCRAPE_DEFAULT );
+
+    /* partly-full scrapes don't count toward growing */
+    check( !tr_multiscrapeSizeOnResponse( &size, makeResponse( 10, 10, NULL ) ) );
+    check( size.successes == 0 );
+
+    /* nor do failed ones */
+    check( !tr_multiscrapeSizeOnResponse( &size, makeResponse( size.max, 0, "Tracker is down" ) ) );
+    check( size.successes == 0 );
+
+    /* after enough full-size scrapes, one request tries halfway to the ceiling */
+    growToProbe( &size );
+    check( size.probe );
+    check( tr_multiscrapeSizeNext( &size ) == ( TR_MULTISCRAPE_DEFAULT + TR_MULTISCRAPE_MAX + 1 ) / 2 );
+    check( tr_multiscrapeSizeNext( &size ) == TR_MULTISCRAPE_DEFAULT );
+
+    /* the probe worked, so it becomes the new size */
+    check( !tr_multiscrapeSizeOnResponse( &size, makeResponse( 96, 96, NULL ) ) );
+    check( size.max == 96 );
+    check( size.successes == 0 );
+
+    /* udp trackers have a smaller ceiling */
+    tr_multiscrapeSizeInit( &size, "udp://example.com:80" );
+    growToProbe( &size );
+    check( tr_multiscrapeSizeNext( &size ) == ( TR_MULTISCRAPE_DEFAULT + TR_MULTISCRAPE_UDP_MAX + 1 ) / 2 );
+
+    /* never probe past the most that'll fit */
+    size.max = TR_MULTISCRAPE_UDP_MAX;
+    growToProbe( &size );
+    check( !size.probe );
+    check( tr_multiscrapeSizeNext( &size ) == TR_MULTISCRAPE_UDP_MAX );
+
+    return 0;
+}
+
+static int
+testTooBig( void )
+{
+    tr_multiscrape_size size;
+
+    tr_multiscrapeSizeInit( &size, "http://example.com/announce" );
+
+    /* a size we thought was safe got turned down, so it's halved */
+    check( tr_multiscrapeSizeOnResponse( &size, makeResponse( 64, 0, "Request-URI Too Long" ) ) );
+    check( size.max == 32 );
+    check( size.ceiling == 64 );
+
+    /* other requests of that size that were already in flight
+       don't halve it again */
+    check( tr_multiscrapeSizeOnResponse( &size, makeResponse( 64, 0, "GET string too long" ) ) );
+    check( size.max == 32 );
+
+    /* probes now stay under the new ceiling */
+    growToProbe( &size );
+    check( tr_multiscrapeSizeNext( &size ) == 48 );
+
+    /* a failed probe lowers the ceiling but keeps the size */
+    check( tr_multiscrapeSizeOnResponse( &size, makeResponse( 48, 0, "Bad Request" ) ) );
+    check( size.max == 32 );
+    check( size.ceiling == 48 );
+    check( !size.probe );
+
+    /* a one-torrent scrape is never too big */
+    check( !tr_multiscrapeSizeOnResponse( &size, makeResponse( 1, 0, "Bad Request" ) ) );
+    check( size.max == 32 );
+
+    /* it doesn't go below one */
+    size.max = 2;
+    check( tr_multiscrapeSizeOnResponse( &size, makeResponse( 2, 0, "Bad Request" ) ) );
+    check( size.max == 1 );
+
+    return 0;
+}
+
+static int
+testDroppedRows( void )
+{
+    tr_multiscrape_size size;
+
+    tr_multiscrapeSizeInit( &size, "http://example.com/announce" );
+
+    /* unregistered torrents can go missing from a normal-size response,
+       so that's not a sign that it was too big */
+    check( !tr_multiscrapeSizeOnResponse( &size, makeResponse( 64, 60, NULL ) ) );
+    check( size.max == 64 );
+    check( size.ceiling == TR_MULTISCRAPE_MAX + 1 );
+
+    /* ...but it doesn't count toward growing, either */
+    check( size.successes == 0 );
+    growToProbe( &size );
+    check( size.probe );
+
+    /* a probe whose extra rows were silently dropped was too big */
+    check( tr_multiscrapeSizeNext( &size ) == 96 );
+    check( tr_multiscrapeSizeOnResponse( &size, makeResponse( 96, 80, NULL ) ) );
+    check( size.max == 64 );
+    check( size.ceiling == 96 );
+
+    return 0;
+}
+
+int
+main( void )
+{
+    int l;
+
+    if(( l = testGrowth( )))
+        return l;
+    if(( l = testTooBig( )))
+        return l;
+    if(( l = testDroppedRows( )))
+        return l;
+
+    return 0;
+}
@@ -12,6 +12,7 @@
 
 #define __LIBTRANSMISSION_ANNOUNCER_MODULE___
 
+#include <stdlib.h> /* abs() */
 #include <string.h> /* memcpy(), memset() */
 
 #include <event2/buffer.h>
@@ -66,7 +67,8 @@ tau_sendto( tr_session * session,
     }
 
     tau_sockaddr_setport( ai->ai_addr, port );
-    return sendto( sockfd, buf, buflen, 0, ai->ai_addr, ai->ai_addrlen );
+    return tr_udpSendTo( session, sockfd, buf, buflen, 0,
+                         ai->ai_addr, ai->ai_addrlen );
 }
 
 /****
@@ -129,27 +131,223 @@ is_tau_response_message( int action, int msglen )
     if( action == TAU_ACTION_ERROR    ) return msglen >= 8;
     return false;
 }
-
 enum
 {
-    TAU_REQUEST_TTL = 60
+    TAU_REQUEST_TTL = 60,
+
+    /* the most info_hashes that fit in one UDP scrape packet */
+    TAU_SCRAPE_MAX_HASHES = TR_MULTISCRAPE_UDP_MAX,
+
+    /* the token bucket that paces the requests sent to one tracker */
+    TAU_TRACKER_REQUESTS_PER_SEC = 50,
+    TAU_TRACKER_REQUEST_BURST = 100
 };
 
 /****
 *****
-*****  SCRAPE
+*****  REQUESTS
 *****
 ****/
 
-struct tau_scrape_request
+struct tau_tracker;
+struct tau_request_list;
+
+/* The fields that connect, announce, and scrape requests have in common.
+   This is the first field of tau_announce_request and tau_scrape_request,
+   so a pointer to either can be cast to a tau_request pointer. */
+struct tau_request
 {
-    void * payload;
-    size_t payload_len;
+    tau_action_t action;
+    tau_transaction_t transaction_id;
 
-    time_t sent_at;
     time_t created_at;
+    uint64_t sent_msec;
+
+    struct tau_tracker * tracker;
+
+    /* the tracker list that this request is in */
+    struct tau_request_list * list;
+    struct tau_request * prev;
+    struct tau_request * next;
+
+    /* the next request in this transaction table bucket */
+    struct tau_request * hash_next;
+};
+
+/* requests, oldest first */
+struct tau_request_list
+{
+    struct tau_request * head;
+    struct tau_request * tail;
+    int count;
+};
+
+static void
+tau_request_list_append( struct tau_request_list * list,
+                         struct tau_request      * req )
+{
+    assert( req->list == NULL );
+
+    req->list = list;
+    req->prev = list->tail;
+    req->next = NULL;
+
+    if( list->tail != NULL )
+        list->tail->next = req;
+    else
+        list->head = req;
+
+    list->tail = req;
+    ++list->count;
+}
+
+static void
+tau_request_list_remove( struct tau_request * req )
+{
+    struct tau_request_list * list = req->list;
+
+    assert( list != NULL );
+
+    if( req->prev != NULL )
+        req->prev->next = req->next;
+    else
+        list->head = req->next;
+
+    if( req->next != NULL )
+        req->next->prev = req->prev;
+    else
+        list->tail = req->prev;
+
+    req->list = NULL;
+    req->prev = NULL;
+    req->next = NULL;
+    --list->count;
+}
+
+/****
+*****
+*****  TRANSACTIONS
+*****
+****/
+
+struct tr_announcer_udp
+{
+    /* tau_tracker */
+    tr_ptrArray trackers;
+
+    /* the requests awaiting a response, hashed by transaction id */
+    struct tau_request ** transactions;
+    size_t transaction_table_size;
+    size_t transaction_count;
+
+    tr_session * session;
+};
+
+static struct tau_request **
+tau_transaction_bucket( struct tr_announcer_udp  * tau,
+                        tau_transaction_t          transaction_id )
+{
+    return &tau->transactions[transaction_id & ( tau->transaction_table_size - 1 )];
+}
+
+static struct tau_request *
+tau_transaction_find( struct tr_announcer_udp  * tau,
+                      tau_transaction_t          transaction_id )
+{
+    struct tau_request * req = NULL;
+
+    if( tau->transaction_table_size > 0 )
+        for( req=*tau_transaction_bucket( tau, transaction_id ); req!=NULL; req=req->hash_next )
+            if( req->transaction_id == transaction_id )
+                break;
+
+    return req;
+}
+
+static void
+tau_transaction_add( struct tr_announcer_udp * tau, struct tau_request * req )
+{
+    struct tau_request ** bucket;
+
+    /* grow the table to keep the chains short */
+    if( tau->transaction_count >= tau->transaction_table_size )
+    {
+        size_t i;
+        const size_t old_size = tau->transaction_table_size;
+        struct tau_request ** old = tau->transactions;
+
+        tau->transaction_table_size = old_size ? old_size * 2 : 64;
+        tau->transactions = tr_new0( struct tau_request*, tau->transaction_table_size );
+
+        for( i=0; i<old_size; ++i )
+        {
+            struct tau_request * walk = old[i];
+
+            while( walk != NULL )
+            {
+                struct tau_request * next = walk->hash_next;
+                bucket = tau_transaction_bucket( tau, walk->transaction_id );
+                walk->hash_next = *bucket;
+                *bucket = walk;
+                walk = next;
+            }
+        }
+
+        tr_free( old );
+    }
+
+    bucket = tau_transaction_bucket( tau, req->transaction_id );
+    req->hash_next = *bucket;
+    *bucket = req;
+    ++tau->transaction_count;
+}
+
+static void
+tau_transaction_remove( struct tr_announcer_udp * tau, struct tau_request * req )
+{
+    struct tau_request ** walk;
+
+    if( tau->transaction_table_size == 0 )
+        return;
+
+    for( walk=tau_transaction_bucket( tau, req->transaction_id ); *walk!=NULL; walk=&(*walk)->hash_next )
+    {
+        if( *walk == req )
+        {
+            *walk = req->hash_next;
+            req->hash_next = NULL;
+            --tau->transaction_count;
+            break;
+        }
+    }
+}
+
+/* returns a transaction id that no pending request is using */
+static tau_transaction_t
+tau_transaction_new_unique( struct tr_announcer_udp * tau )
+{
     tau_transaction_t transaction_id;
 
+    do
+        transaction_id = tau_transaction_new( );
+    while( tau_transaction_find( tau, transaction_id ) != NULL );
+
+    return transaction_id;
+}
+
+/****
+*****
+*****  SCRAPE
+*****
+****/
+
+struct tau_scrape_request
+{
+    struct tau_request base;
+
+    /* where this request's rows start in a packed scrape response */
+    int row_offset;
+
     tr_scrape_response response;
     tr_scrape_response_func * callback;
     void * user_data;
@@ -161,27 +359,18 @@ tau_scrape_request_new( const tr_scrape_request  * in,
                         void                     * user_data )
 {
     int i;
-    struct evbuffer * buf;
     struct tau_scrape_request * req;
-    const tau_transaction_t transaction_id = tau_transaction_new( );
 
-    /* build the payload */
-    buf = evbuffer_new( );
-    evbuffer_add_hton_32( buf, TAU_ACTION_SCRAPE );
-    evbuffer_add_hton_32( buf, transaction_id );
-    for( i=0; i<in->info_hash_count; ++i )
-        evbuffer_add( buf, in->info_hash[i], SHA_DIGEST_LENGTH );
-
-    /* build the tau_scrape_request */
+    /* build the tau_scrape_request.
+       its payload is built when it's sent, since it may be packed
+       into the same packet as other scrapes to the same tracker */
     req = tr_new0( struct tau_scrape_request, 1 );
-    req->created_at = tr_time( );
-    req->transaction_id = transaction_id;
+    req->base.action = TAU_ACTION_SCRAPE;
+    req->base.created_at = tr_time( );
     req->callback = callback;
     req->user_data = user_data;
     req->response.url = tr_strdup( in->url );
     req->response.row_count = in->info_hash_count;
-    req->payload_len = evbuffer_get_length( buf );
-    req->payload = tr_memdup( evbuffer_pullup( buf, -1 ), req->payload_len );
     for( i=0; i<req->response.row_count; ++i )
     {
         req->response.rows[i].seeders = -1;
@@ -191,8 +380,6 @@ tau_scrape_request_new( const tr_scrape_request  * in,
                 in->info_hash[i], SHA_DIGEST_LENGTH );
     }
 
-    /* cleanup */
-    evbuffer_free( buf );
     return req;
 }
 
@@ -201,7 +388,6 @@ tau_scrape_request_free( struct tau_scrape_request * req )
 {
     tr_free( req->response.errmsg );
     tr_free( req->response.url );
-    tr_free( req->payload );
     tr_free( req );
 }
 
@@ -273,13 +459,12 @@ on_scrape_response( struct tau_scrape_request  * request,
 
 struct tau_announce_request
 {
+    struct tau_request base;
+
+    /* everything that follows the action and transaction id */
     void * payload;
     size_t payload_len;
 
-    time_t created_at;
-    time_t sent_at;
-    tau_transaction_t transaction_id;
-
     tr_announce_response response;
     tr_announce_response_func * callback;
     void * user_data;
@@ -314,12 +499,10 @@ tau_announce_request_new( const tr_announce_request  * in,
 {
     struct evbuffer * buf;
     struct tau_announce_request * req;
-    const tau_transaction_t transaction_id = tau_transaction_new( );
 
-    /* build the payload */
+    /* build the payload.
+       the transaction id is picked when the request is sent */
     buf = evbuffer_new( );
-    evbuffer_add_hton_32( buf, TAU_ACTION_ANNOUNCE );
-    evbuffer_add_hton_32( buf, transaction_id );
     evbuffer_add        ( buf, in->info_hash, SHA_DIGEST_LENGTH );
     evbuffer_add        ( buf, in->peer_id, PEER_ID_LEN );
     evbuffer_add_hton_64( buf, in->down );
@@ -333,8 +516,8 @@ tau_announce_request_new( const tr_announce_request  * in,
 
     /* build the tau_announce_request */
     req = tr_new0( struct tau_announce_request, 1 );
-    req->created_at = tr_time( );
-    req->transaction_id = transaction_id;
+    req->base.action = TAU_ACTION_ANNOUNCE;
+    req->base.created_at = tr_time( );
     req->callback = callback;
     req->user_data = user_data;
     req->payload_len = evbuffer_get_length( buf );
@@ -415,6 +598,33 @@ on_announce_response( struct tau_announce_request  * request,
     }
 }
 
+/***
+****
+***/
+
+static void
+tau_request_fail( struct tau_request  * req,
+                  bool                  did_connect,
+                  bool                  did_timeout,
+                  const char          * errmsg )
+{
+    if( req->action == TAU_ACTION_ANNOUNCE )
+        tau_announce_request_fail( (struct tau_announce_request*)req,
+                                   did_connect, did_timeout, errmsg );
+    else
+        tau_scrape_request_fail( (struct tau_scrape_request*)req,
+                                 did_connect, did_timeout, errmsg );
+}
+
+static void
+tau_request_free( struct tau_request * req )
+{
+    if( req->action == TAU_ACTION_ANNOUNCE )
+        tau_announce_request_free( (struct tau_announce_request*)req );
+    else
+        tau_scrape_request_free( (struct tau_scrape_request*)req );
+}
+
 /****
 *****
 *****  TRACKERS
@@ -424,6 +634,7 @@ on_announce_response( struct tau_announce_request  * request,
 struct tau_tracker
 {
     tr_session * session;
+    struct tr_announcer_udp * tau;
 
     char * key;
     char * host;
@@ -436,54 +647,128 @@ struct tau_tracker
     time_t connecting_at;
     time_t connection_expiration_time;
     tau_connection_t connection_id;
-    tau_transaction_t connection_transaction_id;
+    struct tau_request connection_request;
 
     time_t close_at;
 
-    tr_ptrArray announces;
-    tr_ptrArray scrapes;
+    /* requests that haven't been sent yet */
+    struct tau_request_list announce_queue;
+    struct tau_request_list scrape_queue;
+
+    /* requests that have been sent and are awaiting a response */
+    struct tau_request_list announces;
+    struct tau_request_list scrapes;
+
+    /* how many requests we can send right now, and when that was counted */
+    double tokens;
+    uint64_t tokens_msec;
+
+    /* the smoothed round-trip time and its variation, as in RFC 6298 */
+    int srtt_msec;
+    int rttvar_msec;
+
+    /* how many requests we've sent, and how many went unanswered */
+    int sent_count;
+    int lost_count;
 };
 
 static void tau_tracker_upkeep( struct tau_tracker * );
 
+static void
+tau_request_list_destruct( struct tau_request_list * list )
+{
+    while( list->head != NULL )
+    {
+        struct tau_request * req = list->head;
+        tau_request_list_remove( req );
+        tau_request_free( req );
+    }
+}
+
 static void
 tau_tracker_free( struct tau_tracker * t )
 {
     if( t->addr )
         evutil_freeaddrinfo( t->addr );
-    tr_ptrArrayDestruct( &t->announces, (PtrArrayForeachFunc)tau_announce_request_free );
-    tr_ptrArrayDestruct( &t->scrapes, (PtrArrayForeachFunc)tau_scrape_request_free );
+    tau_request_list_destruct( &t->announce_queue );
+    tau_request_list_destruct( &t->scrape_queue );
+    tau_request_list_destruct( &t->announces );
+    tau_request_list_destruct( &t->scrapes );
     tr_free( t->host );
     tr_free( t->key );
     tr_free( t );
 }
 
+/* remove a request from its list and from the transaction table */
+static void
+tau_tracker_forget_request( struct tau_tracker * tracker,
+                            struct tau_request * req )
+{
+    if( req->list != NULL )
+        tau_request_list_remove( req );
+
+    if( req->sent_msec )
+        tau_transaction_remove( tracker->tau, req );
+}
+
+static void
+tau_tracker_add_rtt( struct tau_tracker * tracker, int rtt_msec )
+{
+    if( !tracker->srtt_msec )
+    {
+        tracker->srtt_msec = rtt_msec;
+        tracker->rttvar_msec = rtt_msec / 2;
+    }
+    else
+    {
+        tracker->rttvar_msec = ( 3 * tracker->rttvar_msec
+                               + abs( tracker->srtt_msec - rtt_msec ) ) / 4;
+        tracker->srtt_msec = ( 7 * tracker->srtt_msec + rtt_msec ) / 8;
+    }
+
+    dbgmsg( tracker->key, "rtt %d msec (smoothed %d, variation %d); "
+                          "%d of %d requests lost",
+            rtt_msec, tracker->srtt_msec, tracker->rttvar_msec,
+            tracker->lost_count, tracker->sent_count );
+}
+
+static void
+tau_tracker_fail_list( struct tau_tracker       * tracker,
+                       struct tau_request_list  * list,
+                       bool                       did_connect,
+                       bool                       did_timeout,
+                       const char               * errmsg )
+{
+    int n;
+
+    /* only fail the requests that were here when we started,
+       in case a callback adds new ones */
+    for( n=list->count; n>0 && list->head!=NULL; --n )
+    {
+        struct tau_request * req = list->head;
+        tau_tracker_forget_request( tracker, req );
+        tau_request_fail( req, did_connect, did_timeout, errmsg );
+        tau_request_free( req );
+    }
+}
+
 static void
 tau_tracker_fail_all( struct tau_tracker  * tracker,
                       bool                  did_connect,
                       bool                  did_timeout,
                       const char          * errmsg )
 {
-    int i;
-    int n;
-    tr_ptrArray * reqs;
-
     /* fail all the scrapes */
-    reqs = &tracker->scrapes;
-    for( i=0, n=tr_ptrArraySize(reqs); i<n; ++i )
-        tau_scrape_request_fail( tr_ptrArrayNth( reqs, i ),
-                                 did_connect, did_timeout, errmsg );
-    tr_ptrArrayDestruct( reqs, (PtrArrayForeachFunc)tau_scrape_request_free );
-    *reqs = TR_PTR_ARRAY_INIT;
+    tau_tracker_fail_list( tracker, &tracker->scrapes,
+                           did_connect, did_timeout, errmsg );
+    tau_tracker_fail_list( tracker, &tracker->scrape_queue,
+                           did_connect, did_timeout, errmsg );
 
     /* fail all the announces */
-    reqs = &tracker->announces;
-    for( i=0, n=tr_ptrArraySize(reqs); i<n; ++i )
-        tau_announce_request_fail( tr_ptrArrayNth( reqs, i ),
-                                   did_connect, did_timeout, errmsg );
-    tr_ptrArrayDestruct( reqs, (PtrArrayForeachFunc)tau_announce_request_free );
-    *reqs = TR_PTR_ARRAY_INIT;
-
+    tau_tracker_fail_list( tracker, &tracker->announces,
+                           did_connect, did_timeout, errmsg );
+    tau_tracker_fail_list( tracker, &tracker->announce_queue,
+                           did_connect, did_timeout, errmsg );
 }
 
 static void
@@ -512,6 +797,8 @@ tau_tracker_on_dns( int errcode, struct evutil_addrinfo *addr, void * vtracker )
 
 static void
 tau_tracker_send_request( struct tau_tracker  * tracker,
+                          tau_action_t          action,
+                          tau_transaction_t     transaction_id,
                           const void          * payload,
                           size_t                payload_len )
 {
@@ -519,6 +806,8 @@ tau_tracker_send_request( struct tau_tracker  * tracker,
     dbgmsg( tracker->key, "sending request w/connection id %"PRIu64"\n",
                           tracker->connection_id );
     evbuffer_add_hton_64( buf, tracker->connection_id );
+    evbuffer_add_hton_32( buf, action );
+    evbuffer_add_hton_32( buf, transaction_id );
     evbuffer_add_reference( buf, payload, payload_len, NULL, NULL );
     tau_sendto( tracker->session, tracker->addr, tracker->port,
                 evbuffer_pullup( buf, -1 ),
@@ -526,49 +815,109 @@ tau_tracker_send_request( struct tau_tracker  * tracker,
     evbuffer_free( buf );
 }
 
+/* move a request that was just sent into the list that awaits responses */
+static void
+tau_tracker_await_response( struct tau_tracker       * tracker,
+                            struct tau_request_list  * list,
+                            struct tau_request       * req )
+{
+    ++tracker->sent_count;
+    tau_request_list_append( list, req );
+    tau_transaction_add( tracker->tau, req );
+}
+
+static void
+tau_tracker_send_announce( struct tau_tracker           * tracker,
+                           struct tau_announce_request  * req,
+                           uint64_t                       now_msec )
+{
+    tau_request_list_remove( &req->base );
+    req->base.transaction_id = tau_transaction_new_unique( tracker->tau );
+    req->base.sent_msec = now_msec;
+
+    dbgmsg( tracker->key, "sending announce req %p", req );
+    tau_tracker_send_request( tracker, TAU_ACTION_ANNOUNCE,
+                              req->base.transaction_id,
+                              req->payload, req->payload_len );
+
+    if( req->callback == NULL )
+        tau_announce_request_free( req );
+    else
+        tau_tracker_await_response( tracker, &tracker->announces, &req->base );
+}
+
+/* send the oldest scrapes, packing as many into one packet as will fit.
+   They share a transaction id and each remembers where its rows start. */
+static void
+tau_tracker_send_scrapes( struct tau_tracker * tracker, uint64_t now_msec )
+{
+    int row_count = 0;
+    struct tau_request * base;
+    uint8_t hashes[TAU_SCRAPE_MAX_HASHES * SHA_DIGEST_LENGTH];
+    const tau_transaction_t transaction_id = tau_transaction_new_unique( tracker->tau );
+
+    while(( base = tracker->scrape_queue.head ))
+    {
+        int i;
+        struct tau_scrape_request * req = (struct tau_scrape_request*)base;
+
+        if( row_count + req->response.row_count > TAU_SCRAPE_MAX_HASHES )
+            break;
+
+        tau_request_list_remove( base );
+        base->transaction_id = transaction_id;
+        base->sent_msec = now_msec;
+        req->row_offset = row_count;
+        for( i=0; i<req->response.row_count; ++i )
+            memcpy( hashes + SHA_DIGEST_LENGTH * row_count++,
+                    req->response.rows[i].info_hash, SHA_DIGEST_LENGTH );
+
+        dbgmsg( tracker->key, "sending scrape req %p", req );
+
+        if( req->callback == NULL )
+            tau_scrape_request_free( req );
+        else
+            tau_tracker_await_response( tracker, &tracker->scrapes, base );
+    }
+
+    assert( row_count > 0 );
+    tau_tracker_send_request( tracker, TAU_ACTION_SCRAPE, transaction_id,
+                              hashes, row_count * SHA_DIGEST_LENGTH );
+}
+
 static void
 tau_tracker_send_reqs( struct tau_tracker * tracker )
 {
-    int i, n;
-    tr_ptrArray * reqs;
-    const time_t now = tr_time( );
+    const uint64_t now_msec = tr_time_msec( );
 
     assert( tracker->is_asking_dns == false );
     assert( tracker->connecting_at == 0 );
     assert( tracker->addr != NULL );
-    assert( tracker->connection_expiration_time > now );
-
-    reqs = &tracker->announces;
-    for( i=0, n=tr_ptrArraySize(reqs); i<n; ++i ) {
-        struct tau_announce_request * req = tr_ptrArrayNth( reqs, i );
-        if( !req->sent_at ) {
-            dbgmsg( tracker->key, "sending announce req %p", req );
-            req->sent_at = now;
-            tau_tracker_send_request( tracker, req->payload, req->payload_len );
-            if( req->callback == NULL ) {
-                tau_announce_request_free( req );
-                tr_ptrArrayRemove( reqs, i );
-                --i;
-                --n;
-            }
-        }
+    assert( tracker->connection_expiration_time > tr_time( ) );
+
+    /* refill the token bucket */
+    tracker->tokens += ( now_msec - tracker->tokens_msec )
+                     * TAU_TRACKER_REQUESTS_PER_SEC / 1000.0;
+    tracker->tokens = MIN( tracker->tokens, TAU_TRACKER_REQUEST_BURST );
+    tracker->tokens_msec = now_msec;
+
+    while( ( tracker->tokens >= 1 ) && ( tracker->announce_queue.head != NULL ) )
+    {
+        tracker->tokens -= 1;
+        tau_tracker_send_announce( tracker,
+            (struct tau_announce_request*)tracker->announce_queue.head,
+            now_msec );
     }
 
-    reqs = &tracker->scrapes;
-    for( i=0, n=tr_ptrArraySize(reqs); i<n; ++i ) {
-        struct tau_scrape_request * req = tr_ptrArrayNth( reqs, i );
-        if( !req->sent_at ) {
-            dbgmsg( tracker->key, "sending scrape req %p", req );
-            req->sent_at = now;
-            tau_tracker_send_request( tracker, req->payload, req->payload_len );
-            if( req->callback == NULL ) {
-                tau_scrape_request_free( req );
-                tr_ptrArrayRemove( reqs, i );
-                --i;
-                --n;
-            }
-        }
+    while( ( tracker->tokens >= 1 ) && ( tracker->scrape_queue.head != NULL ) )
+    {
+        tracker->tokens -= 1;
+        tau_tracker_send_scrapes( tracker, now_msec );
     }
+
+    if( tracker->announce_queue.count || tracker->scrape_queue.count )
+        dbgmsg( tracker->key, "%d announces and %d scrapes are waiting to be sent",
+                tracker->announce_queue.count, tracker->scrape_queue.count );
 }
 
 static void
@@ -578,8 +927,8 @@ on_tracker_connection_response( struct tau_tracker  * tracker,
 {
     const time_t now = tr_time( );
 
+    tau_transaction_remove( tracker->tau, &tracker->connection_request );
     tracker->connecting_at = 0;
-    tracker->connection_transaction_id = 0;
 
     if( action == TAU_ACTION_CONNECT )
     {
@@ -593,6 +942,9 @@ on_tracker_connection_response( struct tau_tracker  * tracker,
         char * errmsg;
         const size_t buflen = buf ? evbuffer_get_length( buf ) : 0;
 
+        if( buf == NULL )
+            ++tracker->lost_count;
+
         if( ( action == TAU_ACTION_ERROR ) && ( buflen > 0 ) )
             errmsg = tr_strndup( evbuffer_pullup( buf, -1 ), buflen );
         else
@@ -606,11 +958,31 @@ on_tracker_connection_response( struct tau_tracker  * tracker,
     tau_tracker_upkeep( tracker );
 }
 
+static void
+tau_tracker_timeout_list( struct tau_tracker       * tracker,
+                          struct tau_request_list  * list,
+                          time_t                     now,
+                          bool                       cancel_all )
+{
+    struct tau_request * req;
+
+    /* the list is oldest-first, so stop at the first one that isn't stale */
+    while(( req = list->head )
+        && ( cancel_all || ( req->created_at + TAU_REQUEST_TTL < now ) ))
+    {
+        dbgmsg( tracker->key, "timeout %s req %p",
+                req->action == TAU_ACTION_ANNOUNCE ? "announce" : "scrape", req );
+        if( req->sent_msec )
+            ++tracker->lost_count;
+        tau_tracker_forget_request( tracker, req );
+        tau_request_fail( req, false, true, NULL );
+        tau_request_free( req );
+    }
+}
+
 static void
 tau_tracker_timeout_reqs( struct tau_tracker * tracker )
 {
-    int i, n;
-    tr_ptrArray * reqs;
     const time_t now = time( NULL );
     const bool cancel_all = tracker->close_at && ( tracker->close_at <= now );
 
@@ -619,38 +991,19 @@ tau_tracker_timeout_reqs( struct tau_tracker * tracker )
         on_tracker_connection_response( tracker, TAU_ACTION_ERROR, NULL );
     }
 
-    reqs = &tracker->announces;
-    for( i=0, n=tr_ptrArraySize(reqs); i<n; ++i ) {
-        struct tau_announce_request * req = tr_ptrArrayNth( reqs, i );
-        if( cancel_all || ( req->created_at + TAU_REQUEST_TTL < now ) ) {
-            dbgmsg( tracker->key, "timeout announce req %p", req );
-            tau_announce_request_fail( req, false, true, NULL );
-            tau_announce_request_free( req );
-            tr_ptrArrayRemove( reqs, i );
-            --i;
-            --n;
-        }
-    }
-
-    reqs = &tracker->scrapes;
-    for( i=0, n=tr_ptrArraySize(reqs); i<n; ++i ) {
-        struct tau_scrape_request * req = tr_ptrArrayNth( reqs, i );
-        if( cancel_all || ( req->created_at + TAU_REQUEST_TTL < now ) ) {
-            dbgmsg( tracker->key, "timeout scrape req %p", req );
-            tau_scrape_request_fail( req, false, true, NULL );
-            tau_scrape_request_free( req );
-            tr_ptrArrayRemove( reqs, i );
-            --i;
-            --n;
-        }
-    }
+    tau_tracker_timeout_list( tracker, &tracker->announces, now, cancel_all );
+    tau_tracker_timeout_list( tracker, &tracker->announce_queue, now, cancel_all );
+    tau_tracker_timeout_list( tracker, &tracker->scrapes, now, cancel_all );
+    tau_tracker_timeout_list( tracker, &tracker->scrape_queue, now, cancel_all );
 }
 
 static bool
 tau_tracker_is_idle( const struct tau_tracker * tracker )
 {
-    return tr_ptrArrayEmpty( &tracker->announces )
-        && tr_ptrArrayEmpty( &tracker->scrapes );
+    return !tracker->announce_queue.count
+        && !tracker->announces.count
+        && !tracker->scrape_queue.count
+        && !tracker->scrapes.count;
 }
 
 static void
@@ -697,13 +1050,17 @@ tau_tracker_upkeep( struct tau_tracker * tracker )
         && ( !tracker->connecting_at ) )
     {
         struct evbuffer * buf = evbuffer_new( );
+        struct tau_request * req = &tracker->connection_request;
         tracker->connecting_at = now;
-        tracker->connection_transaction_id = tau_transaction_new( );
+        req->transaction_id = tau_transaction_new_unique( tracker->tau );
+        req->sent_msec = tr_time_msec( );
+        ++tracker->sent_count;
+        tau_transaction_add( tracker->tau, req );
         dbgmsg( tracker->key, "Trying to connect. Transaction ID is %u",
-                tracker->connection_transaction_id );
+                req->transaction_id );
         evbuffer_add_hton_64( buf, 0x41727101980LL );
         evbuffer_add_hton_32( buf, TAU_ACTION_CONNECT );
-        evbuffer_add_hton_32( buf, tracker->connection_transaction_id );
+        evbuffer_add_hton_32( buf, req->transaction_id );
         tau_sendto( tracker->session, tracker->addr, tracker->port,
                     evbuffer_pullup( buf, -1 ),
                     evbuffer_get_length( buf ) );
@@ -723,14 +1080,6 @@ tau_tracker_upkeep( struct tau_tracker * tracker )
 *****
 ****/
 
-struct tr_announcer_udp
-{
-    /* tau_tracker */
-    tr_ptrArray trackers;
-
-    tr_session * session;
-};
-
 static struct tr_announcer_udp*
 announcer_udp_get( tr_session * session )
 {
@@ -772,11 +1121,12 @@ tau_session_get_tracker( struct tr_announcer_udp * tau, const char * url )
     {
         tracker = tr_new0( struct tau_tracker, 1 );
         tracker->session = tau->session;
+        tracker->tau = tau;
+        tracker->connection_request.action = TAU_ACTION_CONNECT;
+        tracker->connection_request.tracker = tracker;
         tracker->key = key;
         tracker->host = host;
         tracker->port = port;
-        tracker->scrapes = TR_PTR_ARRAY_INIT;
-        tracker->announces = TR_PTR_ARRAY_INIT;
         tr_ptrArrayAppend( &tau->trackers, tracker );
         dbgmsg( tracker->key, "New tau_tracker created" );
     }
@@ -830,6 +1180,7 @@ tr_tracker_udp_close( tr_session * session )
     {
         session->announcer_udp = NULL;
         tr_ptrArrayDestruct( &tau->trackers, (PtrArrayForeachFunc)tau_tracker_free );
+        tr_free( tau->transactions );
         tr_free( tau );
     }
 }
@@ -860,9 +1211,9 @@ tr_tracker_udp_start_shutdown( tr_session * session )
 bool
 tau_handle_message( tr_session * session, const uint8_t * msg, size_t msglen )
 {
-    int i;
-    int n;
     struct tr_announcer_udp * tau;
+    struct tau_tracker * tracker;
+    struct tau_request * req;
     tau_action_t action_id;
     tau_transaction_t transaction_id;
     struct evbuffer * buf;
@@ -887,54 +1238,61 @@ tau_handle_message( tr_session * session, const uint8_t * msg, size_t msglen )
     tau = session->announcer_udp;
     transaction_id = evbuffer_read_ntoh_32( buf );
     /*fprintf( stderr, "UDP got a transaction_id %u...\n", transaction_id );*/
-    for( i=0, n=tr_ptrArraySize( &tau->trackers ); i<n; ++i )
-    {
-        int j, jn;
-        tr_ptrArray * reqs;
-        struct tau_tracker * tracker = tr_ptrArrayNth( &tau->trackers, i );
-
-        /* is it a connection response? */
-        if( tracker->connecting_at
-            && ( transaction_id == tracker->connection_transaction_id ) )
-        {
-            dbgmsg( tracker->key, "%"PRIu32" is my connection request!", transaction_id );
-            on_tracker_connection_response( tracker, action_id, buf );
-            evbuffer_free( buf );
-            return true;
-        }
+    req = tau_transaction_find( tau, transaction_id );
+    if( req == NULL ) {
+        evbuffer_free( buf );
+        return false;
+    }
 
-        /* is it a response to one of this tracker's announces? */
-        reqs = &tracker->announces;
-        for( j=0, jn=tr_ptrArraySize(reqs); j<jn; ++j ) {
-            struct tau_announce_request * req = tr_ptrArrayNth( reqs, j );
-            if( req->sent_at && ( transaction_id == req->transaction_id ) ) {
-                dbgmsg( tracker->key, "%"PRIu32" is an announce request!", transaction_id );
-                tr_ptrArrayRemove( reqs, j );
-                on_announce_response( req, action_id, buf );
-                tau_announce_request_free( req );
-                evbuffer_free( buf );
-                return true;
-            }
-        }
+    tracker = req->tracker;
+    tau_tracker_add_rtt( tracker, (int)( tr_time_msec( ) - req->sent_msec ) );
 
-        /* is it a response to one of this tracker's scrapes? */
-        reqs = &tracker->scrapes;
-        for( j=0, jn=tr_ptrArraySize(reqs); j<jn; ++j ) {
-            struct tau_scrape_request * req = tr_ptrArrayNth( reqs, j );
-            if( req->sent_at && ( transaction_id == req->transaction_id ) ) {
-                dbgmsg( tracker->key, "%"PRIu32" is a scrape request!", transaction_id );
-                tr_ptrArrayRemove( reqs, j );
-                on_scrape_response( req, action_id, buf );
-                tau_scrape_request_free( req );
-                evbuffer_free( buf );
-                return true;
-            }
+    if( req->action == TAU_ACTION_CONNECT )
+    {
+        dbgmsg( tracker->key, "%"PRIu32" is my connection request!", transaction_id );
+        on_tracker_connection_response( tracker, action_id, buf );
+    }
+    else if( req->action == TAU_ACTION_ANNOUNCE )
+    {
+        dbgmsg( tracker->key, "%"PRIu32" is an announce request!", transaction_id );
+        tau_tracker_forget_request( tracker, req );
+        on_announce_response( (struct tau_announce_request*)req, action_id, buf );
+        tau_request_free( req );
+    }
+    else
+    {
+        int i;
+        int n = 0;
+        struct tau_request * scrapes[TAU_SCRAPE_MAX_HASHES];
+        const uint8_t * body = msg + sizeof( uint32_t ) * 2;
+        const size_t bodylen = msglen - sizeof( uint32_t ) * 2;
+
+        dbgmsg( tracker->key, "%"PRIu32" is a scrape request!", transaction_id );
+
+        /* collect all the scrapes that were packed into this transaction
+           before calling back, so a new request can't reuse its id */
+        do {
+            tau_tracker_forget_request( tracker, req );
+            scrapes[n++] = req;
+        } while(( n < TAU_SCRAPE_MAX_HASHES )
+             && (( req = tau_transaction_find( tau, transaction_id ) )));
+
+        /* give each of them its own rows */
+        for( i=0; i<n; ++i )
+        {
+            struct tau_scrape_request * scrape = (struct tau_scrape_request*)scrapes[i];
+            struct evbuffer * rows = evbuffer_new( );
+            evbuffer_add_reference( rows, body, bodylen, NULL, NULL );
+            if( action_id == TAU_ACTION_SCRAPE )
+                evbuffer_drain( rows, scrape->row_offset * sizeof( uint32_t ) * 3 );
+            on_scrape_response( scrape, action_id, rows );
+            tau_request_free( scrapes[i] );
+            evbuffer_free( rows );
         }
     }
 
-    /* no match... */
     evbuffer_free( buf );
-    return false;
+    return true;
 }
 
 void
@@ -948,7 +1306,8 @@ tr_tracker_udp_announce( tr_session                 * session,
     struct tau_announce_request * r = tau_announce_request_new( request,
                                                                 response_func,
                                                                 user_data );
-    tr_ptrArrayAppend( &tracker->announces, r );
+    r->base.tracker = tracker;
+    tau_request_list_append( &tracker->announce_queue, &r->base );
     tau_tracker_upkeep( tracker );
 }
 
@@ -963,6 +1322,7 @@ tr_tracker_udp_scrape( tr_session               * session,
     struct tau_scrape_request * r = tau_scrape_request_new( request,
                                                             response_func,
                                                             user_data );
-    tr_ptrArrayAppend( &tracker->scrapes, r );
+    r->base.tracker = tracker;
+    tau_request_list_append( &tracker->scrape_queue, &r->base );
     tau_tracker_upkeep( tracker );
 }
@@ -25,6 +25,7 @@
 #include "announcer.h"
 #include "announcer-common.h"
 #include "crypto.h" /* tr_cryptoRandInt(), tr_cryptoWeakRandInt() */
+#include "heap.h"
 #include "peer-mgr.h" /* tr_peerMgrCompactToPex() */
 #include "ptrarray.h"
 #include "session.h"
@@ -62,8 +63,13 @@ enum
 
     UPKEEP_INTERVAL_SECS = 1,
 
-    /* this is how often to call the UDP tracker upkeep */
-    TAU_UPKEEP_INTERVAL_SECS = 5
+    /* this is how often to call the UDP tracker upkeep.
+       it's also when requests held back by a tracker's token bucket
+       get sent, so keep it short */
+    TAU_UPKEEP_INTERVAL_SECS = 1,
+
+    /* how often to log how many requests we've sent to each tracker */
+    REPORT_INTERVAL_SECS = ( 60 * 15 )
 };
 
 /***
@@ -127,6 +133,89 @@ compareStops( const void * va, const void * vb )
     return tr_strcmp0( a->url, b->url );
 }
 
+/***
+****  PLANNER
+***/
+
+/* a tier that wants to announce or scrape at a given time */
+typedef struct
+{
+    time_t at;
+    int torrentId;
+    int tierId;
+}
+tr_tier_due;
+
+/* tr_heapCompareFunc for tr_tier_dues, soonest first */
+static int
+compareTierDues( const void * va, const void * vb )
+{
+    const tr_tier_due * a = va;
+    const tr_tier_due * b = vb;
+
+    if( a->at != b->at )
+        return a->at < b->at ? -1 : 1;
+
+    return 0;
+}
+
+static void
+tierHeapPush( tr_heap * heap, time_t at, int torrentId, int tierId )
+{
+    tr_tier_due due;
+    due.at = at;
+    due.torrentId = torrentId;
+    due.tierId = tierId;
+    tr_heapPush( heap, &due );
+}
+
+/**
+ * What we've learned about a tracker, shared by all the torrents that use it.
+ * Trackers are identified by tr_tracker.key, so several announce URLs
+ * on the same host and port share one of these.
+ */
+typedef struct
+{
+    char * key;
+
+    /* how many info_hashes this tracker will take in one scrape */
+    tr_multiscrape_size multiscrape;
+
+    /* tr_tier_due of tiers that use this tracker, soonest scrape first */
+    tr_heap scrapes;
+
+    /* requests sent since the last report */
+    int announce_count;
+    int scrape_count;
+    int scrape_hash_count;
+}
+tr_tracker_host;
+
+static int
+compareHosts( const void * va, const void * vb )
+{
+    const tr_tracker_host * a = va;
+    const tr_tracker_host * b = vb;
+    return strcmp( a->key, b->key );
+}
+
+static void
+hostFree( void * vhost )
+{
+    tr_tracker_host * host = vhost;
+    tr_heapDestruct( &host->scrapes );
+    tr_free( host->key );
+    tr_free( host );
+}
+
+/* the most info_hashes that this kind of tracker can take in one scrape */
+static int
+hostGetMultiscrapeLimit( const char * url )
+{
+    return !memcmp( url, "udp://", 6 ) ? TR_MULTISCRAPE_UDP_MAX
+                                       : TR_MULTISCRAPE_MAX;
+}
+
 /***
 ****
 ***/
@@ -138,14 +227,45 @@ typedef struct tr_announcer
 {
     tr_ptrArray stops; /* tr_announce_request */
 
+    /* tr_tracker_host, sorted by key */
+    tr_ptrArray hosts;
+    int hostIndex;
+
+    /* tr_tier_due of all the tiers, soonest announce first */
+    tr_heap announces;
+
     tr_session * session;
     struct event * upkeepTimer;
     int slotsAvailable;
     int key;
     time_t tauUpkeepAt;
+    time_t reportAt;
 }
 tr_announcer;
 
+static tr_tracker_host *
+getHost( tr_announcer * announcer, const char * key )
+{
+    tr_tracker_host tmp;
+    tr_tracker_host * host;
+
+    tmp.key = (char*) key;
+    host = tr_ptrArrayFindSorted( &announcer->hosts, &tmp, compareHosts );
+
+    if( host == NULL )
+    {
+        const tr_heap scrapes = TR_HEAP_INIT( tr_tier_due, compareTierDues );
+
+        host = tr_new0( tr_tracker_host, 1 );
+        host->key = tr_strdup( key );
+        host->scrapes = scrapes;
+        tr_multiscrapeSizeInit( &host->multiscrape, key );
+        tr_ptrArrayInsertSorted( &announcer->hosts, host, compareHosts );
+    }
+
+    return host;
+}
+
 bool
 tr_announcerHasBacklog( const struct tr_announcer * announcer )
 {
@@ -159,12 +279,16 @@ void
 tr_announcerInit( tr_session * session )
 {
     tr_announcer * a;
+    const tr_heap announces = TR_HEAP_INIT( tr_tier_due, compareTierDues );
 
     assert( tr_isSession( session ) );
 
     a = tr_new0( tr_announcer, 1 );
     a->stops = TR_PTR_ARRAY_INIT;
+    a->hosts = TR_PTR_ARRAY_INIT;
+    a->announces = announces;
     a->key = tr_cryptoRandInt( INT_MAX );
+    a->reportAt = tr_time( ) + REPORT_INTERVAL_SECS;
     a->session = session;
     a->slotsAvailable = MAX_CONCURRENT_TASKS;
     a->upkeepTimer = evtimer_new( session->event_base, onUpkeepTimer, a );
@@ -188,6 +312,8 @@ tr_announcerClose( tr_session * session )
     announcer->upkeepTimer = NULL;
 
     tr_ptrArrayDestruct( &announcer->stops, NULL );
+    tr_ptrArrayDestruct( &announcer->hosts, hostFree );
+    tr_heapDestruct( &announcer->announces );
 
     session->announcer = NULL;
     tr_free( announcer );
@@ -302,6 +428,10 @@ typedef struct tr_tier
 
     int lastAnnouncePeerCount;
 
+    /* when this tier is due in the announcer's heaps, or 0 if it isn't */
+    time_t announcePlannedAt;
+    time_t scrapePlannedAt;
+
     bool isRunning;
     bool isAnnouncing;
     bool isScraping;
@@ -364,6 +494,28 @@ tier_build_log_name( const tr_tier * tier, char * buf, size_t buflen )
        ( tier && tier->currentTracker ) ? tier->currentTracker->key : "?" );
 }
 
+/* Add the tier's scrapeAt to its tracker's scrape heap.
+ * Stale entries aren't removed from the heaps; instead, an entry only
+ * counts if it still matches the tier's *PlannedAt when it comes due. */
+static void
+tierScheduleScrape( tr_tier * tier )
+{
+    tr_announcer * announcer = tier->tor->session->announcer;
+
+    tr_torrentMarkChanged( tier->tor, TR_CHANGED_TRACKERS );
+
+    if( ( announcer != NULL )
+        && ( tier->scrapeAt != 0 )
+        && ( tier->scrapeAt != tier->scrapePlannedAt )
+        && ( tier->currentTracker != NULL )
+        && ( tier->currentTracker->scrape != NULL ) )
+    {
+        tr_tracker_host * host = getHost( announcer, tier->currentTracker->key );
+        tierHeapPush( &host->scrapes, tier->scrapeAt, tier->tor->uniqueId, tier->key );
+        tier->scrapePlannedAt = tier->scrapeAt;
+    }
+}
+
 static void
 tierIncrementTracker( tr_tier * tier )
 {
@@ -382,6 +534,28 @@ tierIncrementTracker( tr_tier * tier )
     tier->isScraping = false;
     tier->lastAnnounceStartTime = 0;
     tier->lastScrapeStartTime = 0;
+    tr_torrentMarkChanged( tier->tor, TR_CHANGED_TRACKERS );
+
+    /* the new tracker may have a scrape URL that the old one didn't */
+    tierScheduleScrape( tier );
+}
+
+/* Add the tier's announceAt to the announcer's announce heap */
+static void
+tierScheduleAnnounce( tr_tier * tier )
+{
+    tr_announcer * announcer = tier->tor->session->announcer;
+
+    tr_torrentMarkChanged( tier->tor, TR_CHANGED_TRACKERS );
+
+    if( ( announcer != NULL )
+        && ( tier->announceAt != 0 )
+        && ( tier->announceAt != tier->announcePlannedAt )
+        && ( tier->announce_event_count > 0 ) )
+    {
+        tierHeapPush( &announcer->announces, tier->announceAt, tier->tor->uniqueId, tier->key );
+        tier->announcePlannedAt = tier->announceAt;
+    }
 }
 
 /***
@@ -825,6 +999,8 @@ tier_announce_event_push( tr_tier            * tier,
 
     dbgmsg_tier_announce_queue( tier );
     dbgmsg( tier, "announcing in %d seconds", (int)difftime(announceAt,tr_time()) );
+
+    tierScheduleAnnounce( tier );
 }
 
 static tr_announce_event
@@ -1052,6 +1228,7 @@ on_announce_done( const tr_announce_response  * response,
         tier->lastAnnounceSucceeded = false;
         tier->isAnnouncing = false;
         tier->manualAnnounceAllowedAt = now + tier->announceMinIntervalSec;
+        tr_torrentMarkChanged( tier->tor, TR_CHANGED_TRACKERS );
 
         if( !response->did_connect )
         {
@@ -1151,10 +1328,12 @@ on_announce_done( const tr_announce_response  * response,
                 tier->scrapeAt = get_next_scrape_time( announcer->session, tier, tier->scrapeIntervalSec );
                 tier->lastScrapeTime = now;
                 tier->lastScrapeSucceeded = true;
+                tierScheduleScrape( tier );
             }
             else if( tier->lastScrapeTime + tier->scrapeIntervalSec <= now )
             {
                 tier->scrapeAt = get_next_scrape_time( announcer->session, tier, 0 );
+                tierScheduleScrape( tier );
             }
 
             tier->lastAnnounceSucceeded = true;
@@ -1179,6 +1358,10 @@ on_announce_done( const tr_announce_response  * response,
                 tier_announce_event_push( tier, TR_ANNOUNCE_EVENT_NONE, now + i );
             }
         }
+
+        /* events that were queued while we were announcing
+           were skipped by the planner, so reschedule them */
+        tierScheduleAnnounce( tier );
     }
 
     tr_free( data );
@@ -1234,7 +1417,9 @@ tierAnnounce( tr_announcer * announcer, tr_tier * tier )
 
     tier->isAnnouncing = true;
     tier->lastAnnounceStartTime = now;
+    tr_torrentMarkChanged( tier->tor, TR_CHANGED_TRACKERS );
     --announcer->slotsAvailable;
+    ++getHost( announcer, tier->currentTracker->key )->announce_count;
 
     announce_request_delegate( announcer, req, on_announce_done, data );
 }
@@ -1268,6 +1453,7 @@ on_scrape_error( tr_session * session, tr_tier * tier, const char * errmsg )
     tr_torinf( tier->tor, "Retrying scrape in %zu seconds.", (size_t)interval );
     tier->lastScrapeSucceeded = false;
     tier->scrapeAt = get_next_scrape_time( session, tier, interval );
+    tierScheduleScrape( tier );
 }
 
 static tr_tier *
@@ -1285,13 +1471,145 @@ find_tier( tr_torrent * tor, const char * scrape )
     return NULL;
 }
 
+struct scrape_data
+{
+    tr_session * session;
+
+    /* the tr_tracker_host.key of the tracker that was scraped */
+    char * hostKey;
+};
+
+/* does this error mean the multiscrape had too many info_hashes in it? */
+static bool
+multiscrape_too_big( const char * errmsg )
+{
+    int i;
+    static const char * too_long_errors[] = { "Bad Request",
+                                              "GET string too long",
+                                              "Request-URI Too Long" };
+    const int n = sizeof( too_long_errors ) / sizeof( too_long_errors[0] );
+
+    if( errmsg != NULL )
+        for( i=0; i<n; ++i )
+            if( strstr( errmsg, too_long_errors[i] ) != NULL )
+                return true;
+
+    return false;
+}
+
+static bool
+scrape_row_was_answered( const struct tr_scrape_response_row * row )
+{
+    return ( row->seeders >= 0 ) || ( row->leechers >= 0 ) || ( row->downloads >= 0 );
+}
+
+void
+tr_multiscrapeSizeInit( tr_multiscrape_size * size, const char * url )
+{
+    size->max = TR_MULTISCRAPE_DEFAULT;
+    size->ceiling = hostGetMultiscrapeLimit( url ) + 1;
+    size->successes = 0;
+    size->probe = false;
+}
+
+bool
+tr_multiscrapeSizeOnResponse( tr_multiscrape_size       * size,
+                              const tr_scrape_response  * response )
+{
+    int i;
+    int answered = 0;
+    bool too_big = false;
+    const int row_count = response->row_count;
+    const bool ok = response->did_connect && !response->did_timeout
+                                          && !response->errmsg;
+
+    for( i=0; i<row_count; ++i )
+        if( scrape_row_was_answered( &response->rows[i] ) )
+            ++answered;
+
+    if( row_count > 1 )
+    {
+        if( multiscrape_too_big( response->errmsg ) )
+            too_big = true;
+
+        /* some trackers quietly skip the info_hashes past their limit.
+           only trust that on a probe, since unregistered torrents
+           can go missing from any response */
+        else if( ok && ( answered < row_count ) && ( row_count > size->max ) )
+            too_big = true;
+    }
+
+    if( too_big )
+    {
+        size->ceiling = MIN( size->ceiling, row_count );
+        size->successes = 0;
+        size->probe = false;
+
+        /* if a size we thought was safe got turned down, halve it.
+           only do this once, even if several requests of that size
+           were in flight when the tracker turned them down */
+        if( row_count <= size->max )
+            size->max = MAX( 1, row_count / 2 );
+    }
+    else if( ok && ( answered == row_count ) && ( row_count > size->max ) )
+    {
+        /* a probe worked */
+        size->max = row_count;
+        size->successes = 0;
+    }
+    else if( ok && ( answered == row_count ) && ( row_count == size->max ) )
+    {
+        if( ( ++size->successes >= TR_MULTISCRAPE_GROW_AFTER )
+            && ( size->max + 1 < size->ceiling ) )
+        {
+            size->successes = 0;
+            size->probe = true;
+        }
+    }
+
+    return too_big;
+}
+
+/* How big a request can grow once it's full at size->max.
+   Only one request at a time tries a bigger size -- halfway to the smallest
+   size that's failed -- so a wrong guess costs one error, not a whole round */
+int
+tr_multiscrapeSizeNext( tr_multiscrape_size * size )
+{
+    if( !size->probe )
+        return size->max;
+
+    size->probe = false;
+    return ( size->max + size->ceiling ) / 2;
+}
+
 static void
-on_scrape_done( const tr_scrape_response * response, void * vsession )
+on_scrape_done( const tr_scrape_response * response, void * vdata )
 {
     int i;
+    bool too_big = false;
     const time_t now = tr_time( );
-    tr_session * session = vsession;
+    struct scrape_data * data = vdata;
+    tr_session * session = data->session;
     tr_announcer * announcer = session->announcer;
+    const bool ok = response->did_connect && !response->did_timeout
+                                          && !response->errmsg;
+
+    if( announcer != NULL )
+    {
+        tr_tracker_host * host = getHost( announcer, data->hostKey );
+        const int old_max = host->multiscrape.max;
+
+        too_big = tr_multiscrapeSizeOnResponse( &host->multiscrape, response );
+
+        if( host->multiscrape.max < old_max )
+            tr_ndbg( host->key, "Scrape of %d torrents was too big; "
+                                "lowering multiscrape size to %d",
+                     response->row_count, host->multiscrape.max );
+        else if( host->multiscrape.max > old_max )
+            tr_ndbg( host->key, "Raising multiscrape size to %d",
+                     host->multiscrape.max );
+    }
 
     for( i=0; i<response->row_count; ++i )
     {
@@ -1325,10 +1643,19 @@ on_scrape_done( const tr_scrape_response * response, void * vsession )
 
                 tier->isScraping = false;
                 tier->lastScrapeTime = now;
+                tr_torrentMarkChanged( tier->tor, TR_CHANGED_TRACKERS );
                 tier->lastScrapeSucceeded = false;
                 tier->lastScrapeTimedOut = response->did_timeout;
 
-                if( !response->did_connect )
+                if( too_big && ( !ok || !scrape_row_was_answered( row ) ) )
+                {
+                    /* not the tracker's fault, so don't count it as an error.
+                       try again soon in a smaller multiscrape */
+                    dbgmsg( tier, "multiscrape was too big; rescraping soon" );
+                    tier->scrapeAt = get_next_scrape_time( session, tier, 0 );
+                    tierScheduleScrape( tier );
+                }
+                else if( !response->did_connect )
                 {
                     on_scrape_error( session, tier, _( "Could not connect to tracker" ) );
 		}
@@ -1348,6 +1675,7 @@ on_scrape_done( const tr_scrape_response * response, void * vsession )
                     tier->scrapeIntervalSec = MAX( DEFAULT_SCRAPE_INTERVAL_SEC,
                                                    response->min_request_interval );
                     tier->scrapeAt = get_next_scrape_time( session, tier, tier->scrapeIntervalSec );
+                    tierScheduleScrape( tier );
                     tr_tordbg( tier->tor, "Scrape successful. Rescraping in %d seconds.",
                                tier->scrapeIntervalSec );
 
@@ -1363,12 +1691,19 @@ on_scrape_done( const tr_scrape_response * response, void * vsession )
                         tracker->consecutiveFailures = 0;
                     }
                 }
+
+                /* an announce that came due while we were scraping
+                   was skipped by the planner, so reschedule it */
+                tierScheduleAnnounce( tier );
             }
         }
     }
 
     if( announcer )
         ++announcer->slotsAvailable;
+
+    tr_free( data->hostKey );
+    tr_free( data );
 }
 
 static void
@@ -1379,6 +1714,8 @@ scrape_request_delegate( tr_announcer             * announcer,
 {
     tr_session * session = announcer->session;
 
+    --announcer->slotsAvailable;
+
     if( !memcmp( request->url, "http", 4 ) )
         tr_tracker_http_scrape( session, request, callback, callback_data );
     else if( !memcmp( request->url, "udp://", 6 ) )
@@ -1387,58 +1724,152 @@ scrape_request_delegate( tr_announcer             * announcer,
         tr_err( "Unsupported url: %s", request->url );
 }
 
+static tr_tier *
+getTierFromId( tr_announcer * announcer, int torrentId, int tierId )
+{
+    int i;
+    tr_torrent * tor = tr_torrentFindFromId( announcer->session, torrentId );
+    struct tr_torrent_tiers * tt = tor ? tor->tiers : NULL;
+
+    for( i=0; tt && i<tt->tier_count; ++i )
+        if( tt->tiers[i].key == tierId )
+            return &tt->tiers[i];
+
+    return NULL;
+}
+
+static bool
+tierNeedsToAnnounce( const tr_tier * tier, const time_t now )
+{
+    return !tier->isAnnouncing
+        && !tier->isScraping
+        && ( tier->announceAt != 0 )
+        && ( tier->announceAt <= now )
+        && ( tier->announce_event_count > 0 );
+}
+
+static bool
+tierNeedsToScrape( const tr_tier * tier, const time_t now )
+{
+    return ( !tier->isScraping )
+        && ( tier->scrapeAt != 0 )
+        && ( tier->scrapeAt <= now )
+        && ( tier->currentTracker != NULL )
+        && ( tier->currentTracker->scrape != NULL );
+}
+
 static void
-multiscrape( tr_announcer * announcer, tr_ptrArray * tiers )
+multiscrape( tr_announcer * announcer, const time_t now )
 {
+    int h;
     int i;
     int request_count = 0;
-    const time_t now = tr_time( );
-    const int tier_count = tr_ptrArraySize( tiers );
-    const int max_request_count = MIN( announcer->slotsAvailable, tier_count );
+    const int host_count = tr_ptrArraySize( &announcer->hosts );
+    const int max_request_count = announcer->slotsAvailable;
     tr_scrape_request * requests = tr_new0( tr_scrape_request, max_request_count );
+    tr_tracker_host ** hosts = tr_new0( tr_tracker_host*, max_request_count );
+    int * sizes = tr_new0( int, max_request_count );
+
+    /* start with a different tracker each time so that
+       one busy tracker can't keep using up all the slots */
+    ++announcer->hostIndex;
 
-    /* batch as many info_hashes into a request as we can */
-    for( i=0; i<tier_count; ++i )
+    for( h=0; h<host_count && request_count<max_request_count; ++h )
     {
-        int j;
-        tr_tier * tier = tr_ptrArrayNth( tiers, i );
-        char * url = tier->currentTracker->scrape;
-        const uint8_t * hash = tier->tor->info.hash;
+        const tr_tier_due * due;
+        const int first_request = request_count;
+        tr_tracker_host * host = tr_ptrArrayNth( &announcer->hosts,
+                                         ( announcer->hostIndex + h ) % host_count );
 
-        /* if there's a request with this scrape URL and a free slot, use it */
-        for( j=0; j<request_count; ++j )
+        /* batch as many of this tracker's due tiers into a request as it'll take */
+        while(( due = tr_heapPeek( &host->scrapes )) && ( due->at <= now ))
         {
-            tr_scrape_request * req = &requests[j];
+            int j;
+            const char * url;
+            const tr_tier_due d = *due;
+            tr_tier * tier = getTierFromId( announcer, d.torrentId, d.tierId );
 
-            if( req->info_hash_count >= TR_MULTISCRAPE_MAX )
+            /* skip entries that have been rescheduled or removed */
+            if( !tier || ( tier->scrapeAt != d.at ) || ( tier->scrapePlannedAt != d.at ) )
+            {
+                tr_heapPop( &host->scrapes, NULL );
                 continue;
-            if( tr_strcmp0( req->url, url ) )
+            }
+
+            /* if the tier has moved to another tracker, move it to that heap */
+            if( tier->currentTracker && tr_strcmp0( tier->currentTracker->key, host->key ) )
+            {
+                tr_heapPop( &host->scrapes, NULL );
+                tier->scrapePlannedAt = 0;
+                tierScheduleScrape( tier );
                 continue;
+            }
 
-            memcpy( req->info_hash[req->info_hash_count++], hash, SHA_DIGEST_LENGTH );
-            tier->isScraping = true;
-            tier->lastScrapeStartTime = now;
-            break;
-        }
+            if( !tierNeedsToScrape( tier, now ) )
+            {
+                tr_heapPop( &host->scrapes, NULL );
+                tier->scrapePlannedAt = 0;
+                continue;
+            }
 
-        /* otherwise, if there's room for another request, build a new one */
-        if( ( j==request_count ) && ( request_count < max_request_count ) )
-        {
-            tr_scrape_request * req = &requests[request_count++];
-            req->url = url;
-            tier_build_log_name( tier, req->log_name, sizeof( req->log_name ) );
+            /* if there's a request with this scrape URL and a free slot, use it */
+            url = tier->currentTracker->scrape;
+            for( j=first_request; j<request_count; ++j )
+            {
+                const tr_scrape_request * req = &requests[j];
+                int max;
+
+                if( tr_strcmp0( req->url, url ) )
+                    continue;
+
+                /* the first request to fill up gets to try a bigger size */
+                if( req->info_hash_count == sizes[j] )
+                    sizes[j] = tr_multiscrapeSizeNext( &host->multiscrape );
+
+                max = MIN( sizes[j], hostGetMultiscrapeLimit( url ) );
+                if( req->info_hash_count < max )
+                    break;
+            }
 
-            memcpy( req->info_hash[req->info_hash_count++], hash, SHA_DIGEST_LENGTH );
+            /* otherwise, if there's room for another request, build a new one */
+            if( j == request_count )
+            {
+                if( request_count == max_request_count )
+                    break;
+
+                requests[j].url = (char*) url;
+                tier_build_log_name( tier, requests[j].log_name, sizeof( requests[j].log_name ) );
+                hosts[j] = host;
+                sizes[j] = host->multiscrape.max;
+                ++request_count;
+            }
+
+            tr_heapPop( &host->scrapes, NULL );
+            tier->scrapePlannedAt = 0;
+            memcpy( requests[j].info_hash[requests[j].info_hash_count++],
+                    tier->tor->info.hash, SHA_DIGEST_LENGTH );
             tier->isScraping = true;
             tier->lastScrapeStartTime = now;
+            tr_torrentMarkChanged( tier->tor, TR_CHANGED_TRACKERS );
         }
     }
 
     /* send the requests we just built */
     for( i=0; i<request_count; ++i )
-        scrape_request_delegate( announcer, &requests[i], on_scrape_done, announcer->session );
+    {
+        struct scrape_data * data = tr_new0( struct scrape_data, 1 );
+        data->session = announcer->session;
+        data->hostKey = tr_strdup( hosts[i]->key );
+
+        ++hosts[i]->scrape_count;
+        hosts[i]->scrape_hash_count += requests[i].info_hash_count;
+
+        scrape_request_delegate( announcer, &requests[i], on_scrape_done, data );
+    }
 
     /* cleanup */
+    tr_free( sizes );
+    tr_free( hosts );
     tr_free( requests );
 }
 
@@ -1449,29 +1880,16 @@ flushCloseMessages( tr_announcer * announcer )
     const int n = tr_ptrArraySize( &announcer->stops );
 
     for( i=0; i<n; ++i )
-        announce_request_delegate( announcer, tr_ptrArrayNth( &announcer->stops, i ), NULL, NULL );
-
-    tr_ptrArrayClear( &announcer->stops );
-}
+    {
+        tr_announce_request * req = tr_ptrArrayNth( &announcer->stops, i );
+        char * key = getKey( req->url );
+        ++getHost( announcer, key )->announce_count;
+        tr_free( key );
 
-static bool
-tierNeedsToAnnounce( const tr_tier * tier, const time_t now )
-{
-    return !tier->isAnnouncing
-        && !tier->isScraping
-        && ( tier->announceAt != 0 )
-        && ( tier->announceAt <= now )
-        && ( tier->announce_event_count > 0 );
-}
+        announce_request_delegate( announcer, req, NULL, NULL );
+    }
 
-static bool
-tierNeedsToScrape( const tr_tier * tier, const time_t now )
-{
-    return ( !tier->isScraping )
-        && ( tier->scrapeAt != 0 )
-        && ( tier->scrapeAt <= now )
-        && ( tier->currentTracker != NULL )
-        && ( tier->currentTracker->scrape != NULL );
+    tr_ptrArrayClear( &announcer->stops );
 }
 
 static int
@@ -1497,9 +1915,8 @@ announceMore( tr_announcer * announcer )
 {
     int i;
     int n;
-    tr_torrent * tor;
+    const tr_tier_due * due;
     tr_ptrArray announceMe = TR_PTR_ARRAY_INIT;
-    tr_ptrArray scrapeMe = TR_PTR_ARRAY_INIT;
     const time_t now = tr_time( );
 
     dbgmsg( NULL, "announceMore: slotsAvailable is %d", announcer->slotsAvailable );
@@ -1508,16 +1925,22 @@ announceMore( tr_announcer * announcer )
         return;
 
     /* build a list of tiers that need to be announced */
-    tor = NULL;
-    while(( tor = tr_torrentNext( announcer->session, tor ))) {
-        struct tr_torrent_tiers * tt = tor->tiers;
-        for( i=0; tt && i<tt->tier_count; ++i ) {
-            tr_tier * tier = &tt->tiers[i];
-            if( tierNeedsToAnnounce( tier, now ) )
-                tr_ptrArrayAppend( &announceMe, tier );
-            else if( tierNeedsToScrape( tier, now ) )
-                tr_ptrArrayAppend( &scrapeMe, tier );
-        }
+    while(( due = tr_heapPeek( &announcer->announces )) && ( due->at <= now ))
+    {
+        tr_tier_due d;
+        tr_tier * tier;
+
+        tr_heapPop( &announcer->announces, &d );
+        tier = getTierFromId( announcer, d.torrentId, d.tierId );
+
+        /* skip entries that have been rescheduled or removed */
+        if( !tier || ( tier->announcePlannedAt != d.at ) )
+            continue;
+
+        tier->announcePlannedAt = 0;
+
+        if( tierNeedsToAnnounce( tier, now ) )
+            tr_ptrArrayAppend( &announceMe, tier );
     }
 
     /* if there are more tiers than slots available, prioritize */
@@ -1534,14 +1957,41 @@ announceMore( tr_announcer * announcer )
         tierAnnounce( announcer, tier );
     }
 
+    /* put the rest back for next time */
+    for( i=n; i<tr_ptrArraySize( &announceMe ); ++i )
+        tierScheduleAnnounce( tr_ptrArrayNth( &announceMe, i ) );
+
     /* scrape some */
-    multiscrape( announcer, &scrapeMe );
+    multiscrape( announcer, now );
 
     /* cleanup */
-    tr_ptrArrayDestruct( &scrapeMe, NULL );
     tr_ptrArrayDestruct( &announceMe, NULL );
 }
 
+/* log how many requests we've sent to each tracker since the last report */
+static void
+reportRequestCounts( tr_announcer * announcer )
+{
+    int i;
+    const int n = tr_ptrArraySize( &announcer->hosts );
+
+    for( i=0; i<n; ++i )
+    {
+        tr_tracker_host * host = tr_ptrArrayNth( &announcer->hosts, i );
+
+        if( host->announce_count || host->scrape_count )
+            tr_ndbg( host->key, "%d announces and %d scrapes of %d torrents "
+                                "in the last %d minutes; multiscrape size is %d",
+                     host->announce_count, host->scrape_count,
+                     host->scrape_hash_count, REPORT_INTERVAL_SECS / 60,
+                     host->multiscrape.max );
+
+        host->announce_count = 0;
+        host->scrape_count = 0;
+        host->scrape_hash_count = 0;
+    }
+}
+
 static void
 onUpkeepTimer( int foo UNUSED, short bar UNUSED, void * vannouncer )
 {
@@ -1559,6 +2009,12 @@ onUpkeepTimer( int foo UNUSED, short bar UNUSED, void * vannouncer )
     if( !is_closing )
         announceMore( announcer );
 
+    /* maybe log how many requests we've been sending */
+    if( announcer->reportAt <= now ) {
+        announcer->reportAt = now + REPORT_INTERVAL_SECS;
+        reportRequestCounts( announcer );
+    }
+
     /* TAU upkeep */
     if( announcer->tauUpkeepAt <= now ) {
         announcer->tauUpkeepAt = now + TAU_UPKEEP_INTERVAL_SECS;
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h> /* memset() */
+
+#include "transmission.h"
+#include "bandwidth.h"
+#include "utils.h"
+
+#undef VERBOSE
+
+static int test = 0;
+
+#ifdef VERBOSE
+  #define check( A ) \
+    { \
+        ++test; \
+        if( A ){ \
+            fprintf( stderr, "PASS test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+        } else { \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#else
+  #define check( A ) \
+    { \
+        ++test; \
+        if( !( A ) ){ \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#endif
+
+/* a fake peer that has `wanted' bytes queued up */
+struct fake_peer
+{
+    size_t wanted;
+    size_t used;
+    size_t quantum;
+    size_t * torrentBytesLeft; /* its torrent's limit, or NULL */
+    int calls;
+};
+
+/* the bandwidth shared by all the fake peers */
+static size_t bytesLeft;
+
+static int
+fakeFlush( void * vpeer, tr_direction dir UNUSED, size_t limit )
+{
+    struct fake_peer * peer = vpeer;
+    size_t n = MIN( limit, peer->wanted - peer->used );
+    n = MIN( n, bytesLeft );
+    if( peer->torrentBytesLeft != NULL ) {
+        n = MIN( n, *peer->torrentBytesLeft );
+        *peer->torrentBytesLeft -= n;
+    }
+
+    bytesLeft -= n;
+    peer->used += n;
+    ++peer->calls;
+    return n;
+}
+
+static size_t
+fakeQuantum( void * vpeer, tr_direction dir UNUSED )
+{
+    const struct fake_peer * peer = vpeer;
+    return peer->quantum;
+}
+
+static void
+roundRobinQuanta( struct fake_peer * peers, int n, int first )
+{
+    int i;
+    void ** p = tr_new( void*, n );
+
+    for( i=0; i<n; ++i )
+        p[i] = &peers[i];
+    tr_bandwidthRoundRobin( p, n, first, TR_UP, fakeQuantum, fakeFlush );
+
+    tr_free( p );
+}
+
+static void
+roundRobin( struct fake_peer * peers, int n, int first, size_t quantum )
+{
+    int i;
+
+    for( i=0; i<n; ++i )
+        peers[i].quantum = quantum;
+    roundRobinQuanta( peers, n, first );
+}
+
+/* busy peers share the bandwidth evenly */
+static int
+testFairness( void )
+{
+    int i;
+    struct fake_peer peers[4];
+
+    memset( peers, 0, sizeof( peers ) );
+    for( i=0; i<4; ++i )
+        peers[i].wanted = 1000000;
+
+    bytesLeft = 100000;
+    roundRobin( peers, 4, 0, 3000 );
+    check( bytesLeft == 0 )
+    for( i=0; i<4; ++i ) {
+        check( peers[i].used >= 25000 - 3000 )
+        check( peers[i].used <= 25000 + 3000 )
+    }
+
+    return 0;
+}
+
+/* a peer that doesn't need its share leaves the rest for the others */
+static int
+testShortPeer( void )
+{
+    struct fake_peer peers[3];
+
+    memset( peers, 0, sizeof( peers ) );
+    peers[0].wanted = 1000;
+    peers[1].wanted = 1000000;
+    peers[2].wanted = 1000000;
+
+    bytesLeft = 61000;
+    roundRobin( peers, 3, 0, 3000 );
+    check( bytesLeft == 0 )
+    check( peers[0].used == 1000 )
+    check( peers[0].calls == 1 )
+    check( peers[1].used == 30000 )
+    check( peers[2].used == 30000 )
+
+    return 0;
+}
+
+/* when there's not enough for everyone, `first' decides who's served */
+static int
+testRotation( void )
+{
+    struct fake_peer peers[4];
+
+    memset( peers, 0, sizeof( peers ) );
+    peers[0].wanted = peers[1].wanted = peers[2].wanted = peers[3].wanted = 100000;
+
+    bytesLeft = 6000;
+    roundRobin( peers, 4, 2, 3000 );
+    check( peers[0].used == 0 )
+    check( peers[1].used == 0 )
+    check( peers[2].used == 3000 )
+    check( peers[3].used == 3000 )
+
+    return 0;
+}
+
+/* a large quantum means a few large writes instead of many small ones */
+static int
+testBatching( void )
+{
+    int i;
+    int calls = 0;
+    const int n = 2000;
+    struct fake_peer * peers = tr_new0( struct fake_peer, n );
+
+    for( i=0; i<n; ++i )
+        peers[i].wanted = 60000;
+
+    bytesLeft = ~(size_t)0;
+    roundRobin( peers, n, 0, 65536 );
+    for( i=0; i<n; ++i ) {
+        check( peers[i].used == 60000 )
+        calls += peers[i].calls;
+    }
+    check( calls == n )
+
+    tr_free( peers );
+    return 0;
+}
+
+/* a peer's quantum comes from the nearest limit above it */
+static int
+testQuantum( void )
+{
+    tr_bandwidth top, torA, torB, peerA, peerB;
+
+    memset( &top, 0, sizeof( tr_bandwidth ) );
+    memset( &torA, 0, sizeof( tr_bandwidth ) );
+    memset( &torB, 0, sizeof( tr_bandwidth ) );
+    memset( &peerA, 0, sizeof( tr_bandwidth ) );
+    memset( &peerB, 0, sizeof( tr_bandwidth ) );
+    tr_bandwidthConstruct( &top, NULL, NULL );
+    tr_bandwidthConstruct( &torA, NULL, &top );
+    tr_bandwidthConstruct( &torB, NULL, &top );
+    tr_bandwidthConstruct( &peerA, NULL, &torA );
+    tr_bandwidthConstruct( &peerB, NULL, &torB );
+
+    /* what tr_bandwidthAllocate() leaves behind for a session limit of
+       1 MB per period, torrent A limited to 40 KB with 4 peers,
+       and torrent B unlimited with 2 peers */
+    top.band[TR_UP].isLimited = true;
+    top.band[TR_UP].bytesLeft = 600000;
+    top.band[TR_UP].peerCount = 6;
+    torA.band[TR_UP].isLimited = true;
+    torA.band[TR_UP].bytesLeft = 40000;
+    torA.band[TR_UP].peerCount = 4;
+    torB.band[TR_UP].peerCount = 2;
+    peerA.band[TR_UP].peerCount = 1;
+    peerB.band[TR_UP].peerCount = 1;
+
+    check( tr_bandwidthGetQuantum( &peerA, TR_UP ) == 10000 )
+    check( tr_bandwidthGetQuantum( &peerB, TR_UP ) == 65536 )
+
+    top.band[TR_UP].bytesLeft = 60000;
+    check( tr_bandwidthGetQuantum( &peerB, TR_UP ) == 10000 )
+
+    /* a torrent that ignores the session limit isn't held to it */
+    torB.band[TR_UP].honorParentLimits = false;
+    check( tr_bandwidthGetQuantum( &peerB, TR_UP ) == 65536 )
+
+    /* but the quantum's never so small that uTP can't fill a frame */
+    torA.band[TR_UP].bytesLeft = 4000;
+    check( tr_bandwidthGetQuantum( &peerA, TR_UP ) == 3000 )
+
+    tr_bandwidthDestruct( &peerB );
+    tr_bandwidthDestruct( &peerA );
+    tr_bandwidthDestruct( &torB );
+    tr_bandwidthDestruct( &torA );
+    tr_bandwidthDestruct( &top );
+    return 0;
+}
+
+/* with a torrent limit, the torrent's first peers in the rotation
+   don't get to use up its whole limit before the others get any */
+static int
+testTorrentLimit( void )
+{
+    int i;
+    size_t torrentBytesLeft = 40000;
+    struct fake_peer peers[6];
+
+    memset( peers, 0, sizeof( peers ) );
+    for( i=0; i<6; ++i )
+        peers[i].wanted = 1000000;
+
+    /* peers 0-3 are in a torrent limited to 40000 bytes;
+       peers 4-5 are in an unlimited torrent */
+    for( i=0; i<4; ++i ) {
+        peers[i].torrentBytesLeft = &torrentBytesLeft;
+        peers[i].quantum = 40000 / 4;
+    }
+    peers[4].quantum = peers[5].quantum = 65536;
+
+    bytesLeft = 200000;
+    roundRobinQuanta( peers, 6, 0 );
+    check( torrentBytesLeft == 0 )
+    for( i=0; i<4; ++i )
+        check( peers[i].used == 10000 )
+    check( peers[4].used + peers[5].used == 160000 )
+
+    return 0;
+}
+
+int
+main( void )
+{
+    int i;
+
+    if( ( i = testFairness( ) ) )
+        return i;
+    if( ( i = testShortPeer( ) ) )
+        return i;
+    if( ( i = testRotation( ) ) )
+        return i;
+    if( ( i = testBatching( ) ) )
+        return i;
+    if( ( i = testQuantum( ) ) )
+        return i;
+    if( ( i = testTorrentLimit( ) ) )
+        return i;
+
+    return 0;
+}
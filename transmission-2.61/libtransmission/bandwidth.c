@@ -20,6 +20,13 @@
 #include "peer-io.h"
 #include "utils.h"
 
+enum
+{
+    /* see tr_bandwidthGetQuantum() */
+    MIN_QUANTUM = 3000,
+    MAX_QUANTUM = 65536
+};
+
 #define dbgmsg( ... ) \
     do { \
         if( tr_deepLoggingIsActive( ) ) \
@@ -159,7 +166,8 @@ tr_bandwidthSetParent( tr_bandwidth  * b,
 ****
 ***/
 
-static void
+/* returns how many peers are in b's subtree */
+static unsigned int
 allocateBandwidth( tr_bandwidth  * b,
                    tr_priority_t   parent_priority,
                    tr_direction    dir,
@@ -178,10 +186,13 @@ allocateBandwidth( tr_bandwidth  * b,
         b->band[dir].bytesLeft = (unsigned int)( nextPulseSpeed * period_msec ) / 1000u;
     }
 
+    b->band[dir].peerCount = 0;
+
     /* add this bandwidth's peer, if any, to the peer pool */
     if( b->peer != NULL ) {
         b->peer->priority = priority;
         tr_ptrArrayAppend( peer_pool, b->peer );
+        ++b->band[dir].peerCount;
     }
 
     /* traverse & repeat for the subtree */
@@ -190,44 +201,127 @@ allocateBandwidth( tr_bandwidth  * b,
         struct tr_bandwidth ** children = (struct tr_bandwidth**) tr_ptrArrayBase( &b->children );
         const int n = tr_ptrArraySize( &b->children );
         for( i=0; i<n; ++i )
-            allocateBandwidth( children[i], priority, dir, period_msec, peer_pool );
+            b->band[dir].peerCount += allocateBandwidth( children[i], priority, dir, period_msec, peer_pool );
     }
+
+    return b->band[dir].peerCount;
 }
 
-static void
-phaseOne( tr_ptrArray * peerArray, tr_direction dir )
+/* Deficit round-robin. Each pass, every peer that's still busy is credited
+ * another quantum of bytes and gets to use as much of it as it can.
+ * Peers that can't use all of their credit (they're out of data, out of
+ * socket buffer, or out of bandwidth) are done for this period. Since
+ * a byte stream can be cut anywhere, a busy peer never carries a deficit
+ * over to the next pass, so there's no need to keep one. Compared to
+ * handing out small slices to randomly-chosen peers, this keeps the
+ * share fair while letting each peer do its I/O in large batches. */
+struct rr_peer
 {
-    int n;
-    int peerCount = tr_ptrArraySize( peerArray );
-    struct tr_peerIo ** peers = (struct tr_peerIo**) tr_ptrArrayBase( peerArray );
+    void * peer;
+    size_t quantum;
+};
+
+void
+tr_bandwidthRoundRobin( void                   ** peers,
+                        int                       peerCount,
+                        int                       first,
+                        tr_direction              dir,
+                        tr_bandwidthQuantumFunc   quantum,
+                        tr_bandwidthFlushFunc     flush )
+{
+    int i;
+    int n = peerCount;
+    struct rr_peer * order;
+
+    assert( tr_isDirection( dir ) );
+
+    if( n < 1 )
+        return;
+
+    /* start the rotation at `first' so that no peer is always
+     * the one left waiting when the bandwidth runs out mid-pass */
+    order = tr_new( struct rr_peer, n );
+    for( i=0; i<n; ++i ) {
+        order[i].peer = peers[(first + i) % n];
+        order[i].quantum = quantum( order[i].peer, dir );
+        assert( order[i].quantum > 0 );
+    }
 
-    /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
-     * peers from starving the others. Loop through the peers, giving each a
-     * small chunk of bandwidth. Keep looping until we run out of bandwidth
-     * and/or peers that can use it */
-    n = peerCount;
     dbgmsg( "%d peers to go round-robin for %s", n, (dir==TR_UP?"upload":"download") );
     while( n > 0 )
     {
-        const int i = tr_cryptoWeakRandInt( n ); /* pick a peer at random */
+        int kept = 0;
 
-        /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
-         * frame right away and leave enough buffered data for the next frame to go
-         * out in a timely manner. */
-        const size_t increment = 3000;
+        for( i=0; i<n; ++i )
+        {
+            const int bytesUsed = flush( order[i].peer, dir, order[i].quantum );
+
+            dbgmsg( "peer #%d of %d used %d of its %zu bytes in this pass", i, n, bytesUsed, order[i].quantum );
 
-        const int bytesUsed = tr_peerIoFlush( peers[i], dir, increment );
+            /* if the peer used all its credit, it's still busy */
+            if( bytesUsed >= (int)order[i].quantum )
+                order[kept++] = order[i];
+        }
 
-        dbgmsg( "peer #%d of %d used %d bytes in this pass", i, n, bytesUsed );
+        n = kept;
+    }
 
-        if( bytesUsed != (int)increment ) {
-            /* peer is done writing for now; move it to the end of the list */
-            tr_peerIo * pio = peers[i];
-            peers[i] = peers[n-1];
-            peers[n-1] = pio;
-            --n;
+    tr_free( order );
+}
+
+static int
+peerIoFlush( void * io, tr_direction dir, size_t limit )
+{
+    return tr_peerIoFlush( io, dir, limit );
+}
+
+static size_t
+peerIoQuantum( void * io, tr_direction dir )
+{
+    return tr_bandwidthGetQuantum( &((tr_peerIo*)io)->bandwidth, dir );
+}
+
+static void
+phaseOne( tr_ptrArray * peerArray, tr_direction dir )
+{
+    const int n = tr_ptrArraySize( peerArray );
+
+    if( n > 0 )
+        tr_bandwidthRoundRobin( tr_ptrArrayBase( peerArray ), n,
+                                tr_cryptoWeakRandInt( n ),
+                                dir, peerIoQuantum, peerIoFlush );
+}
+
+/* How many bytes to credit each peer per round-robin pass.
+ * Ideally this lets every peer get its share in a single write, so
+ * the bytes left in the nearest limit that applies to the peer -- its
+ * torrent's, or else the session's -- are split among the peers under
+ * that limit. It's kept to at least MIN_QUANTUM so that when using uTP
+ * we'll send a full-size frame right away and leave enough buffered
+ * data for the next frame to go out in a timely manner, and at most
+ * MAX_QUANTUM so that a fast peer can't hog a pass. */
+size_t
+tr_bandwidthGetQuantum( const tr_bandwidth * b, tr_direction dir )
+{
+    size_t quantum = MAX_QUANTUM;
+
+    assert( tr_isBandwidth( b ) );
+    assert( tr_isDirection( dir ) );
+
+    for( ;; )
+    {
+        if( b->band[dir].isLimited ) {
+            quantum = b->band[dir].bytesLeft / MAX( 1u, b->band[dir].peerCount );
+            break;
         }
+
+        if( ( b->parent == NULL ) || !b->band[dir].honorParentLimits )
+            break;
+
+        b = b->parent;
     }
+
+    return MIN( MAX( quantum, MIN_QUANTUM ), MAX_QUANTUM );
 }
 
 void
@@ -265,8 +359,8 @@ tr_bandwidthAllocate( tr_bandwidth  * b,
 
     /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
      * peers from starving the others. Loop through the peers, giving each a
-     * small chunk of bandwidth. Keep looping until we run out of bandwidth
-     * and/or peers that can use it */
+     * quantum of bandwidth. Keep looping until we run out of bandwidth
+     * and/or peers that can use it. Higher priorities go first. */
     phaseOne( &high, dir );
     phaseOne( &normal, dir );
     phaseOne( &low, dir );
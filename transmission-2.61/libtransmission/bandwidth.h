@@ -59,6 +59,7 @@ struct tr_band
     bool honorParentLimits;
     unsigned int bytesLeft;
     unsigned int desiredSpeed_Bps;
+    unsigned int peerCount; /* peers in this subtree, as of the last tr_bandwidthAllocate() */
     struct bratecontrol raw;
     struct bratecontrol piece;
 };
@@ -200,6 +201,36 @@ unsigned int  tr_bandwidthClamp       ( const tr_bandwidth  * bandwidth,
                                         tr_direction          direction,
                                         unsigned int          byteCount );
 
+/** @brief the I/O callback used by tr_bandwidthRoundRobin(). Returns the number of bytes used. */
+typedef int ( *tr_bandwidthFlushFunc )( void * peer, tr_direction dir, size_t limit );
+
+/** @brief returns how many bytes to credit a peer per tr_bandwidthRoundRobin() pass */
+typedef size_t ( *tr_bandwidthQuantumFunc )( void * peer, tr_direction dir );
+
+/**
+ * @brief Deficit round-robin over peers, starting with peers[first].
+ *
+ * Each pass, every busy peer is credited with its quantum and flushed.
+ * A peer that doesn't use all of its credit is done. This is the first
+ * phase of tr_bandwidthAllocate(); it's exposed for unit testing.
+ */
+void    tr_bandwidthRoundRobin        ( void               ** peers,
+                                        int                   peerCount,
+                                        int                   first,
+                                        tr_direction          direction,
+                                        tr_bandwidthQuantumFunc quantum,
+                                        tr_bandwidthFlushFunc flush );
+
+/**
+ * @brief how many bytes a peer under this bandwidth is credited per pass.
+ *
+ * This is the bytesLeft of the nearest limited bandwidth at or above
+ * this one, split evenly among the peers under it. It's only valid
+ * after tr_bandwidthAllocate(); it's exposed for unit testing.
+ */
+size_t  tr_bandwidthGetQuantum        ( const tr_bandwidth  * bandwidth,
+                                        tr_direction          direction );
+
 /******
 *******
 ******/
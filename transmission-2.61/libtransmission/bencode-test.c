@@ -526,6 +526,164 @@ testParse2( void )
     return 0;
 }
 
+static int
+testBigDict( void )
+{
+    int i;
+    int len;
+    char * benc;
+    int64_t intVal;
+    tr_benc top;
+    tr_benc top2;
+    char key[64];
+    const int n = 200;
+
+    /* build a dict too big to search linearly, in key order */
+    tr_bencInitDict( &top, n );
+    for( i=0; i<n; ++i ) {
+        tr_snprintf( key, sizeof( key ), "key-%04d", i );
+        tr_bencDictAddInt( &top, key, i );
+    }
+    for( i=0; i<n; ++i ) {
+        tr_snprintf( key, sizeof( key ), "key-%04d", i );
+        check( tr_bencDictFindInt( &top, key, &intVal ) )
+        check( intVal == i )
+    }
+    check( !tr_bencDictFind( &top, "key-" ) )
+    check( !tr_bencDictFind( &top, "key-00000" ) )
+    check( !tr_bencDictFind( &top, "a" ) )
+    check( !tr_bencDictFind( &top, "z" ) )
+
+    /* round-trip it through the parser */
+    benc = tr_bencToStr( &top, TR_FMT_BENC, &len );
+    check( !tr_bencLoad( benc, len, &top2, NULL ) )
+    for( i=0; i<n; ++i ) {
+        tr_snprintf( key, sizeof( key ), "key-%04d", i );
+        check( tr_bencDictFindInt( &top2, key, &intVal ) )
+        check( intVal == i )
+    }
+    tr_bencFree( &top2 );
+    tr_free( benc );
+
+    /* adding and removing keys out of order mustn't lose any */
+    tr_bencDictAddInt( &top, "another-key", -1 );
+    check( tr_bencDictRemove( &top, "key-0010" ) )
+    check( !tr_bencDictFind( &top, "key-0010" ) )
+    check( tr_bencDictFindInt( &top, "another-key", &intVal ) )
+    check( intVal == -1 )
+    for( i=0; i<n; ++i ) {
+        tr_snprintf( key, sizeof( key ), "key-%04d", i );
+        check( ( i == 10 ) == !tr_bencDictFind( &top, key ) )
+    }
+    tr_bencFree( &top );
+
+    /* a dict whose keys are out of order can still be searched */
+    tr_bencInitDict( &top, n );
+    for( i=n-1; i>=0; --i ) {
+        tr_snprintf( key, sizeof( key ), "key-%04d", i );
+        tr_bencDictAddInt( &top, key, i );
+    }
+    for( i=0; i<n; ++i ) {
+        tr_snprintf( key, sizeof( key ), "key-%04d", i );
+        check( tr_bencDictFindInt( &top, key, &intVal ) )
+        check( intVal == i )
+    }
+    tr_bencFree( &top );
+
+    /* and so can an unsorted one from the parser */
+    benc = tr_strdup( "d1:bi2e1:ai1e1:ci3e1:di4e1:ei5e1:fi6e1:gi7e1:hi8e1:ii9ee" );
+    check( !tr_bencLoad( benc, strlen( benc ), &top, NULL ) )
+    check( tr_bencDictFindInt( &top, "a", &intVal ) )
+    check( intVal == 1 )
+    check( tr_bencDictFindInt( &top, "b", &intVal ) )
+    check( intVal == 2 )
+    check( tr_bencDictFindInt( &top, "i", &intVal ) )
+    check( intVal == 9 )
+    tr_bencFree( &top );
+    tr_free( benc );
+
+    /* a list that's longer than the parser's first guess */
+    benc = tr_strdup( "li1ei2ei3ei4ei5ei6ei7ei8ei9ei10ei11ei12ei13ei14ei15ei16ei17ee" );
+    check( !tr_bencLoad( benc, strlen( benc ), &top, NULL ) )
+    check( tr_bencListSize( &top ) == 17 )
+    check( tr_bencGetInt( tr_bencListChild( &top, 16 ), &intVal ) )
+    check( intVal == 17 )
+    tr_bencFree( &top );
+    tr_free( benc );
+
+    return 0;
+}
+
+static int
+testJSONWriter( void )
+{
+    char * a;
+    char * b;
+    tr_benc top;
+    tr_benc * d;
+    tr_benc * l;
+    tr_jsonWriter w;
+    struct evbuffer * buf;
+    struct evbuffer * tmp;
+
+    /* build the same thing with a tr_benc tree... */
+    tr_bencInitDict( &top, 4 );
+    d = tr_bencDictAddDict( &top, "arguments", 2 );
+    l = tr_bencDictAddList( d, "removed", 0 );
+    l = tr_bencDictAddList( d, "torrents", 2 );
+    d = tr_bencListAddDict( l, 3 );
+    tr_bencDictAddInt( d, "id", -12 );
+    tr_bencDictAddStr( d, "name", "\"quoted\"\n\xc3\xbc" );
+    tr_bencDictAddReal( d, "percentDone", 0.25 );
+    d = tr_bencListAddDict( l, 0 );
+    tr_bencDictAddBool( &top, "bool", false );
+    tr_bencDictAddReal( &top, "real", 2.0 );
+    tr_bencDictAddStr( &top, "result", "success" );
+    a = tr_bencToStr( &top, TR_FMT_JSON_LEAN, NULL );
+
+    /* ...and with a tr_jsonWriter */
+    buf = evbuffer_new( );
+    tr_jsonWriterInit( &w, buf );
+    tr_jsonDictBegin( &w );
+    tr_jsonAddKey( &w, "arguments" );
+    tr_jsonDictBegin( &w );
+    tr_jsonAddKey( &w, "removed" );
+    tr_jsonListBegin( &w );
+    tr_jsonListEnd( &w );
+    tr_jsonAddKey( &w, "torrents" );
+    tr_jsonListBegin( &w );
+    tr_jsonDictBegin( &w );
+    tr_jsonDictAddInt( &w, "id", -12 );
+    tr_jsonDictAddStr( &w, "name", "\"quoted\"\n\xc3\xbc" );
+    tr_jsonDictAddReal( &w, "percentDone", 0.25 );
+    tr_jsonDictEnd( &w );
+    tr_jsonDictBegin( &w );
+    tr_jsonDictEnd( &w );
+    tr_jsonListEnd( &w );
+    tr_jsonDictEnd( &w );
+    tr_jsonDictAddBool( &w, "bool", false );
+    tr_jsonAddKey( &w, "real" );
+    tmp = evbuffer_new( );
+    evbuffer_add( tmp, "2", 1 );
+    tr_jsonAddEncoded( &w, tmp );
+    check( evbuffer_get_length( tmp ) == 0 )
+    evbuffer_free( tmp );
+    tr_jsonAddKey( &w, "result" );
+    tr_jsonAddBenc( &w, tr_bencDictFind( &top, "result" ) );
+    tr_jsonDictEnd( &w );
+    evbuffer_add( buf, "\n", 1 );
+    check( w.depth == 0 )
+    b = evbuffer_free_to_str( buf );
+
+    check( !strcmp( a, "{\"arguments\":{\"removed\":[],\"torrents\":[{\"id\":-12,\"name\":\"\\\"quoted\\\"\\n\\u00fc\",\"percentDone\":0.2500},{}]},\"bool\":false,\"real\":2,\"result\":\"success\"}\n" ) )
+    check( !strcmp( a, b ) )
+
+    tr_free( b );
+    tr_free( a );
+    tr_bencFree( &top );
+    return 0;
+}
+
 int
 main( void )
 {
@@ -543,6 +701,9 @@ main( void )
     if(( i = testJSON( )))
         return i;
 
+    if(( i = testJSONWriter( )))
+        return i;
+
     if(( i = testMerge( )))
         return i;
 
@@ -552,6 +713,9 @@ main( void )
     if(( i = testParse2( )))
         return i;
 
+    if(( i = testBigDict( )))
+        return i;
+
 #ifndef WIN32
     i = testStackSmash( 1000000 );
 #else
@@ -206,10 +206,16 @@ getNode( tr_benc *     top,
       && ( !( parent->val.l.count % 2 ) ) )
         return NULL;
 
-    makeroom( parent, 1 );
+    /* grow geometrically so that long lists, such as a torrent's
+     * file list, don't get realloc'ed every LIST_SIZE children */
+    if( parent->val.l.count == parent->val.l.alloc )
+        makeroom( parent, MAX( parent->val.l.count, LIST_SIZE ) );
+
     return parent->val.l.vals + parent->val.l.count++;
 }
 
+static bool dictKeysAreSorted( const tr_benc * dict );
+
 /**
  * This function's previous recursive implementation was
  * easier to read, but was vulnerable to a smash-stacking
@@ -285,6 +291,9 @@ tr_bencParseImpl( const void *     buf_in,
                 return EILSEQ;
             }
 
+            if( tr_bencIsDict( node ) )
+                node->sorted = dictKeysAreSorted( node );
+
             tr_ptrArrayPop( parentStack );
             if( tr_ptrArrayEmpty( parentStack ) )
                 break;
@@ -375,6 +384,40 @@ getStr( const tr_benc* val )
     return stringIsAlloced(val) ? val->val.s.str.ptr : val->val.s.str.buf;
 }
 
+/* bencoded dicts' keys are supposed to be sorted as raw strings,
+ * which is the same order that tr_bencToStr() writes them in. */
+static int
+compareKey( const tr_benc * key, const char * str, size_t len )
+{
+    const int i = memcmp( getStr( key ), str, MIN( key->val.s.len, len ) );
+
+    if( i )
+        return i;
+    if( key->val.s.len == len )
+        return 0;
+    return key->val.s.len < len ? -1 : 1;
+}
+
+static bool
+dictKeysAreSorted( const tr_benc * dict )
+{
+    size_t i;
+
+    for( i = 2; ( i + 1 ) < dict->val.l.count; i += 2 )
+    {
+        const tr_benc * prev = dict->val.l.vals + i - 2;
+        const tr_benc * key = dict->val.l.vals + i;
+
+        if( compareKey( prev, getStr( key ), key->val.s.len ) >= 0 )
+            return false;
+    }
+
+    return true;
+}
+
+/* dicts with fewer keys than this are searched linearly */
+#define BISECT_MIN_KEYS 8
+
 static int
 dictIndexOf( const tr_benc * val, const char * key )
 {
@@ -383,6 +426,28 @@ dictIndexOf( const tr_benc * val, const char * key )
         size_t       i;
         const size_t len = strlen( key );
 
+        /* if the keys are in order, bisect them */
+        if( val->sorted && ( val->val.l.count >= BISECT_MIN_KEYS * 2 ) )
+        {
+            size_t lo = 0;
+            size_t hi = val->val.l.count / 2;
+
+            while( lo < hi )
+            {
+                const size_t mid = lo + ( hi - lo ) / 2;
+                const int cmp = compareKey( val->val.l.vals + mid * 2, key, len );
+
+                if( !cmp )
+                    return mid * 2;
+                if( cmp < 0 )
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            return -1;
+        }
+
         for( i = 0; ( i + 1 ) < val->val.l.count; i += 2 )
         {
             const tr_benc * child = val->val.l.vals + i;
@@ -658,6 +723,7 @@ int
 tr_bencInitDict( tr_benc * b, size_t reserveCount )
 {
     tr_bencInit( b, TR_TYPE_DICT );
+    b->sorted = true;
     return tr_bencDictReserve( b, reserveCount );
 }
 
@@ -762,6 +828,10 @@ tr_bencDictAdd( tr_benc *    dict,
     keyval = dict->val.l.vals + dict->val.l.count++;
     tr_bencInitStr( keyval, key, -1 );
 
+    /* appending a key that sorts after the last one keeps the dict sorted */
+    if( dict->sorted && ( dict->val.l.count > 2 ) )
+        dict->sorted = compareKey( keyval - 2, getStr( keyval ), keyval->val.s.len ) < 0;
+
     itemval = dict->val.l.vals + dict->val.l.count++;
     tr_bencInit( itemval, TR_TYPE_INT );
 
@@ -906,6 +976,7 @@ tr_bencDictRemove( tr_benc *    dict,
         {
             dict->val.l.vals[i]   = dict->val.l.vals[n - 2];
             dict->val.l.vals[i + 1] = dict->val.l.vals[n - 1];
+            dict->sorted = false;
         }
         dict->val.l.count -= 2;
     }
@@ -1320,13 +1391,33 @@ jsonPopParent( struct jsonWalk * data )
     tr_free( tr_list_pop_front( &data->parents ) );
 }
 
+/* a lot of ints get written in big RPC responses,
+ * so this skips evbuffer_add_printf()'s overhead */
+static void
+jsonAddInt( struct evbuffer * out, int64_t i )
+{
+    char buf[32];
+    char * end = buf + sizeof( buf );
+    char * walk = end;
+    uint64_t u = i < 0 ? -(uint64_t)i : (uint64_t)i;
+
+    do
+        *--walk = '0' + ( u % 10 );
+    while(( u /= 10 ));
+
+    if( i < 0 )
+        *--walk = '-';
+
+    evbuffer_add( out, walk, end - walk );
+}
+
 static void
 jsonIntFunc( const tr_benc * val,
              void *          vdata )
 {
     struct jsonWalk * data = vdata;
 
-    evbuffer_add_printf( data->out, "%" PRId64, val->val.i );
+    jsonAddInt( data->out, val->val.i );
     jsonChildFunc( data );
 }
 
@@ -1343,41 +1434,47 @@ jsonBoolFunc( const tr_benc * val, void * vdata )
     jsonChildFunc( data );
 }
 
+/* json requires a '.' decimal point regardless of locale */
 static void
-jsonRealFunc( const tr_benc * val, void * vdata )
+jsonAddReal( struct evbuffer * out, double d )
 {
-    struct jsonWalk * data = vdata;
-    char locale[128];
-
-    if( fabs( val->val.d - (int)val->val.d ) < 0.00001 )
-        evbuffer_add_printf( data->out, "%d", (int)val->val.d );
+    if( fabs( d - (int)d ) < 0.00001 )
+        jsonAddInt( out, (int)d );
+    else if( !strcmp( localeconv( )->decimal_point, "." ) )
+        evbuffer_add_printf( out, "%.4f", tr_truncd( d, 4 ) );
     else {
-        /* json requires a '.' decimal point regardless of locale */
+        char locale[128];
         tr_strlcpy( locale, setlocale( LC_NUMERIC, NULL ), sizeof( locale ) );
         setlocale( LC_NUMERIC, "POSIX" );
-        evbuffer_add_printf( data->out, "%.4f", tr_truncd( val->val.d, 4 ) );
+        evbuffer_add_printf( out, "%.4f", tr_truncd( d, 4 ) );
         setlocale( LC_NUMERIC, locale );
     }
+}
+
+static void
+jsonRealFunc( const tr_benc * val, void * vdata )
+{
+    struct jsonWalk * data = vdata;
 
+    jsonAddReal( data->out, val->val.d );
     jsonChildFunc( data );
 }
 
 static void
-jsonStringFunc( const tr_benc * val, void * vdata )
+jsonAddString( struct evbuffer * out, const char * str, size_t len )
 {
-    char * out;
+    char * outbuf;
     char * outwalk;
     char * outend;
     struct evbuffer_iovec vec[1];
-    struct jsonWalk * data = vdata;
-    const unsigned char * it = (const unsigned char *) getStr(val);
-    const unsigned char * end = it + val->val.s.len;
+    const unsigned char * it = (const unsigned char *) str;
+    const unsigned char * end = it + len;
 
-    evbuffer_reserve_space( data->out, val->val.s.len * 4, vec, 1 );
-    out = vec[0].iov_base;
-    outend = out + vec[0].iov_len;
+    evbuffer_reserve_space( out, len * 4 + 2, vec, 1 );
+    outbuf = vec[0].iov_base;
+    outend = outbuf + vec[0].iov_len;
 
-    outwalk = out;
+    outwalk = outbuf;
     *outwalk++ = '"';
 
     for( ; it!=end; ++it )
@@ -1409,9 +1506,16 @@ jsonStringFunc( const tr_benc * val, void * vdata )
     }
 
     *outwalk++ = '"';
-    vec[0].iov_len = outwalk - out;
-    evbuffer_commit_space( data->out, vec, 1 );
+    vec[0].iov_len = outwalk - outbuf;
+    evbuffer_commit_space( out, vec, 1 );
+}
 
+static void
+jsonStringFunc( const tr_benc * val, void * vdata )
+{
+    struct jsonWalk * data = vdata;
+
+    jsonAddString( data->out, getStr( val ), val->val.s.len );
     jsonChildFunc( data );
 }
 
@@ -1465,6 +1569,171 @@ static const struct WalkFuncs jsonWalkFuncs = { jsonIntFunc,
                                                 jsonListBeginFunc,
                                                 jsonContainerEndFunc };
 
+/***
+****  tr_jsonWriter
+***/
+
+void
+tr_jsonWriterInit( tr_jsonWriter * w, struct evbuffer * out )
+{
+    memset( w, 0, sizeof( tr_jsonWriter ) );
+    w->out = out;
+}
+
+/* write a comma if this isn't the container's first child */
+static void
+jsonWriterChild( tr_jsonWriter * w )
+{
+    if( w->afterKey )
+        w->afterKey = false;
+    else if( w->hasChildren[w->depth] )
+        evbuffer_add( w->out, ",", 1 );
+    else
+        w->hasChildren[w->depth] = true;
+}
+
+static void
+jsonWriterBegin( tr_jsonWriter * w, const char * ch )
+{
+    jsonWriterChild( w );
+    evbuffer_add( w->out, ch, 1 );
+
+    ++w->depth;
+    assert( w->depth < TR_JSON_MAX_DEPTH );
+    w->hasChildren[w->depth] = false;
+}
+
+static void
+jsonWriterEnd( tr_jsonWriter * w, const char * ch )
+{
+    assert( w->depth > 0 );
+    assert( !w->afterKey );
+
+    --w->depth;
+    evbuffer_add( w->out, ch, 1 );
+}
+
+void
+tr_jsonDictBegin( tr_jsonWriter * w )
+{
+    jsonWriterBegin( w, "{" );
+}
+
+void
+tr_jsonDictEnd( tr_jsonWriter * w )
+{
+    jsonWriterEnd( w, "}" );
+}
+
+void
+tr_jsonListBegin( tr_jsonWriter * w )
+{
+    jsonWriterBegin( w, "[" );
+}
+
+void
+tr_jsonListEnd( tr_jsonWriter * w )
+{
+    jsonWriterEnd( w, "]" );
+}
+
+void
+tr_jsonAddKey( tr_jsonWriter * w, const char * key )
+{
+    assert( !w->afterKey );
+
+    jsonWriterChild( w );
+    jsonAddString( w->out, key, strlen( key ) );
+    evbuffer_add( w->out, ":", 1 );
+    w->afterKey = true;
+}
+
+void
+tr_jsonAddInt( tr_jsonWriter * w, int64_t val )
+{
+    jsonWriterChild( w );
+    jsonAddInt( w->out, val );
+}
+
+void
+tr_jsonAddBool( tr_jsonWriter * w, bool val )
+{
+    jsonWriterChild( w );
+
+    if( val )
+        evbuffer_add( w->out, "true", 4 );
+    else
+        evbuffer_add( w->out, "false", 5 );
+}
+
+void
+tr_jsonAddReal( tr_jsonWriter * w, double val )
+{
+    jsonWriterChild( w );
+    jsonAddReal( w->out, val );
+}
+
+void
+tr_jsonAddStr( tr_jsonWriter * w, const char * val )
+{
+    tr_jsonAddRaw( w, val, strlen( val ) );
+}
+
+void
+tr_jsonAddRaw( tr_jsonWriter * w, const void * val, size_t len )
+{
+    jsonWriterChild( w );
+    jsonAddString( w->out, val, len );
+}
+
+void
+tr_jsonAddBenc( tr_jsonWriter * w, const tr_benc * val )
+{
+    struct jsonWalk data;
+
+    jsonWriterChild( w );
+
+    data.doIndent = false;
+    data.out = w->out;
+    data.parents = NULL;
+    bencWalk( val, &jsonWalkFuncs, &data, true );
+}
+
+void
+tr_jsonAddEncoded( tr_jsonWriter * w, struct evbuffer * json )
+{
+    jsonWriterChild( w );
+    evbuffer_add_buffer( w->out, json );
+}
+
+void
+tr_jsonDictAddInt( tr_jsonWriter * w, const char * key, int64_t val )
+{
+    tr_jsonAddKey( w, key );
+    tr_jsonAddInt( w, val );
+}
+
+void
+tr_jsonDictAddBool( tr_jsonWriter * w, const char * key, bool val )
+{
+    tr_jsonAddKey( w, key );
+    tr_jsonAddBool( w, val );
+}
+
+void
+tr_jsonDictAddReal( tr_jsonWriter * w, const char * key, double val )
+{
+    tr_jsonAddKey( w, key );
+    tr_jsonAddReal( w, val );
+}
+
+void
+tr_jsonDictAddStr( tr_jsonWriter * w, const char * key, const char * val )
+{
+    tr_jsonAddKey( w, key );
+    tr_jsonAddStr( w, val );
+}
+
 /***
 ****
 ***/
@@ -77,6 +77,9 @@ typedef struct tr_benc
     } val;
 
     char type;
+
+    /* dicts only: true if the keys are known to be in sorted order */
+    bool sorted;
 } tr_benc;
 
 /***
@@ -255,6 +258,54 @@ int tr_bencParseStr( const uint8_t *  buf,
 /* this is only quasi-supported. don't rely on it too heavily outside of libT */
 void  tr_bencMergeDicts( tr_benc * target, const tr_benc * source );
 
+/***
+****  Streaming JSON output
+***/
+
+#define TR_JSON_MAX_DEPTH 16
+
+/**
+ * @brief Writes lean JSON straight into an evbuffer.
+ *
+ * This is for big responses, such as RPC's torrent-get, where building
+ * a tr_benc tree just to walk it with tr_bencToBuf() costs more than
+ * producing the output itself. Keys are written in the order they're
+ * added, so to match tr_bencToBuf()'s output, add them in sorted order.
+ */
+typedef struct tr_jsonWriter
+{
+    struct evbuffer * out;
+    int depth;
+    bool afterKey;
+    bool hasChildren[TR_JSON_MAX_DEPTH];
+}
+tr_jsonWriter;
+
+void tr_jsonWriterInit( tr_jsonWriter * writer, struct evbuffer * out );
+
+void tr_jsonDictBegin( tr_jsonWriter * );
+void tr_jsonDictEnd  ( tr_jsonWriter * );
+void tr_jsonListBegin( tr_jsonWriter * );
+void tr_jsonListEnd  ( tr_jsonWriter * );
+
+/** @brief Write a dict key. The next value written is its value. */
+void tr_jsonAddKey( tr_jsonWriter *, const char * key );
+
+void tr_jsonAddInt ( tr_jsonWriter *, int64_t val );
+void tr_jsonAddBool( tr_jsonWriter *, bool val );
+void tr_jsonAddReal( tr_jsonWriter *, double val );
+void tr_jsonAddStr ( tr_jsonWriter *, const char * val );
+void tr_jsonAddRaw ( tr_jsonWriter *, const void * val, size_t len );
+void tr_jsonAddBenc( tr_jsonWriter *, const tr_benc * val );
+
+/** @brief Add a value that's already JSON. This drains `json'. */
+void tr_jsonAddEncoded( tr_jsonWriter *, struct evbuffer * json );
+
+void tr_jsonDictAddInt ( tr_jsonWriter *, const char * key, int64_t val );
+void tr_jsonDictAddBool( tr_jsonWriter *, const char * key, bool val );
+void tr_jsonDictAddReal( tr_jsonWriter *, const char * key, double val );
+void tr_jsonDictAddStr ( tr_jsonWriter *, const char * key, const char * val );
+
 /* @} */
 
 #ifdef __cplusplus
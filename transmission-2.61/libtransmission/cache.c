@@ -19,6 +19,7 @@
 #include "inout.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
 #include "ptrarray.h"
+#include "resume.h" /* tr_torrentResumeBlocksWritten() */
 #include "torrent.h"
 #include "utils.h"
 
@@ -162,29 +163,34 @@ flushContiguous( tr_cache * cache, int pos, int n )
 {
     int i;
     int err = 0;
-    uint8_t * buf = tr_new( uint8_t, n * MAX_BLOCK_SIZE );
-    uint8_t * walk = buf;
+    size_t len;
+    struct evbuffer * buf = evbuffer_new( );
     struct cache_block ** blocks = (struct cache_block**) tr_ptrArrayBase( &cache->blocks );
 
     struct cache_block * b = blocks[pos];
     tr_torrent * tor             = b->tor;
     const tr_piece_index_t piece = b->piece;
     const uint32_t offset        = b->offset;
+    const tr_block_index_t block = b->block;
 
+    /* chain the blocks' memory together instead of copying it into
+     * a staging buffer. tr_ioWriteBuf() writes straight from there. */
     for( i=pos; i<pos+n; ++i ) {
         b = blocks[i];
-        evbuffer_copyout( b->evbuf, walk, b->length );
-        walk += b->length;
+        evbuffer_add_buffer( buf, b->evbuf );
         evbuffer_free( b->evbuf );
         tr_free( b );
     }
     tr_ptrArrayErase( &cache->blocks, pos, pos+n );
 
-    err = tr_ioWrite( tor, piece, offset, walk-buf, buf );
-    tr_free( buf );
+    len = evbuffer_get_length( buf );
+    err = tr_ioWriteBuf( tor, piece, offset, buf );
+    evbuffer_free( buf );
+    if( !err )
+        tr_torrentResumeBlocksWritten( tor, block, block + n - 1 );
 
     ++cache->disk_writes;
-    cache->disk_write_bytes += walk-buf;
+    cache->disk_write_bytes += len;
     return err;
 }
 
@@ -309,6 +315,17 @@ findBlock( tr_cache           * cache,
     return tr_ptrArrayFindSorted( &cache->blocks, &key, cache_block_compare );
 }
 
+bool
+tr_cacheHasBlock( tr_cache         * cache,
+                  tr_torrent       * torrent,
+                  tr_block_index_t   block )
+{
+    struct cache_block key;
+    key.tor = torrent;
+    key.block = block;
+    return tr_ptrArrayFindSorted( &cache->blocks, &key, cache_block_compare ) != NULL;
+}
+
 int
 tr_cacheWriteBlock( tr_cache         * cache,
                     tr_torrent       * torrent,
@@ -44,6 +44,11 @@ int tr_cacheWriteBlock( tr_cache         * cache,
                         uint32_t           len,
                         struct evbuffer  * writeme );
 
+/** @brief true if the block is in the cache, waiting to be written */
+bool tr_cacheHasBlock( tr_cache         * cache,
+                       tr_torrent       * torrent,
+                       tr_block_index_t   block );
+
 int tr_cacheReadBlock( tr_cache         * cache,
                        tr_torrent       * torrent,
                        tr_piece_index_t   piece,
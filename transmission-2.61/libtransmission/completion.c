@@ -27,6 +27,7 @@ tr_cpReset( tr_completion * cp )
     cp->sizeNow = 0;
     cp->sizeWhenDoneIsDirty = true;
     cp->haveValidIsDirty = true;
+    ++cp->changeCount;
     tr_bitfieldSetHasNone( &cp->blockBitfield );
 }
 
@@ -53,6 +54,8 @@ tr_cpBlockInit( tr_completion * cp, const tr_bitfield * b )
     if( tr_bitfieldHas( b, cp->tor->blockCount-1 ) )
         cp->sizeNow -= ( cp->tor->blockSize - cp->tor->lastBlockSize );
     assert( cp->sizeNow <= cp->tor->info.totalSize );
+
+    tr_torrentMarkChanged( cp->tor, TR_CHANGED_PROGRESS );
 }
 
 /***
@@ -68,21 +71,38 @@ tr_cpGetStatus( const tr_completion * cp )
     return TR_LEECH;
 }
 
+/* haveValid and sizeWhenDone are kept up to date as blocks come and go
+   so that they don't have to be recounted piece-by-piece every time
+   the torrent's stats are asked for. They're only recounted when
+   marked dirty, e.g. when the dnd flags change. */
+
 void
 tr_cpPieceRem( tr_completion *  cp, tr_piece_index_t piece )
 {
     tr_block_index_t i, f, l;
+    uint64_t removed = 0;
     const tr_torrent * tor = cp->tor;
+    const bool wasComplete = tr_cpPieceIsComplete( cp, piece );
 
     tr_torGetPieceBlockRange( cp->tor, piece, &f, &l );
 
     for( i=f; i<=l; ++i )
         if( tr_cpBlockIsComplete( cp, i ) )
-            cp->sizeNow -= tr_torBlockCountBytes( tor, i );
+            removed += tr_torBlockCountBytes( tor, i );
+
+    if( !removed )
+        return;
+
+    cp->sizeNow -= removed;
+    ++cp->changeCount;
+
+    if( !cp->haveValidIsDirty && wasComplete )
+        cp->haveValidLazy -= tr_torPieceCountBytes( tor, piece );
+    if( !cp->sizeWhenDoneIsDirty && tor->info.pieces[piece].dnd )
+        cp->sizeWhenDoneLazy -= removed;
 
-    cp->haveValidIsDirty = true;
-    cp->sizeWhenDoneIsDirty = true;
     tr_bitfieldRemRange( &cp->blockBitfield, f, l+1 );
+    tr_torrentMarkChanged( cp->tor, TR_CHANGED_PROGRESS );
 }
 
 void
@@ -102,11 +122,19 @@ tr_cpBlockAdd( tr_completion * cp, tr_block_index_t block )
 
     if( !tr_cpBlockIsComplete( cp, block ) )
     {
+        const tr_piece_index_t piece = tr_torBlockPiece( tor, block );
+        const uint32_t n = tr_torBlockCountBytes( tor, block );
+
         tr_bitfieldAdd( &cp->blockBitfield, block );
-        cp->sizeNow += tr_torBlockCountBytes( tor, block );
+        cp->sizeNow += n;
+        ++cp->changeCount;
+
+        if( !cp->haveValidIsDirty && tr_cpPieceIsComplete( cp, piece ) )
+            cp->haveValidLazy += tr_torPieceCountBytes( tor, piece );
+        if( !cp->sizeWhenDoneIsDirty && tor->info.pieces[piece].dnd )
+            cp->sizeWhenDoneLazy += n;
 
-        cp->haveValidIsDirty = true;
-        cp->sizeWhenDoneIsDirty = true;
+        tr_torrentMarkChanged( cp->tor, TR_CHANGED_PROGRESS );
     }
 }
 
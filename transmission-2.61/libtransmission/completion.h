@@ -45,6 +45,10 @@ typedef struct tr_completion
 
     /* number of bytes we want or have now. [0..sizeWhenDone] */
     uint64_t sizeNow;
+
+    /* incremented whenever blockBitfield or the torrent's dnd flags change,
+       so that values derived from them can be cached elsewhere */
+    uint32_t changeCount;
 }
 tr_completion;
 
@@ -141,6 +145,7 @@ static inline void
 tr_cpInvalidateDND( tr_completion * cp )
 {
     cp->sizeWhenDoneIsDirty = true;
+    ++cp->changeCount;
 }
 
 
@@ -18,6 +18,7 @@
 #include <string.h> /* memcpy(), memset(), strcmp() */
 
 #include <openssl/bn.h>
+#include <openssl/crypto.h> /* CRYPTO_set_locking_callback() */
 #include <openssl/dh.h>
 #include <openssl/err.h>
 #include <openssl/rc4.h>
@@ -26,6 +27,7 @@
 
 #include "transmission.h"
 #include "crypto.h"
+#include "platform.h" /* tr_lock */
 #include "utils.h"
 
 #define MY_NAME "tr_crypto"
@@ -90,31 +92,130 @@ static const uint8_t dh_G[] = { 2 };
         } \
     } while( 0 )
 
+/**
+*** OpenSSL before 1.1 isn't thread-safe unless the app gives it locks.
+*** The web thread and the handshake workers use it alongside the
+*** libtransmission thread, so hand it some unless somebody beat us to it.
+**/
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static tr_lock ** sslLocks = NULL;
+
 static void
-ensureKeyExists( tr_crypto * crypto)
+sslLockFunc( int mode, int n, const char * file UNUSED, int line UNUSED )
 {
-    if( crypto->dh == NULL )
+    if( mode & CRYPTO_LOCK )
+        tr_lockLock( sslLocks[n] );
+    else
+        tr_lockUnlock( sslLocks[n] );
+}
+#endif
+
+void
+tr_cryptoThreadsInit( void )
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    if( ( sslLocks == NULL ) && ( CRYPTO_get_locking_callback( ) == NULL ) )
     {
-        int len, offset;
-        DH * dh = DH_new( );
+        int i;
+        const int n = CRYPTO_num_locks( );
 
-        dh->p = BN_bin2bn( dh_P, sizeof( dh_P ), NULL );
-        if( dh->p == NULL )
-            logErrorFromSSL( );
+        sslLocks = tr_new( tr_lock*, n );
+        for( i=0; i<n; ++i )
+            sslLocks[i] = tr_lockNew( );
+        CRYPTO_set_locking_callback( sslLockFunc );
+    }
+#endif
+}
 
-        dh->g = BN_bin2bn( dh_G, sizeof( dh_G ), NULL );
-        if( dh->g == NULL )
-            logErrorFromSSL( );
+/**
+*** DH keys are expensive to make, so the handshake workers make some
+*** ahead of time while they're otherwise idle. Each key is only used once.
+**/
+
+#define KEY_CACHE_SIZE 32
+
+static DH * keyCache[KEY_CACHE_SIZE];
+static int keyCacheCount = 0;
+
+/* keys that workers are making for the cache. their slots are
+   spoken for, so a finished key always has somewhere to go */
+static int keyCachePending = 0;
+
+static tr_lock*
+getKeyCacheLock( void )
+{
+    static tr_lock * lock = NULL;
+    if( lock == NULL )
+        lock = tr_lockNew( );
+    return lock;
+}
+
+static DH*
+generateKey( void )
+{
+    DH * dh = DH_new( );
+
+    dh->p = BN_bin2bn( dh_P, sizeof( dh_P ), NULL );
+    if( dh->p == NULL )
+        logErrorFromSSL( );
 
-        /* private DH value: strong random BN of DH_PRIVKEY_LEN*8 bits */
-        dh->priv_key = BN_new( );
-        do {
-            if( BN_rand( dh->priv_key, DH_PRIVKEY_LEN * 8, -1, 0 ) != 1 )
-                logErrorFromSSL( );
-        } while ( BN_num_bits( dh->priv_key ) < DH_PRIVKEY_LEN_MIN * 8 );
+    dh->g = BN_bin2bn( dh_G, sizeof( dh_G ), NULL );
+    if( dh->g == NULL )
+        logErrorFromSSL( );
 
-        if( !DH_generate_key( dh ) )
+    /* private DH value: strong random BN of DH_PRIVKEY_LEN*8 bits */
+    dh->priv_key = BN_new( );
+    do {
+        if( BN_rand( dh->priv_key, DH_PRIVKEY_LEN * 8, -1, 0 ) != 1 )
             logErrorFromSSL( );
+    } while ( BN_num_bits( dh->priv_key ) < DH_PRIVKEY_LEN_MIN * 8 );
+
+    if( !DH_generate_key( dh ) )
+        logErrorFromSSL( );
+
+    return dh;
+}
+
+bool
+tr_cryptoFillKeyCache( void )
+{
+    DH * dh;
+    bool full;
+
+    tr_lockLock( getKeyCacheLock( ) );
+    full = keyCacheCount + keyCachePending == KEY_CACHE_SIZE;
+    if( !full )
+        ++keyCachePending;
+    tr_lockUnlock( getKeyCacheLock( ) );
+    if( full )
+        return false;
+
+    dh = generateKey( );
+
+    tr_lockLock( getKeyCacheLock( ) );
+    keyCache[keyCacheCount++] = dh;
+    --keyCachePending;
+    tr_lockUnlock( getKeyCacheLock( ) );
+
+    return true;
+}
+
+static void
+ensureKeyExists( tr_crypto * crypto)
+{
+    if( crypto->dh == NULL )
+    {
+        int len, offset;
+        DH * dh = NULL;
+
+        tr_lockLock( getKeyCacheLock( ) );
+        if( keyCacheCount > 0 )
+            dh = keyCache[--keyCacheCount];
+        tr_lockUnlock( getKeyCacheLock( ) );
+
+        if( dh == NULL )
+            dh = generateKey( );
 
         /* DH can generate key sizes that are smaller than the size of
            P with exponentially decreasing probability, in which case
@@ -146,6 +247,20 @@ tr_cryptoDestruct( tr_crypto * crypto )
         DH_free( crypto->dh );
 }
 
+void
+tr_cryptoMoveKey( tr_crypto * to, tr_crypto * from )
+{
+    assert( to->dh == NULL );
+
+    to->dh = from->dh;
+    memcpy( to->myPublicKey, from->myPublicKey, KEY_LEN );
+    memcpy( to->mySecret, from->mySecret, KEY_LEN );
+    to->mySecretIsSet = from->mySecretIsSet;
+
+    from->dh = NULL;
+    from->mySecretIsSet = false;
+}
+
 /**
 ***
 **/
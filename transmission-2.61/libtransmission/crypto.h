@@ -55,6 +55,10 @@ void tr_cryptoConstruct( tr_crypto * crypto, const uint8_t * torrentHash, bool i
 /** @brief destruct an existing tr_crypto object */
 void tr_cryptoDestruct( tr_crypto * crypto );
 
+/** @brief move the DH key and the secret, if any, from one tr_crypto
+    to another that doesn't have a key yet */
+void tr_cryptoMoveKey( tr_crypto * to, tr_crypto * from );
+
 
 void tr_cryptoSetTorrentHash( tr_crypto * crypto, const uint8_t * torrentHash );
 
@@ -62,12 +66,24 @@ const uint8_t* tr_cryptoGetTorrentHash( const tr_crypto * crypto );
 
 int            tr_cryptoHasTorrentHash( const tr_crypto * crypto );
 
+/* Computing the secret is expensive, and so is making our key when
+   there isn't one cached, so the handshake calls these in a worker thread
+   on a tr_crypto of its own, then moves the key into the peer's. */
+
 const uint8_t* tr_cryptoComputeSecret( tr_crypto *     crypto,
                                        const uint8_t * peerPublicKey );
 
 const uint8_t* tr_cryptoGetMyPublicKey( const tr_crypto * crypto,
                                         int *             setme_len );
 
+/** @brief make a DH key for a future handshake to use.
+    @return false if enough keys are already made */
+bool           tr_cryptoFillKeyCache( void );
+
+/** @brief let OpenSSL be used from more than one thread.
+    This needs to be called before any threads are started. */
+void           tr_cryptoThreadsInit( void );
+
 void           tr_cryptoDecryptInit( tr_crypto * crypto );
 
 void           tr_cryptoDecrypt( tr_crypto *  crypto,
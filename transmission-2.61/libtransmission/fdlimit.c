@@ -17,6 +17,11 @@
  #define _XOPEN_SOURCE 600
 #endif
 
+#ifdef HAVE_PWRITEV
+ #define _DEFAULT_SOURCE /* glibc needs this to pick up pwritev alongside _XOPEN_SOURCE */
+ #define _BSD_SOURCE
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -40,6 +45,11 @@
 #include <sys/resource.h> /* getrlimit */
 #include <fcntl.h> /* O_LARGEFILE posix_fadvise */
 #include <unistd.h> /* lseek(), write(), ftruncate(), pread(), pwrite(), etc */
+#ifdef HAVE_PWRITEV
+ #include <sys/uio.h> /* pwritev() */
+#endif
+
+#include <event2/buffer.h> /* struct evbuffer_iovec */
 
 #include "transmission.h"
 #include "fdlimit.h"
@@ -233,6 +243,30 @@ tr_pwrite( int fd, const void *buf, size_t count, off_t offset )
 #endif
 }
 
+ssize_t
+tr_pwritev( int fd, const struct evbuffer_iovec * vec, int n, off_t offset )
+{
+#ifdef HAVE_PWRITEV
+    /* evbuffer_iovec is binary-compatible with iovec on Unix */
+    return pwritev( fd, (const struct iovec*) vec, n, offset );
+#else
+    int i;
+    ssize_t total = 0;
+
+    for( i=0; i<n; ++i )
+    {
+        const ssize_t rc = tr_pwrite( fd, vec[i].iov_base, vec[i].iov_len, offset + total );
+        if( rc < 0 )
+            return total ? total : rc;
+        total += rc;
+        if( rc < (ssize_t)vec[i].iov_len )
+            break;
+    }
+
+    return total;
+#endif
+}
+
 int
 tr_prefetch( int fd UNUSED, off_t offset UNUSED, size_t count UNUSED )
 {
@@ -508,6 +542,7 @@ fileset_get_empty_slot( struct tr_fileset * set )
 
 struct tr_fdInfo
 {
+    /* open peer sockets, plus the descriptors from tr_fdReserve() */
     int peerCount;
     struct tr_fileset fileset;
 };
@@ -757,3 +792,34 @@ tr_fdSocketClose( tr_session * session, int fd )
         assert( gFd->peerCount >= 0 );
     }
 }
+
+bool
+tr_fdReserve( tr_session * session )
+{
+    struct tr_fdInfo * gFd;
+    assert( tr_isSession( session ) );
+
+    ensureSessionFdInfoExists( session );
+    gFd = session->fdInfo;
+
+    if( gFd->peerCount >= session->peerLimit )
+        return false;
+
+    ++gFd->peerCount;
+    return true;
+}
+
+void
+tr_fdUnreserve( tr_session * session )
+{
+    assert( tr_isSession( session ) );
+
+    if( session->fdInfo != NULL )
+    {
+        struct tr_fdInfo * gFd = session->fdInfo;
+
+        --gFd->peerCount;
+
+        assert( gFd->peerCount >= 0 );
+    }
+}
@@ -17,6 +17,8 @@
 #include "transmission.h"
 #include "net.h"
 
+struct evbuffer_iovec;
+
 /**
  * @addtogroup file_io File IO
  * @{
@@ -38,6 +40,7 @@ int tr_fsync(int fd);
 
 ssize_t tr_pread(int fd, void *buf, size_t count, off_t offset);
 ssize_t tr_pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t tr_pwritev(int fd, const struct evbuffer_iovec * vec, int n, off_t offset);
 int tr_prefetch(int fd, off_t offset, size_t count);
 
 
@@ -106,6 +109,18 @@ int      tr_fdSocketAccept( tr_session  * session,
 
 void     tr_fdSocketClose( tr_session * session, int s );
 
+/**
+ * Files that are kept open outside of the file cache, such as the
+ * binary resume stores, take their descriptors from the same budget
+ * as peer sockets.
+ *
+ * @return true if a descriptor was available
+ * @see tr_fdUnreserve
+ */
+bool     tr_fdReserve( tr_session * session );
+
+void     tr_fdUnreserve( tr_session * session );
+
 /***********************************************************************
  * tr_fdClose
  ***********************************************************************
@@ -23,9 +23,11 @@
 #include "handshake.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
+#include "platform.h" /* tr_lock, tr_threadNew() */
 #include "session.h"
 #include "torrent.h"
 #include "tr-dht.h"
+#include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 
 /* enable LibTransmission extension protocol */
@@ -59,7 +61,10 @@ enum
     CRYPTO_PROVIDE_CRYPTO          = 2,
 
     /* how long to wait before giving up on a handshake */
-    HANDSHAKE_TIMEOUT_SEC          = 30
+    HANDSHAKE_TIMEOUT_SEC          = 30,
+
+    /* the most threads to do Diffie-Hellman in */
+    MAX_DH_THREADS                 = 4
 };
 
 
@@ -96,6 +101,8 @@ enum
 
 typedef uint8_t handshake_state_t;
 
+struct dh_job;
+
 struct tr_handshake
 {
     bool                  haveReadAnythingFromPeer;
@@ -116,6 +123,7 @@ struct tr_handshake
     handshakeDoneCB       doneCB;
     void *                doneUserData;
     struct event        * timeout_timer;
+    struct dh_job       * dhJob;
 };
 
 /**
@@ -318,9 +326,244 @@ parseHandshake( tr_handshake *    handshake,
 ****
 ***/
 
+/***
+****  Diffie-Hellman workers
+****
+****  Making our DH key and computing the shared secret are modular
+****  exponentiations, and they stall the libtransmission thread when lots
+****  of peers connect at once, so they're done in worker threads instead.
+****  Each job does its math in a tr_crypto of its own: the handshake moves
+****  its key, if it has one yet, into the job, and gets it back when the
+****  job's done. While a job is out, the handshake leaves its read buffer
+****  alone. If the handshake goes away first, it clears job->handshake and
+****  the result is thrown out when it gets back to the libtransmission thread.
+****
+****  Like the verify thread, the workers are started when there's work and
+****  exit when there isn't -- after topping up the crypto's key cache.
+***/
+
+typedef void ( dh_done_func )( tr_handshake * handshake, const uint8_t * secret );
+
+struct dh_job
+{
+    struct dh_job  * next;
+    tr_session     * session;
+    tr_handshake   * handshake;
+    tr_peerIo      * io;
+    tr_crypto        crypto;
+    bool             hasPeerKey;
+    uint8_t          peerKey[KEY_LEN];
+    const uint8_t  * secret;
+    dh_done_func   * done;
+};
+
+static struct dh_job * dhQueueHead = NULL;
+static struct dh_job * dhQueueTail = NULL;
+static int dhThreadCount = 0;
+
+/* jobs that the workers have finished, waiting for dhJobsDone() */
+static struct dh_job * dhDoneList = NULL;
+
+/* jobs that haven't been through dhJobDone() yet */
+static int dhJobCount = 0;
+
+/* workers that are still telling the libtransmission thread about a job */
+static int dhWakeupCount = 0;
+
+static tr_lock*
+getDHLock( void )
+{
+    static tr_lock * lock = NULL;
+    if( lock == NULL )
+        lock = tr_lockNew( );
+    return lock;
+}
+
+/* called in the libtransmission thread */
+static void
+dhJobDone( struct dh_job * job )
+{
+    tr_handshake * handshake = job->handshake;
+
+    if( handshake != NULL )
+    {
+        assert( handshake->dhJob == job );
+        handshake->dhJob = NULL;
+        tr_cryptoMoveKey( handshake->crypto, &job->crypto );
+
+        tr_sessionLock( job->session );
+        job->done( handshake, job->secret );
+        tr_sessionUnlock( job->session );
+    }
+
+    tr_cryptoDestruct( &job->crypto );
+    tr_peerIoUnref( job->io ); /* balanced by the ref in dhJobStart */
+    tr_free( job );
+
+    tr_lockLock( getDHLock( ) );
+    --dhJobCount;
+    tr_lockUnlock( getDHLock( ) );
+}
+
+/* called in the libtransmission thread */
+static void
+dhJobsDone( void * unused UNUSED )
+{
+    struct dh_job * job;
+    struct dh_job * next;
+
+    tr_lockLock( getDHLock( ) );
+    job = dhDoneList;
+    dhDoneList = NULL;
+    tr_lockUnlock( getDHLock( ) );
+
+    for( ; job != NULL; job = next )
+    {
+        next = job->next;
+        dhJobDone( job );
+    }
+}
+
+static void
+dhThreadFunc( void * unused UNUSED )
+{
+    for( ;; )
+    {
+        struct dh_job * job;
+        tr_session * session;
+
+        tr_lockLock( getDHLock( ) );
+        if(( job = dhQueueHead ))
+            if(( dhQueueHead = job->next ) == NULL )
+                dhQueueTail = NULL;
+        tr_lockUnlock( getDHLock( ) );
+
+        if( job == NULL )
+        {
+            bool done;
+
+            /* nothing to do, so make keys for later */
+            if( tr_cryptoFillKeyCache( ) )
+                continue;
+
+            /* the cache is full. quit unless a job came in meanwhile */
+            tr_lockLock( getDHLock( ) );
+            if(( done = dhQueueHead == NULL ))
+                --dhThreadCount;
+            tr_lockUnlock( getDHLock( ) );
+
+            if( done )
+                break;
+            continue;
+        }
+
+        if( job->hasPeerKey )
+        {
+            job->secret = tr_cryptoComputeSecret( &job->crypto, job->peerKey );
+        }
+        else
+        {
+            int len;
+            tr_cryptoGetMyPublicKey( &job->crypto, &len );
+        }
+
+        /* the job belongs to the libtransmission thread after this */
+        session = job->session;
+        tr_lockLock( getDHLock( ) );
+        job->next = dhDoneList;
+        dhDoneList = job;
+        ++dhWakeupCount;
+        tr_lockUnlock( getDHLock( ) );
+
+        tr_runInEventThread( session, dhJobsDone, NULL );
+
+        tr_lockLock( getDHLock( ) );
+        --dhWakeupCount;
+        tr_lockUnlock( getDHLock( ) );
+    }
+}
+
+/* Make our key, and if peerKey isn't NULL, compute the secret too,
+   then call done() in the libtransmission thread */
+static void
+dhJobStart( tr_handshake   * handshake,
+            const uint8_t  * peerKey,
+            dh_done_func   * done )
+{
+    struct dh_job * job;
+
+    assert( handshake->dhJob == NULL );
+
+    job = tr_new0( struct dh_job, 1 );
+    job->session = handshake->session;
+    job->handshake = handshake;
+    job->io = handshake->io;
+    job->done = done;
+    job->hasPeerKey = peerKey != NULL;
+    if( job->hasPeerKey )
+        memcpy( job->peerKey, peerKey, KEY_LEN );
+    tr_cryptoConstruct( &job->crypto, NULL, handshake->crypto->isIncoming );
+    tr_cryptoMoveKey( &job->crypto, handshake->crypto );
+
+    handshake->dhJob = job;
+    tr_peerIoRef( job->io );
+
+    tr_lockLock( getDHLock( ) );
+    if( dhQueueTail != NULL )
+        dhQueueTail->next = job;
+    else
+        dhQueueHead = job;
+    dhQueueTail = job;
+    ++dhJobCount;
+    if( dhThreadCount < MIN( tr_getProcessorCount( ), MAX_DH_THREADS ) )
+    {
+        ++dhThreadCount;
+        tr_threadNew( dhThreadFunc, NULL );
+    }
+    tr_lockUnlock( getDHLock( ) );
+}
+
+static void
+dhJobCancel( tr_handshake * handshake )
+{
+    if( handshake->dhJob != NULL )
+    {
+        dbgmsg( handshake, "abandoning its Diffie-Hellman job" );
+        handshake->dhJob->handshake = NULL;
+        handshake->dhJob = NULL;
+    }
+}
+
+/* This is called in the libtransmission thread, so it can't wait for
+   the dhJobsDone() calls that the workers queued up -- it hands back
+   the finished jobs itself instead. */
+void
+tr_handshakeWaitForWorkers( void )
+{
+    for( ;; )
+    {
+        int n;
+
+        dhJobsDone( NULL );
+
+        tr_lockLock( getDHLock( ) );
+        n = dhJobCount + dhWakeupCount;
+        tr_lockUnlock( getDHLock( ) );
+
+        if( !n )
+            break;
+
+        tr_wait_msec( 10 );
+    }
+}
+
+/***
+****
+***/
+
 /* 1 A->B: Diffie Hellman Ya, PadA */
 static void
-sendYa( tr_handshake * handshake )
+sendYaDone( tr_handshake * handshake, const uint8_t * secret UNUSED )
 {
     int               len;
     const uint8_t *   public_key;
@@ -339,10 +582,16 @@ sendYa( tr_handshake * handshake )
     walk += len;
 
     /* send it */
-    setReadState( handshake, AWAITING_YB );
     tr_peerIoWriteBytes( handshake->io, outbuf, walk - outbuf, false );
 }
 
+static void
+sendYa( tr_handshake * handshake )
+{
+    setReadState( handshake, AWAITING_YB );
+    dhJobStart( handshake, NULL, sendYaDone );
+}
+
 static uint32_t
 getCryptoProvide( const tr_handshake * handshake )
 {
@@ -394,13 +643,13 @@ getCryptoSelect( const tr_handshake * handshake,
     return 0;
 }
 
+static void readYbDone( tr_handshake * handshake, const uint8_t * secret );
+
 static int
 readYb( tr_handshake * handshake, struct evbuffer * inbuf )
 {
     int               isEncrypted;
-    const uint8_t *   secret;
     uint8_t           yb[KEY_LEN];
-    struct evbuffer * outbuf;
     size_t            needlen = HANDSHAKE_NAME_LEN;
 
     if( evbuffer_get_length( inbuf ) < needlen )
@@ -429,7 +678,15 @@ readYb( tr_handshake * handshake, struct evbuffer * inbuf )
 
     /* compute the secret */
     evbuffer_remove( inbuf, yb, KEY_LEN );
-    secret = tr_cryptoComputeSecret( handshake->crypto, yb );
+    dhJobStart( handshake, yb, readYbDone );
+    return READ_LATER;
+}
+
+static void
+readYbDone( tr_handshake * handshake, const uint8_t * secret )
+{
+    struct evbuffer * outbuf;
+
     memcpy( handshake->mySecret, secret, KEY_LEN );
 
     /* now send these: HASH('req1', S), HASH('req2', SKEY) xor HASH('req3', S),
@@ -491,7 +748,6 @@ readYb( tr_handshake * handshake, struct evbuffer * inbuf )
 
     /* cleanup */
     evbuffer_free( outbuf );
-    return READ_LATER;
 }
 
 static int
@@ -734,14 +990,13 @@ readPeerId( tr_handshake    * handshake,
     return tr_handshakeDone( handshake, peerIsGood );
 }
 
+static void readYaDone( tr_handshake * handshake, const uint8_t * secret );
+
 static int
 readYa( tr_handshake *    handshake,
         struct evbuffer * inbuf )
 {
     uint8_t        ya[KEY_LEN];
-    uint8_t *      walk, outbuf[KEY_LEN + PadB_MAXLEN];
-    const uint8_t *myKey, *secret;
-    int            len;
 
     dbgmsg( handshake, "in readYa... need %d, have %zu",
             KEY_LEN, evbuffer_get_length( inbuf ) );
@@ -750,7 +1005,17 @@ readYa( tr_handshake *    handshake,
 
     /* read the incoming peer's public key */
     evbuffer_remove( inbuf, ya, KEY_LEN );
-    secret = tr_cryptoComputeSecret( handshake->crypto, ya );
+    dhJobStart( handshake, ya, readYaDone );
+    return READ_LATER;
+}
+
+static void
+readYaDone( tr_handshake * handshake, const uint8_t * secret )
+{
+    uint8_t *      walk, outbuf[KEY_LEN + PadB_MAXLEN];
+    const uint8_t *myKey;
+    int            len;
+
     memcpy( handshake->mySecret, secret, KEY_LEN );
     tr_sha1( handshake->myReq1, "req1", 4, secret, KEY_LEN, NULL );
 
@@ -766,7 +1031,9 @@ readYa( tr_handshake *    handshake,
 
     setReadState( handshake, AWAITING_PAD_A );
     tr_peerIoWriteBytes( handshake->io, outbuf, walk - outbuf, false );
-    return READ_NOW;
+
+    /* PadA may have come in while we were busy */
+    tr_peerIoReadBuffered( handshake->io );
 }
 
 static int
@@ -1004,6 +1271,10 @@ canRead( struct tr_peerIo * io, void * arg, size_t * piece )
     dbgmsg( handshake, "handling canRead; state is [%s]",
            getStateName( handshake->state ) );
 
+    /* wait for the Diffie-Hellman worker to finish */
+    if( handshake->dhJob != NULL )
+        return READ_LATER;
+
     while( readyForMore )
     {
         switch( handshake->state )
@@ -1080,6 +1351,8 @@ fireDoneFunc( tr_handshake * handshake, bool isConnected )
 static void
 tr_handshakeFree( tr_handshake * handshake )
 {
+    dhJobCancel( handshake );
+
     if( handshake->io )
         tr_peerIoUnref( handshake->io ); /* balanced by the ref in tr_handshakeNew */
 
@@ -1117,6 +1390,8 @@ gotError( tr_peerIo  * io,
     int errcode = errno;
     tr_handshake * handshake = vhandshake;
 
+    dhJobCancel( handshake );
+
     if( io->utp_socket && !io->isIncoming && handshake->state == AWAITING_YB ) {
         /* This peer probably doesn't speak uTP. */
         tr_torrent *tor =
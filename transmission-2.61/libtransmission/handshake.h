@@ -52,6 +52,11 @@ struct tr_peerIo*      tr_handshakeGetIO( tr_handshake * handshake );
 
 struct tr_peerIo*      tr_handshakeStealIO( tr_handshake * handshake );
 
+/** @brief wait until the Diffie-Hellman workers have handed back all their
+    results to the libtransmission thread. Call it once the handshakes are
+    aborted so that none of them are still working on a closed session. */
+void                   tr_handshakeWaitForWorkers( void );
+
 
 /** @} */
 #endif
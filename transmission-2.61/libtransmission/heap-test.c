@@ -0,0 +1,137 @@
+#include <stdio.h> /* fprintf */
+
+#include "transmission.h"
+#include "crypto.h" /* tr_cryptoWeakRandInt() */
+#include "heap.h"
+#include "utils.h"
+
+#undef VERBOSE
+
+static int test = 0;
+
+#ifdef VERBOSE
+  #define check( A ) \
+    { \
+        ++test; \
+        if( A ){ \
+            fprintf( stderr, "PASS test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+        } else { \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#else
+  #define check( A ) \
+    { \
+        ++test; \
+        if( !( A ) ){ \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#endif
+
+struct item
+{
+    int key;
+    int id;
+};
+
+static int
+compareItems( const void * va, const void * vb )
+{
+    const struct item * a = va;
+    const struct item * b = vb;
+
+    if( a->key != b->key )
+        return a->key < b->key ? -1 : 1;
+
+    return 0;
+}
+
+static int
+testEmpty( void )
+{
+    struct item it;
+    tr_heap heap = TR_HEAP_INIT( struct item, compareItems );
+
+    check( tr_heapSize( &heap ) == 0 );
+    check( tr_heapPeek( &heap ) == NULL );
+    check( !tr_heapPop( &heap, &it ) );
+
+    it.key = 5;
+    it.id = 1;
+    tr_heapPush( &heap, &it );
+    check( tr_heapSize( &heap ) == 1 );
+    check( ( (const struct item*)tr_heapPeek( &heap ) )->id == 1 );
+    check( tr_heapPop( &heap, NULL ) );
+    check( tr_heapPeek( &heap ) == NULL );
+    check( !tr_heapPop( &heap, &it ) );
+
+    tr_heapDestruct( &heap );
+    return 0;
+}
+
+/* push items in random order, with plenty of ties, and pop them
+ * back in order. each item has to come out exactly once. */
+static int
+testOrder( void )
+{
+    int i;
+    int n;
+    int prev;
+    const int count = 1000;
+    bool * seen = tr_new0( bool, count );
+    struct item it;
+    tr_heap heap = TR_HEAP_INIT( struct item, compareItems );
+
+    for( i=0; i<count; ++i )
+    {
+        it.key = tr_cryptoWeakRandInt( 100 );
+        it.id = i;
+        tr_heapPush( &heap, &it );
+
+        /* mix in some pops so that the heap shrinks and grows */
+        if( ( i % 7 ) == 6 )
+        {
+            const struct item * top = tr_heapPeek( &heap );
+            const int key = top->key;
+            check( tr_heapPop( &heap, &it ) );
+            check( it.key == key );
+            check( !seen[it.id] );
+            seen[it.id] = true;
+        }
+    }
+    check( tr_heapSize( &heap ) == count - count / 7 );
+
+    n = 0;
+    prev = -1;
+    while( tr_heapPop( &heap, &it ) )
+    {
+        check( it.key >= prev );
+        check( !seen[it.id] );
+        seen[it.id] = true;
+        prev = it.key;
+        ++n;
+    }
+    check( n == count - count / 7 );
+    for( i=0; i<count; ++i )
+        check( seen[i] );
+
+    tr_heapDestruct( &heap );
+    tr_free( seen );
+    return 0;
+}
+
+int
+main( void )
+{
+    int l;
+
+    if(( l = testEmpty( )))
+        return l;
+    if(( l = testOrder( )))
+        return l;
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * This file is licensed by the GPL version 2. Works owned by the
+ * Transmission project are granted a special exemption to clause 2(b)
+ * so that the bulk of its code can remain under the MIT license.
+ * This exemption does not extend to derived works not owned by
+ * the Transmission project.
+ *
+ * $Id$
+ */
+
+#include <assert.h>
+#include <stdlib.h> /* tr_renew() -> realloc() */
+#include <string.h> /* memcpy() */
+
+#include "heap.h"
+#include "utils.h"
+
+#define FLOOR 64
+
+static inline char*
+getItem( const tr_heap * heap, int i )
+{
+    return heap->items + ( heap->itemSize * i );
+}
+
+void
+tr_heapDestruct( tr_heap * heap )
+{
+    assert( heap );
+
+    tr_free( heap->items );
+    heap->items = NULL;
+    heap->n_items = heap->n_alloc = 0;
+}
+
+void
+tr_heapPush( tr_heap * heap, const void * item )
+{
+    int i;
+
+    assert( heap );
+    assert( heap->compare );
+
+    if( heap->n_items == heap->n_alloc )
+    {
+        heap->n_alloc = heap->n_alloc ? heap->n_alloc * 2 : FLOOR;
+        heap->items = tr_renew( char, heap->items, heap->itemSize * heap->n_alloc );
+    }
+
+    /* sift up, moving parents down until there's a place for item */
+    for( i=heap->n_items++; i>0; )
+    {
+        const int parent = ( i - 1 ) / 2;
+        if( heap->compare( item, getItem( heap, parent ) ) >= 0 )
+            break;
+        memcpy( getItem( heap, i ), getItem( heap, parent ), heap->itemSize );
+        i = parent;
+    }
+
+    memcpy( getItem( heap, i ), item, heap->itemSize );
+}
+
+bool
+tr_heapPop( tr_heap * heap, void * setme )
+{
+    int i, child;
+    const char * last;
+
+    assert( heap );
+
+    if( heap->n_items == 0 )
+        return false;
+
+    if( setme != NULL )
+        memcpy( setme, heap->items, heap->itemSize );
+
+    /* the last item stays where it is until it's been placed,
+     * since the sift below only touches the items in front of it */
+    last = getItem( heap, --heap->n_items );
+
+    for( i=0; ( child = 2*i + 1 ) < heap->n_items; i=child )
+    {
+        if( ( child + 1 < heap->n_items )
+            && ( heap->compare( getItem( heap, child+1 ), getItem( heap, child ) ) < 0 ) )
+            ++child;
+        if( heap->compare( last, getItem( heap, child ) ) <= 0 )
+            break;
+        memcpy( getItem( heap, i ), getItem( heap, child ), heap->itemSize );
+    }
+
+    if( heap->n_items > 0 )
+        memcpy( getItem( heap, i ), last, heap->itemSize );
+
+    return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * This file is licensed by the GPL version 2. Works owned by the
+ * Transmission project are granted a special exemption to clause 2(b)
+ * so that the bulk of its code can remain under the MIT license.
+ * This exemption does not extend to derived works not owned by
+ * the Transmission project.
+ *
+ * $Id$
+ */
+
+#ifndef __TRANSMISSION__
+ #error only libtransmission should #include this header.
+#endif
+
+#ifndef TR_HEAP_H
+#define TR_HEAP_H
+
+#include <stddef.h> /* size_t */
+
+#include "transmission.h"
+
+/**
+ * @addtogroup utils Utilities
+ * @{
+ */
+
+typedef int ( *tr_heapCompareFunc )( const void * a, const void * b );
+
+/**
+ * @brief a binary min-heap of fixed-size items, stored by value.
+ *
+ * The item that compares lowest is on top. Items that compare equal
+ * come off in no particular order.
+ */
+typedef struct tr_heap
+{
+    char * items;
+    size_t itemSize;
+    int n_items;
+    int n_alloc;
+    tr_heapCompareFunc compare;
+}
+tr_heap;
+
+#define TR_HEAP_INIT( type, compare ) { NULL, sizeof( type ), 0, 0, compare }
+
+/** @brief free the heap's items */
+void tr_heapDestruct( tr_heap * heap );
+
+/** @brief copy `item' into the heap */
+void tr_heapPush( tr_heap * heap, const void * item );
+
+/** @brief remove the top item, copying it into `setme' if it's not NULL
+    @return false if the heap was empty */
+bool tr_heapPop( tr_heap * heap, void * setme );
+
+/** @return the top item, or NULL if the heap is empty.
+    It's only valid until the heap is next changed. */
+static inline const void*
+tr_heapPeek( const tr_heap * heap )
+{
+    return heap->n_items > 0 ? heap->items : NULL;
+}
+
+static inline int
+tr_heapSize( const tr_heap * heap )
+{
+    return heap->n_items;
+}
+
+/* @} */
+
+#endif
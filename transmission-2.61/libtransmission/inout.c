@@ -17,6 +17,8 @@
 
 #include <openssl/sha.h>
 
+#include <event2/buffer.h>
+
 #include "transmission.h"
 #include "cache.h" /* tr_cacheReadBlock() */
 #include "fdlimit.h"
@@ -35,32 +37,18 @@ enum { TR_IO_READ, TR_IO_PREFETCH,
        TR_IO_WRITE
 };
 
-/* returns 0 on success, or an errno on failure */
+/* find the file's fd, opening (and maybe creating) the file if needed.
+   returns 0 on success, or an errno on failure */
 static int
-readOrWriteBytes( tr_session       * session,
-                  tr_torrent       * tor,
-                  int                ioMode,
-                  tr_file_index_t    fileIndex,
-                  uint64_t           fileOffset,
-                  void             * buf,
-                  size_t             buflen )
+checkoutFile( tr_session       * session,
+              tr_torrent       * tor,
+              tr_file_index_t    fileIndex,
+              bool               doWrite,
+              int              * setme_fd )
 {
     int fd;
     int err = 0;
-    const bool doWrite = ioMode >= TR_IO_WRITE;
-    const tr_info * const info = &tor->info;
-    const tr_file * const file = &info->files[fileIndex];
-
-    assert( fileIndex < info->fileCount );
-    assert( !file->length || ( fileOffset < file->length ) );
-    assert( fileOffset + buflen <= file->length );
-
-    if( !file->length )
-        return 0;
-
-    /***
-    ****  Find the fd
-    ***/
+    const tr_file * const file = &tor->info.files[fileIndex];
 
     fd = tr_fdFileGetCached( session, tr_torrentId( tor ), fileIndex, doWrite );
     if( fd < 0 )
@@ -111,9 +99,34 @@ readOrWriteBytes( tr_session       * session,
         tr_free( subpath );
     }
 
-    /***
-    ****  Use the fd
-    ***/
+    *setme_fd = fd;
+    return err;
+}
+
+/* returns 0 on success, or an errno on failure */
+static int
+readOrWriteBytes( tr_session       * session,
+                  tr_torrent       * tor,
+                  int                ioMode,
+                  tr_file_index_t    fileIndex,
+                  uint64_t           fileOffset,
+                  void             * buf,
+                  size_t             buflen )
+{
+    int fd;
+    int err;
+    const bool doWrite = ioMode >= TR_IO_WRITE;
+    const tr_info * const info = &tor->info;
+    const tr_file * const file = &info->files[fileIndex];
+
+    assert( fileIndex < info->fileCount );
+    assert( !file->length || ( fileOffset < file->length ) );
+    assert( fileOffset + buflen <= file->length );
+
+    if( !file->length )
+        return 0;
+
+    err = checkoutFile( session, tor, fileIndex, doWrite, &fd );
 
     if( !err )
     {
@@ -253,6 +266,103 @@ tr_ioWrite( tr_torrent       * tor,
                              len );
 }
 
+enum
+{
+    /* the most evbuffer segments to hand to a single pwritev() */
+    MAX_WRITE_IOVEC = 32
+};
+
+/* writes the first buflen bytes of buf straight from its segments and
+   drains them. returns 0 on success, or an errno on failure */
+static int
+writeEvbufferBytes( tr_torrent       * tor,
+                    tr_file_index_t    fileIndex,
+                    uint64_t           fileOffset,
+                    struct evbuffer  * buf,
+                    size_t             buflen )
+{
+    int fd;
+    int err;
+    const tr_file * const file = &tor->info.files[fileIndex];
+
+    assert( fileIndex < tor->info.fileCount );
+    assert( fileOffset + buflen <= file->length );
+    assert( evbuffer_get_length( buf ) >= buflen );
+
+    if( !file->length )
+        return 0;
+
+    err = checkoutFile( tor->session, tor, fileIndex, true, &fd );
+
+    while( !err && buflen )
+    {
+        int i;
+        int n;
+        ssize_t rc;
+        size_t len = 0;
+        struct evbuffer_iovec vec[MAX_WRITE_IOVEC];
+
+        /* don't write past buflen */
+        n = MIN( evbuffer_peek( buf, buflen, NULL, vec, MAX_WRITE_IOVEC ), MAX_WRITE_IOVEC );
+        for( i=0; i<n; ++i ) {
+            vec[i].iov_len = MIN( vec[i].iov_len, buflen - len );
+            len += vec[i].iov_len;
+        }
+
+        rc = tr_pwritev( fd, vec, n, fileOffset );
+        if( rc <= 0 ) {
+            err = rc < 0 ? errno : EIO;
+            tr_torerr( tor, "write failed for \"%s\": %s",
+                       file->name, tr_strerror( err ) );
+        } else {
+            evbuffer_drain( buf, rc );
+            fileOffset += rc;
+            buflen -= rc;
+        }
+    }
+
+    return err;
+}
+
+int
+tr_ioWriteBuf( tr_torrent       * tor,
+               tr_piece_index_t   pieceIndex,
+               uint32_t           begin,
+               struct evbuffer  * buf )
+{
+    int             err = 0;
+    size_t          buflen = evbuffer_get_length( buf );
+    tr_file_index_t fileIndex;
+    uint64_t        fileOffset;
+    const tr_info * info = &tor->info;
+
+    if( pieceIndex >= tor->info.pieceCount )
+        return EINVAL;
+
+    tr_ioFindFileLocation( tor, pieceIndex, begin,
+                           &fileIndex, &fileOffset );
+
+    while( buflen && !err )
+    {
+        const tr_file * file = &info->files[fileIndex];
+        const uint64_t bytesThisPass = MIN( buflen, file->length - fileOffset );
+
+        err = writeEvbufferBytes( tor, fileIndex, fileOffset, buf, bytesThisPass );
+        buflen -= bytesThisPass;
+        ++fileIndex;
+        fileOffset = 0;
+
+        if( ( err != 0 ) && ( tor->error != TR_STAT_LOCAL_ERROR ) )
+        {
+            char * path = tr_buildPath( tor->downloadDir, file->name, NULL );
+            tr_torrentSetLocalError( tor, "%s (%s)", tr_strerror( err ), path );
+            tr_free( path );
+        }
+    }
+
+    return err;
+}
+
 /****
 *****
 ****/
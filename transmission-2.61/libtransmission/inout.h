@@ -17,6 +17,7 @@
 #ifndef TR_IO_H
 #define TR_IO_H 1
 
+struct evbuffer;
 struct tr_torrent;
 
 /**
@@ -49,6 +50,16 @@ int tr_ioWrite( struct tr_torrent  * tor,
                 uint32_t             len,
                 const uint8_t      * writeme );
 
+/**
+ * Like tr_ioWrite(), but writes all of buf straight from its memory
+ * and drains it. buf may span several blocks or pieces.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioWriteBuf( struct tr_torrent  * tor,
+                   tr_piece_index_t     pieceIndex,
+                   uint32_t             offset,
+                   struct evbuffer    * buf );
+
 /**
  * @brief Test to see if the piece matches its metainfo's SHA1 checksum.
  */
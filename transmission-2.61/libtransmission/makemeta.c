@@ -194,50 +194,205 @@ tr_metaInfoBuilderFree( tr_metainfo_builder * builder )
 *****
 ****/
 
+/**
+ * The pieces are hashed in parallel: the builder's thread reads the files
+ * front to back in big sequential chunks of whole pieces, and a handful of
+ * hasher threads hash the chunks as they come in.
+ */
+
+enum
+{
+    /* each read is about this big, rounded down to whole pieces */
+    HASH_CHUNK_SIZE = ( 4 * 1024 * 1024 ),
+
+    MAX_HASH_THREADS = 8,
+
+    /* read-ahead: how many chunks each hasher thread gets in the pool */
+    HASH_CHUNKS_PER_THREAD = 2
+};
+
+enum
+{
+    CHUNK_FREE,     /* waiting to be read into */
+    CHUNK_READ,     /* waiting to be hashed */
+    CHUNK_HASHING
+};
+
+struct hash_chunk
+{
+    int state;
+    uint8_t * buf;
+    uint32_t firstPiece;
+    uint32_t pieceCount;
+    uint64_t len;
+};
+
+struct hash_info
+{
+    tr_metainfo_builder * builder;
+    uint8_t * pieces;
+
+    tr_lock * lock;
+    struct hash_chunk * chunks;
+    int chunkCount;
+    int threadCount;   /* hasher threads that are still running */
+    bool readerDone;   /* no more chunks are coming */
+};
+
+static void
+hashThreadFunc( void * vinfo )
+{
+    struct hash_info * info = vinfo;
+    tr_metainfo_builder * b = info->builder;
+
+    for( ;; )
+    {
+        int i;
+        bool done = false;
+        struct hash_chunk * chunk = NULL;
+
+        tr_lockLock( info->lock );
+        for( i=0; i<info->chunkCount && chunk==NULL; ++i )
+            if( info->chunks[i].state == CHUNK_READ )
+                chunk = &info->chunks[i];
+        if( chunk != NULL )
+            chunk->state = CHUNK_HASHING;
+        else if( info->readerDone ) {
+            --info->threadCount;
+            done = true;
+        }
+        tr_lockUnlock( info->lock );
+
+        if( done )
+            break;
+
+        if( chunk == NULL ) {
+            tr_wait_msec( 1 );
+            continue;
+        }
+
+        if( !b->abortFlag )
+        {
+            uint32_t j;
+
+            for( j=0; j<chunk->pieceCount; ++j )
+            {
+                const uint64_t offset = (uint64_t)j * b->pieceSize;
+                const uint32_t len = (uint32_t) MIN( b->pieceSize, chunk->len - offset );
+                tr_sha1( info->pieces + SHA_DIGEST_LENGTH * ( chunk->firstPiece + j ),
+                         chunk->buf + offset, len, NULL );
+            }
+        }
+
+        tr_lockLock( info->lock );
+        chunk->state = CHUNK_FREE;
+        b->pieceIndex += chunk->pieceCount;
+        tr_lockUnlock( info->lock );
+    }
+}
+
+static struct hash_chunk*
+getFreeChunk( struct hash_info * info )
+{
+    struct hash_chunk * chunk = NULL;
+
+    while( ( chunk == NULL ) && !info->builder->abortFlag )
+    {
+        int i;
+
+        tr_lockLock( info->lock );
+        for( i=0; i<info->chunkCount && chunk==NULL; ++i )
+            if( info->chunks[i].state == CHUNK_FREE )
+                chunk = &info->chunks[i];
+        tr_lockUnlock( info->lock );
+
+        if( chunk == NULL )
+            tr_wait_msec( 1 );
+    }
+
+    return chunk;
+}
+
+static void
+setReadError( tr_metainfo_builder * b, uint32_t fileIndex, int err )
+{
+    b->my_errno = err;
+    tr_strlcpy( b->errfile, b->files[fileIndex].filename, sizeof( b->errfile ) );
+    b->result = TR_MAKEMETA_IO_READ;
+}
+
 static uint8_t*
 getHashInfo( tr_metainfo_builder * b )
 {
+    int i;
+    int fd;
     uint32_t fileIndex = 0;
-    uint8_t *ret = tr_new0( uint8_t, SHA_DIGEST_LENGTH * b->pieceCount );
-    uint8_t *walk = ret;
-    uint8_t *buf;
-    uint64_t totalRemain;
+    uint32_t pieceIndex = 0;
     uint64_t off = 0;
-    int fd;
+    uint64_t totalRemain;
+    uint32_t piecesPerChunk;
+    struct hash_info info;
+    uint8_t * ret = tr_new0( uint8_t, SHA_DIGEST_LENGTH * b->pieceCount );
 
     if( !b->totalSize )
         return ret;
 
-    buf = tr_valloc( b->pieceSize );
     b->pieceIndex = 0;
     totalRemain = b->totalSize;
     fd = tr_open_file_for_scanning( b->files[fileIndex].filename );
     if( fd < 0 )
     {
-        b->my_errno = errno;
-        tr_strlcpy( b->errfile,
-                    b->files[fileIndex].filename,
-                    sizeof( b->errfile ) );
-        b->result = TR_MAKEMETA_IO_READ;
-        tr_free( buf );
+        setReadError( b, fileIndex, errno );
         tr_free( ret );
         return NULL;
     }
-    while( totalRemain )
+
+    piecesPerChunk = MAX( 1, HASH_CHUNK_SIZE / b->pieceSize );
+
+    memset( &info, 0, sizeof( info ) );
+    info.builder = b;
+    info.pieces = ret;
+    info.lock = tr_lockNew( );
+    info.threadCount = MIN( tr_getProcessorCount( ), MAX_HASH_THREADS );
+    info.threadCount = MAX( 1, info.threadCount );
+    info.chunkCount = info.threadCount * HASH_CHUNKS_PER_THREAD;
+    info.chunks = tr_new0( struct hash_chunk, info.chunkCount );
+    for( i=0; i<info.chunkCount; ++i )
+        info.chunks[i].buf = tr_valloc( (size_t)piecesPerChunk * b->pieceSize );
+    for( i=0; i<info.threadCount; ++i )
+        tr_threadNew( hashThreadFunc, &info );
+
+    while( totalRemain && !b->result )
     {
-        uint8_t * bufptr = buf;
-        const uint32_t thisPieceSize = (uint32_t) MIN( b->pieceSize, totalRemain );
-        uint32_t leftInPiece = thisPieceSize;
+        uint8_t * bufptr;
+        uint64_t leftInChunk;
+        struct hash_chunk * chunk;
+
+        if(( chunk = getFreeChunk( &info )) == NULL ) /* aborted */
+            break;
 
-        assert( b->pieceIndex < b->pieceCount );
+        chunk->firstPiece = pieceIndex;
+        chunk->len = MIN( (uint64_t)piecesPerChunk * b->pieceSize, totalRemain );
+        chunk->pieceCount = (uint32_t)( ( chunk->len + b->pieceSize - 1 ) / b->pieceSize );
+        assert( pieceIndex + chunk->pieceCount <= b->pieceCount );
 
-        while( leftInPiece )
+        bufptr = chunk->buf;
+        leftInChunk = chunk->len;
+        while( leftInChunk )
         {
-            const size_t n_this_pass = (size_t) MIN( ( b->files[fileIndex].size - off ), leftInPiece );
-            const ssize_t n_read = read( fd, bufptr, n_this_pass );
-            bufptr += n_read;
-            off += n_read;
-            leftInPiece -= n_read;
+            const size_t n_this_pass = (size_t) MIN( ( b->files[fileIndex].size - off ), leftInChunk );
+            if( n_this_pass > 0 )
+            {
+                const ssize_t n_read = read( fd, bufptr, n_this_pass );
+                if( n_read <= 0 ) /* an error, or the file got smaller */
+                {
+                    setReadError( b, fileIndex, n_read < 0 ? errno : EIO );
+                    break;
+                }
+                bufptr += n_read;
+                off += n_read;
+                leftInChunk -= n_read;
+            }
             if( off == b->files[fileIndex].size )
             {
                 off = 0;
@@ -248,42 +403,53 @@ getHashInfo( tr_metainfo_builder * b )
                     fd = tr_open_file_for_scanning( b->files[fileIndex].filename );
                     if( fd < 0 )
                     {
-                        b->my_errno = errno;
-                        tr_strlcpy( b->errfile,
-                                    b->files[fileIndex].filename,
-                                    sizeof( b->errfile ) );
-                        b->result = TR_MAKEMETA_IO_READ;
-                        tr_free( buf );
-                        tr_free( ret );
-                        return NULL;
+                        setReadError( b, fileIndex, errno );
+                        break;
                     }
                 }
             }
         }
 
-        assert( bufptr - buf == (int)thisPieceSize );
-        assert( leftInPiece == 0 );
-        tr_sha1( walk, buf, thisPieceSize, NULL );
-        walk += SHA_DIGEST_LENGTH;
-
-        if( b->abortFlag )
-        {
-            b->result = TR_MAKEMETA_CANCELLED;
+        if( b->result )
             break;
-        }
 
-        totalRemain -= thisPieceSize;
-        ++b->pieceIndex;
+        assert( bufptr - chunk->buf == (ptrdiff_t)chunk->len );
+
+        tr_lockLock( info.lock );
+        chunk->state = CHUNK_READ;
+        tr_lockUnlock( info.lock );
+
+        totalRemain -= chunk->len;
+        pieceIndex += chunk->pieceCount;
     }
 
-    assert( b->abortFlag
-          || ( walk - ret == (int)( SHA_DIGEST_LENGTH * b->pieceCount ) ) );
-    assert( b->abortFlag || !totalRemain );
+    /* let the hashers finish up */
+    tr_lockLock( info.lock );
+    info.readerDone = true;
+    tr_lockUnlock( info.lock );
+    while( info.threadCount > 0 )
+        tr_wait_msec( 1 );
 
     if( fd >= 0 )
         tr_close_file( fd );
+    for( i=0; i<info.chunkCount; ++i )
+        tr_free( info.chunks[i].buf );
+    tr_free( info.chunks );
+    tr_lockFree( info.lock );
+
+    if( b->abortFlag )
+    {
+        b->result = TR_MAKEMETA_CANCELLED;
+    }
+    else if( b->result )
+    {
+        tr_free( ret );
+        return NULL;
+    }
+
+    assert( b->abortFlag || ( b->pieceIndex == b->pieceCount ) );
+    assert( b->abortFlag || !totalRemain );
 
-    tr_free( buf );
     return ret;
 }
 
@@ -901,6 +901,15 @@ tr_peerIoClear( tr_peerIo * io )
     tr_peerIoSetEnabled( io, TR_DOWN, false );
 }
 
+void
+tr_peerIoReadBuffered( tr_peerIo * io )
+{
+    assert( tr_isPeerIo( io ) );
+
+    if( evbuffer_get_length( io->inbuf ) )
+        canReadWrapper( io );
+}
+
 int
 tr_peerIoReconnect( tr_peerIo * io )
 {
@@ -1035,21 +1044,46 @@ addDatatype( tr_peerIo * io, size_t byteCount, bool isPieceData )
     peer_io_push_datatype( io, d );
 }
 
+typedef void ( crypt_func )( tr_crypto *, size_t, const void * in, void * out );
+
+/* encrypt or decrypt the first byteCount bytes of buf in place.
+   this walks the evbuffer's segments directly instead of pulling them up */
 static void
-maybeEncryptBuffer( tr_peerIo * io, struct evbuffer * buf )
+cryptBuffer( tr_crypto * crypto, struct evbuffer * buf, size_t byteCount, crypt_func * func )
 {
-    if( io->encryption_type == PEER_ENCRYPTION_RC4 )
+    struct evbuffer_ptr pos;
+    struct evbuffer_iovec iovec[16];
+
+    evbuffer_ptr_set( buf, &pos, 0, EVBUFFER_PTR_SET );
+
+    while( byteCount > 0 )
     {
-        struct evbuffer_ptr pos;
-        struct evbuffer_iovec iovec;
-        evbuffer_ptr_set( buf, &pos, 0, EVBUFFER_PTR_SET );
-        do {
-            evbuffer_peek( buf, -1, &pos, &iovec, 1 );
-            tr_cryptoEncrypt( &io->crypto, iovec.iov_len, iovec.iov_base, iovec.iov_base );
-        } while( !evbuffer_ptr_set( buf, &pos, iovec.iov_len, EVBUFFER_PTR_ADD ) );
+        int i, n;
+        size_t done = 0;
+
+        n = evbuffer_peek( buf, byteCount, &pos, iovec, 16 );
+        n = MIN( n, 16 );
+
+        for( i=0; i<n && byteCount>0; ++i )
+        {
+            const size_t len = MIN( iovec[i].iov_len, byteCount );
+            func( crypto, len, iovec[i].iov_base, iovec[i].iov_base );
+            byteCount -= len;
+            done += len;
+        }
+
+        if( !done || ( byteCount && evbuffer_ptr_set( buf, &pos, done, EVBUFFER_PTR_ADD ) ) )
+            break;
     }
 }
 
+static void
+maybeEncryptBuffer( tr_peerIo * io, struct evbuffer * buf )
+{
+    if( io->encryption_type == PEER_ENCRYPTION_RC4 )
+        cryptBuffer( &io->crypto, buf, evbuffer_get_length( buf ), tr_cryptoEncrypt );
+}
+
 void
 tr_peerIoWriteBuf( tr_peerIo * io, struct evbuffer * buf, bool isPieceData )
 {
@@ -1113,29 +1147,14 @@ evbuffer_add_uint64( struct evbuffer * outbuf, uint64_t addme_hll )
 void
 tr_peerIoReadBytesToBuf( tr_peerIo * io, struct evbuffer * inbuf, struct evbuffer * outbuf, size_t byteCount )
 {
-    struct evbuffer * tmp;
-    const size_t old_length = evbuffer_get_length( outbuf );
-
     assert( tr_isPeerIo( io ) );
     assert( evbuffer_get_length( inbuf ) >= byteCount );
 
-    /* append it to outbuf */
-    tmp = evbuffer_new( );
-    evbuffer_remove_buffer( inbuf, tmp, byteCount );
-    evbuffer_add_buffer( outbuf, tmp );
-    evbuffer_free( tmp );
-
-    /* decrypt if needed */
-    if( io->encryption_type == PEER_ENCRYPTION_RC4 ) {
-        struct evbuffer_ptr pos;
-        struct evbuffer_iovec iovec;
-        evbuffer_ptr_set( outbuf, &pos, old_length, EVBUFFER_PTR_SET );
-        do {
-            evbuffer_peek( outbuf, byteCount, &pos, &iovec, 1 );
-            tr_cryptoDecrypt( &io->crypto, iovec.iov_len, iovec.iov_base, iovec.iov_base );
-            byteCount -= iovec.iov_len;
-        } while( !evbuffer_ptr_set( outbuf, &pos, iovec.iov_len, EVBUFFER_PTR_ADD ) );
-    }
+    /* decrypt it in place, then move it to outbuf */
+    if( io->encryption_type == PEER_ENCRYPTION_RC4 )
+        cryptBuffer( &io->crypto, inbuf, byteCount, tr_cryptoDecrypt );
+
+    evbuffer_remove_buffer( inbuf, outbuf, byteCount );
 }
 
 void
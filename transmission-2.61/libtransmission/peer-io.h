@@ -265,6 +265,11 @@ void    tr_peerIoSetIOFuncs      ( tr_peerIo        * io,
 
 void    tr_peerIoClear           ( tr_peerIo        * io );
 
+/** @brief call the canRead callback on whatever's already in the read buffer.
+    For readers that returned READ_LATER to wait on something other than
+    the socket, such as a handshake waiting on its crypto. */
+void    tr_peerIoReadBuffered    ( tr_peerIo        * io );
+
 /**
 ***
 **/
@@ -34,8 +34,10 @@
 #include "peer-mgr.h"
 #include "peer-msgs.h"
 #include "ptrarray.h"
+#include "resume.h" /* tr_torrentResumeBlockAdded() */
 #include "session.h"
 #include "stats.h" /* tr_statsAddUploaded, tr_statsAddDownloaded */
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "tr-utp.h"
 #include "utils.h"
@@ -46,6 +48,9 @@ enum
     /* how frequently to cull old atoms */
     ATOM_PERIOD_MSEC = ( 60 * 1000 ),
 
+    /* how many atoms to allocate at a time */
+    ATOM_SLAB_SIZE = 256,
+
     /* how frequently to change which peers are choked */
     RECHOKE_PERIOD_MSEC = ( 10 * 1000 ),
 
@@ -123,10 +128,12 @@ struct peer_atom
     uint8_t     flags2;             /* flags that aren't defined in added_f */
     int8_t      seedProbability;    /* how likely is this to be a seed... [0..100] or -1 for unknown */
     int8_t      blocklisted;        /* -1 for unknown, true for blocklisted, false for not blocklisted */
+    bool        utp_failed;         /* We recently failed to connect over uTP */
 
     tr_port     port;
-    bool        utp_failed;         /* We recently failed to connect over uTP */
     uint16_t    numFails;
+    tr_address  addr;
+
     time_t      time;               /* when the peer's connection status last changed */
     time_t      piece_data_time;
 
@@ -137,7 +144,6 @@ struct peer_atom
      * if the swarm is small, the atom will be kept past this date. */
     time_t      shelf_date;
     tr_peer   * peer;               /* will be NULL if not connected */
-    tr_address  addr;
 };
 
 #ifdef NDEBUG
@@ -184,7 +190,9 @@ enum piece_sort_state
 typedef struct tr_torrent_peers
 {
     tr_ptrArray                outgoingHandshakes; /* tr_handshake */
-    tr_ptrArray                pool; /* struct peer_atom */
+    tr_ptrArray                pool; /* struct peer_atom, unsorted */
+    struct peer_atom        ** atomIndex; /* pool, hashed by address. see getExistingAtom() */
+    int                        atomIndexSize; /* always zero or a power of two */
     tr_ptrArray                peers; /* tr_peer */
     tr_ptrArray                webseeds; /* tr_webseed */
 
@@ -212,6 +220,14 @@ typedef struct tr_torrent_peers
     uint16_t                 * pieceReplication;
     size_t                     pieceReplicationSize;
 
+    /* tr_peerMgrGetDesiredAvailable()'s sum over pieceReplication.
+       DON'T access this directly; it's a lazy field. It's recounted when
+       the replication counts change or when the torrent's completion
+       no longer matches desiredAvailableChangeCount. */
+    uint64_t                   desiredAvailableLazy;
+    uint32_t                   desiredAvailableChangeCount;
+    bool                       desiredAvailableIsDirty;
+
     int                        interestedCount;
     int                        maxPeers;
     time_t                     lastCancel;
@@ -228,10 +244,14 @@ struct tr_peerMgr
 {
     tr_session    * session;
     tr_ptrArray     incomingHandshakes; /* tr_handshake */
-    struct event  * bandwidthTimer;
-    struct event  * rechokeTimer;
-    struct event  * refillUpkeepTimer;
-    struct event  * atomTimer;
+    tr_wheelTimer * bandwidthTimer;
+    tr_wheelTimer * rechokeTimer;
+    tr_wheelTimer * refillUpkeepTimer;
+    tr_wheelTimer * atomTimer;
+
+    /* every torrent's atoms are carved from these, a slab at a time */
+    tr_ptrArray     atomSlabs; /* struct peer_atom[ATOM_SLAB_SIZE] */
+    tr_ptrArray     freeAtoms; /* struct peer_atom */
 };
 
 #define tordbg( t, ... ) \
@@ -307,24 +327,6 @@ getExistingHandshake( tr_ptrArray * handshakes, const tr_address * addr )
     return tr_ptrArrayFindSorted( handshakes, addr, handshakeCompareToAddr );
 }
 
-static int
-comparePeerAtomToAddress( const void * va, const void * vb )
-{
-    const struct peer_atom * a = va;
-
-    return tr_address_compare( &a->addr, vb );
-}
-
-static int
-compareAtomsByAddress( const void * va, const void * vb )
-{
-    const struct peer_atom * b = vb;
-
-    assert( tr_isAtom( b ) );
-
-    return comparePeerAtomToAddress( va, &b->addr );
-}
-
 /**
 ***
 **/
@@ -350,13 +352,111 @@ peerCompare( const void * a, const void * b )
     return tr_address_compare( tr_peerAddress( a ), tr_peerAddress( b ) );
 }
 
+/***
+****  Atoms are looked up by address in Torrent.atomIndex, an open-addressed
+****  hash table with linear probing. It's kept at most half full, and is
+****  only ever rebuilt, never pruned, so there are no tombstones to skip.
+***/
+
+static uint32_t
+atomHashAddress( const tr_address * addr )
+{
+    size_t i;
+    const size_t len = addr->type == TR_AF_INET ? sizeof( struct in_addr )
+                                                : sizeof( struct in6_addr );
+    const uint8_t * walk = (const uint8_t*) &addr->addr;
+    uint32_t hash = 2166136261u ^ addr->type; /* FNV-1a */
+
+    for( i=0; i<len; ++i ) {
+        hash ^= walk[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void
+atomIndexInsert( Torrent * t, struct peer_atom * atom )
+{
+    const int mask = t->atomIndexSize - 1;
+    int i = atomHashAddress( &atom->addr ) & mask;
+
+    while( t->atomIndex[i] != NULL )
+        i = ( i + 1 ) & mask;
+
+    t->atomIndex[i] = atom;
+}
+
+/* resize Torrent.atomIndex to fit the pool, then refill it */
+static void
+atomIndexRebuild( Torrent * t )
+{
+    int i;
+    const int n = tr_ptrArraySize( &t->pool );
+    struct peer_atom ** atoms = (struct peer_atom**) tr_ptrArrayBase( &t->pool );
+
+    t->atomIndexSize = 64;
+    while( t->atomIndexSize < n * 4 )
+        t->atomIndexSize *= 2;
+
+    tr_free( t->atomIndex );
+    t->atomIndex = tr_new0( struct peer_atom*, t->atomIndexSize );
+
+    for( i=0; i<n; ++i )
+        atomIndexInsert( t, atoms[i] );
+}
+
 static struct peer_atom*
 getExistingAtom( const Torrent    * t,
                  const tr_address * addr )
 {
-    Torrent * tt = (Torrent*)t;
+    int i;
+    int mask;
+    struct peer_atom * atom;
+
     assert( torrentIsLocked( t ) );
-    return tr_ptrArrayFindSorted( &tt->pool, addr, comparePeerAtomToAddress );
+
+    if( t->atomIndexSize == 0 )
+        return NULL;
+
+    mask = t->atomIndexSize - 1;
+    i = atomHashAddress( addr ) & mask;
+    while(( atom = t->atomIndex[i] ))
+    {
+        if( !tr_address_compare( &atom->addr, addr ) )
+            return atom;
+
+        i = ( i + 1 ) & mask;
+    }
+
+    return NULL;
+}
+
+static struct peer_atom*
+atomNew( tr_peerMgr * mgr )
+{
+    struct peer_atom * atom;
+
+    if( tr_ptrArrayEmpty( &mgr->freeAtoms ) )
+    {
+        int i;
+        struct peer_atom * slab = tr_new( struct peer_atom, ATOM_SLAB_SIZE );
+        tr_ptrArrayAppend( &mgr->atomSlabs, slab );
+        for( i=ATOM_SLAB_SIZE-1; i>=0; --i )
+            tr_ptrArrayAppend( &mgr->freeAtoms, slab + i );
+    }
+
+    atom = tr_ptrArrayPop( &mgr->freeAtoms );
+    memset( atom, 0, sizeof( struct peer_atom ) );
+    return atom;
+}
+
+static void
+atomFree( tr_peerMgr * mgr, struct peer_atom * atom )
+{
+    assert( atom->peer == NULL );
+
+    tr_ptrArrayAppend( &mgr->freeAtoms, atom );
 }
 
 static bool
@@ -455,6 +555,7 @@ replicationFree( Torrent * t )
     tr_free( t->pieceReplication );
     t->pieceReplication = NULL;
     t->pieceReplicationSize = 0;
+    t->desiredAvailableIsDirty = true;
 }
 
 static void
@@ -481,6 +582,8 @@ replicationNew( Torrent * t )
 
         t->pieceReplication[piece_i] = r;
     }
+
+    t->desiredAvailableIsDirty = true;
 }
 
 static void
@@ -495,7 +598,10 @@ torrentFree( void * vt )
     assert( tr_ptrArrayEmpty( &t->peers ) );
 
     tr_ptrArrayDestruct( &t->webseeds, (PtrArrayForeachFunc)tr_webseedFree );
-    tr_ptrArrayDestruct( &t->pool, (PtrArrayForeachFunc)tr_free );
+    while( !tr_ptrArrayEmpty( &t->pool ) )
+        atomFree( t->manager, tr_ptrArrayPop( &t->pool ) );
+    tr_ptrArrayDestruct( &t->pool, NULL );
+    tr_free( t->atomIndex );
     tr_ptrArrayDestruct( &t->outgoingHandshakes, NULL );
     tr_ptrArrayDestruct( &t->peers, NULL );
 
@@ -521,6 +627,7 @@ torrentNew( tr_peerMgr * manager, tr_torrent * tor )
     t->peers = TR_PTR_ARRAY_INIT;
     t->webseeds = TR_PTR_ARRAY_INIT;
     t->outgoingHandshakes = TR_PTR_ARRAY_INIT;
+    t->desiredAvailableIsDirty = true;
 
     for( i = 0; i < tor->info.webseedCount; ++i )
     {
@@ -540,16 +647,18 @@ tr_peerMgrNew( tr_session * session )
     tr_peerMgr * m = tr_new0( tr_peerMgr, 1 );
     m->session = session;
     m->incomingHandshakes = TR_PTR_ARRAY_INIT;
+    m->atomSlabs = TR_PTR_ARRAY_INIT;
+    m->freeAtoms = TR_PTR_ARRAY_INIT;
     ensureMgrTimersExist( m );
     return m;
 }
 
 static void
-deleteTimer( struct event ** t )
+deleteTimer( tr_wheelTimer ** t )
 {
     if( *t != NULL )
     {
-        event_free( *t );
+        tr_wheelTimerFree( *t );
         *t = NULL;
     }
 }
@@ -577,6 +686,9 @@ tr_peerMgrFree( tr_peerMgr * manager )
 
     tr_ptrArrayDestruct( &manager->incomingHandshakes, NULL );
 
+    tr_ptrArrayDestruct( &manager->freeAtoms, NULL );
+    tr_ptrArrayDestruct( &manager->atomSlabs, (PtrArrayForeachFunc)tr_free );
+
     managerUnlock( manager );
     tr_free( manager );
 }
@@ -1222,6 +1334,7 @@ tr_incrReplicationOfPiece( Torrent * t, const size_t index )
 
     /* One more replication of this piece is present in the swarm */
     ++t->pieceReplication[index];
+    t->desiredAvailableIsDirty = true;
 
     /* we only resort the piece if the list is already sorted */
     if( t->pieceSortState == PIECES_SORTED_BY_WEIGHT )
@@ -1243,6 +1356,7 @@ tr_incrReplicationFromBitfield( Torrent * t, const tr_bitfield * b )
     for( i=0; i<n; ++i )
         if( tr_bitfieldHas( b, i ) )
             ++rep[i];
+    t->desiredAvailableIsDirty = true;
 
     if( t->pieceSortState == PIECES_SORTED_BY_WEIGHT )
         invalidatePieceSorting( t );
@@ -1262,6 +1376,7 @@ tr_incrReplication( Torrent * t )
 
     for( i=0; i<n; ++i )
         ++t->pieceReplication[i];
+    t->desiredAvailableIsDirty = true;
 }
 
 /**
@@ -1276,6 +1391,8 @@ tr_decrReplicationFromBitfield( Torrent * t, const tr_bitfield * b )
     assert( replicationExists( t ) );
     assert( t->pieceReplicationSize == t->tor->info.pieceCount );
 
+    t->desiredAvailableIsDirty = true;
+
     if( tr_bitfieldHasAll( b ) )
     {
         for( i=0; i<n; ++i )
@@ -1457,7 +1574,7 @@ tr_peerMgrDidPeerRequest( const tr_torrent  * tor,
 
 /* cancel requests that are too old */
 static void
-refillUpkeep( int foo UNUSED, short bar UNUSED, void * vmgr )
+refillUpkeep( void * vmgr )
 {
     time_t now;
     time_t too_old;
@@ -1521,7 +1638,7 @@ refillUpkeep( int foo UNUSED, short bar UNUSED, void * vmgr )
     }
 
     tr_free( cancel );
-    tr_timerAddMsec( mgr->refillUpkeepTimer, REFILL_UPKEEP_PERIOD_MSEC );
+    tr_wheelTimerAddMsec( mgr->refillUpkeepTimer, REFILL_UPKEEP_PERIOD_MSEC );
     managerUnlock( mgr );
 }
 
@@ -1548,6 +1665,7 @@ gotBadPiece( Torrent * t, tr_piece_index_t pieceIndex )
 
     tor->corruptCur += byteCount;
     tor->downloadedCur -= MIN( tor->downloadedCur, byteCount );
+    tr_torrentMarkChanged( tor, TR_CHANGED_TRANSFER );
 
     tr_announcerAddBytes( tor, TR_ANN_CORRUPT, byteCount );
 }
@@ -1772,11 +1890,13 @@ peerCallbackFunc( tr_peer * peer, const tr_peer_event * e, void * vt )
                 /* we already have this block... */
                 const uint32_t n = tr_torBlockCountBytes( tor, block );
                 tor->downloadedCur -= MIN( tor->downloadedCur, n );
+                tr_torrentMarkChanged( tor, TR_CHANGED_TRANSFER );
                 tordbg( t, "we have this block already..." );
             }
             else
             {
                 tr_cpBlockAdd( &tor->completion, block );
+                tr_torrentResumeBlockAdded( tor, block );
                 pieceListResortPiece( t, pieceListLookup( t, e->pieceIndex ) );
                 tr_torrentSetDirty( tor );
 
@@ -1898,7 +2018,7 @@ ensureAtomExists( Torrent           * t,
     if( a == NULL )
     {
         const int jitter = tr_cryptoWeakRandInt( 60*10 );
-        a = tr_new0( struct peer_atom, 1 );
+        a = atomNew( t->manager );
         a->addr = *addr;
         a->port = port;
         a->flags = flags;
@@ -1907,7 +2027,11 @@ ensureAtomExists( Torrent           * t,
         a->shelf_date = tr_time( ) + getDefaultShelfLife( from ) + jitter;
         a->blocklisted = -1;
         atomSetSeedProbability( a, seedProbability );
-        tr_ptrArrayInsertSorted( &t->pool, a, compareAtomsByAddress );
+        tr_ptrArrayAppend( &t->pool, a );
+        if( tr_ptrArraySize( &t->pool ) * 2 > t->atomIndexSize )
+            atomIndexRebuild( t );
+        else
+            atomIndexInsert( t, a );
 
         tordbg( t, "got a new atom: %s", tr_atomAddrStr( a ) );
     }
@@ -2381,16 +2505,16 @@ tr_peerMgrGetPeers( tr_torrent   * tor,
     return count;
 }
 
-static void atomPulse      ( int, short, void * );
-static void bandwidthPulse ( int, short, void * );
-static void rechokePulse   ( int, short, void * );
+static void atomPulse      ( void * );
+static void bandwidthPulse ( void * );
+static void rechokePulse   ( void * );
 static void reconnectPulse ( int, short, void * );
 
-static struct event *
-createTimer( tr_session * session, int msec, void (*callback)(int, short, void *), void * cbdata )
+static tr_wheelTimer *
+createTimer( tr_session * session, const char * name, int msec, tr_wheel_func callback, void * cbdata )
 {
-    struct event * timer = evtimer_new( session->event_base, callback, cbdata );
-    tr_timerAddMsec( timer, msec );
+    tr_wheelTimer * timer = tr_wheelTimerNew( session, name, callback, cbdata );
+    tr_wheelTimerAddMsec( timer, msec );
     return timer;
 }
 
@@ -2398,16 +2522,16 @@ static void
 ensureMgrTimersExist( struct tr_peerMgr * m )
 {
     if( m->atomTimer == NULL )
-        m->atomTimer = createTimer( m->session, ATOM_PERIOD_MSEC, atomPulse, m );
+        m->atomTimer = createTimer( m->session, "atomPulse", ATOM_PERIOD_MSEC, atomPulse, m );
 
     if( m->bandwidthTimer == NULL )
-        m->bandwidthTimer = createTimer( m->session, BANDWIDTH_PERIOD_MSEC, bandwidthPulse, m );
+        m->bandwidthTimer = createTimer( m->session, "bandwidthPulse", BANDWIDTH_PERIOD_MSEC, bandwidthPulse, m );
 
     if( m->rechokeTimer == NULL )
-        m->rechokeTimer = createTimer( m->session, RECHOKE_PERIOD_MSEC, rechokePulse, m );
+        m->rechokeTimer = createTimer( m->session, "rechokePulse", RECHOKE_PERIOD_MSEC, rechokePulse, m );
 
     if( m->refillUpkeepTimer == NULL )
-        m->refillUpkeepTimer = createTimer( m->session, REFILL_UPKEEP_PERIOD_MSEC, refillUpkeep, m );
+        m->refillUpkeepTimer = createTimer( m->session, "refillUpkeep", REFILL_UPKEEP_PERIOD_MSEC, refillUpkeep, m );
 }
 
 void
@@ -2424,7 +2548,7 @@ tr_peerMgrStartTorrent( tr_torrent * tor )
     t->maxPeers = t->tor->maxConnectedPeers;
     t->pieceSortState = PIECES_UNSORTED;
 
-    rechokePulse( 0, 0, t->manager );
+    rechokePulse( t->manager );
 }
 
 static void
@@ -2579,7 +2703,7 @@ tr_peerMgrGetDesiredAvailable( const tr_torrent * tor )
     size_t i;
     size_t n;
     uint64_t desiredAvailable;
-    const Torrent * t = tor->torrentPeers;
+    Torrent * t = tor->torrentPeers;
 
     /* common shortcuts... */
 
@@ -2602,15 +2726,23 @@ tr_peerMgrGetDesiredAvailable( const tr_torrent * tor )
     if( !t->pieceReplication || !t->pieceReplicationSize )
         return 0;
 
-    /* do it the hard way */
+    /* do it the hard way, unless nothing's changed since last time */
 
-    desiredAvailable = 0;
-    for( i=0, n=MIN(tor->info.pieceCount, t->pieceReplicationSize); i<n; ++i )
-        if( !tor->info.pieces[i].dnd && ( t->pieceReplication[i] > 0 ) )
-            desiredAvailable += tr_cpMissingBytesInPiece( &t->tor->completion, i );
+    if( t->desiredAvailableIsDirty
+        || ( t->desiredAvailableChangeCount != tor->completion.changeCount ) )
+    {
+        desiredAvailable = 0;
+        for( i=0, n=MIN(tor->info.pieceCount, t->pieceReplicationSize); i<n; ++i )
+            if( !tor->info.pieces[i].dnd && ( t->pieceReplication[i] > 0 ) )
+                desiredAvailable += tr_cpMissingBytesInPiece( &t->tor->completion, i );
+
+        t->desiredAvailableLazy = desiredAvailable;
+        t->desiredAvailableChangeCount = tor->completion.changeCount;
+        t->desiredAvailableIsDirty = false;
+    }
 
-    assert( desiredAvailable <= tor->info.totalSize );
-    return desiredAvailable;
+    assert( t->desiredAvailableLazy <= tor->info.totalSize );
+    return t->desiredAvailableLazy;
 }
 
 void
@@ -3163,7 +3295,7 @@ rechokeUploads( Torrent * t, const uint64_t now )
 }
 
 static void
-rechokePulse( int foo UNUSED, short bar UNUSED, void * vmgr )
+rechokePulse( void * vmgr )
 {
     tr_torrent * tor = NULL;
     tr_peerMgr * mgr = vmgr;
@@ -3181,7 +3313,7 @@ rechokePulse( int foo UNUSED, short bar UNUSED, void * vmgr )
         }
     }
 
-    tr_timerAddMsec( mgr->rechokeTimer, RECHOKE_PERIOD_MSEC );
+    tr_wheelTimerAddMsec( mgr->rechokeTimer, RECHOKE_PERIOD_MSEC );
     managerUnlock( mgr );
 }
 
@@ -3579,7 +3711,7 @@ queuePulse( tr_session * session, tr_direction dir )
 }
 
 static void
-bandwidthPulse( int foo UNUSED, short bar UNUSED, void * vmgr )
+bandwidthPulse( void * vmgr )
 {
     tr_torrent * tor;
     tr_peerMgr * mgr = vmgr;
@@ -3618,7 +3750,7 @@ bandwidthPulse( int foo UNUSED, short bar UNUSED, void * vmgr )
 
     reconnectPulse( 0, 0, mgr );
 
-    tr_timerAddMsec( mgr->bandwidthTimer, BANDWIDTH_PERIOD_MSEC );
+    tr_wheelTimerAddMsec( mgr->bandwidthTimer, BANDWIDTH_PERIOD_MSEC );
     managerUnlock( mgr );
 }
 
@@ -3626,18 +3758,6 @@ bandwidthPulse( int foo UNUSED, short bar UNUSED, void * vmgr )
 ****
 ***/
 
-static int
-compareAtomPtrsByAddress( const void * va, const void *vb )
-{
-    const struct peer_atom * a = * (const struct peer_atom**) va;
-    const struct peer_atom * b = * (const struct peer_atom**) vb;
-
-    assert( tr_isAtom( a ) );
-    assert( tr_isAtom( b ) );
-
-    return tr_address_compare( &a->addr, &b->addr );
-}
-
 /* best come first, worst go last */
 static int
 compareAtomPtrsByShelfDate( const void * va, const void *vb )
@@ -3665,6 +3785,59 @@ compareAtomPtrsByShelfDate( const void * va, const void *vb )
     return 0;
 }
 
+/* Helper to selectAtomsByShelfDate().
+ * Adapted from http://en.wikipedia.org/wiki/Selection_algorithm */
+static int
+partitionAtomsByShelfDate( struct peer_atom ** atoms, int left, int right, int pivotIndex )
+{
+    int i;
+    int storeIndex;
+    struct peer_atom * tmp;
+    struct peer_atom * pivotValue = atoms[pivotIndex];
+
+    /* move pivot to end */
+    atoms[pivotIndex] = atoms[right];
+    atoms[right] = pivotValue;
+
+    storeIndex = left;
+    for( i=left; i<right; ++i )
+    {
+        if( compareAtomPtrsByShelfDate( &atoms[i], &pivotValue ) < 0 )
+        {
+            tmp = atoms[storeIndex];
+            atoms[storeIndex] = atoms[i];
+            atoms[i] = tmp;
+            storeIndex++;
+        }
+    }
+
+    /* move pivot to its final place */
+    atoms[right] = atoms[storeIndex];
+    atoms[storeIndex] = pivotValue;
+
+    return storeIndex;
+}
+
+/* move the best k atoms to the front of the array, in no particular order */
+static void
+selectAtomsByShelfDate( struct peer_atom ** atoms, int left, int right, int k )
+{
+    while( right > left )
+    {
+        const int pivotIndex = left + (right-left)/2;
+        const int pivotNewIndex = partitionAtomsByShelfDate( atoms, left, right, pivotIndex );
+
+        if( pivotNewIndex > left + k )
+            right = pivotNewIndex - 1;
+        else if( pivotNewIndex < left + k ) {
+            k -= pivotNewIndex + 1 - left;
+            left = pivotNewIndex + 1;
+        }
+        else
+            break;
+    }
+}
+
 static int
 getMaxAtomCount( const tr_torrent * tor )
 {
@@ -3676,7 +3849,7 @@ getMaxAtomCount( const tr_torrent * tor )
 }
 
 static void
-atomPulse( int foo UNUSED, short bar UNUSED, void * vmgr )
+atomPulse( void * vmgr )
 {
     tr_torrent * tor = NULL;
     tr_peerMgr * mgr = vmgr;
@@ -3709,21 +3882,23 @@ atomPulse( int foo UNUSED, short bar UNUSED, void * vmgr )
             /* if there's room, keep the best of what's left */
             i = 0;
             if( keepCount < maxAtomCount ) {
-                qsort( test, testCount, sizeof( struct peer_atom * ), compareAtomPtrsByShelfDate );
+                const int room = maxAtomCount - keepCount;
+                if( room < testCount )
+                    selectAtomsByShelfDate( test, 0, testCount-1, room );
                 while( i<testCount && keepCount<maxAtomCount )
                     keep[keepCount++] = test[i++];
             }
 
             /* free the culled atoms */
             while( i<testCount )
-                tr_free( test[i++] );
+                atomFree( mgr, test[i++] );
 
             /* rebuild Torrent.pool with what's left */
             tr_ptrArrayDestruct( &t->pool, NULL );
             t->pool = TR_PTR_ARRAY_INIT;
-            qsort( keep, keepCount, sizeof( struct peer_atom * ), compareAtomPtrsByAddress );
             for( i=0; i<keepCount; ++i )
                 tr_ptrArrayAppend( &t->pool, keep[i] );
+            atomIndexRebuild( t );
 
             tordbg( t, "max atom count is %d... pruned from %d to %d\n", maxAtomCount, atomCount, keepCount );
 
@@ -3733,7 +3908,7 @@ atomPulse( int foo UNUSED, short bar UNUSED, void * vmgr )
         }
     }
 
-    tr_timerAddMsec( mgr->atomTimer, ATOM_PERIOD_MSEC );
+    tr_wheelTimerAddMsec( mgr->atomTimer, ATOM_PERIOD_MSEC );
     managerUnlock( mgr );
 }
 
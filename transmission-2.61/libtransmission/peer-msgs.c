@@ -28,7 +28,9 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-msgs.h"
+#include "rpc-server.h" /* tr_rpcChunkArrived() */
 #include "session.h"
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "torrent-magnet.h"
 #include "tr-dht.h"
@@ -209,7 +211,7 @@ struct tr_peermsgs
        value is zero and should be ignored. */
     int64_t               reqq;
 
-    struct event        * pexTimer;
+    tr_wheelTimer       * pexTimer;
 };
 
 /**
@@ -1337,6 +1339,14 @@ readBtPiece( tr_peermsgs      * msgs,
 	       (int)( req->length - evbuffer_get_length( msgs->incoming.block ) ), req->length);
 	/* </ALEXB> */
 
+        {
+            tr_port port;
+            const tr_address * addr = tr_peerIoGetAddress( msgs->peer->io, &port );
+            tr_rpcChunkArrived( getSession( msgs )->rpcServer, msgs->torrent, addr, port,
+                                req->index, req->offset, n,
+                                req->length - evbuffer_get_length( block_buffer ) );
+        }
+
         dbgmsg( msgs, "got %zu bytes for block %u:%u->%u ... %d remain",
                n, req->index, req->offset, req->length,
                (int)( req->length - evbuffer_get_length( block_buffer ) ) );
@@ -2319,14 +2329,14 @@ sendPex( tr_peermsgs * msgs )
 }
 
 static void
-pexPulse( int foo UNUSED, short bar UNUSED, void * vmsgs )
+pexPulse( void * vmsgs )
 {
     struct tr_peermsgs * msgs = vmsgs;
 
     sendPex( msgs );
 
     assert( msgs->pexTimer != NULL );
-    tr_timerAdd( msgs->pexTimer, PEX_INTERVAL_SECS, 0 );
+    tr_wheelTimerAddMsec( msgs->pexTimer, PEX_INTERVAL_SECS * 1000 );
 }
 
 /**
@@ -2360,8 +2370,8 @@ tr_peerMsgsNew( struct tr_torrent    * torrent,
     peer->msgs = m;
 
     if( tr_torrentAllowsPex( torrent ) ) {
-        m->pexTimer = evtimer_new( torrent->session->event_base, pexPulse, m );
-        tr_timerAdd( m->pexTimer, PEX_INTERVAL_SECS, 0 );
+        m->pexTimer = tr_wheelTimerNew( torrent->session, "pexPulse", pexPulse, m );
+        tr_wheelTimerAddMsec( m->pexTimer, PEX_INTERVAL_SECS * 1000 );
     }
 
     if( tr_peerIoSupportsUTP( peer->io ) ) {
@@ -2395,8 +2405,7 @@ tr_peerMsgsFree( tr_peermsgs* msgs )
 {
     if( msgs )
     {
-        if( msgs->pexTimer != NULL )
-            event_free( msgs->pexTimer );
+        tr_wheelTimerFree( msgs->pexTimer );
 
         if( msgs->incoming.block != NULL )
             evbuffer_free( msgs->incoming.block );
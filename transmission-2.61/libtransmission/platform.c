@@ -150,6 +150,22 @@ tr_threadNew( void   ( *func )(void *),
     return t;
 }
 
+int
+tr_getProcessorCount( void )
+{
+    long n = 1;
+
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    n = info.dwNumberOfProcessors;
+#elif defined( _SC_NPROCESSORS_ONLN )
+    n = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+
+    return n > 0 ? (int)n : 1;
+}
+
 /***
 ****  LOCKS
 ***/
@@ -63,6 +63,9 @@ tr_thread* tr_threadNew( void ( *func )(void *), void * arg );
     @param thread the thread being tested */
 bool tr_amInThread( const tr_thread * );
 
+/** @brief return the number of processors that are online, or 1 if unknown */
+int tr_getProcessorCount( void );
+
 /***
 ****
 ***/
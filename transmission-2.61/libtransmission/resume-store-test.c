@@ -0,0 +1,233 @@
+#include <errno.h>
+#include <stdio.h> /* fprintf */
+#include <string.h> /* strlen */
+
+#include <unistd.h> /* pwrite, truncate */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "transmission.h"
+#include "bencode.h"
+#include "resume-store.h"
+#include "utils.h"
+
+#undef VERBOSE
+
+static int test = 0;
+
+#ifdef VERBOSE
+  #define check( A ) \
+    { \
+        ++test; \
+        if( A ){ \
+            fprintf( stderr, "PASS test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+        } else { \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#else
+  #define check( A ) \
+    { \
+        ++test; \
+        if( !( A ) ){ \
+            fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+            return test; \
+        } \
+    }
+#endif
+
+#define FILENAME "/tmp/transmission-resume-store-test.bin"
+
+/* the file layout from resume-store.c, for a store with BLOCK_COUNT blocks */
+enum
+{
+    BLOCK_COUNT = 20,
+    RECORDS_BEGIN = 16 + ( ( BLOCK_COUNT + 7 ) / 8 ),
+    RECORD_SIZE = 8 + 8 /* strlen( "d1:ai1ee" ) */
+};
+
+static const char * records[] = { "d1:ai1ee", "d1:ai2ee", "d1:ai3ee", "d1:ai4ee" };
+
+/* write a store holding the first `n' records */
+static bool
+makeStore( int n )
+{
+    int i;
+    tr_resume_store * store;
+
+    unlink( FILENAME );
+    if(( store = tr_resumeStoreOpen( FILENAME, BLOCK_COUNT )) == NULL )
+        return false;
+
+    tr_resumeStoreSetBlocks( store, 0, 4, true );
+    tr_resumeStoreSetBlocks( store, 19, 19, true );
+    for( i=0; i<n; ++i )
+        if( tr_resumeStoreAppend( store, records[i], strlen( records[i] ) ) )
+            break;
+
+    tr_resumeStoreClose( store );
+    return i == n;
+}
+
+/* returns the newest record's "a" value, or -errno */
+static int64_t
+readStore( void )
+{
+    int err;
+    tr_benc top;
+    size_t bitlen = 0;
+    uint8_t * bits = NULL;
+    int64_t a = -1;
+
+    if(( err = tr_resumeStoreRead( FILENAME, &top, &bits, &bitlen )))
+        return -err;
+
+    tr_bencDictFindInt( &top, "a", &a );
+
+    /* every test's store has blocks 0-4 and 19 */
+    if( ( bitlen != 3 ) || ( bits[0] != 0xf8 ) || ( bits[1] != 0x00 ) || ( bits[2] != 0x10 ) )
+        a = -1;
+
+    tr_bencFree( &top );
+    tr_free( bits );
+    return a;
+}
+
+static bool
+setNewestOffset( uint32_t offset )
+{
+    int fd;
+    bool ok;
+    uint8_t buf[4];
+
+    buf[0] = ( offset >> 24 ) & 0xff;
+    buf[1] = ( offset >> 16 ) & 0xff;
+    buf[2] = ( offset >> 8 ) & 0xff;
+    buf[3] = offset & 0xff;
+
+    if(( fd = open( FILENAME, O_WRONLY )) < 0 )
+        return false;
+    ok = pwrite( fd, buf, 4, 12 ) == 4;
+    close( fd );
+    return ok;
+}
+
+static int
+testRecords( void )
+{
+    struct stat sb;
+    tr_resume_store * store;
+
+    check( makeStore( 2 ) );
+    check( readStore( ) == 2 );
+
+    /* appending the same record again is a no-op */
+    check(( store = tr_resumeStoreOpen( FILENAME, BLOCK_COUNT )));
+    check( !tr_resumeStoreAppend( store, records[1], strlen( records[1] ) ) );
+    tr_resumeStoreClose( store );
+    check( !stat( FILENAME, &sb ) );
+    check( sb.st_size == RECORDS_BEGIN + 2 * RECORD_SIZE );
+    check( readStore( ) == 2 );
+
+    return 0;
+}
+
+static int
+testTornRecord( void )
+{
+    tr_resume_store * store;
+
+    /* a crash in the middle of writing the third record.
+     * the header already points at it, so the reader has to
+     * fall back to walking the chain from the start */
+    check( makeStore( 3 ) );
+    check( !truncate( FILENAME, RECORDS_BEGIN + 3 * RECORD_SIZE - 3 ) );
+    check( readStore( ) == 2 );
+
+    /* just the length of a record is left */
+    check( !truncate( FILENAME, RECORDS_BEGIN + 2 * RECORD_SIZE + 4 ) );
+    check( readStore( ) == 2 );
+
+    /* reopening it appends over the torn record */
+    check(( store = tr_resumeStoreOpen( FILENAME, BLOCK_COUNT )));
+    check( !tr_resumeStoreAppend( store, records[3], strlen( records[3] ) ) );
+    tr_resumeStoreClose( store );
+    check( readStore( ) == 4 );
+
+    /* no intact records at all */
+    check( !truncate( FILENAME, RECORDS_BEGIN + RECORD_SIZE - 1 ) );
+    check( readStore( ) == -EINVAL );
+
+    return 0;
+}
+
+static int
+testStaleHeader( void )
+{
+    /* the header points at an older record, so the reader walks forward */
+    check( makeStore( 3 ) );
+    check( setNewestOffset( RECORDS_BEGIN ) );
+    check( readStore( ) == 3 );
+    check( setNewestOffset( RECORDS_BEGIN + RECORD_SIZE ) );
+    check( readStore( ) == 3 );
+
+    /* or at nothing useful */
+    check( setNewestOffset( 0 ) );
+    check( readStore( ) == 3 );
+    check( setNewestOffset( RECORDS_BEGIN + 5 ) );
+    check( readStore( ) == 3 );
+    check( setNewestOffset( 0xffffffff ) );
+    check( readStore( ) == 3 );
+
+    return 0;
+}
+
+static int
+testBlockCount( void )
+{
+    int fd;
+    uint8_t buf[4] = { 0, 1, 0, 0 };
+    tr_resume_store * store;
+
+    /* a store opened with a different block count starts over */
+    check( makeStore( 2 ) );
+    check(( store = tr_resumeStoreOpen( FILENAME, BLOCK_COUNT + 10 )));
+    check( tr_resumeStoreGetBlockCount( store ) == BLOCK_COUNT + 10 );
+    tr_resumeStoreClose( store );
+    check( readStore( ) == -EINVAL );
+
+    /* a header that claims more blocks than the file holds */
+    check( makeStore( 2 ) );
+    check(( fd = open( FILENAME, O_WRONLY )) >= 0 );
+    check( pwrite( fd, buf, 4, 8 ) == 4 );
+    close( fd );
+    check( readStore( ) == -EINVAL );
+
+    /* not a store at all */
+    check( !truncate( FILENAME, 10 ) );
+    check( readStore( ) == -EINVAL );
+
+    return 0;
+}
+
+int
+main( void )
+{
+#ifndef WIN32
+    int l;
+
+    if(( l = testRecords( )))
+        return l;
+    if(( l = testTornRecord( )))
+        return l;
+    if(( l = testStaleHeader( )))
+        return l;
+    if(( l = testBlockCount( )))
+        return l;
+
+    unlink( FILENAME );
+#endif
+    return 0;
+}
@@ -0,0 +1,569 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * This file is licensed by the GPL version 2. Works owned by the
+ * Transmission project are granted a special exemption to clause 2(b)
+ * so that the bulk of its code can remain under the MIT license.
+ * This exemption does not extend to derived works not owned by
+ * the Transmission project.
+ *
+ * $Id$
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h> /* mkstemp() */
+#include <string.h> /* memcmp(), memcpy() */
+
+#include <unistd.h> /* pread(), pwrite(), ftruncate(), fsync(), unlink() */
+
+#ifndef WIN32
+ #include <sys/mman.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "transmission.h"
+#include "bencode.h"
+#include "bitfield.h"
+#include "crypto.h" /* tr_sha1() */
+#include "resume-store.h"
+#include "utils.h"
+
+#ifndef O_BINARY
+ #define O_BINARY 0
+#endif
+
+/**
+ * File layout. All integers are big-endian.
+ *
+ *   header:   "TRrs" magic, uint32 version, uint32 blockCount,
+ *             uint32 file offset of the newest record (0 if none)
+ *   bitfield: (blockCount+7)/8 bytes, mapped into memory
+ *   records:  uint32 length, uint32 checksum, `length' bytes of bencoded dict
+ *
+ * The records are a chain that ends at the first one that's truncated
+ * or fails its checksum, and the last one in the chain is the current one.
+ * The header's offset is only updated after a record is written, so readers
+ * start from there and walk forward rather than checking the whole chain.
+ */
+
+enum
+{
+    STORE_VERSION = 1,
+
+    HEADER_SIZE = 16,
+
+    RECORD_HEADER_SIZE = 8,
+
+    /* once the stale records take up more than this much room
+     * and more than COMPACT_RATIO times the size of a record,
+     * the file is rewritten with just the newest one */
+    COMPACT_MIN_BYTES = ( 64 * 1024 ),
+    COMPACT_RATIO = 8
+};
+
+static const uint8_t STORE_MAGIC[4] = { 'T', 'R', 'r', 's' };
+
+struct tr_resume_store
+{
+    int fd;
+    char * filename;
+
+    uint32_t blockCount;
+    size_t bitfieldBytes;
+
+    /* the header and the bitfield */
+    uint8_t * map;
+    size_t mapLen;
+
+    /* where the next record will be written */
+    size_t recordsEnd;
+
+    /* the newest record, so that unchanged ones aren't appended again */
+    uint8_t * lastRecord;
+    size_t lastRecordLen;
+};
+
+/***
+****
+***/
+
+static void
+putU32( uint8_t * buf, uint32_t val )
+{
+    buf[0] = ( val >> 24 ) & 0xff;
+    buf[1] = ( val >> 16 ) & 0xff;
+    buf[2] = ( val >> 8 ) & 0xff;
+    buf[3] = val & 0xff;
+}
+
+static uint32_t
+getU32( const uint8_t * buf )
+{
+    return ( (uint32_t)buf[0] << 24 )
+         | ( (uint32_t)buf[1] << 16 )
+         | ( (uint32_t)buf[2] << 8 )
+         |   (uint32_t)buf[3];
+}
+
+static uint32_t
+getChecksum( const void * record, size_t len )
+{
+    uint8_t hash[SHA_DIGEST_LENGTH];
+    tr_sha1( hash, record, (int)len, NULL );
+    return getU32( hash );
+}
+
+static void
+makeHeader( uint8_t * header, uint32_t blockCount )
+{
+    memcpy( header, STORE_MAGIC, 4 );
+    putU32( header + 4, STORE_VERSION );
+    putU32( header + 8, blockCount );
+    putU32( header + 12, 0 );
+}
+
+static bool
+isHeaderValid( const uint8_t * header )
+{
+    return !memcmp( header, STORE_MAGIC, 4 )
+        && ( getU32( header + 4 ) == STORE_VERSION );
+}
+
+static size_t
+getBitfieldBytes( uint32_t blockCount )
+{
+    return ( (size_t)blockCount + 7u ) / 8u;
+}
+
+/**
+ * Walks the chain of records in buf, starting at pos.
+ * @return the offset of the end of the chain
+ */
+static size_t
+walkRecords( const uint8_t * buf, size_t buflen, size_t pos,
+             const uint8_t ** setme_record, size_t * setme_len )
+{
+    *setme_record = NULL;
+    *setme_len = 0;
+
+    while( buflen - pos >= RECORD_HEADER_SIZE )
+    {
+        const uint8_t * record = buf + pos + RECORD_HEADER_SIZE;
+        const size_t len = getU32( buf + pos );
+
+        if( len > buflen - pos - RECORD_HEADER_SIZE )
+            break;
+        if( getChecksum( record, len ) != getU32( buf + pos + 4 ) )
+            break;
+
+        *setme_record = record;
+        *setme_len = len;
+        pos += RECORD_HEADER_SIZE + len;
+    }
+
+    return pos;
+}
+
+/**
+ * @param buf the records, which start at file offset `begin'
+ * @param header the file's header, for the offset of the newest record
+ * @return the offset in buf of the end of the chain
+ */
+static size_t
+findNewestRecord( const uint8_t * buf, size_t buflen,
+                  size_t begin, const uint8_t * header,
+                  const uint8_t ** setme_record, size_t * setme_len )
+{
+    const size_t newest = getU32( header + 12 );
+
+    if( ( newest >= begin ) && ( newest - begin < buflen ) )
+    {
+        const size_t end = walkRecords( buf, buflen, newest - begin,
+                                        setme_record, setme_len );
+        if( *setme_record != NULL )
+            return end;
+    }
+
+    return walkRecords( buf, buflen, 0, setme_record, setme_len );
+}
+
+static int
+writeRecord( int fd, size_t offset, const void * record, size_t len )
+{
+    int err = 0;
+    const size_t buflen = RECORD_HEADER_SIZE + len;
+    uint8_t * buf = tr_new( uint8_t, buflen );
+
+    putU32( buf, len );
+    putU32( buf + 4, getChecksum( record, len ) );
+    memcpy( buf + RECORD_HEADER_SIZE, record, len );
+
+    /* one write, so that a crash leaves either the whole record
+     * or something that fails its checksum */
+    if( pwrite( fd, buf, buflen, offset ) != (ssize_t)buflen )
+        err = errno ? errno : EIO;
+
+    tr_free( buf );
+    return err;
+}
+
+/***
+****
+***/
+
+#ifdef WIN32
+
+tr_resume_store *
+tr_resumeStoreOpen( const char * filename UNUSED, uint32_t blockCount UNUSED )
+{
+    /* platform.c's mmap() can't write through to the file */
+    errno = ENOSYS;
+    return NULL;
+}
+
+#else
+
+static bool
+storeMap( tr_resume_store * store )
+{
+    store->map = mmap( NULL, store->mapLen, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, store->fd, 0 );
+
+    if( store->map == MAP_FAILED )
+    {
+        store->map = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void
+storeUnmap( tr_resume_store * store )
+{
+    if( store->map != NULL )
+    {
+        munmap( store->map, store->mapLen );
+        store->map = NULL;
+    }
+}
+
+/* read the existing records, if any, to find where to append */
+static void
+storeScanRecords( tr_resume_store * store, size_t fileLen )
+{
+    size_t len;
+    uint8_t * buf;
+    const uint8_t * record;
+    const size_t recordsBegin = store->mapLen;
+
+    store->recordsEnd = recordsBegin;
+
+    if( fileLen <= recordsBegin )
+        return;
+
+    len = fileLen - recordsBegin;
+    buf = tr_new( uint8_t, len );
+    if( pread( store->fd, buf, len, recordsBegin ) == (ssize_t)len )
+    {
+        size_t recordLen;
+        store->recordsEnd += findNewestRecord( buf, len, recordsBegin, store->map,
+                                               &record, &recordLen );
+        if( record != NULL )
+        {
+            store->lastRecord = tr_memdup( record, recordLen );
+            store->lastRecordLen = recordLen;
+        }
+    }
+    tr_free( buf );
+}
+
+tr_resume_store *
+tr_resumeStoreOpen( const char * filename, uint32_t blockCount )
+{
+    int err;
+    struct stat sb;
+    uint8_t header[HEADER_SIZE];
+    tr_resume_store * store;
+
+    store = tr_new0( tr_resume_store, 1 );
+    store->filename = tr_strdup( filename );
+    store->blockCount = blockCount;
+    store->bitfieldBytes = getBitfieldBytes( blockCount );
+    store->mapLen = HEADER_SIZE + store->bitfieldBytes;
+
+    store->fd = open( filename, O_RDWR | O_CREAT | O_BINARY, 0600 );
+    if( store->fd == -1 )
+        goto fail;
+
+    if( fstat( store->fd, &sb ) == -1 )
+        goto fail;
+
+    if( ( (size_t)sb.st_size < store->mapLen )
+        || ( pread( store->fd, header, HEADER_SIZE, 0 ) != HEADER_SIZE )
+        || !isHeaderValid( header )
+        || ( getU32( header + 8 ) != blockCount ) )
+    {
+        /* start over with no blocks and no records */
+        makeHeader( header, blockCount );
+        if( ftruncate( store->fd, 0 )
+            || ftruncate( store->fd, store->mapLen )
+            || ( pwrite( store->fd, header, HEADER_SIZE, 0 ) != HEADER_SIZE ) )
+            goto fail;
+        sb.st_size = store->mapLen;
+    }
+
+    if( !storeMap( store ) )
+        goto fail;
+
+    storeScanRecords( store, sb.st_size );
+    return store;
+
+fail:
+    err = errno;
+    tr_resumeStoreClose( store );
+    errno = err;
+    return NULL;
+}
+
+#endif
+
+void
+tr_resumeStoreClose( tr_resume_store * store )
+{
+    if( store != NULL )
+    {
+#ifndef WIN32
+        storeUnmap( store );
+#endif
+        if( store->fd >= 0 )
+            close( store->fd );
+        tr_free( store->lastRecord );
+        tr_free( store->filename );
+        tr_free( store );
+    }
+}
+
+const char *
+tr_resumeStoreGetFilename( const tr_resume_store * store )
+{
+    return store->filename;
+}
+
+uint32_t
+tr_resumeStoreGetBlockCount( const tr_resume_store * store )
+{
+    return store->blockCount;
+}
+
+/***
+****
+***/
+
+void
+tr_resumeStoreSetBlocks( tr_resume_store * store,
+                         uint32_t          first,
+                         uint32_t          last,
+                         bool              has )
+{
+    uint32_t i;
+    uint8_t * bits = store->map + HEADER_SIZE;
+
+    assert( first <= last );
+    assert( last < store->blockCount );
+
+    for( i=first; i<=last; ++i )
+    {
+        const uint8_t mask = 0x80 >> ( i & 7u );
+
+        if( has )
+            bits[i>>3u] |= mask;
+        else
+            bits[i>>3u] &= ~mask;
+    }
+}
+
+void
+tr_resumeStoreSetBitfield( tr_resume_store    * store,
+                           const tr_bitfield  * blocks )
+{
+    size_t i;
+    uint8_t * bits = store->map + HEADER_SIZE;
+    const bool hasAll = tr_bitfieldHasAll( blocks );
+    const bool hasNone = tr_bitfieldHasNone( blocks );
+    const int spareBits = ( 8 - ( store->blockCount & 7u ) ) & 7;
+
+    for( i=0; i<store->bitfieldBytes; ++i )
+    {
+        uint8_t val;
+
+        if( hasAll )
+            val = 0xff;
+        else if( hasNone || ( i >= blocks->alloc_count ) )
+            val = 0;
+        else
+            val = blocks->bits[i];
+
+        if( i + 1 == store->bitfieldBytes )
+            val &= 0xff << spareBits;
+
+        /* don't dirty pages that haven't changed */
+        if( bits[i] != val )
+            bits[i] = val;
+    }
+}
+
+/***
+****
+***/
+
+#ifndef WIN32
+
+/* write a new file with just the bits and the newest record,
+ * then swap it in for the old one. */
+static int
+storeCompact( tr_resume_store * store, const void * record, size_t len )
+{
+    int fd;
+    int err = 0;
+    uint8_t newest[4];
+    char * tmp = tr_strdup_printf( "%s.tmp.XXXXXX", store->filename );
+
+    putU32( newest, store->mapLen );
+
+    fd = mkstemp( tmp );
+    if( fd < 0 )
+        err = errno;
+    else if( ( pwrite( fd, store->map, store->mapLen, 0 ) != (ssize_t)store->mapLen )
+          || ( pwrite( fd, newest, 4, 12 ) != 4 ) )
+        err = errno ? errno : EIO;
+    else
+        err = writeRecord( fd, store->mapLen, record, len );
+
+    /* the new file has to be on disk before it replaces the old one,
+     * or a crash could leave neither */
+    if( !err && fsync( fd ) )
+        err = errno;
+
+    if( !err && rename( tmp, store->filename ) )
+        err = errno;
+
+    if( err )
+    {
+        if( fd >= 0 )
+            close( fd );
+        unlink( tmp );
+    }
+    else
+    {
+        storeUnmap( store );
+        close( store->fd );
+        store->fd = fd;
+        store->recordsEnd = store->mapLen + RECORD_HEADER_SIZE + len;
+
+        if( !storeMap( store ) )
+            err = errno;
+    }
+
+    tr_free( tmp );
+    return err;
+}
+
+int
+tr_resumeStoreAppend( tr_resume_store * store,
+                      const void      * record,
+                      size_t            len )
+{
+    int err;
+    const size_t used = store->recordsEnd - store->mapLen;
+
+    assert( store->map != NULL );
+
+    if( ( len == store->lastRecordLen ) && !memcmp( record, store->lastRecord, len ) )
+        return 0;
+
+    if( ( used > COMPACT_MIN_BYTES ) && ( used > len * COMPACT_RATIO ) )
+    {
+        err = storeCompact( store, record, len );
+    }
+    else if(( err = writeRecord( store->fd, store->recordsEnd, record, len )))
+    {
+        /* leave recordsEnd alone so the next record overwrites this one */
+    }
+    else
+    {
+        putU32( store->map + 12, store->recordsEnd );
+        store->recordsEnd += RECORD_HEADER_SIZE + len;
+    }
+
+    if( !err )
+    {
+        tr_free( store->lastRecord );
+        store->lastRecord = tr_memdup( record, len );
+        store->lastRecordLen = len;
+
+        /* start writing the bits out, but don't wait for them */
+        msync( store->map, store->mapLen, MS_ASYNC );
+    }
+
+    return err;
+}
+
+#else
+
+int
+tr_resumeStoreAppend( tr_resume_store * store UNUSED,
+                      const void      * record UNUSED,
+                      size_t            len UNUSED )
+{
+    return ENOSYS;
+}
+
+#endif
+
+int
+tr_resumeStoreRead( const char  * filename,
+                    tr_benc     * setme,
+                    uint8_t    ** setme_bits,
+                    size_t      * setme_bitlen )
+{
+    int err = 0;
+    size_t len;
+    uint8_t * buf;
+    size_t recordLen;
+    size_t bitfieldBytes = 0;
+    const uint8_t * record = NULL;
+
+    if(( buf = tr_loadFile( filename, &len )) == NULL )
+        return errno;
+
+    if( ( len < HEADER_SIZE ) || !isHeaderValid( buf ) )
+        err = EINVAL;
+    else if( len - HEADER_SIZE < ( bitfieldBytes = getBitfieldBytes( getU32( buf + 8 ) ) ) )
+        err = EINVAL;
+    else {
+        const size_t recordsBegin = HEADER_SIZE + bitfieldBytes;
+        findNewestRecord( buf + recordsBegin, len - recordsBegin, recordsBegin, buf,
+                          &record, &recordLen );
+        if( record == NULL )
+            err = EINVAL;
+        else if( tr_bencLoad( record, recordLen, setme, NULL ) )
+            err = EILSEQ;
+        else if( !tr_bencIsDict( setme ) ) {
+            tr_bencFree( setme );
+            err = EILSEQ;
+        }
+    }
+
+    if( !err )
+    {
+        *setme_bits = tr_memdup( buf + HEADER_SIZE, bitfieldBytes );
+        *setme_bitlen = bitfieldBytes;
+    }
+
+    tr_free( buf );
+    return err;
+}
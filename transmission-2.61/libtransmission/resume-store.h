@@ -0,0 +1,72 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * This file is licensed by the GPL version 2. Works owned by the
+ * Transmission project are granted a special exemption to clause 2(b)
+ * so that the bulk of its code can remain under the MIT license.
+ * This exemption does not extend to derived works not owned by
+ * the Transmission project.
+ *
+ * $Id$
+ */
+
+#ifndef __TRANSMISSION__
+ #error only libtransmission should #include this header.
+#endif
+
+#ifndef TR_RESUME_STORE_H
+#define TR_RESUME_STORE_H
+
+struct tr_benc;
+struct tr_bitfield;
+
+/**
+ * A binary alternative to the bencoded .resume file.
+ *
+ * The file starts with a fixed header and the torrent's block bitfield,
+ * which is kept mapped into memory and updated in place. After that come
+ * checksummed records holding everything else, each one a complete
+ * bencoded dict. New records are appended and the newest intact one wins,
+ * so an interrupted save only loses that save.
+ */
+typedef struct tr_resume_store tr_resume_store;
+
+/** @brief open or create a store for a torrent with `blockCount' blocks.
+    An existing file with a different block count is started over.
+    @return the store, or NULL with errno set */
+tr_resume_store * tr_resumeStoreOpen( const char * filename,
+                                      uint32_t     blockCount );
+
+void tr_resumeStoreClose( tr_resume_store * store );
+
+const char * tr_resumeStoreGetFilename( const tr_resume_store * store );
+
+uint32_t tr_resumeStoreGetBlockCount( const tr_resume_store * store );
+
+/** @brief set or clear the bits for blocks [first..last] */
+void tr_resumeStoreSetBlocks( tr_resume_store * store,
+                              uint32_t          first,
+                              uint32_t          last,
+                              bool              has );
+
+/** @brief make the stored bits match `blocks'.
+    Only the bytes that differ are written. */
+void tr_resumeStoreSetBitfield( tr_resume_store          * store,
+                                const struct tr_bitfield * blocks );
+
+/** @brief append a record, unless it's the same as the newest one.
+    @return 0 on success, or an errno value */
+int tr_resumeStoreAppend( tr_resume_store * store,
+                          const void      * record,
+                          size_t            len );
+
+/** @brief read a store's newest record and its bits without opening it.
+    This is safe to call from any thread.
+    @param setme_bits is set to a tr_malloc()ed copy of the bitfield
+    @return 0 on success, or an errno value */
+int tr_resumeStoreRead( const char     * filename,
+                        struct tr_benc * setme,
+                        uint8_t       ** setme_bits,
+                        size_t         * setme_bitlen );
+
+#endif
@@ -16,11 +16,15 @@
 
 #include "transmission.h"
 #include "bencode.h"
+#include "cache.h" /* tr_cacheFlushTorrent() */
 #include "completion.h"
+#include "fdlimit.h" /* tr_fdReserve() */
+#include "list.h"
 #include "metainfo.h" /* tr_metainfoGetBasename() */
 #include "peer-mgr.h" /* pex */
 #include "platform.h" /* tr_getResumeDir() */
 #include "resume.h"
+#include "resume-store.h"
 #include "session.h"
 #include "torrent.h"
 #include "utils.h" /* tr_buildPath */
@@ -74,15 +78,29 @@ enum
 };
 
 static char*
-getResumeFilename( const tr_torrent * tor )
+getResumeFilenameFromInfo( const tr_session * session, const tr_info * inf,
+                           const char * extension )
 {
-    char * base = tr_metainfoGetBasename( tr_torrentInfo( tor ) );
-    char * filename = tr_strdup_printf( "%s" TR_PATH_DELIMITER_STR "%s.resume",
-                                        tr_getResumeDir( tor->session ), base );
+    char * base = tr_metainfoGetBasename( inf );
+    char * filename = tr_strdup_printf( "%s" TR_PATH_DELIMITER_STR "%s%s",
+                                        tr_getResumeDir( session ), base, extension );
     tr_free( base );
     return filename;
 }
 
+static char*
+getResumeFilename( const tr_torrent * tor )
+{
+    return getResumeFilenameFromInfo( tor->session, tr_torrentInfo( tor ), ".resume" );
+}
+
+/* the binary format. see resume-store.h */
+static char*
+getResumeStoreFilename( const tr_torrent * tor )
+{
+    return getResumeFilenameFromInfo( tor->session, tr_torrentInfo( tor ), ".resume.bin" );
+}
+
 /***
 ****
 ***/
@@ -477,10 +495,18 @@ saveProgress( tr_benc * dict, tr_torrent * tor )
     /* add the progress */
     if( tor->completeness == TR_SEED )
         tr_bencDictAddStr( prog, KEY_PROGRESS_HAVE, "all" );
+}
 
-    /* add the blocks bitfield */
-    bitfieldToBenc( &tor->completion.blockBitfield,
-                    tr_bencDictAdd( prog, KEY_PROGRESS_BLOCKS ) );
+/* the blocks bitfield is kept apart from the rest of the progress
+ * because the binary resume file stores it on its own */
+static void
+saveProgressBlocks( tr_benc * dict, const tr_torrent * tor )
+{
+    tr_benc * prog;
+
+    if( tr_bencDictFindDict( dict, KEY_PROGRESS, &prog ) )
+        bitfieldToBenc( &tor->completion.blockBitfield,
+                        tr_bencDictAdd( prog, KEY_PROGRESS_BLOCKS ) );
 }
 
 static uint64_t
@@ -622,12 +648,93 @@ loadProgress( tr_benc * dict, tr_torrent * tor )
 ****
 ***/
 
+enum
+{
+    /* how many binary resume stores can stay open between saves.
+     * the least recently saved one is closed to make room. */
+    MAX_OPEN_RESUME_STORES = 8
+};
+
+static int
+openResumeStore( tr_torrent * tor, const char * filename, uint32_t blockCount )
+{
+    tr_session * session = tor->session;
+
+    if( tr_list_size( session->openResumeStores ) >= MAX_OPEN_RESUME_STORES )
+    {
+        tr_list * l = session->openResumeStores;
+        while( l->next != NULL )
+            l = l->next;
+        tr_torrentCloseResume( l->data );
+    }
+
+    if( !tr_fdReserve( session ) )
+        return EMFILE;
+
+    if(( tor->resumeStore = tr_resumeStoreOpen( filename, blockCount )) == NULL )
+    {
+        const int err = errno;
+        tr_fdUnreserve( session );
+        return err;
+    }
+
+    tr_list_prepend( &session->openResumeStores, tor );
+    return 0;
+}
+
+static int
+saveResumeStore( tr_torrent * tor, const tr_benc * top )
+{
+    int err = 0;
+    char * filename = getResumeStoreFilename( tor );
+    const uint32_t blockCount = tr_torrentHasMetadata( tor ) ? tor->blockCount : 0;
+    tr_resume_store * store = tor->resumeStore;
+
+    /* a magnet link's filename and block count change with its metadata */
+    if( ( store != NULL )
+        && ( ( tr_resumeStoreGetBlockCount( store ) != blockCount )
+          || strcmp( tr_resumeStoreGetFilename( store ), filename ) ) )
+        tr_torrentCloseResume( tor );
+
+    if( tor->resumeStore == NULL )
+        err = openResumeStore( tor, filename, blockCount );
+    else if( tor->session->openResumeStores->data != tor ) {
+        tr_list_remove_data( &tor->session->openResumeStores, tor );
+        tr_list_prepend( &tor->session->openResumeStores, tor );
+    }
+
+    if( !err )
+    {
+        int len;
+        char * str;
+
+        /* the bits may only claim blocks that are on disk,
+         * so write out the ones that are still in the cache */
+        if( blockCount && !tr_cacheFlushTorrent( tor->session->cache, tor ) )
+            tr_resumeStoreSetBitfield( tor->resumeStore, &tor->completion.blockBitfield );
+
+        str = tr_bencToStr( top, TR_FMT_BENC, &len );
+        if(( err = tr_resumeStoreAppend( tor->resumeStore, str, len )))
+            tr_torrentCloseResume( tor );
+        tr_free( str );
+    }
+
+    if( err )
+        tr_torerr( tor, "Couldn't save \"%s\": %s", filename, tr_strerror( err ) );
+    else
+        tr_tordbg( tor, "Saved \"%s\"", filename );
+
+    tr_free( filename );
+    return err;
+}
+
 void
 tr_torrentSaveResume( tr_torrent * tor )
 {
     int err;
     tr_benc top;
     char * filename;
+    char * storeFilename;
 
     if( !tr_isTorrent( tor ) )
         return;
@@ -658,30 +765,89 @@ tr_torrentSaveResume( tr_torrent * tor )
     saveRatioLimits( &top, tor );
     saveIdleLimits( &top, tor );
 
+    /* save in one format, then remove the other. If that's interrupted,
+     * tr_torrentReadResume() prefers the binary one */
     filename = getResumeFilename( tor );
-    if(( err = tr_bencToFile( &top, TR_FMT_BENC, filename )))
-        tr_torrentSetLocalError( tor, "Unable to save resume file: %s", tr_strerror( err ) );
+    storeFilename = getResumeStoreFilename( tor );
+    if( tor->session->isBinaryResumeEnabled && !saveResumeStore( tor, &top ) )
+    {
+        unlink( filename );
+    }
+    else
+    {
+        tr_torrentCloseResume( tor );
+        if( tr_torrentHasMetadata( tor ) )
+            saveProgressBlocks( &top, tor );
+        if(( err = tr_bencToFile( &top, TR_FMT_BENC, filename )))
+            tr_torrentSetLocalError( tor, "Unable to save resume file: %s", tr_strerror( err ) );
+        else
+            unlink( storeFilename );
+    }
+    tr_free( storeFilename );
     tr_free( filename );
 
     tr_bencFree( &top );
 }
 
+int
+tr_torrentReadResume( const tr_session * session,
+                      const tr_info    * inf,
+                      struct tr_benc   * setme )
+{
+    int err;
+    size_t bitlen;
+    uint8_t * bits;
+    char * filename = getResumeFilenameFromInfo( session, inf, ".resume.bin" );
+
+    if( !( err = tr_resumeStoreRead( filename, setme, &bits, &bitlen ) ) )
+    {
+        /* put the bits back where loadProgress() looks for them */
+        tr_benc * prog;
+        if( bitlen && tr_bencDictFindDict( setme, KEY_PROGRESS, &prog ) )
+            tr_bencDictAddRaw( prog, KEY_PROGRESS_BLOCKS, bits, bitlen );
+        tr_free( bits );
+    }
+    else
+    {
+        tr_free( filename );
+        filename = getResumeFilenameFromInfo( session, inf, ".resume" );
+        err = tr_bencLoadFile( setme, TR_FMT_BENC, filename );
+    }
+
+    tr_free( filename );
+    return err;
+}
+
 static uint64_t
-loadFromFile( tr_torrent * tor, uint64_t fieldsToLoad )
+loadFromFile( tr_torrent * tor, uint64_t fieldsToLoad, const tr_ctor * ctor )
 {
     int64_t  i;
     const char * str;
     char * filename;
     tr_benc top;
     bool boolVal;
+    bool isRead;
     uint64_t fieldsLoaded = 0;
     const bool wasDirty = tor->isDirty;
+    tr_torrent_prefetch * prefetch = ctor ? tr_ctorGetPrefetch( ctor ) : NULL;
 
     assert( tr_isTorrent( tor ) );
 
     filename = getResumeFilename( tor );
 
-    if( tr_bencLoadFile( &top, TR_FMT_BENC, filename ) )
+    if( prefetch != NULL ) /* tr_torrentPrefetch() has already read it */
+    {
+        isRead = prefetch->hasResume;
+        if( isRead )
+            top = prefetch->resume;
+        prefetch->hasResume = false;
+    }
+    else
+    {
+        isRead = !tr_torrentReadResume( tor->session, tr_torrentInfo( tor ), &top );
+    }
+
+    if( !isRead )
     {
         tr_tordbg( tor, "Couldn't read \"%s\"", filename );
 
@@ -874,7 +1040,7 @@ tr_torrentLoadResume( tr_torrent *    tor,
 
     ret |= useManditoryFields( tor, fieldsToLoad, ctor );
     fieldsToLoad &= ~ret;
-    ret |= loadFromFile( tor, fieldsToLoad );
+    ret |= loadFromFile( tor, fieldsToLoad, ctor );
     fieldsToLoad &= ~ret;
     ret |= useFallbackFields( tor, fieldsToLoad, ctor );
 
@@ -882,9 +1048,75 @@ tr_torrentLoadResume( tr_torrent *    tor,
 }
 
 void
-tr_torrentRemoveResume( const tr_torrent * tor )
+tr_torrentRemoveResume( tr_torrent * tor )
 {
-    char * filename = getResumeFilename( tor );
+    char * filename;
+
+    tr_torrentCloseResume( tor );
+
+    filename = getResumeFilename( tor );
     unlink( filename );
     tr_free( filename );
+
+    filename = getResumeStoreFilename( tor );
+    unlink( filename );
+    tr_free( filename );
+}
+
+void
+tr_torrentCloseResume( tr_torrent * tor )
+{
+    if( tor->resumeStore != NULL )
+    {
+        tr_resumeStoreClose( tor->resumeStore );
+        tor->resumeStore = NULL;
+        tr_list_remove_data( &tor->session->openResumeStores, tor );
+        tr_fdUnreserve( tor->session );
+    }
+}
+
+/***
+****
+***/
+
+void
+tr_torrentResumeBlocksWritten( tr_torrent       * tor,
+                               tr_block_index_t   first,
+                               tr_block_index_t   last )
+{
+    tr_block_index_t b;
+    tr_resume_store * store = tor->resumeStore;
+
+    if( ( store == NULL ) || ( last >= tr_resumeStoreGetBlockCount( store ) ) )
+        return;
+
+    /* skip any that failed a checksum while they were in the cache */
+    for( b=first; b<=last; ++b )
+        if( tr_cpBlockIsComplete( &tor->completion, b ) )
+            tr_resumeStoreSetBlocks( store, b, b, true );
+}
+
+/* the cache may have written the block out before it was added */
+void
+tr_torrentResumeBlockAdded( tr_torrent * tor, tr_block_index_t block )
+{
+    tr_resume_store * store = tor->resumeStore;
+
+    if( ( store != NULL )
+        && ( block < tr_resumeStoreGetBlockCount( store ) )
+        && !tr_cacheHasBlock( tor->session->cache, tor, block ) )
+        tr_resumeStoreSetBlocks( store, block, block, true );
+}
+
+void
+tr_torrentResumePieceRemoved( tr_torrent * tor, tr_piece_index_t piece )
+{
+    tr_resume_store * store = tor->resumeStore;
+
+    if( ( store != NULL ) && ( tor->blockCount == tr_resumeStoreGetBlockCount( store ) ) )
+    {
+        tr_block_index_t first, last;
+        tr_torGetPieceBlockRange( tor, piece, &first, &last );
+        tr_resumeStoreSetBlocks( store, first, last, false );
+    }
 }
@@ -48,8 +48,37 @@ uint64_t tr_torrentLoadResume( tr_torrent *    tor,
                                uint64_t        fieldsToLoad,
                                const tr_ctor * ctor );
 
+/**
+ * Read the resume file of the torrent described by `inf' without needing
+ * the torrent itself, so that it can be done off the event thread.
+ * Returns 0 on success, or an errno value on failure.
+ */
+int      tr_torrentReadResume( const tr_session * session,
+                               const tr_info    * inf,
+                               struct tr_benc   * setme );
+
 void     tr_torrentSaveResume( tr_torrent * tor );
 
-void     tr_torrentRemoveResume( const tr_torrent * tor );
+void     tr_torrentRemoveResume( tr_torrent * tor );
+
+void     tr_torrentCloseResume( tr_torrent * tor );
+
+/**
+ * Keep the binary resume file's block bits current between saves.
+ * Blocks are only marked once they've been written to disk, so the
+ * bits on disk never claim more than the files hold.
+ *
+ * Only the most recently saved torrents keep their files open for this.
+ * The others' bits are brought up to date at their next save.
+ */
+void     tr_torrentResumeBlocksWritten( tr_torrent       * tor,
+                                        tr_block_index_t   first,
+                                        tr_block_index_t   last );
+
+void     tr_torrentResumeBlockAdded( tr_torrent       * tor,
+                                     tr_block_index_t   block );
+
+void     tr_torrentResumePieceRemoved( tr_torrent       * tor,
+                                       tr_piece_index_t   piece );
 
 #endif
@@ -22,6 +22,7 @@
 #endif
 
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/http_struct.h> /* TODO: eventually remove this */
@@ -30,13 +31,17 @@
 #include "bencode.h"
 #include "crypto.h" /* tr_cryptoRandBuf(), tr_ssha1_matches() */
 #include "fdlimit.h"
+#include "inout.h" /* tr_ioFindFileLocation() */
 #include "list.h"
 #include "net.h"
+#include "peer-io.h" /* tr_peerIoAddrStr() */
 #include "platform.h" /* tr_getWebClientDir() */
 #include "ptrarray.h"
 #include "rpcimpl.h"
 #include "rpc-server.h"
 #include "session.h"
+#include "timer-wheel.h"
+#include "torrent.h"
 #include "trevent.h"
 #include "utils.h"
 #include "web.h"
@@ -70,6 +75,12 @@ struct tr_rpc_server
     char *             sessionId;
     time_t             sessionIdExpiresAt;
 
+    tr_ptrArray        streams; /* struct event_stream */
+    int                chunkStreamCount;
+    bool               chunksPending;
+    tr_wheelTimer *    streamTimer;
+    tr_wheelTimer *    chunkTimer;
+
 #ifdef HAVE_ZLIB
     bool               isStreamInitialized;
     z_stream           stream;
@@ -558,6 +569,538 @@ handle_rpc( struct evhttp_request * req,
 
 }
 
+/***
+****  EVENT STREAM
+****
+****  A GET of <url>events is answered with a chunked text/event-stream
+****  reply that's kept open so that clients needn't poll. Once a second,
+****  each stream is sent the session's speeds and, if it asked for any
+****  fields, torrent-get's "since" changes for the torrents it asked for.
+****  Streams that ask for chunks are also sent the blocks' data as it
+****  arrives from peers, batched every STREAM_CHUNK_MSEC.
+****
+****  Streams that asked for the same torrents and fields share one
+****  "since" sweep per pulse. A client that stops reading has its chunk
+****  events dropped and then its stream closed, rather than letting its
+****  unsent events pile up in memory.
+***/
+
+enum
+{
+    STREAM_PULSE_MSEC = 1000,
+
+    STREAM_CHUNK_MSEC = 100,
+
+    /* chunk events past this many in one batch are counted, not sent */
+    STREAM_MAX_CHUNKS = 4096,
+
+    /* if this many bytes are waiting to be sent to a stream's client,
+       its chunk events are dropped. At twice this, it's closed. */
+    STREAM_MAX_BACKLOG = ( 512 * 1024 ),
+
+    MAX_STREAMS = 16
+};
+
+struct event_stream
+{
+    struct evhttp_request * req;
+    tr_rpc_server         * server;
+
+    tr_benc                 args; /* torrent-get's "ids" and "fields" */
+    char                  * query; /* `args' as JSON, to find streams that match */
+    int64_t                 since;
+    bool                    wantsTorrents;
+    bool                    wantsChunks;
+
+    struct evbuffer       * chunks;
+    tr_jsonWriter           chunkWriter;
+    int                     chunkCount;
+    int                     chunksDropped;
+};
+
+static void
+streamSend( struct event_stream  * stream,
+            const char           * name,
+            int64_t                id,
+            struct evbuffer      * data )
+{
+    struct evbuffer * buf = evbuffer_new( );
+
+    if( id )
+        evbuffer_add_printf( buf, "id: %" PRId64 "\n", id );
+    evbuffer_add_printf( buf, "event: %s\ndata: ", name );
+    evbuffer_add( buf, evbuffer_pullup( data, -1 ), evbuffer_get_length( data ) );
+    evbuffer_add( buf, "\n\n", 2 );
+
+    evhttp_send_reply_chunk( stream->req, buf );
+    evbuffer_free( buf );
+}
+
+/* how many bytes are waiting to be sent to the stream's client */
+static size_t
+streamBacklog( const struct event_stream * stream )
+{
+    struct evhttp_connection * evcon = evhttp_request_get_connection( stream->req );
+    struct bufferevent * bev = evhttp_connection_get_bufferevent( evcon );
+
+    return evbuffer_get_length( bufferevent_get_output( bev ) );
+}
+
+static void
+streamFree( struct event_stream * stream )
+{
+    struct evhttp_request * req = stream->req;
+
+    /* if the client's gone, libevent has handed the request
+       over to us and this frees it. Otherwise it ends the reply. */
+    if( req != NULL )
+    {
+        if( req->evcon != NULL )
+            evhttp_connection_set_closecb( req->evcon, NULL, NULL );
+        evhttp_send_reply_end( req );
+    }
+
+    if( stream->wantsChunks )
+        --stream->server->chunkStreamCount;
+
+    evbuffer_free( stream->chunks );
+    tr_free( stream->query );
+    tr_bencFree( &stream->args );
+    tr_free( stream );
+}
+
+static void
+streamRemove( struct event_stream * stream )
+{
+    tr_rpc_server * server = stream->server;
+    const int n = tr_ptrArraySize( &server->streams );
+    int i;
+
+    for( i=0; i<n; ++i )
+        if( tr_ptrArrayNth( &server->streams, i ) == stream )
+            break;
+
+    assert( i < n );
+    tr_ptrArrayRemove( &server->streams, i );
+
+    dbgmsg( "event stream %p closed; %d left", (void*)stream, n - 1 );
+    streamFree( stream );
+}
+
+static void
+onStreamClosed( struct evhttp_connection * evcon UNUSED, void * vstream )
+{
+    struct event_stream * stream = vstream;
+
+    /* libevent frees the requests that are still on the connection */
+    if( stream->req->evcon != NULL )
+        stream->req = NULL;
+
+    streamRemove( stream );
+}
+
+static void
+streamSendTorrents( struct event_stream * stream, int64_t token, struct evbuffer * buf )
+{
+    tr_session * session = stream->server->session;
+
+    if( tr_rpc_torrent_changes( session, &stream->args, stream->since, token, buf ) )
+        streamSend( stream, "torrents", token, buf );
+
+    stream->since = token;
+}
+
+/* one "since" sweep, shared by the streams that asked for the same thing */
+struct stream_sweep
+{
+    const char      * query;
+    int64_t           since;
+    bool              changed;
+    struct evbuffer * buf;
+};
+
+static void
+streamSendSharedTorrents( struct event_stream  * stream,
+                          tr_ptrArray          * sweeps,
+                          int64_t                token )
+{
+    int i;
+    const int n = tr_ptrArraySize( sweeps );
+    struct stream_sweep * sweep = NULL;
+
+    for( i=0; i<n && sweep==NULL; ++i )
+    {
+        struct stream_sweep * walk = tr_ptrArrayNth( sweeps, i );
+
+        if( ( walk->since == stream->since ) && !strcmp( walk->query, stream->query ) )
+            sweep = walk;
+    }
+
+    if( sweep == NULL )
+    {
+        sweep = tr_new0( struct stream_sweep, 1 );
+        sweep->query = stream->query;
+        sweep->since = stream->since;
+        sweep->buf = evbuffer_new( );
+        sweep->changed = tr_rpc_torrent_changes( stream->server->session,
+                                                 &stream->args, stream->since,
+                                                 token, sweep->buf );
+        tr_ptrArrayAppend( sweeps, sweep );
+    }
+
+    if( sweep->changed )
+        streamSend( stream, "torrents", token, sweep->buf );
+
+    stream->since = token;
+}
+
+static void
+streamSweepFree( void * vsweep )
+{
+    struct stream_sweep * sweep = vsweep;
+
+    evbuffer_free( sweep->buf );
+    tr_free( sweep );
+}
+
+static void
+onStreamPulse( void * vserver )
+{
+    int i;
+    int64_t token = 0;
+    tr_jsonWriter w;
+    tr_rpc_server * server = vserver;
+    tr_session * session = server->session;
+    tr_ptrArray sweeps = TR_PTR_ARRAY_INIT;
+    struct evbuffer * stats = evbuffer_new( );
+
+    tr_jsonWriterInit( &w, stats );
+    tr_jsonDictBegin( &w );
+    tr_jsonDictAddInt( &w, "downloadSpeed", tr_sessionGetPieceSpeed_Bps( session, TR_DOWN ) );
+    tr_jsonDictAddInt( &w, "uploadSpeed", tr_sessionGetPieceSpeed_Bps( session, TR_UP ) );
+    tr_jsonDictEnd( &w );
+
+    for( i=0; i<tr_ptrArraySize( &server->streams ); )
+    {
+        struct event_stream * stream = tr_ptrArrayNth( &server->streams, i );
+
+        if( stream->req->evcon == NULL ) /* the client went away */
+        {
+            streamRemove( stream );
+            continue;
+        }
+
+        if( streamBacklog( stream ) > 2 * STREAM_MAX_BACKLOG )
+        {
+            tr_ninf( MY_NAME, "closing event stream %p: its client isn't keeping up",
+                     (void*)stream );
+            evhttp_connection_free( stream->req->evcon ); /* calls onStreamClosed() */
+            continue;
+        }
+
+        streamSend( stream, "stats", 0, stats );
+
+        if( stream->wantsTorrents )
+        {
+            if( !token )
+                token = tr_rpc_next_change_token( session );
+
+            streamSendSharedTorrents( stream, &sweeps, token );
+        }
+
+        ++i;
+    }
+
+    tr_ptrArrayDestruct( &sweeps, streamSweepFree );
+    evbuffer_free( stats );
+
+    if( !tr_ptrArrayEmpty( &server->streams ) )
+        tr_wheelTimerAddMsec( server->streamTimer, STREAM_PULSE_MSEC );
+}
+
+static void
+onChunkPulse( void * vserver )
+{
+    int i;
+    tr_rpc_server * server = vserver;
+
+    server->chunksPending = false;
+
+    for( i=0; i<tr_ptrArraySize( &server->streams ); ++i )
+    {
+        struct event_stream * stream = tr_ptrArrayNth( &server->streams, i );
+
+        if( ( stream->chunkCount > 0 ) && ( stream->req->evcon != NULL )
+                                       && ( streamBacklog( stream ) > STREAM_MAX_BACKLOG ) )
+        {
+            stream->chunksDropped += stream->chunkCount;
+            evbuffer_drain( stream->chunks, evbuffer_get_length( stream->chunks ) );
+            stream->chunkCount = 0;
+        }
+
+        if( stream->chunkCount > 0 )
+        {
+            tr_jsonListEnd( &stream->chunkWriter );
+            streamSend( stream, "chunks", 0, stream->chunks );
+            evbuffer_drain( stream->chunks, evbuffer_get_length( stream->chunks ) );
+            stream->chunkCount = 0;
+        }
+
+        if( stream->chunksDropped > 0 )
+        {
+            tr_ninf( MY_NAME, "event stream %p was too slow for %d chunk events",
+                     (void*)stream, stream->chunksDropped );
+            stream->chunksDropped = 0;
+        }
+    }
+}
+
+static bool
+streamWantsTorrent( const struct event_stream * stream, const tr_torrent * tor )
+{
+    int64_t id;
+    const char * str;
+    tr_benc * ids = tr_bencDictFind( (tr_benc*)&stream->args, "ids" );
+
+    if( ids == NULL )
+        return true;
+
+    if( tr_bencGetInt( ids, &id ) )
+        return id == tor->uniqueId;
+
+    if( tr_bencGetStr( ids, &str ) )
+        return !strcmp( str, "recently-active" )
+            || !evutil_ascii_strcasecmp( str, tor->info.hashString );
+
+    if( tr_bencIsList( ids ) )
+    {
+        int i;
+        const int n = tr_bencListSize( ids );
+
+        for( i=0; i<n; ++i )
+        {
+            tr_benc * node = tr_bencListChild( ids, i );
+
+            if( tr_bencGetInt( node, &id ) && ( id == tor->uniqueId ) )
+                return true;
+            if( tr_bencGetStr( node, &str ) && !evutil_ascii_strcasecmp( str, tor->info.hashString ) )
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void
+tr_rpcChunkArrived( tr_rpc_server     * server,
+                    const tr_torrent  * tor,
+                    const tr_address  * addr,
+                    tr_port             port,
+                    uint32_t            piece,
+                    uint32_t            offset,
+                    size_t              length,
+                    size_t              remaining )
+{
+    int i;
+    bool located = false;
+    const char * peer = NULL;
+    uint64_t fileOffset = 0;
+    tr_file_index_t fileIndex = 0;
+    const uint64_t now = tr_time_msec( );
+
+    if( ( server == NULL ) || ( server->chunkStreamCount < 1 ) )
+        return;
+
+    for( i=0; i<tr_ptrArraySize( &server->streams ); ++i )
+    {
+        tr_jsonWriter * w;
+        struct event_stream * stream = tr_ptrArrayNth( &server->streams, i );
+
+        if( !stream->wantsChunks || !streamWantsTorrent( stream, tor ) )
+            continue;
+
+        if( stream->chunkCount >= STREAM_MAX_CHUNKS )
+        {
+            ++stream->chunksDropped;
+            continue;
+        }
+
+        if( !located )
+        {
+            tr_ioFindFileLocation( tor, piece, offset, &fileIndex, &fileOffset );
+            peer = tr_peerIoAddrStr( addr, port );
+            located = true;
+        }
+
+        w = &stream->chunkWriter;
+        if( !stream->chunkCount++ )
+        {
+            tr_jsonWriterInit( w, stream->chunks );
+            tr_jsonListBegin( w );
+        }
+
+        tr_jsonDictBegin( w );
+        tr_jsonDictAddInt( w, "id", tor->uniqueId );
+        tr_jsonDictAddStr( w, "peer", peer );
+        tr_jsonDictAddInt( w, "piece", piece );
+        tr_jsonDictAddInt( w, "offset", offset );
+        tr_jsonDictAddInt( w, "length", length );
+        tr_jsonDictAddInt( w, "remaining", remaining );
+        tr_jsonDictAddInt( w, "file", fileIndex );
+        tr_jsonDictAddInt( w, "fileOffset", fileOffset );
+        tr_jsonDictAddInt( w, "time", now );
+        tr_jsonDictEnd( w );
+
+        if( !server->chunksPending )
+        {
+            server->chunksPending = true;
+            tr_wheelTimerAddMsec( server->chunkTimer, STREAM_CHUNK_MSEC );
+        }
+    }
+}
+
+/* fields=name,status&ids=1,3-5&chunks=1&since=... */
+static void
+parseStreamQuery( struct event_stream * stream, const char * query )
+{
+    const char * pch = query;
+
+    while( pch && *pch )
+    {
+        const char * delim = strchr( pch, '=' );
+        const char * next = strchr( pch, '&' );
+        const char * val;
+        size_t keylen;
+        size_t len;
+
+        if( next == NULL )
+            next = pch + strlen( pch );
+        if( ( delim == NULL ) || ( delim > next ) )
+            delim = next;
+        keylen = delim - pch;
+        val = delim < next ? delim + 1 : next;
+        len = next - val;
+
+        if( ( keylen == 6 ) && !memcmp( pch, "fields", 6 ) )
+        {
+            tr_benc * fields = tr_bencDictAddList( &stream->args, "fields", 0 );
+
+            while( len > 0 )
+            {
+                const char * comma = memchr( val, ',', len );
+                const size_t n = comma ? (size_t)( comma - val ) : len;
+                if( n > 0 )
+                    tr_bencListAddRaw( fields, (const uint8_t*)val, n );
+                val += n;
+                len -= n;
+                if( len > 0 ) {
+                    ++val;
+                    --len;
+                }
+            }
+
+            stream->wantsTorrents = tr_bencListSize( fields ) > 0;
+        }
+        else if( ( keylen == 3 ) && !memcmp( pch, "ids", 3 ) )
+        {
+            tr_rpc_parse_list_str( tr_bencDictAdd( &stream->args, "ids" ), val, len );
+        }
+        else if( ( keylen == 6 ) && !memcmp( pch, "chunks", 6 ) )
+        {
+            stream->wantsChunks = ( len == 1 && *val == '1' )
+                               || ( len == 4 && !memcmp( val, "true", 4 ) );
+        }
+        else if( ( keylen == 5 ) && !memcmp( pch, "since", 5 ) )
+        {
+            char * str = tr_strndup( val, len );
+            stream->since = strtoll( str, NULL, 10 );
+            tr_free( str );
+        }
+
+        pch = *next ? next + 1 : NULL;
+    }
+}
+
+static void
+handle_events( struct evhttp_request * req,
+               struct tr_rpc_server  * server )
+{
+    if( req->type != EVHTTP_REQ_GET )
+    {
+        send_simple_response( req, 405, NULL );
+    }
+    else if( tr_ptrArraySize( &server->streams ) >= MAX_STREAMS )
+    {
+        send_simple_response( req, 503, "<p>Too many event streams are open.</p>" );
+    }
+    else
+    {
+        const char * q;
+        struct event_stream * stream = tr_new0( struct event_stream, 1 );
+
+        stream->req = req;
+        stream->server = server;
+        stream->chunks = evbuffer_new( );
+        tr_bencInitDict( &stream->args, 2 );
+
+        /* a browser that reconnects sends the last torrents event's id */
+        if(( q = evhttp_find_header( req->input_headers, "Last-Event-ID" )))
+            stream->since = strtoll( q, NULL, 10 );
+        if(( q = strchr( req->uri, '?' )))
+            parseStreamQuery( stream, q + 1 );
+        stream->query = tr_bencToStr( &stream->args, TR_FMT_JSON_LEAN, NULL );
+
+        if( stream->wantsChunks )
+            ++server->chunkStreamCount;
+
+        if( server->streamTimer == NULL )
+        {
+            server->streamTimer = tr_wheelTimerNew( server->session, "rpc-event-streams", onStreamPulse, server );
+            server->chunkTimer = tr_wheelTimerNew( server->session, "rpc-event-chunks", onChunkPulse, server );
+        }
+
+        if( tr_ptrArrayEmpty( &server->streams ) )
+            tr_wheelTimerAddMsec( server->streamTimer, STREAM_PULSE_MSEC );
+        tr_ptrArrayAppend( &server->streams, stream );
+        dbgmsg( "event stream %p opened for [%s]", (void*)stream, req->uri );
+
+        evhttp_add_header( req->output_headers, "Content-Type", "text/event-stream" );
+        evhttp_add_header( req->output_headers, "Cache-Control", "no-cache" );
+        evhttp_send_reply_start( req, HTTP_OK, "OK" );
+        evhttp_connection_set_closecb( req->evcon, onStreamClosed, stream );
+
+        /* don't make the client wait a second for the torrents' state */
+        if( stream->wantsTorrents )
+        {
+            struct evbuffer * buf = evbuffer_new( );
+            streamSendTorrents( stream, tr_rpc_next_change_token( server->session ), buf );
+            evbuffer_free( buf );
+        }
+    }
+}
+
+/* "events", with or without a query, but not "eventsfoo" */
+static bool
+isEventsPath( const char * path )
+{
+    return !strncmp( path, "events", 6 ) && ( ( path[6] == '\0' ) || ( path[6] == '?' ) );
+}
+
+static void
+closeStreams( tr_rpc_server * server )
+{
+    struct event_stream * stream;
+
+    while(( stream = tr_ptrArrayPop( &server->streams )))
+        streamFree( stream );
+
+    tr_wheelTimerFree( server->chunkTimer );
+    server->chunkTimer = NULL;
+    tr_wheelTimerFree( server->streamTimer );
+    server->streamTimer = NULL;
+    server->chunksPending = false;
+}
+
 static bool
 isAddressAllowed( const tr_rpc_server * server,
                   const char *          address )
@@ -641,6 +1184,12 @@ handle_request( struct evhttp_request * req, void * arg )
         {
             handle_upload( req, server );
         }
+        /* the event stream is read-only, and browsers' EventSource
+           can't add the session-id header, so it isn't checked here */
+        else if( isEventsPath( req->uri + strlen( server->url ) ) )
+        {
+            handle_events( req, server );
+        }
 #ifdef REQUIRE_SESSION_ID
         else if( !test_session_id( server, req ) )
         {
@@ -695,6 +1244,8 @@ startServer( void * vserver )
 static void
 stopServer( tr_rpc_server * server )
 {
+    closeStreams( server );
+
     if( server->httpd )
     {
         evhttp_free( server->httpd );
@@ -908,6 +1459,7 @@ closeServer( void * vserver )
     tr_free( s->whitelistStr );
     tr_free( s->username );
     tr_free( s->password );
+    tr_ptrArrayDestruct( &s->streams, NULL );
     tr_free( s );
 }
 
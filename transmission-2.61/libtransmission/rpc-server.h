@@ -66,4 +66,15 @@ bool            tr_rpcIsPasswordEnabled( const tr_rpc_server * session );
 
 const char*     tr_rpcGetBindAddress( const tr_rpc_server * server );
 
+/** @brief pass a block's data that's arrived from a peer along to
+           the event streams that asked for chunks */
+void            tr_rpcChunkArrived( tr_rpc_server            * server,
+                                    const tr_torrent         * tor,
+                                    const struct tr_address  * addr,
+                                    tr_port                    port,
+                                    uint32_t                   piece,
+                                    uint32_t                   offset,
+                                    size_t                     length,
+                                    size_t                     remaining );
+
 #endif
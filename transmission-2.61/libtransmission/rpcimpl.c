@@ -26,16 +26,18 @@
 #include "transmission.h"
 #include "bencode.h"
 #include "completion.h"
+#include "crypto.h" /* tr_cryptoWeakRandInt() */
 #include "fdlimit.h"
 #include "json.h"
 #include "rpcimpl.h"
 #include "session.h"
 #include "torrent.h"
+#include "tr-dht.h" /* tr_dhtGetStats() */
 #include "utils.h"
 #include "version.h"
 #include "web.h"
 
-#define RPC_VERSION     14
+#define RPC_VERSION     15
 #define RPC_VERSION_MIN 1
 
 #define RECENTLY_ACTIVE_SECONDS 60
@@ -406,388 +408,795 @@ torrentVerify( tr_session               * session,
 ***/
 
 static void
-addFileStats( const tr_torrent * tor, tr_benc * list )
+addFileStats( tr_jsonWriter * w, const tr_torrent * tor )
 {
     tr_file_index_t i;
     tr_file_index_t n;
     const tr_info * info = tr_torrentInfo( tor );
     tr_file_stat * files = tr_torrentFiles( tor, &n );
 
+    tr_jsonListBegin( w );
     for( i = 0; i < info->fileCount; ++i )
     {
         const tr_file * file = &info->files[i];
-        tr_benc * d = tr_bencListAddDict( list, 3 );
-        tr_bencDictAddInt( d, "bytesCompleted", files[i].bytesCompleted );
-        tr_bencDictAddInt( d, "priority", file->priority );
-        tr_bencDictAddBool( d, "wanted", !file->dnd );
+        tr_jsonDictBegin( w );
+        tr_jsonDictAddInt( w, "bytesCompleted", files[i].bytesCompleted );
+        tr_jsonDictAddInt( w, "priority", file->priority );
+        tr_jsonDictAddBool( w, "wanted", !file->dnd );
+        tr_jsonDictEnd( w );
     }
+    tr_jsonListEnd( w );
 
     tr_torrentFilesFree( files, n );
 }
 
 static void
-addFiles( const tr_torrent * tor,
-          tr_benc *          list )
+addFiles( tr_jsonWriter * w, const tr_torrent * tor )
 {
     tr_file_index_t i;
     tr_file_index_t n;
     const tr_info * info = tr_torrentInfo( tor );
     tr_file_stat *  files = tr_torrentFiles( tor, &n );
 
+    tr_jsonListBegin( w );
     for( i = 0; i < info->fileCount; ++i )
     {
         const tr_file * file = &info->files[i];
-        tr_benc *       d = tr_bencListAddDict( list, 3 );
-        tr_bencDictAddInt( d, "bytesCompleted", files[i].bytesCompleted );
-        tr_bencDictAddInt( d, "length", file->length );
-        tr_bencDictAddStr( d, "name", file->name );
+        tr_jsonDictBegin( w );
+        tr_jsonDictAddInt( w, "bytesCompleted", files[i].bytesCompleted );
+        tr_jsonDictAddInt( w, "length", file->length );
+        tr_jsonDictAddStr( w, "name", file->name );
+        tr_jsonDictEnd( w );
     }
+    tr_jsonListEnd( w );
 
     tr_torrentFilesFree( files, n );
 }
 
 static void
-addWebseeds( const tr_info * info,
-             tr_benc *       webseeds )
+addWebseeds( tr_jsonWriter * w, const tr_info * info )
 {
     int i;
 
+    tr_jsonListBegin( w );
     for( i = 0; i < info->webseedCount; ++i )
-        tr_bencListAddStr( webseeds, info->webseeds[i] );
+        tr_jsonAddStr( w, info->webseeds[i] );
+    tr_jsonListEnd( w );
 }
 
 static void
-addTrackers( const tr_info * info,
-             tr_benc *       trackers )
+addTrackers( tr_jsonWriter * w, const tr_info * info )
 {
     int i;
 
+    tr_jsonListBegin( w );
     for( i = 0; i < info->trackerCount; ++i )
     {
         const tr_tracker_info * t = &info->trackers[i];
-        tr_benc *               d = tr_bencListAddDict( trackers, 4 );
-        tr_bencDictAddStr( d, "announce", t->announce );
-        tr_bencDictAddInt( d, "id", t->id );
-        tr_bencDictAddStr( d, "scrape", t->scrape );
-        tr_bencDictAddInt( d, "tier", t->tier );
+        tr_jsonDictBegin( w );
+        tr_jsonDictAddStr( w, "announce", t->announce );
+        tr_jsonDictAddInt( w, "id", t->id );
+        tr_jsonDictAddStr( w, "scrape", t->scrape );
+        tr_jsonDictAddInt( w, "tier", t->tier );
+        tr_jsonDictEnd( w );
     }
+    tr_jsonListEnd( w );
 }
 
 static void
-addTrackerStats( const tr_tracker_stat * st, int n, tr_benc * list )
+addTrackerStats( tr_jsonWriter * w, const tr_torrent * tor )
 {
     int i;
+    int n;
+    tr_tracker_stat * st = tr_torrentTrackers( tor, &n );
 
+    tr_jsonListBegin( w );
     for( i=0; i<n; ++i )
     {
         const tr_tracker_stat * s = &st[i];
-        tr_benc * d = tr_bencListAddDict( list, 26 );
-        tr_bencDictAddStr ( d, "announce", s->announce );
-        tr_bencDictAddInt ( d, "announceState", s->announceState );
-        tr_bencDictAddInt ( d, "downloadCount", s->downloadCount );
-        tr_bencDictAddBool( d, "hasAnnounced", s->hasAnnounced );
-        tr_bencDictAddBool( d, "hasScraped", s->hasScraped );
-        tr_bencDictAddStr ( d, "host", s->host );
-        tr_bencDictAddInt ( d, "id", s->id );
-        tr_bencDictAddBool( d, "isBackup", s->isBackup );
-        tr_bencDictAddInt ( d, "lastAnnouncePeerCount", s->lastAnnouncePeerCount );
-        tr_bencDictAddStr ( d, "lastAnnounceResult", s->lastAnnounceResult );
-        tr_bencDictAddInt ( d, "lastAnnounceStartTime", s->lastAnnounceStartTime );
-        tr_bencDictAddBool( d, "lastAnnounceSucceeded", s->lastAnnounceSucceeded );
-        tr_bencDictAddInt ( d, "lastAnnounceTime", s->lastAnnounceTime );
-        tr_bencDictAddBool( d, "lastAnnounceTimedOut", s->lastAnnounceTimedOut );
-        tr_bencDictAddStr ( d, "lastScrapeResult", s->lastScrapeResult );
-        tr_bencDictAddInt ( d, "lastScrapeStartTime", s->lastScrapeStartTime );
-        tr_bencDictAddBool( d, "lastScrapeSucceeded", s->lastScrapeSucceeded );
-        tr_bencDictAddInt ( d, "lastScrapeTime", s->lastScrapeTime );
-        tr_bencDictAddInt ( d, "lastScrapeTimedOut", s->lastScrapeTimedOut );
-        tr_bencDictAddInt ( d, "leecherCount", s->leecherCount );
-        tr_bencDictAddInt ( d, "nextAnnounceTime", s->nextAnnounceTime );
-        tr_bencDictAddInt ( d, "nextScrapeTime", s->nextScrapeTime );
-        tr_bencDictAddStr ( d, "scrape", s->scrape );
-        tr_bencDictAddInt ( d, "scrapeState", s->scrapeState );
-        tr_bencDictAddInt ( d, "seederCount", s->seederCount );
-        tr_bencDictAddInt ( d, "tier", s->tier );
+        tr_jsonDictBegin( w );
+        tr_jsonDictAddStr ( w, "announce", s->announce );
+        tr_jsonDictAddInt ( w, "announceState", s->announceState );
+        tr_jsonDictAddInt ( w, "downloadCount", s->downloadCount );
+        tr_jsonDictAddBool( w, "hasAnnounced", s->hasAnnounced );
+        tr_jsonDictAddBool( w, "hasScraped", s->hasScraped );
+        tr_jsonDictAddStr ( w, "host", s->host );
+        tr_jsonDictAddInt ( w, "id", s->id );
+        tr_jsonDictAddBool( w, "isBackup", s->isBackup );
+        tr_jsonDictAddInt ( w, "lastAnnouncePeerCount", s->lastAnnouncePeerCount );
+        tr_jsonDictAddStr ( w, "lastAnnounceResult", s->lastAnnounceResult );
+        tr_jsonDictAddInt ( w, "lastAnnounceStartTime", s->lastAnnounceStartTime );
+        tr_jsonDictAddBool( w, "lastAnnounceSucceeded", s->lastAnnounceSucceeded );
+        tr_jsonDictAddInt ( w, "lastAnnounceTime", s->lastAnnounceTime );
+        tr_jsonDictAddBool( w, "lastAnnounceTimedOut", s->lastAnnounceTimedOut );
+        tr_jsonDictAddStr ( w, "lastScrapeResult", s->lastScrapeResult );
+        tr_jsonDictAddInt ( w, "lastScrapeStartTime", s->lastScrapeStartTime );
+        tr_jsonDictAddBool( w, "lastScrapeSucceeded", s->lastScrapeSucceeded );
+        tr_jsonDictAddInt ( w, "lastScrapeTime", s->lastScrapeTime );
+        tr_jsonDictAddInt ( w, "lastScrapeTimedOut", s->lastScrapeTimedOut );
+        tr_jsonDictAddInt ( w, "leecherCount", s->leecherCount );
+        tr_jsonDictAddInt ( w, "nextAnnounceTime", s->nextAnnounceTime );
+        tr_jsonDictAddInt ( w, "nextScrapeTime", s->nextScrapeTime );
+        tr_jsonDictAddStr ( w, "scrape", s->scrape );
+        tr_jsonDictAddInt ( w, "scrapeState", s->scrapeState );
+        tr_jsonDictAddInt ( w, "seederCount", s->seederCount );
+        tr_jsonDictAddInt ( w, "tier", s->tier );
+        tr_jsonDictEnd( w );
     }
+    tr_jsonListEnd( w );
+
+    tr_torrentTrackersFree( st, n );
 }
 
 static void
-addPeers( const tr_torrent * tor,
-          tr_benc *          list )
+addPeers( tr_jsonWriter * w, const tr_torrent * tor )
 {
     int            i;
     int            peerCount;
     tr_peer_stat * peers = tr_torrentPeers( tor, &peerCount );
 
-    tr_bencInitList( list, peerCount );
-
+    tr_jsonListBegin( w );
     for( i = 0; i < peerCount; ++i )
     {
-        tr_benc *            d = tr_bencListAddDict( list, 16 );
         const tr_peer_stat * peer = peers + i;
-        tr_bencDictAddStr ( d, "address", peer->addr );
-        tr_bencDictAddStr ( d, "clientName", peer->client );
-        tr_bencDictAddBool( d, "clientIsChoked", peer->clientIsChoked );
-        tr_bencDictAddBool( d, "clientIsInterested", peer->clientIsInterested );
-        tr_bencDictAddStr ( d, "flagStr", peer->flagStr );
-        tr_bencDictAddBool( d, "isDownloadingFrom", peer->isDownloadingFrom );
-        tr_bencDictAddBool( d, "isEncrypted", peer->isEncrypted );
-        tr_bencDictAddBool( d, "isIncoming", peer->isIncoming );
-        tr_bencDictAddBool( d, "isUploadingTo", peer->isUploadingTo );
-        tr_bencDictAddBool( d, "isUTP", peer->isUTP );
-        tr_bencDictAddBool( d, "peerIsChoked", peer->peerIsChoked );
-        tr_bencDictAddBool( d, "peerIsInterested", peer->peerIsInterested );
-        tr_bencDictAddInt ( d, "port", peer->port );
-        tr_bencDictAddReal( d, "progress", peer->progress );
-        tr_bencDictAddInt ( d, "rateToClient", toSpeedBytes( peer->rateToClient_KBps ) );
-        tr_bencDictAddInt ( d, "rateToPeer", toSpeedBytes( peer->rateToPeer_KBps ) );
+        tr_jsonDictBegin( w );
+        tr_jsonDictAddStr ( w, "address", peer->addr );
+        tr_jsonDictAddBool( w, "clientIsChoked", peer->clientIsChoked );
+        tr_jsonDictAddBool( w, "clientIsInterested", peer->clientIsInterested );
+        tr_jsonDictAddStr ( w, "clientName", peer->client );
+        tr_jsonDictAddStr ( w, "flagStr", peer->flagStr );
+        tr_jsonDictAddBool( w, "isDownloadingFrom", peer->isDownloadingFrom );
+        tr_jsonDictAddBool( w, "isEncrypted", peer->isEncrypted );
+        tr_jsonDictAddBool( w, "isIncoming", peer->isIncoming );
+        tr_jsonDictAddBool( w, "isUTP", peer->isUTP );
+        tr_jsonDictAddBool( w, "isUploadingTo", peer->isUploadingTo );
+        tr_jsonDictAddBool( w, "peerIsChoked", peer->peerIsChoked );
+        tr_jsonDictAddBool( w, "peerIsInterested", peer->peerIsInterested );
+        tr_jsonDictAddInt ( w, "port", peer->port );
+        tr_jsonDictAddReal( w, "progress", peer->progress );
+        tr_jsonDictAddInt ( w, "rateToClient", toSpeedBytes( peer->rateToClient_KBps ) );
+        tr_jsonDictAddInt ( w, "rateToPeer", toSpeedBytes( peer->rateToPeer_KBps ) );
+        tr_jsonDictEnd( w );
     }
+    tr_jsonListEnd( w );
 
     tr_torrentPeersFree( peers, peerCount );
 }
 
-/* faster-than-strcmp() optimization. This is kind of clumsy,
-   but addField() was in the profiler's top 10 list, and this
-   makes it 4x faster... */
-#define tr_streq(a,alen,b) ((alen+1==sizeof(b)) && !memcmp(a,b,alen))
+/* torrent-get's fields. These are in sorted order so that
+   the fields are written in the same order tr_bencToBuf() uses */
+enum
+{
+    TF_ACTIVITY_DATE,
+    TF_ADDED_DATE,
+    TF_BANDWIDTH_PRIORITY,
+    TF_COMMENT,
+    TF_CORRUPT_EVER,
+    TF_CREATOR,
+    TF_DATE_CREATED,
+    TF_DESIRED_AVAILABLE,
+    TF_DONE_DATE,
+    TF_DOWNLOAD_DIR,
+    TF_DOWNLOAD_LIMIT,
+    TF_DOWNLOAD_LIMITED,
+    TF_DOWNLOADED_EVER,
+    TF_ERROR,
+    TF_ERROR_STRING,
+    TF_ETA,
+    TF_FILE_STATS,
+    TF_FILES,
+    TF_HASH_STRING,
+    TF_HAVE_UNCHECKED,
+    TF_HAVE_VALID,
+    TF_HONORS_SESSION_LIMITS,
+    TF_ID,
+    TF_IS_FINISHED,
+    TF_IS_PRIVATE,
+    TF_IS_STALLED,
+    TF_LEFT_UNTIL_DONE,
+    TF_MAGNET_LINK,
+    TF_MANUAL_ANNOUNCE_TIME,
+    TF_MAX_CONNECTED_PEERS,
+    TF_METADATA_PERCENT_COMPLETE,
+    TF_NAME,
+    TF_PEER_LIMIT,
+    TF_PEERS,
+    TF_PEERS_CONNECTED,
+    TF_PEERS_FROM,
+    TF_PEERS_GETTING_FROM_US,
+    TF_PEERS_SENDING_TO_US,
+    TF_PERCENT_DONE,
+    TF_PIECE_COUNT,
+    TF_PIECE_SIZE,
+    TF_PIECES,
+    TF_PRIORITIES,
+    TF_QUEUE_POSITION,
+    TF_RATE_DOWNLOAD,
+    TF_RATE_UPLOAD,
+    TF_RECHECK_PROGRESS,
+    TF_SECONDS_DOWNLOADING,
+    TF_SECONDS_SEEDING,
+    TF_SEED_IDLE_LIMIT,
+    TF_SEED_IDLE_MODE,
+    TF_SEED_RATIO_LIMIT,
+    TF_SEED_RATIO_MODE,
+    TF_SIZE_WHEN_DONE,
+    TF_START_DATE,
+    TF_STATUS,
+    TF_TORRENT_FILE,
+    TF_TOTAL_SIZE,
+    TF_TRACKER_STATS,
+    TF_TRACKERS,
+    TF_UPLOAD_LIMIT,
+    TF_UPLOAD_LIMITED,
+    TF_UPLOAD_RATIO,
+    TF_UPLOADED_EVER,
+    TF_WANTED,
+    TF_WEBSEEDS,
+    TF_WEBSEEDS_SENDING_TO_US,
+
+    TF_COUNT
+};
+
+static const char * const torrentFieldNames[TF_COUNT] =
+{
+    "activityDate",
+    "addedDate",
+    "bandwidthPriority",
+    "comment",
+    "corruptEver",
+    "creator",
+    "dateCreated",
+    "desiredAvailable",
+    "doneDate",
+    "downloadDir",
+    "downloadLimit",
+    "downloadLimited",
+    "downloadedEver",
+    "error",
+    "errorString",
+    "eta",
+    "fileStats",
+    "files",
+    "hashString",
+    "haveUnchecked",
+    "haveValid",
+    "honorsSessionLimits",
+    "id",
+    "isFinished",
+    "isPrivate",
+    "isStalled",
+    "leftUntilDone",
+    "magnetLink",
+    "manualAnnounceTime",
+    "maxConnectedPeers",
+    "metadataPercentComplete",
+    "name",
+    "peer-limit",
+    "peers",
+    "peersConnected",
+    "peersFrom",
+    "peersGettingFromUs",
+    "peersSendingToUs",
+    "percentDone",
+    "pieceCount",
+    "pieceSize",
+    "pieces",
+    "priorities",
+    "queuePosition",
+    "rateDownload",
+    "rateUpload",
+    "recheckProgress",
+    "secondsDownloading",
+    "secondsSeeding",
+    "seedIdleLimit",
+    "seedIdleMode",
+    "seedRatioLimit",
+    "seedRatioMode",
+    "sizeWhenDone",
+    "startDate",
+    "status",
+    "torrentFile",
+    "totalSize",
+    "trackerStats",
+    "trackers",
+    "uploadLimit",
+    "uploadLimited",
+    "uploadRatio",
+    "uploadedEver",
+    "wanted",
+    "webseeds",
+    "webseedsSendingToUs",
+};
+
+static int
+compareFieldName( const void * key, const void * name )
+{
+    return strcmp( key, *(const char * const *)name );
+}
+
+/* returns the field's TF_ id, or -1 if it's not a field we know */
+static int
+getFieldId( const char * name )
+{
+    const char * const * pch = bsearch( name, torrentFieldNames, TF_COUNT,
+                                        sizeof( const char * ),
+                                        compareFieldName );
+
+    return pch == NULL ? -1 : (int)( pch - torrentFieldNames );
+}
 
 static void
-addField( const tr_torrent * const tor,
-          const tr_info    * const inf,
-          const tr_stat    * const st,
-          tr_benc          * const d,
-          const char       * const key )
-{
-    const size_t keylen = strlen( key );
-
-    if( tr_streq( key, keylen, "activityDate" ) )
-        tr_bencDictAddInt( d, key, st->activityDate );
-    else if( tr_streq( key, keylen, "addedDate" ) )
-        tr_bencDictAddInt( d, key, st->addedDate );
-    else if( tr_streq( key, keylen, "bandwidthPriority" ) )
-        tr_bencDictAddInt( d, key, tr_torrentGetPriority( tor ) );
-    else if( tr_streq( key, keylen, "comment" ) )
-        tr_bencDictAddStr( d, key, inf->comment ? inf->comment : "" );
-    else if( tr_streq( key, keylen, "corruptEver" ) )
-        tr_bencDictAddInt( d, key, st->corruptEver );
-    else if( tr_streq( key, keylen, "creator" ) )
-        tr_bencDictAddStr( d, key, inf->creator ? inf->creator : "" );
-    else if( tr_streq( key, keylen, "dateCreated" ) )
-        tr_bencDictAddInt( d, key, inf->dateCreated );
-    else if( tr_streq( key, keylen, "desiredAvailable" ) )
-        tr_bencDictAddInt( d, key, st->desiredAvailable );
-    else if( tr_streq( key, keylen, "doneDate" ) )
-        tr_bencDictAddInt( d, key, st->doneDate );
-    else if( tr_streq( key, keylen, "downloadDir" ) )
-        tr_bencDictAddStr( d, key, tr_torrentGetDownloadDir( tor ) );
-    else if( tr_streq( key, keylen, "downloadedEver" ) )
-        tr_bencDictAddInt( d, key, st->downloadedEver );
-    else if( tr_streq( key, keylen, "downloadLimit" ) )
-        tr_bencDictAddInt( d, key, tr_torrentGetSpeedLimit_KBps( tor, TR_DOWN ) );
-    else if( tr_streq( key, keylen, "downloadLimited" ) )
-        tr_bencDictAddBool( d, key, tr_torrentUsesSpeedLimit( tor, TR_DOWN ) );
-    else if( tr_streq( key, keylen, "error" ) )
-        tr_bencDictAddInt( d, key, st->error );
-    else if( tr_streq( key, keylen, "errorString" ) )
-        tr_bencDictAddStr( d, key, st->errorString );
-    else if( tr_streq( key, keylen, "eta" ) )
-        tr_bencDictAddInt( d, key, st->eta );
-    else if( tr_streq( key, keylen, "files" ) )
-        addFiles( tor, tr_bencDictAddList( d, key, inf->fileCount ) );
-    else if( tr_streq( key, keylen, "fileStats" ) )
-        addFileStats( tor, tr_bencDictAddList( d, key, inf->fileCount ) );
-    else if( tr_streq( key, keylen, "hashString" ) )
-        tr_bencDictAddStr( d, key, tor->info.hashString );
-    else if( tr_streq( key, keylen, "haveUnchecked" ) )
-        tr_bencDictAddInt( d, key, st->haveUnchecked );
-    else if( tr_streq( key, keylen, "haveValid" ) )
-        tr_bencDictAddInt( d, key, st->haveValid );
-    else if( tr_streq( key, keylen, "honorsSessionLimits" ) )
-        tr_bencDictAddBool( d, key, tr_torrentUsesSessionLimits( tor ) );
-    else if( tr_streq( key, keylen, "id" ) )
-        tr_bencDictAddInt( d, key, st->id );
-    else if( tr_streq( key, keylen, "isFinished" ) )
-        tr_bencDictAddBool( d, key, st->finished );
-    else if( tr_streq( key, keylen, "isPrivate" ) )
-        tr_bencDictAddBool( d, key, tr_torrentIsPrivate( tor ) );
-    else if( tr_streq( key, keylen, "isStalled" ) )
-        tr_bencDictAddBool( d, key, st->isStalled );
-    else if( tr_streq( key, keylen, "leftUntilDone" ) )
-        tr_bencDictAddInt( d, key, st->leftUntilDone );
-    else if( tr_streq( key, keylen, "manualAnnounceTime" ) )
-        tr_bencDictAddInt( d, key, st->manualAnnounceTime );
-    else if( tr_streq( key, keylen, "maxConnectedPeers" ) )
-        tr_bencDictAddInt( d, key,  tr_torrentGetPeerLimit( tor ) );
-    else if( tr_streq( key, keylen, "magnetLink" ) ) {
-        char * str = tr_torrentGetMagnetLink( tor );
-        tr_bencDictAddStr( d, key, str );
-        tr_free( str );
-    }
-    else if( tr_streq( key, keylen, "metadataPercentComplete" ) )
-        tr_bencDictAddReal( d, key, st->metadataPercentComplete );
-    else if( tr_streq( key, keylen, "name" ) )
-        tr_bencDictAddStr( d, key, tr_torrentName( tor ) );
-    else if( tr_streq( key, keylen, "percentDone" ) )
-        tr_bencDictAddReal( d, key, st->percentDone );
-    else if( tr_streq( key, keylen, "peer-limit" ) )
-        tr_bencDictAddInt( d, key, tr_torrentGetPeerLimit( tor ) );
-    else if( tr_streq( key, keylen, "peers" ) )
-        addPeers( tor, tr_bencDictAdd( d, key ) );
-    else if( tr_streq( key, keylen, "peersConnected" ) )
-        tr_bencDictAddInt( d, key, st->peersConnected );
-    else if( tr_streq( key, keylen, "peersFrom" ) )
+addFieldValue( tr_jsonWriter       * const w,
+               const tr_torrent    * const tor,
+               const tr_info       * const inf,
+               const tr_stat       * const st,
+               int                         field )
+{
+    switch( field )
     {
-        tr_benc *   tmp = tr_bencDictAddDict( d, key, 7 );
-        const int * f = st->peersFrom;
-        tr_bencDictAddInt( tmp, "fromCache",    f[TR_PEER_FROM_RESUME] );
-        tr_bencDictAddInt( tmp, "fromDht",      f[TR_PEER_FROM_DHT] );
-        tr_bencDictAddInt( tmp, "fromIncoming", f[TR_PEER_FROM_INCOMING] );
-        tr_bencDictAddInt( tmp, "fromLpd",      f[TR_PEER_FROM_LPD] );
-        tr_bencDictAddInt( tmp, "fromLtep",     f[TR_PEER_FROM_LTEP] );
-        tr_bencDictAddInt( tmp, "fromPex",      f[TR_PEER_FROM_PEX] );
-        tr_bencDictAddInt( tmp, "fromTracker",  f[TR_PEER_FROM_TRACKER] );
-    }
-    else if( tr_streq( key, keylen, "peersGettingFromUs" ) )
-        tr_bencDictAddInt( d, key, st->peersGettingFromUs );
-    else if( tr_streq( key, keylen, "peersSendingToUs" ) )
-        tr_bencDictAddInt( d, key, st->peersSendingToUs );
-    else if( tr_streq( key, keylen, "pieces" ) ) {
-        size_t byte_count = 0;
-        void * bytes = tr_cpCreatePieceBitfield( &tor->completion, &byte_count );
-        char * str = tr_base64_encode( bytes, byte_count, NULL );
-        tr_bencDictAddStr( d, key, str!=NULL ? str : "" );
-        tr_free( str );
-        tr_free( bytes );
+        case TF_ACTIVITY_DATE: tr_jsonAddInt( w, st->activityDate ); break;
+        case TF_ADDED_DATE: tr_jsonAddInt( w, st->addedDate ); break;
+        case TF_BANDWIDTH_PRIORITY: tr_jsonAddInt( w, tr_torrentGetPriority( tor ) ); break;
+        case TF_COMMENT: tr_jsonAddStr( w, inf->comment ? inf->comment : "" ); break;
+        case TF_CORRUPT_EVER: tr_jsonAddInt( w, st->corruptEver ); break;
+        case TF_CREATOR: tr_jsonAddStr( w, inf->creator ? inf->creator : "" ); break;
+        case TF_DATE_CREATED: tr_jsonAddInt( w, inf->dateCreated ); break;
+        case TF_DESIRED_AVAILABLE: tr_jsonAddInt( w, st->desiredAvailable ); break;
+        case TF_DONE_DATE: tr_jsonAddInt( w, st->doneDate ); break;
+        case TF_DOWNLOAD_DIR: tr_jsonAddStr( w, tr_torrentGetDownloadDir( tor ) ); break;
+        case TF_DOWNLOAD_LIMIT: tr_jsonAddInt( w, tr_torrentGetSpeedLimit_KBps( tor, TR_DOWN ) ); break;
+        case TF_DOWNLOAD_LIMITED: tr_jsonAddBool( w, tr_torrentUsesSpeedLimit( tor, TR_DOWN ) ); break;
+        case TF_DOWNLOADED_EVER: tr_jsonAddInt( w, st->downloadedEver ); break;
+        case TF_ERROR: tr_jsonAddInt( w, st->error ); break;
+        case TF_ERROR_STRING: tr_jsonAddStr( w, st->errorString ); break;
+        case TF_ETA: tr_jsonAddInt( w, st->eta ); break;
+        case TF_FILE_STATS: addFileStats( w, tor ); break;
+        case TF_FILES: addFiles( w, tor ); break;
+        case TF_HASH_STRING: tr_jsonAddStr( w, tor->info.hashString ); break;
+        case TF_HAVE_UNCHECKED: tr_jsonAddInt( w, st->haveUnchecked ); break;
+        case TF_HAVE_VALID: tr_jsonAddInt( w, st->haveValid ); break;
+        case TF_HONORS_SESSION_LIMITS: tr_jsonAddBool( w, tr_torrentUsesSessionLimits( tor ) ); break;
+        case TF_ID: tr_jsonAddInt( w, st->id ); break;
+        case TF_IS_FINISHED: tr_jsonAddBool( w, st->finished ); break;
+        case TF_IS_PRIVATE: tr_jsonAddBool( w, tr_torrentIsPrivate( tor ) ); break;
+        case TF_IS_STALLED: tr_jsonAddBool( w, st->isStalled ); break;
+        case TF_LEFT_UNTIL_DONE: tr_jsonAddInt( w, st->leftUntilDone ); break;
+        case TF_MAGNET_LINK: {
+            char * str = tr_torrentGetMagnetLink( tor );
+            tr_jsonAddStr( w, str );
+            tr_free( str );
+            break;
+        }
+        case TF_MANUAL_ANNOUNCE_TIME: tr_jsonAddInt( w, st->manualAnnounceTime ); break;
+        case TF_MAX_CONNECTED_PEERS: tr_jsonAddInt( w, tr_torrentGetPeerLimit( tor ) ); break;
+        case TF_METADATA_PERCENT_COMPLETE: tr_jsonAddReal( w, st->metadataPercentComplete ); break;
+        case TF_NAME: tr_jsonAddStr( w, tr_torrentName( tor ) ); break;
+        case TF_PEER_LIMIT: tr_jsonAddInt( w, tr_torrentGetPeerLimit( tor ) ); break;
+        case TF_PEERS: addPeers( w, tor ); break;
+        case TF_PEERS_CONNECTED: tr_jsonAddInt( w, st->peersConnected ); break;
+        case TF_PEERS_FROM: {
+            const int * f = st->peersFrom;
+            tr_jsonDictBegin( w );
+            tr_jsonDictAddInt( w, "fromCache",    f[TR_PEER_FROM_RESUME] );
+            tr_jsonDictAddInt( w, "fromDht",      f[TR_PEER_FROM_DHT] );
+            tr_jsonDictAddInt( w, "fromIncoming", f[TR_PEER_FROM_INCOMING] );
+            tr_jsonDictAddInt( w, "fromLpd",      f[TR_PEER_FROM_LPD] );
+            tr_jsonDictAddInt( w, "fromLtep",     f[TR_PEER_FROM_LTEP] );
+            tr_jsonDictAddInt( w, "fromPex",      f[TR_PEER_FROM_PEX] );
+            tr_jsonDictAddInt( w, "fromTracker",  f[TR_PEER_FROM_TRACKER] );
+            tr_jsonDictEnd( w );
+            break;
+        }
+        case TF_PEERS_GETTING_FROM_US: tr_jsonAddInt( w, st->peersGettingFromUs ); break;
+        case TF_PEERS_SENDING_TO_US: tr_jsonAddInt( w, st->peersSendingToUs ); break;
+        case TF_PERCENT_DONE: tr_jsonAddReal( w, st->percentDone ); break;
+        case TF_PIECE_COUNT: tr_jsonAddInt( w, inf->pieceCount ); break;
+        case TF_PIECE_SIZE: tr_jsonAddInt( w, inf->pieceSize ); break;
+        case TF_PIECES: {
+            size_t byte_count = 0;
+            void * bytes = tr_cpCreatePieceBitfield( &tor->completion, &byte_count );
+            char * str = tr_base64_encode( bytes, byte_count, NULL );
+            tr_jsonAddStr( w, str!=NULL ? str : "" );
+            tr_free( str );
+            tr_free( bytes );
+            break;
+        }
+        case TF_PRIORITIES: {
+            tr_file_index_t i;
+            tr_jsonListBegin( w );
+            for( i = 0; i < inf->fileCount; ++i )
+                tr_jsonAddInt( w, inf->files[i].priority );
+            tr_jsonListEnd( w );
+            break;
+        }
+        case TF_QUEUE_POSITION: tr_jsonAddInt( w, st->queuePosition ); break;
+        case TF_RATE_DOWNLOAD: tr_jsonAddInt( w, toSpeedBytes( st->pieceDownloadSpeed_KBps ) ); break;
+        case TF_RATE_UPLOAD: tr_jsonAddInt( w, toSpeedBytes( st->pieceUploadSpeed_KBps ) ); break;
+        case TF_RECHECK_PROGRESS: tr_jsonAddReal( w, st->recheckProgress ); break;
+        case TF_SECONDS_DOWNLOADING: tr_jsonAddInt( w, st->secondsDownloading ); break;
+        case TF_SECONDS_SEEDING: tr_jsonAddInt( w, st->secondsSeeding ); break;
+        case TF_SEED_IDLE_LIMIT: tr_jsonAddInt( w, tr_torrentGetIdleLimit( tor ) ); break;
+        case TF_SEED_IDLE_MODE: tr_jsonAddInt( w, tr_torrentGetIdleMode( tor ) ); break;
+        case TF_SEED_RATIO_LIMIT: tr_jsonAddReal( w, tr_torrentGetRatioLimit( tor ) ); break;
+        case TF_SEED_RATIO_MODE: tr_jsonAddInt( w, tr_torrentGetRatioMode( tor ) ); break;
+        case TF_SIZE_WHEN_DONE: tr_jsonAddInt( w, st->sizeWhenDone ); break;
+        case TF_START_DATE: tr_jsonAddInt( w, st->startDate ); break;
+        case TF_STATUS: tr_jsonAddInt( w, st->activity ); break;
+        case TF_TORRENT_FILE: tr_jsonAddStr( w, inf->torrent ); break;
+        case TF_TOTAL_SIZE: tr_jsonAddInt( w, inf->totalSize ); break;
+        case TF_TRACKER_STATS: addTrackerStats( w, tor ); break;
+        case TF_TRACKERS: addTrackers( w, inf ); break;
+        case TF_UPLOAD_LIMIT: tr_jsonAddInt( w, tr_torrentGetSpeedLimit_KBps( tor, TR_UP ) ); break;
+        case TF_UPLOAD_LIMITED: tr_jsonAddBool( w, tr_torrentUsesSpeedLimit( tor, TR_UP ) ); break;
+        case TF_UPLOAD_RATIO: tr_jsonAddReal( w, st->ratio ); break;
+        case TF_UPLOADED_EVER: tr_jsonAddInt( w, st->uploadedEver ); break;
+        case TF_WANTED: {
+            tr_file_index_t i;
+            tr_jsonListBegin( w );
+            for( i = 0; i < inf->fileCount; ++i )
+                tr_jsonAddInt( w, inf->files[i].dnd ? 0 : 1 );
+            tr_jsonListEnd( w );
+            break;
+        }
+        case TF_WEBSEEDS: addWebseeds( w, inf ); break;
+        case TF_WEBSEEDS_SENDING_TO_US: tr_jsonAddInt( w, st->webseedsSendingToUs ); break;
     }
-    else if( tr_streq( key, keylen, "pieceCount" ) )
-        tr_bencDictAddInt( d, key, inf->pieceCount );
-    else if( tr_streq( key, keylen, "pieceSize" ) )
-        tr_bencDictAddInt( d, key, inf->pieceSize );
-    else if( tr_streq( key, keylen, "priorities" ) )
+}
+
+static void
+addInfo( tr_jsonWriter * w, const tr_torrent * tor, const int * fields, int fieldCount )
+{
+    tr_jsonDictBegin( w );
+
+    if( fieldCount > 0 )
     {
-        tr_file_index_t i;
-        tr_benc *       p = tr_bencDictAddList( d, key, inf->fileCount );
-        for( i = 0; i < inf->fileCount; ++i )
-            tr_bencListAddInt( p, inf->files[i].priority );
-    }
-    else if( tr_streq( key, keylen, "queuePosition" ) )
-        tr_bencDictAddInt( d, key, st->queuePosition );
-    else if( tr_streq( key, keylen, "rateDownload" ) )
-        tr_bencDictAddInt( d, key, toSpeedBytes( st->pieceDownloadSpeed_KBps ) );
-    else if( tr_streq( key, keylen, "rateUpload" ) )
-        tr_bencDictAddInt( d, key, toSpeedBytes( st->pieceUploadSpeed_KBps ) );
-    else if( tr_streq( key, keylen, "recheckProgress" ) )
-        tr_bencDictAddReal( d, key, st->recheckProgress );
-    else if( tr_streq( key, keylen, "seedIdleLimit" ) )
-        tr_bencDictAddInt( d, key, tr_torrentGetIdleLimit( tor ) );
-    else if( tr_streq( key, keylen, "seedIdleMode" ) )
-        tr_bencDictAddInt( d, key, tr_torrentGetIdleMode( tor ) );
-    else if( tr_streq( key, keylen, "seedRatioLimit" ) )
-        tr_bencDictAddReal( d, key, tr_torrentGetRatioLimit( tor ) );
-    else if( tr_streq( key, keylen, "seedRatioMode" ) )
-        tr_bencDictAddInt( d, key, tr_torrentGetRatioMode( tor ) );
-    else if( tr_streq( key, keylen, "sizeWhenDone" ) )
-        tr_bencDictAddInt( d, key, st->sizeWhenDone );
-    else if( tr_streq( key, keylen, "startDate" ) )
-        tr_bencDictAddInt( d, key, st->startDate );
-    else if( tr_streq( key, keylen, "status" ) )
-        tr_bencDictAddInt( d, key, st->activity );
-    else if( tr_streq( key, keylen, "secondsDownloading" ) )
-        tr_bencDictAddInt( d, key, st->secondsDownloading );
-    else if( tr_streq( key, keylen, "secondsSeeding" ) )
-        tr_bencDictAddInt( d, key, st->secondsSeeding );
-    else if( tr_streq( key, keylen, "trackers" ) )
-        addTrackers( inf, tr_bencDictAddList( d, key, inf->trackerCount ) );
-    else if( tr_streq( key, keylen, "trackerStats" ) ) {
-        int n;
-        tr_tracker_stat * s = tr_torrentTrackers( tor, &n );
-        addTrackerStats( s, n, tr_bencDictAddList( d, key, n ) );
-        tr_torrentTrackersFree( s, n );
+        int i;
+        const tr_info * inf = tr_torrentInfo( tor );
+        const tr_stat * st = tr_torrentStat( (tr_torrent*)tor );
+
+        for( i=0; i<fieldCount; ++i ) {
+            tr_jsonAddKey( w, torrentFieldNames[fields[i]] );
+            addFieldValue( w, tor, inf, st, fields[i] );
+        }
     }
-    else if( tr_streq( key, keylen, "torrentFile" ) )
-        tr_bencDictAddStr( d, key, inf->torrent );
-    else if( tr_streq( key, keylen, "totalSize" ) )
-        tr_bencDictAddInt( d, key, inf->totalSize );
-    else if( tr_streq( key, keylen, "uploadedEver" ) )
-        tr_bencDictAddInt( d, key, st->uploadedEver );
-    else if( tr_streq( key, keylen, "uploadLimit" ) )
-        tr_bencDictAddInt( d, key, tr_torrentGetSpeedLimit_KBps( tor, TR_UP ) );
-    else if( tr_streq( key, keylen, "uploadLimited" ) )
-        tr_bencDictAddBool( d, key, tr_torrentUsesSpeedLimit( tor, TR_UP ) );
-    else if( tr_streq( key, keylen, "uploadRatio" ) )
-        tr_bencDictAddReal( d, key, st->ratio );
-    else if( tr_streq( key, keylen, "wanted" ) )
-    {
-        tr_file_index_t i;
-        tr_benc *       w = tr_bencDictAddList( d, key, inf->fileCount );
-        for( i = 0; i < inf->fileCount; ++i )
-            tr_bencListAddInt( w, inf->files[i].dnd ? 0 : 1 );
+
+    tr_jsonDictEnd( w );
+}
+
+/***
+****  torrent-get's "since" argument
+****
+****  Each torrent stamps the kinds of change in tr_torrent_change with
+****  the session's change sequence number when they happen. Every request
+****  that uses "since" is handed the current sequence number and then the
+****  number is bumped, so the next request sees anything that changed
+****  afterwards. Each field lists the kinds of change that can affect it,
+****  which lets us skip a torrent that hasn't changed without stat'ing it.
+****
+****  The tokens handed to clients have a per-session epoch in the upper
+****  bits, so a token from before the session restarted gets everything.
+***/
+
+#define CHANGED(kind) ( 1 << TR_CHANGED_ ## kind )
+
+/* which kinds of change can affect each of torrent-get's fields */
+static const int torrentFieldChanges[TF_COUNT] =
+{
+    CHANGED( TRANSFER ),                                    /* activityDate */
+    CHANGED( STATUS ),                                      /* addedDate */
+    CHANGED( SETTINGS ),                                    /* bandwidthPriority */
+    CHANGED( INFO ),                                        /* comment */
+    CHANGED( TRANSFER ),                                    /* corruptEver */
+    CHANGED( INFO ),                                        /* creator */
+    CHANGED( INFO ),                                        /* dateCreated */
+    CHANGED( PROGRESS ) | CHANGED( TIME ) | CHANGED( STATUS ), /* desiredAvailable */
+    CHANGED( STATUS ),                                      /* doneDate */
+    CHANGED( SETTINGS ),                                    /* downloadDir */
+    CHANGED( SETTINGS ),                                    /* downloadLimit */
+    CHANGED( SETTINGS ),                                    /* downloadLimited */
+    CHANGED( TRANSFER ),                                    /* downloadedEver */
+    CHANGED( STATUS ),                                      /* error */
+    CHANGED( STATUS ),                                      /* errorString */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* eta */
+    CHANGED( PROGRESS ) | CHANGED( SETTINGS ),              /* fileStats */
+    CHANGED( INFO ) | CHANGED( PROGRESS ),                  /* files */
+    CHANGED( INFO ),                                        /* hashString */
+    CHANGED( PROGRESS ),                                    /* haveUnchecked */
+    CHANGED( PROGRESS ),                                    /* haveValid */
+    CHANGED( SETTINGS ),                                    /* honorsSessionLimits */
+    0,                                                      /* id: always sent */
+    CHANGED( STATUS ) | CHANGED( SETTINGS ) | CHANGED( TRANSFER ), /* isFinished */
+    CHANGED( INFO ),                                        /* isPrivate */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* isStalled */
+    CHANGED( PROGRESS ) | CHANGED( SETTINGS ),              /* leftUntilDone */
+    CHANGED( INFO ),                                        /* magnetLink */
+    CHANGED( TRACKERS ) | CHANGED( STATUS ),                /* manualAnnounceTime */
+    CHANGED( SETTINGS ),                                    /* maxConnectedPeers */
+    CHANGED( PROGRESS ) | CHANGED( INFO ),                  /* metadataPercentComplete */
+    CHANGED( INFO ),                                        /* name */
+    CHANGED( SETTINGS ),                                    /* peer-limit */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* peers */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* peersConnected */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* peersFrom */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* peersGettingFromUs */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* peersSendingToUs */
+    CHANGED( PROGRESS ) | CHANGED( SETTINGS ),              /* percentDone */
+    CHANGED( INFO ),                                        /* pieceCount */
+    CHANGED( INFO ),                                        /* pieceSize */
+    CHANGED( INFO ) | CHANGED( PROGRESS ),                  /* pieces */
+    CHANGED( SETTINGS ) | CHANGED( INFO ),                  /* priorities */
+    CHANGED( STATUS ),                                      /* queuePosition */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* rateDownload */
+    CHANGED( TIME ) | CHANGED( STATUS ),                    /* rateUpload */
+    CHANGED( TIME ) | CHANGED( STATUS ) | CHANGED( PROGRESS ), /* recheckProgress */
+    CHANGED( TIME ) | CHANGED( STATUS ) | CHANGED( TRANSFER ), /* secondsDownloading */
+    CHANGED( TIME ) | CHANGED( STATUS ) | CHANGED( TRANSFER ), /* secondsSeeding */
+    CHANGED( SETTINGS ),                                    /* seedIdleLimit */
+    CHANGED( SETTINGS ),                                    /* seedIdleMode */
+    CHANGED( SETTINGS ),                                    /* seedRatioLimit */
+    CHANGED( SETTINGS ),                                    /* seedRatioMode */
+    CHANGED( PROGRESS ) | CHANGED( SETTINGS ) | CHANGED( INFO ), /* sizeWhenDone */
+    CHANGED( STATUS ),                                      /* startDate */
+    CHANGED( STATUS ) | CHANGED( PROGRESS ),                /* status */
+    CHANGED( INFO ),                                        /* torrentFile */
+    CHANGED( INFO ),                                        /* totalSize */
+    CHANGED( TRACKERS ) | CHANGED( INFO ) | CHANGED( STATUS ), /* trackerStats */
+    CHANGED( INFO ),                                        /* trackers */
+    CHANGED( SETTINGS ),                                    /* uploadLimit */
+    CHANGED( SETTINGS ),                                    /* uploadLimited */
+    CHANGED( TRANSFER ) | CHANGED( PROGRESS ),              /* uploadRatio */
+    CHANGED( TRANSFER ),                                    /* uploadedEver */
+    CHANGED( SETTINGS ) | CHANGED( INFO ),                  /* wanted */
+    CHANGED( INFO ),                                        /* webseeds */
+    CHANGED( TIME ) | CHANGED( STATUS )                     /* webseedsSendingToUs */
+};
+
+static int64_t
+makeChangeToken( const tr_session * session, uint32_t seq )
+{
+    return ( (int64_t)session->rpcChangeEpoch << 32 ) | seq;
+}
+
+/* returns the sequence number the client last saw,
+   or 0 if the token is from some other session */
+static uint32_t
+parseChangeToken( tr_session * session, int64_t token )
+{
+    if( !session->rpcChangeEpoch ) /* keep tokens under 2^53 for javascript */
+        session->rpcChangeEpoch = 1 + tr_cryptoWeakRandInt( ( 1 << 20 ) - 1 );
+
+    if( ( token >> 32 ) != session->rpcChangeEpoch )
+        return 0;
+
+    if( ( token & 0xffffffff ) >= session->rpcChangeSeq )
+        return 0;
+
+    return token & 0xffffffff;
+}
+
+/* hand out the current sequence number and start a new one,
+   so that anything stamped from here on is newer than the token */
+static int64_t
+nextChangeToken( tr_session * session )
+{
+    const int64_t token = makeChangeToken( session, session->rpcChangeSeq );
+    ++session->rpcChangeSeq;
+    return token;
+}
+
+/**
+ * Write the fields that have changed since `since' to `w'.
+ * If none have, nothing's written and false is returned.
+ * The torrent's id is always written so that clients can tell
+ * which torrent the changes are for.
+ */
+static bool
+addChangedInfo( tr_jsonWriter    * w,
+                tr_torrent       * tor,
+                const int        * fields,
+                int                fieldCount,
+                uint32_t           since )
+{
+    int i;
+    int changes = 0;
+    int wanted = 0;
+    const tr_info * inf;
+    const tr_stat * st;
+
+    for( i=0; i<TR_CHANGED_COUNT; ++i )
+        if( tor->changeSeq[i] > since )
+            changes |= ( 1 << i );
+
+    for( i=0; i<fieldCount; ++i )
+        wanted |= torrentFieldChanges[fields[i]];
+
+    if( !( changes & wanted ) )
+        return false;
+
+    inf = tr_torrentInfo( tor );
+    st = tr_torrentStat( tor );
+
+    tr_jsonDictBegin( w );
+    for( i=0; i<fieldCount; ++i ) {
+        const int field = fields[i];
+        if( ( field == TF_ID ) || ( torrentFieldChanges[field] & changes ) ) {
+            tr_jsonAddKey( w, torrentFieldNames[field] );
+            addFieldValue( w, tor, inf, st, field );
+        }
     }
-    else if( tr_streq( key, keylen, "webseeds" ) )
-        addWebseeds( inf, tr_bencDictAddList( d, key, inf->webseedCount ) );
-    else if( tr_streq( key, keylen, "webseedsSendingToUs" ) )
-        tr_bencDictAddInt( d, key, st->webseedsSendingToUs );
+    tr_jsonDictEnd( w );
+
+    return true;
 }
 
-static void
-addInfo( const tr_torrent * tor, tr_benc * d, tr_benc * fields )
+/* Look up the requested fields' ids once, rather than once per torrent.
+   They're returned sorted and without duplicates. */
+static int*
+getFields( tr_benc * list, bool needId, int * setmeCount )
 {
+    int i;
+    int n = 0;
     const char * str;
-    const int n = tr_bencListSize( fields );
+    bool wanted[TF_COUNT];
+    int * fields = tr_new( int, TF_COUNT );
+
+    memset( wanted, 0, sizeof( wanted ) );
+    wanted[TF_ID] = needId;
+    for( i=0; i<(int)tr_bencListSize( list ); ++i ) {
+        if( tr_bencGetStr( tr_bencListChild( list, i ), &str ) ) {
+            const int id = getFieldId( str );
+            if( id >= 0 )
+                wanted[id] = true;
+        }
+    }
 
-    tr_bencInitDict( d, n );
+    for( i=0; i<TF_COUNT; ++i )
+        if( wanted[i] )
+            fields[n++] = i;
 
-    if( n > 0 )
-    {
-        int i;
-        const tr_info const * inf = tr_torrentInfo( tor );
-        const tr_stat const * st = tr_torrentStat( (tr_torrent*)tor );
+    *setmeCount = n;
+    return fields;
+}
+
+/* returns how many torrents were written */
+static int
+addRemovedSince( tr_jsonWriter * w, tr_session * session, uint32_t since )
+{
+    int n = 0;
+    int count = 0;
+    tr_benc * d;
 
-        for( i=0; i<n; ++i )
-            if( tr_bencGetStr( tr_bencListChild( fields, i ), &str ) )
-                addField( tor, inf, st, d, str );
+    tr_jsonAddKey( w, "removed" );
+    tr_jsonListBegin( w );
+    while(( d = tr_bencListChild( &session->removedTorrents, n++ ))) {
+        int64_t intVal;
+        if( tr_bencDictFindInt( d, "seq", &intVal ) && ( intVal > since ) ) {
+            tr_bencDictFindInt( d, "id", &intVal );
+            tr_jsonAddInt( w, intVal );
+            ++count;
+        }
     }
+    tr_jsonListEnd( w );
+
+    return count;
 }
 
 static const char*
-torrentGet( tr_session               * session,
-            tr_benc                  * args_in,
-            tr_benc                  * args_out,
-            struct tr_rpc_idle_data  * idle_data UNUSED )
+torrentGet( tr_session     * session,
+            tr_benc        * args_in,
+            tr_jsonWriter  * args_out )
 {
     int           i, torrentCount;
     tr_torrent ** torrents = getTorrents( session, args_in, &torrentCount );
-    tr_benc *     list = tr_bencDictAddList( args_out, "torrents", torrentCount );
     tr_benc *     fields;
+    int64_t       token;
+    uint32_t      since = 0;
     const char *  msg = NULL;
     const char *  strVal;
+    const bool    useSince = tr_bencDictFindInt( args_in, "since", &token );
 
-    assert( idle_data == NULL );
+    if( useSince )
+    {
+        since = parseChangeToken( session, token );
 
-    if( tr_bencDictFindStr( args_in, "ids", &strVal ) && !strcmp( strVal, "recently-active" ) ) {
+        addRemovedSince( args_out, session, since );
+        tr_jsonDictAddInt( args_out, "since", nextChangeToken( session ) );
+    }
+    else if( tr_bencDictFindStr( args_in, "ids", &strVal ) && !strcmp( strVal, "recently-active" ) )
+    {
         int n = 0;
         tr_benc * d;
         const time_t now = tr_time( );
         const int interval = RECENTLY_ACTIVE_SECONDS;
-        tr_benc * removed_out = tr_bencDictAddList( args_out, "removed", 0 );
+        tr_jsonAddKey( args_out, "removed" );
+        tr_jsonListBegin( args_out );
         while(( d = tr_bencListChild( &session->removedTorrents, n++ ))) {
             int64_t intVal;
             if( tr_bencDictFindInt( d, "date", &intVal ) && ( intVal >= now - interval ) ) {
                 tr_bencDictFindInt( d, "id", &intVal );
-                tr_bencListAddInt( removed_out, intVal );
+                tr_jsonAddInt( args_out, intVal );
             }
         }
+        tr_jsonListEnd( args_out );
     }
 
+    tr_jsonAddKey( args_out, "torrents" );
+    tr_jsonListBegin( args_out );
+
     if( !tr_bencDictFindList( args_in, "fields", &fields ) )
         msg = "no fields specified";
-    else for( i = 0; i < torrentCount; ++i )
-        addInfo( torrents[i], tr_bencListAdd( list ), fields );
+    else if( useSince ) {
+        int fieldCount;
+        int * fieldIds = getFields( fields, true, &fieldCount );
+        for( i = 0; i < torrentCount; ++i )
+            addChangedInfo( args_out, torrents[i], fieldIds, fieldCount, since );
+        tr_free( fieldIds );
+    }
+    else {
+        int fieldCount;
+        int * fieldIds = getFields( fields, false, &fieldCount );
+        for( i = 0; i < torrentCount; ++i )
+            addInfo( args_out, torrents[i], fieldIds, fieldCount );
+        tr_free( fieldIds );
+    }
+
+    tr_jsonListEnd( args_out );
 
     tr_free( torrents );
     return msg;
 }
 
+int64_t
+tr_rpc_next_change_token( tr_session * session )
+{
+    parseChangeToken( session, 0 ); /* make sure there's an epoch */
+
+    return nextChangeToken( session );
+}
+
+bool
+tr_rpc_torrent_changes( tr_session       * session,
+                        tr_benc          * args,
+                        int64_t            sinceToken,
+                        int64_t            token,
+                        struct evbuffer  * out )
+{
+    int i;
+    int torrentCount;
+    int fieldCount;
+    int changeCount;
+    int * fieldIds;
+    uint32_t since;
+    tr_benc * fields;
+    tr_jsonWriter w;
+    tr_torrent ** torrents;
+
+    if( !tr_bencDictFindList( args, "fields", &fields ) )
+        return false;
+
+    since = parseChangeToken( session, sinceToken );
+
+    tr_jsonWriterInit( &w, out );
+    tr_jsonDictBegin( &w );
+    changeCount = addRemovedSince( &w, session, since );
+    tr_jsonDictAddInt( &w, "since", token );
+    tr_jsonAddKey( &w, "torrents" );
+    tr_jsonListBegin( &w );
+
+    fieldIds = getFields( fields, true, &fieldCount );
+    torrents = getTorrents( session, args, &torrentCount );
+    for( i=0; i<torrentCount; ++i )
+        if( addChangedInfo( &w, torrents[i], fieldIds, fieldCount, since ) )
+            ++changeCount;
+    tr_free( torrents );
+    tr_free( fieldIds );
+
+    tr_jsonListEnd( &w );
+    tr_jsonDictEnd( &w );
+    return changeCount > 0;
+}
+
 /***
 ****
 ***/
@@ -1324,14 +1733,11 @@ addTorrentImpl( struct tr_rpc_idle_data * data, tr_ctor * ctor )
 
     if( tor )
     {
-        tr_benc fields;
-        tr_bencInitList( &fields, 3 );
-        tr_bencListAddStr( &fields, "id" );
-        tr_bencListAddStr( &fields, "name" );
-        tr_bencListAddStr( &fields, "hashString" );
-        addInfo( tor, tr_bencDictAdd( data->args_out, "torrent-added" ), &fields );
+        tr_benc * d = tr_bencDictAddDict( data->args_out, "torrent-added", 3 );
+        tr_bencDictAddStr( d, "hashString", tor->info.hashString );
+        tr_bencDictAddInt( d, "id", tr_torrentId( tor ) );
+        tr_bencDictAddStr( d, "name", tr_torrentName( tor ) );
         notify( data->session, TR_RPC_TORRENT_ADDED, tor );
-        tr_bencFree( &fields );
     }
     else if( err == TR_PARSE_DUPLICATE )
     {
@@ -1646,6 +2052,7 @@ sessionStats( tr_session               * session,
     tr_benc * d;
     tr_session_stats currentStats = { 0.0f, 0, 0, 0, 0, 0 };
     tr_session_stats cumulativeStats = { 0.0f, 0, 0, 0, 0, 0 };
+    tr_dht_stats dhtStats;
     tr_torrent * tor = NULL;
 
     assert( idle_data == NULL );
@@ -1679,6 +2086,33 @@ sessionStats( tr_session               * session,
     tr_bencDictAddInt( d, "sessionCount", currentStats.sessionCount );
     tr_bencDictAddInt( d, "uploadedBytes", currentStats.uploadedBytes );
 
+    if( tr_dhtGetStats( session, &dhtStats ) )
+    {
+        int i;
+        tr_benc * l;
+
+        d = tr_bencDictAddDict( args_out, "dht-stats", 15 );
+        tr_bencDictAddInt( d, "bucketCount", dhtStats.bucketCount );
+        tr_bencDictAddInt( d, "hashCount", dhtStats.hashCount );
+        tr_bencDictAddInt( d, "hashLimit", dhtStats.hashLimit );
+        tr_bencDictAddInt( d, "peerCount", dhtStats.peerCount );
+        tr_bencDictAddInt( d, "peersPerHashLimit", dhtStats.peersPerHashLimit );
+        tr_bencDictAddInt( d, "searchCount", dhtStats.searchCount );
+        tr_bencDictAddInt( d, "searchLimit", dhtStats.searchLimit );
+        l = tr_bencDictAddList( d, "messageCount", TR_DHT_MSG_KIND_COUNT );
+        for( i=0; i<TR_DHT_MSG_KIND_COUNT; ++i )
+            tr_bencListAddInt( l, dhtStats.messageCount[i] );
+        l = tr_bencDictAddList( d, "messageUsec", TR_DHT_MSG_KIND_COUNT );
+        for( i=0; i<TR_DHT_MSG_KIND_COUNT; ++i )
+            tr_bencListAddInt( l, dhtStats.messageUsec[i] );
+        tr_bencDictAddInt( d, "announcesWaiting", dhtStats.announcesWaiting );
+        tr_bencDictAddInt( d, "announcesDue", dhtStats.announcesDue );
+        tr_bencDictAddInt( d, "announcesInFlight", dhtStats.announcesInFlight );
+        tr_bencDictAddInt( d, "announceCount", dhtStats.announceCount );
+        tr_bencDictAddInt( d, "announceLatencySec", dhtStats.announceLatencySec );
+        tr_bencDictAddInt( d, "announceLatencyMax", dhtStats.announceLatencyMax );
+    }
+
     return NULL;
 }
 
@@ -1738,6 +2172,7 @@ sessionGet( tr_session               * s,
     tr_bencDictAddBool( d, TR_PREFS_KEY_SCRIPT_TORRENT_DONE_ENABLED, tr_sessionIsTorrentDoneScriptEnabled( s ) );
     tr_bencDictAddInt ( d, TR_PREFS_KEY_QUEUE_STALLED_MINUTES, tr_sessionGetQueueStalledMinutes( s ) );
     tr_bencDictAddBool( d, TR_PREFS_KEY_QUEUE_STALLED_ENABLED, tr_sessionGetQueueStalledEnabled( s ) );
+    tr_bencDictAddBool( d, "torrents-loading", tr_sessionIsLoadingTorrents( s ) );
     tr_formatter_get_units( tr_bencDictAddDict( d, "units", 0 ) );
     tr_bencDictAddStr ( d, "version", LONG_VERSION_STRING );
     switch( tr_sessionGetEncryption( s ) ) {
@@ -1770,34 +2205,39 @@ sessionClose( tr_session               * session,
 
 typedef const char* ( *handler )( tr_session*, tr_benc*, tr_benc*, struct tr_rpc_idle_data * );
 
+/* immediate methods whose responses are big enough to be worth
+   writing straight to JSON instead of building a tr_benc tree */
+typedef const char* ( *json_handler )( tr_session*, tr_benc*, tr_jsonWriter* );
+
 static struct method
 {
     const char *  name;
     bool          immediate;
     handler       func;
+    json_handler  json_func;
 }
 methods[] =
 {
-    { "port-test",             false, portTest            },
-    { "blocklist-update",      false, blocklistUpdate     },
-    { "session-close",         true,  sessionClose        },
-    { "session-get",           true,  sessionGet          },
-    { "session-set",           true,  sessionSet          },
-    { "session-stats",         true,  sessionStats        },
-    { "torrent-add",           false, torrentAdd          },
-    { "torrent-get",           true,  torrentGet          },
-    { "torrent-remove",        true,  torrentRemove       },
-    { "torrent-set",           true,  torrentSet          },
-    { "torrent-set-location",  true,  torrentSetLocation  },
-    { "torrent-start",         true,  torrentStart        },
-    { "torrent-start-now",     true,  torrentStartNow     },
-    { "torrent-stop",          true,  torrentStop         },
-    { "torrent-verify",        true,  torrentVerify       },
-    { "torrent-reannounce",    true,  torrentReannounce   },
-    { "queue-move-top",        true,  queueMoveTop        },
-    { "queue-move-up",         true,  queueMoveUp         },
-    { "queue-move-down",       true,  queueMoveDown       },
-    { "queue-move-bottom",     true,  queueMoveBottom     }
+    { "port-test",             false, portTest,           NULL },
+    { "blocklist-update",      false, blocklistUpdate,    NULL },
+    { "session-close",         true,  sessionClose,       NULL },
+    { "session-get",           true,  sessionGet,         NULL },
+    { "session-set",           true,  sessionSet,         NULL },
+    { "session-stats",         true,  sessionStats,       NULL },
+    { "torrent-add",           false, torrentAdd,         NULL },
+    { "torrent-get",           true,  NULL,               torrentGet },
+    { "torrent-remove",        true,  torrentRemove,      NULL },
+    { "torrent-set",           true,  torrentSet,         NULL },
+    { "torrent-set-location",  true,  torrentSetLocation, NULL },
+    { "torrent-start",         true,  torrentStart,       NULL },
+    { "torrent-start-now",     true,  torrentStartNow,    NULL },
+    { "torrent-stop",          true,  torrentStop,        NULL },
+    { "torrent-verify",        true,  torrentVerify,      NULL },
+    { "torrent-reannounce",    true,  torrentReannounce,  NULL },
+    { "queue-move-top",        true,  queueMoveTop,       NULL },
+    { "queue-move-up",         true,  queueMoveUp,        NULL },
+    { "queue-move-down",       true,  queueMoveDown,      NULL },
+    { "queue-move-bottom",     true,  queueMoveBottom,    NULL }
 };
 
 static void
@@ -1852,6 +2292,28 @@ request_exec( tr_session             * session,
 
         tr_bencFree( &response );
     }
+    else if( methods[i].json_func != NULL )
+    {
+        int64_t tag;
+        tr_jsonWriter w;
+        struct evbuffer * buf = evbuffer_new( );
+
+        evbuffer_expand( buf, 4096 );
+        tr_jsonWriterInit( &w, buf );
+        tr_jsonDictBegin( &w );
+        tr_jsonAddKey( &w, "arguments" );
+        tr_jsonDictBegin( &w );
+        result = (*methods[i].json_func)( session, args_in, &w );
+        tr_jsonDictEnd( &w );
+        tr_jsonDictAddStr( &w, "result", result ? result : "success" );
+        if( tr_bencDictFindInt( request, "tag", &tag ) )
+            tr_jsonDictAddInt( &w, "tag", tag );
+        tr_jsonDictEnd( &w );
+        evbuffer_add( buf, "\n", 1 );
+
+        (*callback)( session, buf, callback_user_data );
+        evbuffer_free( buf );
+    }
     else if( methods[i].immediate )
     {
         int64_t tag;
@@ -42,6 +42,32 @@ void tr_rpc_request_exec_uri( tr_session           * session,
                               tr_rpc_response_func   callback,
                               void                 * callback_user_data );
 
+/**
+ * @brief Start a new torrent-get "since" number and return the old one.
+ *
+ * Everything that changes after this call is newer than the returned token.
+ */
+int64_t tr_rpc_next_change_token( tr_session * session );
+
+/**
+ * @brief Write torrent-get's arguments for the changes since `since'.
+ *
+ * This is torrent-get with the "since" argument, for the RPC server's event
+ * stream: `args' holds torrent-get's "ids" and "fields", and `token' is
+ * the "since" number to hand back, from tr_rpc_next_change_token().
+ * Calls with the same args, since, and token write the same thing, so
+ * one call's output can be shared by every stream that asked for it.
+ * The "removed", "since", and "torrents" arguments are written to `out'
+ * as a JSON object.
+ *
+ * @return true if any torrents were removed or had fields change
+ */
+bool tr_rpc_torrent_changes( tr_session       * session,
+                             struct tr_benc   * args,
+                             int64_t            since,
+                             int64_t            token,
+                             struct evbuffer  * out );
+
 void tr_rpc_parse_list_str( struct tr_benc * setme,
                             const char     * list_str,
                             int              list_str_len );
@@ -35,6 +35,7 @@
 #include "cache.h"
 #include "crypto.h"
 #include "fdlimit.h"
+#include "handshake.h" /* tr_handshakeWaitForWorkers() */
 #include "list.h"
 #include "net.h"
 #include "peer-io.h"
@@ -44,8 +45,9 @@
 #include "rpc-server.h"
 #include "session.h"
 #include "stats.h"
+#include "timer-wheel.h"
 #include "torrent.h"
-#include "tr-dht.h" /* tr_dhtUpkeep() */
+#include "tr-dht.h" /* tr_dhtUpkeep(), tr_dhtSetLimits() */
 #include "tr-udp.h"
 #include "tr-utp.h"
 #include "tr-lpd.h"
@@ -64,7 +66,9 @@ enum
     DEFAULT_CACHE_SIZE_MB = 4,
     DEFAULT_PREFETCH_ENABLED = true,
 #endif
-    SAVE_INTERVAL_SECS = 360
+    SAVE_INTERVAL_SECS = 360,
+    DEFAULT_DHT_MAX_HASHES = 16384,
+    DEFAULT_DHT_MAX_SEARCHES = 1024
 };
 
 
@@ -306,10 +310,13 @@ tr_sessionGetDefaultSettings( tr_benc * d )
     assert( tr_bencIsDict( d ) );
 
     tr_bencDictReserve( d, 60 );
+    tr_bencDictAddBool( d, TR_PREFS_KEY_BINARY_RESUME_ENABLED,           false );
     tr_bencDictAddBool( d, TR_PREFS_KEY_BLOCKLIST_ENABLED,               false );
     tr_bencDictAddStr ( d, TR_PREFS_KEY_BLOCKLIST_URL,                   "http://www.example.com/blocklist" );
     tr_bencDictAddInt ( d, TR_PREFS_KEY_MAX_CACHE_SIZE_MB,               DEFAULT_CACHE_SIZE_MB );
     tr_bencDictAddBool( d, TR_PREFS_KEY_DHT_ENABLED,                     true );
+    tr_bencDictAddInt ( d, TR_PREFS_KEY_DHT_MAX_HASHES,                  DEFAULT_DHT_MAX_HASHES );
+    tr_bencDictAddInt ( d, TR_PREFS_KEY_DHT_MAX_SEARCHES,                DEFAULT_DHT_MAX_SEARCHES );
     tr_bencDictAddBool( d, TR_PREFS_KEY_UTP_ENABLED,                     true );
     tr_bencDictAddBool( d, TR_PREFS_KEY_LPD_ENABLED,                     false );
     tr_bencDictAddStr ( d, TR_PREFS_KEY_DOWNLOAD_DIR,                    tr_getDefaultDownloadDir( ) );
@@ -376,10 +383,13 @@ tr_sessionGetSettings( tr_session * s, struct tr_benc * d )
     assert( tr_bencIsDict( d ) );
 
     tr_bencDictReserve( d, 60 );
+    tr_bencDictAddBool( d, TR_PREFS_KEY_BINARY_RESUME_ENABLED,            s->isBinaryResumeEnabled );
     tr_bencDictAddBool( d, TR_PREFS_KEY_BLOCKLIST_ENABLED,                tr_blocklistIsEnabled( s ) );
     tr_bencDictAddStr ( d, TR_PREFS_KEY_BLOCKLIST_URL,                    tr_blocklistGetURL( s ) );
     tr_bencDictAddInt ( d, TR_PREFS_KEY_MAX_CACHE_SIZE_MB,                tr_sessionGetCacheLimit_MB( s ) );
     tr_bencDictAddBool( d, TR_PREFS_KEY_DHT_ENABLED,                      s->isDHTEnabled );
+    tr_bencDictAddInt ( d, TR_PREFS_KEY_DHT_MAX_HASHES,                   s->dhtMaxHashes );
+    tr_bencDictAddInt ( d, TR_PREFS_KEY_DHT_MAX_SEARCHES,                 s->dhtMaxSearches );
     tr_bencDictAddBool( d, TR_PREFS_KEY_UTP_ENABLED,                      s->isUTPEnabled );
     tr_bencDictAddBool( d, TR_PREFS_KEY_LPD_ENABLED,                      s->isLPDEnabled );
     tr_bencDictAddStr ( d, TR_PREFS_KEY_DOWNLOAD_DIR,                     s->downloadDir );
@@ -588,6 +598,7 @@ tr_sessionInit( const char  * tag,
     tr_bandwidthConstruct( &session->bandwidth, session, NULL );
     tr_peerIdInit( session->peer_id );
     tr_bencInitList( &session->removedTorrents, 0 );
+    session->rpcChangeSeq = 1;
 
     /* nice to start logging at the very beginning */
     if( tr_bencDictFindInt( clientSettings, TR_PREFS_KEY_MSGLEVEL, &i ) )
@@ -595,6 +606,7 @@ tr_sessionInit( const char  * tag,
 
     /* start the libtransmission thread */
     tr_netInit( ); /* must go before tr_eventInit */
+    tr_cryptoThreadsInit( ); /* so must this */
     tr_eventInit( session );
     assert( session->events != NULL );
 
@@ -645,6 +657,15 @@ onNowTimer( int foo UNUSED, short bar UNUSED, void * vsession )
             else
                 ++tor->secondsDownloading;
         }
+
+        /* speeds, etas and peers can change just by time passing while a
+           torrent's running, and its speeds take a moment to wind down
+           after it stops. A verify's progress is stamped here too,
+           rather than from inside the verify thread */
+        if( tor->isRunning || ( tor->activityDate + ( HISTORY_MSEC / 1000 ) >= now ) )
+            tr_torrentCheckLiveStats( tor );
+        if( tor->verifyState == TR_VERIFY_NOW )
+            tr_torrentMarkChanged( tor, TR_CHANGED_PROGRESS );
     }
 
     /**
@@ -693,6 +714,8 @@ tr_sessionInitImpl( void * vdata )
 
     tr_setConfigDir( session, data->configDir );
 
+    session->wheel = tr_wheelNew( session );
+
     session->peerMgr = tr_peerMgrNew( session );
 
     session->shared = tr_sharedInit( session );
@@ -772,6 +795,11 @@ sessionSetImpl( void * vdata )
         tr_sessionSetPexEnabled( session, boolVal );
     if( tr_bencDictFindBool( settings, TR_PREFS_KEY_DHT_ENABLED, &boolVal ) )
         tr_sessionSetDHTEnabled( session, boolVal );
+    if( tr_bencDictFindInt( settings, TR_PREFS_KEY_DHT_MAX_HASHES, &i ) && ( i > 0 ) )
+        session->dhtMaxHashes = i;
+    if( tr_bencDictFindInt( settings, TR_PREFS_KEY_DHT_MAX_SEARCHES, &i ) && ( i > 0 ) )
+        session->dhtMaxSearches = i;
+    tr_dhtSetLimits( session );
     if( tr_bencDictFindBool( settings, TR_PREFS_KEY_UTP_ENABLED, &boolVal ) )
         tr_sessionSetUTPEnabled( session, boolVal );
     if( tr_bencDictFindBool( settings, TR_PREFS_KEY_LPD_ENABLED, &boolVal ) )
@@ -810,6 +838,8 @@ sessionSetImpl( void * vdata )
     /* files and directories */
     if( tr_bencDictFindBool( settings, TR_PREFS_KEY_PREFETCH_ENABLED, &boolVal ) )
         session->isPrefetchEnabled = boolVal;
+    if( tr_bencDictFindBool( settings, TR_PREFS_KEY_BINARY_RESUME_ENABLED, &boolVal ) )
+        session->isBinaryResumeEnabled = boolVal;
     if( tr_bencDictFindInt( settings, TR_PREFS_KEY_PREALLOCATION, &i ) )
         session->preallocationMode = i;
     if( tr_bencDictFindStr( settings, TR_PREFS_KEY_DOWNLOAD_DIR, &str ) )
@@ -1142,12 +1172,27 @@ tr_sessionGetPortForwarding( const tr_session * session )
 ****
 ***/
 
+/* for session settings that change what torrent-get reports for every torrent */
+static void
+markTorrentsChanged( tr_session * session, tr_torrent_change what )
+{
+    tr_torrent * tor = NULL;
+
+    tr_sessionLock( session );
+
+    while(( tor = tr_torrentNext( session, tor )))
+        tr_torrentMarkChanged( tor, what );
+
+    tr_sessionUnlock( session );
+}
+
 void
 tr_sessionSetRatioLimited( tr_session * session, bool isLimited )
 {
     assert( tr_isSession( session ) );
 
     session->isRatioLimited = isLimited;
+    markTorrentsChanged( session, TR_CHANGED_STATUS );
 }
 
 void
@@ -1156,6 +1201,7 @@ tr_sessionSetRatioLimit( tr_session * session, double desiredRatio )
     assert( tr_isSession( session ) );
 
     session->desiredRatio = desiredRatio;
+    markTorrentsChanged( session, TR_CHANGED_STATUS );
 }
 
 bool
@@ -1184,6 +1230,7 @@ tr_sessionSetIdleLimited( tr_session * session, bool isLimited )
     assert( tr_isSession( session ) );
 
     session->isIdleLimited = isLimited;
+    markTorrentsChanged( session, TR_CHANGED_STATUS );
 }
 
 void
@@ -1192,6 +1239,7 @@ tr_sessionSetIdleLimit( tr_session * session, uint16_t idleMinutes )
     assert( tr_isSession( session ) );
 
     session->idleLimitMinutes = idleMinutes;
+    markTorrentsChanged( session, TR_CHANGED_STATUS );
 }
 
 bool
@@ -1790,6 +1838,10 @@ sessionCloseImpl( void * vsession )
 
     tr_statsClose( session );
     tr_peerMgrFree( session->peerMgr );
+    tr_handshakeWaitForWorkers( );
+
+    tr_wheelFree( session->wheel );
+    session->wheel = NULL;
 
     closeBlocklists( session );
 
@@ -1859,6 +1911,9 @@ tr_sessionClose( tr_session * session )
 
     /* free the session memory */
     tr_bencFree( &session->removedTorrents );
+    tr_ptrArrayDestruct( &session->torrentsById, NULL );
+    tr_ptrArrayDestruct( &session->torrentsByHash, NULL );
+    tr_ptrArrayDestruct( &session->torrentsByObfuscatedHash, NULL );
     tr_bandwidthDestruct( &session->bandwidth );
     tr_bitfieldDestruct( &session->turtle.minutes );
     tr_lockFree( session->lock );
@@ -1878,23 +1933,174 @@ tr_sessionClose( tr_session * session )
     tr_free( session );
 }
 
+/***
+****  Loading the torrents from tr_getTorrentDir()
+***/
+
+/* Loading a torrent has two parts: reading and parsing its .torrent and
+ * .resume files, which tr_torrentPrefetch() can do on any thread, and
+ * adding it to the session, which needs the session lock. The first part
+ * is done by a pool of worker threads, and the second is done on the event
+ * thread in batches so that RPC requests and the peers don't have to wait
+ * for thousands of torrents to finish loading. */
+
+enum
+{
+    /* how long to spend adding torrents before letting the event loop run */
+    LOAD_BATCH_MSEC = 50,
+
+    /* how long to wait for the workers when nothing's ready to be added */
+    LOAD_WAIT_MSEC = 10,
+
+    MAX_LOAD_THREADS = 8
+};
+
 struct sessionLoadTorrentsData
 {
     tr_session * session;
     tr_ctor * ctor;
     int * setmeCount;
     tr_torrent ** torrents;
+    int torrentCount;
     bool done;
+
+    char ** filenames;
+    int fileCount;
+    int nextToAdd;
+    tr_wheelTimer * timer;
+
+    /* shared with the workers */
+    tr_lock * lock;
+    tr_torrent_prefetch * prefetches;
+    bool * isPrefetched;
+    int nextToPrefetch;
+    int threadCount; /* how many are still running */
+
+    int workerCount;
+
+    /* how long each phase took */
+    uint64_t startMsec;
+    uint64_t scanMsec;
+    uint64_t prefetchMsec;
+    uint64_t addMsec;
+    int batchCount;
 };
 
+static void
+loadTorrentsThreadFunc( void * vdata )
+{
+    struct sessionLoadTorrentsData * data = vdata;
+
+    for( ;; )
+    {
+        int i;
+        uint64_t begin;
+
+        tr_lockLock( data->lock );
+        if( data->nextToPrefetch < data->fileCount )
+            i = data->nextToPrefetch++;
+        else {
+            i = -1;
+            --data->threadCount;
+        }
+        tr_lockUnlock( data->lock );
+
+        if( i < 0 )
+            break;
+
+        begin = tr_time_msec( );
+        tr_torrentPrefetch( data->session, data->filenames[i], &data->prefetches[i] );
+
+        tr_lockLock( data->lock );
+        data->isPrefetched[i] = true;
+        data->prefetchMsec += tr_time_msec( ) - begin;
+        tr_lockUnlock( data->lock );
+    }
+}
+
+static void
+loadTorrentsFinish( struct sessionLoadTorrentsData * data )
+{
+    int i;
+    const int n = data->torrentCount;
+
+    if( n )
+        tr_inf( _( "Loaded %d torrents" ), n );
+
+    if( data->fileCount )
+        tr_inf( "Loading torrents took %d msec: %d to list the directory, "
+                "%d to read and parse the files on %d threads, "
+                "and %d to add them in %d batches",
+                (int)( tr_time_msec( ) - data->startMsec ),
+                (int)data->scanMsec,
+                (int)data->prefetchMsec, data->workerCount,
+                (int)data->addMsec, data->batchCount );
+
+    for( i=0; i<data->fileCount; ++i )
+        tr_free( data->filenames[i] );
+    tr_free( data->filenames );
+    tr_free( data->prefetches );
+    tr_free( data->isPrefetched );
+    tr_lockFree( data->lock );
+    tr_wheelTimerFree( data->timer );
+
+    data->session->isLoadingTorrents = false;
+
+    if( data->setmeCount )
+        *data->setmeCount = n;
+
+    data->done = true;
+}
+
+static void
+onLoadTorrentsTimer( void * vdata )
+{
+    bool isReady = true;
+    int threadCount;
+    struct sessionLoadTorrentsData * data = vdata;
+    const uint64_t begin = tr_time_msec( );
+
+    while( data->nextToAdd < data->fileCount )
+    {
+        tr_torrent * tor;
+        tr_torrent_prefetch * prefetch = &data->prefetches[data->nextToAdd];
+
+        tr_lockLock( data->lock );
+        isReady = data->isPrefetched[data->nextToAdd];
+        tr_lockUnlock( data->lock );
+
+        if( !isReady || ( tr_time_msec( ) - begin >= LOAD_BATCH_MSEC ) )
+            break;
+
+        tr_ctorSetPrefetch( data->ctor, prefetch );
+        if(( tor = tr_torrentNew( data->ctor, NULL )))
+            data->torrents[data->torrentCount++] = tor;
+        tr_ctorSetPrefetch( data->ctor, NULL );
+
+        tr_torrentPrefetchFree( prefetch );
+        ++data->nextToAdd;
+    }
+
+    data->addMsec += tr_time_msec( ) - begin;
+    ++data->batchCount;
+
+    /* don't free the shared state until all the workers have exited */
+    tr_lockLock( data->lock );
+    threadCount = data->threadCount;
+    tr_lockUnlock( data->lock );
+
+    if( ( data->nextToAdd == data->fileCount ) && !threadCount )
+        loadTorrentsFinish( data );
+    else
+        tr_wheelTimerAddMsec( data->timer, isReady ? 0 : LOAD_WAIT_MSEC );
+}
+
 static void
 sessionLoadTorrents( void * vdata )
 {
     int i;
-    int n = 0;
     struct stat sb;
     DIR * odir = NULL;
-    tr_list * l = NULL;
     tr_list * list = NULL;
     struct sessionLoadTorrentsData * data = vdata;
     const char * dirname = tr_getTorrentDir( data->session );
@@ -1903,6 +2109,8 @@ sessionLoadTorrents( void * vdata )
 
     tr_ctorSetSave( data->ctor, false ); /* since we already have them */
 
+    data->startMsec = tr_time_msec( );
+
     if( !stat( dirname, &sb )
       && S_ISDIR( sb.st_mode )
       && ( ( odir = opendir ( dirname ) ) ) )
@@ -1912,34 +2120,36 @@ sessionLoadTorrents( void * vdata )
         {
             if( tr_str_has_suffix( d->d_name, ".torrent" ) )
             {
-                tr_torrent * tor;
-                char * path = tr_buildPath( dirname, d->d_name, NULL );
-                tr_ctorSetMetainfoFromFile( data->ctor, path );
-                if(( tor = tr_torrentNew( data->ctor, NULL )))
-                {
-                    tr_list_prepend( &list, tor );
-                    ++n;
-                }
-                tr_free( path );
+                tr_list_prepend( &list, tr_buildPath( dirname, d->d_name, NULL ) );
+                ++data->fileCount;
             }
         }
         closedir( odir );
     }
 
-    data->torrents = tr_new( tr_torrent *, n );
-    for( i = 0, l = list; l != NULL; l = l->next )
-        data->torrents[i++] = (tr_torrent*) l->data;
-    assert( i == n );
+    data->filenames = tr_new( char *, data->fileCount );
+    for( i=data->fileCount; list!=NULL; )
+        data->filenames[--i] = tr_list_pop_front( &list );
 
-    tr_list_free( &list, NULL );
+    data->scanMsec = tr_time_msec( ) - data->startMsec;
 
-    if( n )
-        tr_inf( _( "Loaded %d torrents" ), n );
+    data->torrents = tr_new( tr_torrent *, data->fileCount );
+    data->prefetches = tr_new0( tr_torrent_prefetch, data->fileCount );
+    data->isPrefetched = tr_new0( bool, data->fileCount );
+    data->lock = tr_lockNew( );
+    data->workerCount = MIN( data->fileCount,
+                             MIN( tr_getProcessorCount( ), MAX_LOAD_THREADS ) );
+    data->threadCount = data->workerCount;
 
-    if( data->setmeCount )
-        *data->setmeCount = n;
+    for( i=0; i<data->workerCount; ++i )
+        tr_threadNew( loadTorrentsThreadFunc, data );
 
-    data->done = true;
+    tr_sessionLock( data->session );
+    data->session->isLoadingTorrents = true;
+    data->timer = tr_wheelTimerNew( data->session, "load-torrents",
+                                    onLoadTorrentsTimer, data );
+    onLoadTorrentsTimer( data );
+    tr_sessionUnlock( data->session );
 }
 
 tr_torrent **
@@ -1949,11 +2159,10 @@ tr_sessionLoadTorrents( tr_session * session,
 {
     struct sessionLoadTorrentsData data;
 
+    memset( &data, 0, sizeof( data ) );
     data.session = session;
     data.ctor = ctor;
     data.setmeCount = setmeCount;
-    data.torrents = NULL;
-    data.done = false;
 
     tr_runInEventThread( session, sessionLoadTorrents, &data );
     while( !data.done )
@@ -1962,6 +2171,14 @@ tr_sessionLoadTorrents( tr_session * session,
     return data.torrents;
 }
 
+bool
+tr_sessionIsLoadingTorrents( const tr_session * session )
+{
+    assert( tr_isSession( session ) );
+
+    return session->isLoadingTorrents;
+}
+
 /***
 ****
 ***/
@@ -2657,6 +2874,7 @@ tr_sessionSetQueueEnabled( tr_session * session, tr_direction dir, bool is_enabl
     assert( tr_isBool( is_enabled ) );
 
     session->queueEnabled[dir] = is_enabled;
+    markTorrentsChanged( session, TR_CHANGED_STATUS );
 }
 
 bool
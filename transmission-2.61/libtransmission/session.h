@@ -50,6 +50,7 @@ struct tr_announcer_udp;
 struct tr_bindsockets;
 struct tr_cache;
 struct tr_fdInfo;
+struct tr_udp_queue;
 
 typedef void ( tr_web_config_func )( tr_session * session, void * curl_pointer, const char * url, void * user_data );
 
@@ -99,8 +100,10 @@ struct tr_session
     bool                         isLPDEnabled;
     bool                         isBlocklistEnabled;
     bool                         isPrefetchEnabled;
+    bool                         isBinaryResumeEnabled;
     bool                         isTorrentDoneScriptEnabled;
     bool                         isClosed;
+    bool                         isLoadingTorrents;
     bool                         isIncompleteFileNamingEnabled;
     bool                         isRatioLimited;
     bool                         isIdleLimited;
@@ -111,6 +114,10 @@ struct tr_session
 
     tr_benc                      removedTorrents;
 
+    /* for torrent-get's "since" argument. see rpcimpl.c */
+    uint32_t                     rpcChangeEpoch;
+    uint32_t                     rpcChangeSeq;
+
     bool                         stalledEnabled;
     bool                         queueEnabled[2];
     int                          queueSize[2];
@@ -140,6 +147,11 @@ struct tr_session
 
     int                          uploadSlotsPerTorrent;
 
+    /* how many info hashes the DHT stores peers for, and how many
+       searches it keeps */
+    int                          dhtMaxHashes;
+    int                          dhtMaxSearches;
+
     /* The UDP sockets used for the DHT and uTP. */
     tr_port                      udp_port;
     int                          udp_socket;
@@ -147,6 +159,7 @@ struct tr_session
     unsigned char *              udp6_bound;
     struct event                 *udp_event;
     struct event                 *udp6_event;
+    struct tr_udp_queue          *udp_queue;
 
     /* The open port on the local machine for incoming peer requests */
     tr_port                      private_peer_port;
@@ -168,6 +181,11 @@ struct tr_session
     int                          torrentCount;
     tr_torrent *                 torrentList;
 
+    /* torrentList, sorted for tr_torrentFindFrom*() */
+    tr_ptrArray                  torrentsById;
+    tr_ptrArray                  torrentsByHash;
+    tr_ptrArray                  torrentsByObfuscatedHash;
+
     char *                       torrentDoneScript;
 
     char *                       tag;
@@ -180,6 +198,9 @@ struct tr_session
     char *                       blocklist_url;
 
     struct tr_list *             blocklists;
+
+    /* torrents whose binary resume store is open, most recently saved first */
+    struct tr_list *             openResumeStores;
     struct tr_peerMgr *          peerMgr;
     struct tr_shared *           shared;
 
@@ -203,6 +224,9 @@ struct tr_session
     struct event               * nowTimer;
     struct event               * saveTimer;
 
+    /* schedules the periodic pulses of peer-mgr and friends */
+    struct tr_wheel            * wheel;
+
     /* monitors the "global pool" speeds */
     struct tr_bandwidth          bandwidth;
 
@@ -257,6 +281,9 @@ struct tr_bindsockets * tr_sessionGetBindSockets( tr_session * );
 
 int tr_sessionCountTorrents( const tr_session * session );
 
+/** @brief true while tr_sessionLoadTorrents() is still adding torrents */
+bool tr_sessionIsLoadingTorrents( const tr_session * session );
+
 enum
 {
     SESSION_MAGIC_NUMBER = 3845,
@@ -0,0 +1,404 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * This file is licensed by the GPL version 2. Works owned by the
+ * Transmission project are granted a special exemption to clause 2(b)
+ * so that the bulk of its code can remain under the MIT license.
+ * This exemption does not extend to derived works not owned by
+ * the Transmission project.
+ *
+ * $Id$
+ */
+
+#include <assert.h>
+#include <string.h> /* memset(), strcmp() */
+
+#include <event2/event.h>
+
+#include "transmission.h"
+#include "session.h"
+#include "timer-wheel.h"
+#include "utils.h"
+
+#define MY_NAME "Timers"
+
+#define dbgmsg( ... ) \
+    do { \
+        if( tr_deepLoggingIsActive( ) ) \
+            tr_deepLog( __FILE__, __LINE__, MY_NAME, __VA_ARGS__ ); \
+    } while( 0 )
+
+enum
+{
+    /* the wheel's resolution. Timers are rounded up to the next tick,
+     * so this is kept small next to the 500 msec bandwidth pulse */
+    TICK_MSEC = 10,
+
+    /* the near wheel has a slot for each of the next NEAR_SIZE ticks
+     * (2.56 seconds)... */
+    NEAR_BITS = 8,
+    NEAR_SIZE = ( 1 << NEAR_BITS ),
+    NEAR_MASK = ( NEAR_SIZE - 1 ),
+
+    /* ...and the far wheel has a slot for each of the next FAR_SIZE turns
+     * of the near wheel (about 2.7 minutes). Each time the near wheel
+     * comes around, the far slot for that turn is cascaded into it. */
+    FAR_BITS = 6,
+    FAR_SIZE = ( 1 << FAR_BITS ),
+    FAR_MASK = ( FAR_SIZE - 1 ),
+
+    /* if a tick's callbacks run longer than this, the rest wait for
+     * the next tick so that the peers' I/O gets a turn in between */
+    TICK_BUDGET_MSEC = 100,
+
+    /* a single callback that takes longer than this gets logged */
+    SLOW_PULSE_MSEC = 50
+};
+
+struct tr_wheelTimer
+{
+    struct tr_wheel       * wheel;
+    struct tr_wheelTimer ** slot; /* NULL if not scheduled */
+    struct tr_wheelTimer  * prev;
+    struct tr_wheelTimer  * next;
+
+    uint64_t expires;  /* the tick it fires on */
+    uint64_t due_msec; /* when it was asked to fire, to measure lateness */
+
+    int stat;
+    tr_wheel_func func;
+    void * user_data;
+};
+
+struct wheel_stat
+{
+    const char * name;
+    unsigned int runs;
+    uint64_t msec;
+    unsigned int maxMsec;
+    uint64_t lateMsec;
+    unsigned int maxLateMsec;
+};
+
+struct tr_wheel
+{
+    tr_session * session;
+    struct event * timer;
+
+    uint64_t start_msec; /* when tick 0 was */
+    uint64_t tick;       /* the last tick that was run */
+    uint64_t wake_tick;  /* the tick `timer' is set for, or 0 if unset */
+
+    int timerCount;      /* timers that exist */
+    int pendingCount;    /* timers that are scheduled */
+
+    struct tr_wheelTimer * near[NEAR_SIZE];
+    struct tr_wheelTimer * far[FAR_SIZE];
+
+    /* one per timer name; timers with the same name share one */
+    int statCount;
+    int statAlloc;
+    struct wheel_stat * stats;
+};
+
+/***
+****
+***/
+
+static void
+slotInsert( tr_wheelTimer ** slot, tr_wheelTimer * t )
+{
+    assert( t->slot == NULL );
+
+    t->slot = slot;
+    t->prev = NULL;
+    t->next = *slot;
+    if( t->next != NULL )
+        t->next->prev = t;
+    *slot = t;
+}
+
+static void
+slotRemove( tr_wheelTimer * t )
+{
+    assert( t->slot != NULL );
+
+    if( t->prev != NULL )
+        t->prev->next = t->next;
+    else
+        *t->slot = t->next;
+
+    if( t->next != NULL )
+        t->next->prev = t->prev;
+
+    t->slot = NULL;
+    t->prev = t->next = NULL;
+}
+
+static void
+wheelInsert( tr_wheel * w, tr_wheelTimer * t )
+{
+    tr_wheelTimer ** slot;
+    const uint64_t delta = t->expires - w->tick;
+
+    assert( t->expires >= w->tick );
+
+    if( delta < NEAR_SIZE )
+        slot = &w->near[t->expires & NEAR_MASK];
+    else if( delta < NEAR_SIZE * FAR_SIZE )
+        slot = &w->far[( t->expires >> NEAR_BITS ) & FAR_MASK];
+    else /* park it in the farthest slot; it'll be cascaded back to here */
+        slot = &w->far[( ( w->tick >> NEAR_BITS ) + FAR_SIZE - 1 ) & FAR_MASK];
+
+    slotInsert( slot, t );
+}
+
+static void
+cascade( tr_wheel * w, tr_wheelTimer ** slot )
+{
+    tr_wheelTimer * t;
+
+    while(( t = *slot ))
+    {
+        slotRemove( t );
+        wheelInsert( w, t );
+    }
+}
+
+static uint64_t
+msecToTick( const tr_wheel * w, uint64_t msec, bool roundUp )
+{
+    if( msec <= w->start_msec )
+        return 0;
+
+    msec -= w->start_msec;
+    return ( msec + ( roundUp ? TICK_MSEC - 1 : 0 ) ) / TICK_MSEC;
+}
+
+/* the next tick that has something to do: either a near slot with timers
+ * in it, or the start of the near wheel's next turn, to cascade */
+static uint64_t
+nextBusyTick( const tr_wheel * w )
+{
+    uint64_t tick = w->tick + 1;
+
+    while( ( w->near[tick & NEAR_MASK] == NULL ) && ( tick & NEAR_MASK ) )
+        ++tick;
+
+    return tick;
+}
+
+static void
+wheelSchedule( tr_wheel * w )
+{
+    uint64_t tick;
+    uint64_t now;
+    uint64_t when;
+
+    if( !w->pendingCount )
+        return;
+
+    tick = nextBusyTick( w );
+    if( w->wake_tick && ( w->wake_tick <= tick ) )
+        return;
+
+    now = tr_time_msec( );
+    when = w->start_msec + tick * TICK_MSEC;
+    w->wake_tick = tick;
+    tr_timerAddMsec( w->timer, when > now ? (int)( when - now ) : 0 );
+}
+
+static void
+runTimer( tr_wheel * w, tr_wheelTimer * t )
+{
+    unsigned int took;
+    struct wheel_stat * stat = &w->stats[t->stat];
+    const uint64_t begin = tr_time_msec( );
+    const unsigned int late = begin > t->due_msec ? begin - t->due_msec : 0;
+
+    /* this may free or reschedule t */
+    t->func( t->user_data );
+
+    took = tr_time_msec( ) - begin;
+    ++stat->runs;
+    stat->msec += took;
+    stat->maxMsec = MAX( stat->maxMsec, took );
+    stat->lateMsec += late;
+    stat->maxLateMsec = MAX( stat->maxLateMsec, late );
+
+    if( took >= SLOW_PULSE_MSEC )
+        tr_ndbg( MY_NAME, "%s took %u msec (%u msec late)", stat->name, took, late );
+}
+
+static void
+onWheelTimer( int foo UNUSED, short bar UNUSED, void * vwheel )
+{
+    tr_wheel * w = vwheel;
+    bool overBudget = false;
+    const uint64_t begin = tr_time_msec( );
+    const uint64_t target = msecToTick( w, begin, false );
+
+    tr_sessionLock( w->session );
+
+    w->wake_tick = 0;
+
+    while( !overBudget && ( w->tick < target ) )
+    {
+        tr_wheelTimer * t;
+        tr_wheelTimer ** slot;
+        const uint64_t tick = ++w->tick;
+
+        if( !( tick & NEAR_MASK ) )
+            cascade( w, &w->far[( tick >> NEAR_BITS ) & FAR_MASK] );
+
+        slot = &w->near[tick & NEAR_MASK];
+
+        while(( t = *slot ))
+        {
+            assert( t->expires == tick );
+
+            if( tr_time_msec( ) - begin >= TICK_BUDGET_MSEC )
+            {
+                overBudget = true;
+                break;
+            }
+
+            slotRemove( t );
+            --w->pendingCount;
+            runTimer( w, t );
+        }
+
+        /* if we ran out of time, the rest wait for the next tick */
+        while(( t = *slot ))
+        {
+            slotRemove( t );
+            t->expires = tick + 1;
+            wheelInsert( w, t );
+        }
+    }
+
+    if( overBudget )
+        dbgmsg( "ran over the %d msec budget at tick %" PRIu64, (int)TICK_BUDGET_MSEC, w->tick );
+
+    wheelSchedule( w );
+
+    tr_sessionUnlock( w->session );
+}
+
+/***
+****
+***/
+
+tr_wheel *
+tr_wheelNew( tr_session * session )
+{
+    tr_wheel * w = tr_new0( tr_wheel, 1 );
+    w->session = session;
+    w->timer = evtimer_new( session->event_base, onWheelTimer, w );
+    w->start_msec = tr_time_msec( );
+    return w;
+}
+
+void
+tr_wheelFree( tr_wheel * w )
+{
+    int i;
+
+    assert( w->timerCount == 0 );
+
+    for( i=0; i<w->statCount; ++i )
+    {
+        const struct wheel_stat * stat = &w->stats[i];
+
+        if( stat->runs )
+            tr_ndbg( MY_NAME, "%s ran %u times; took %u msec on average (%u max), "
+                              "ran %u msec late on average (%u max)",
+                     stat->name, stat->runs,
+                     (unsigned int)( stat->msec / stat->runs ), stat->maxMsec,
+                     (unsigned int)( stat->lateMsec / stat->runs ), stat->maxLateMsec );
+    }
+
+    event_free( w->timer );
+    tr_free( w->stats );
+    tr_free( w );
+}
+
+tr_wheelTimer *
+tr_wheelTimerNew( tr_session     * session,
+                  const char     * name,
+                  tr_wheel_func    func,
+                  void           * user_data )
+{
+    int i;
+    tr_wheel * w = session->wheel;
+    tr_wheelTimer * t = tr_new0( tr_wheelTimer, 1 );
+
+    assert( w != NULL );
+    assert( name != NULL );
+    assert( func != NULL );
+
+    for( i=0; i<w->statCount; ++i )
+        if( !strcmp( w->stats[i].name, name ) )
+            break;
+
+    if( i == w->statCount )
+    {
+        if( w->statCount == w->statAlloc )
+        {
+            w->statAlloc = w->statAlloc ? w->statAlloc * 2 : 32;
+            w->stats = tr_renew( struct wheel_stat, w->stats, w->statAlloc );
+        }
+
+        memset( &w->stats[i], 0, sizeof( struct wheel_stat ) );
+        w->stats[i].name = name;
+        ++w->statCount;
+    }
+
+    t->wheel = w;
+    t->stat = i;
+    t->func = func;
+    t->user_data = user_data;
+    ++w->timerCount;
+    return t;
+}
+
+void
+tr_wheelTimerAddMsec( tr_wheelTimer * t, int msec )
+{
+    tr_wheel * w = t->wheel;
+    const uint64_t now = tr_time_msec( );
+
+    assert( msec >= 0 );
+
+    if( t->slot != NULL )
+    {
+        slotRemove( t );
+        --w->pendingCount;
+    }
+
+    /* round up so that it never fires early */
+    t->due_msec = now + msec;
+    t->expires = MAX( msecToTick( w, t->due_msec, true ), w->tick + 1 );
+    wheelInsert( w, t );
+    ++w->pendingCount;
+
+    wheelSchedule( w );
+}
+
+void
+tr_wheelTimerFree( tr_wheelTimer * t )
+{
+    if( t != NULL )
+    {
+        tr_wheel * w = t->wheel;
+
+        if( t->slot != NULL )
+        {
+            slotRemove( t );
+            --w->pendingCount;
+        }
+
+        --w->timerCount;
+        tr_free( t );
+    }
+}
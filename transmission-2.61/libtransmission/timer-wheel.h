@@ -0,0 +1,66 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * This file is licensed by the GPL version 2. Works owned by the
+ * Transmission project are granted a special exemption to clause 2(b)
+ * so that the bulk of its code can remain under the MIT license.
+ * This exemption does not extend to derived works not owned by
+ * the Transmission project.
+ *
+ * $Id$
+ */
+
+#ifndef __TRANSMISSION__
+ #error only libtransmission should #include this header.
+#endif
+
+#ifndef TR_TIMER_WHEEL_H
+#define TR_TIMER_WHEEL_H
+
+/**
+ * @addtogroup utils Utilities
+ * @{
+ */
+
+/**
+ * A timing wheel for the session's periodic pulses.
+ *
+ * Instead of one libevent timer per object, the session keeps a single
+ * libevent timer that wakes for the next slot of the wheel that has
+ * anything in it. All the callbacks that come due in the same tick are
+ * run together, and if they run over the tick's budget, the rest wait for
+ * the next tick so that a burst of pulses can't starve the peers' I/O.
+ *
+ * How long each kind of pulse takes, and how late it runs, is tracked
+ * by name and logged when the session closes.
+ *
+ * The wheel isn't thread-safe; callers must hold the session lock.
+ */
+typedef struct tr_wheel tr_wheel;
+
+typedef struct tr_wheelTimer tr_wheelTimer;
+
+typedef void ( *tr_wheel_func )( void * user_data );
+
+tr_wheel * tr_wheelNew( tr_session * session );
+
+void tr_wheelFree( tr_wheel * wheel );
+
+/**
+ * @brief Create a timer. It won't fire until tr_wheelTimerAddMsec() is called.
+ * @param name groups this timer's statistics with others of its kind;
+ *             it must remain valid for the life of the session.
+ */
+tr_wheelTimer * tr_wheelTimerNew( tr_session     * session,
+                                  const char     * name,
+                                  tr_wheel_func    func,
+                                  void           * user_data );
+
+/** @brief (Re)schedule the timer to fire once, msec milliseconds from now. */
+void tr_wheelTimerAddMsec( tr_wheelTimer * timer, int msec );
+
+/** @brief Unschedule and free the timer. */
+void tr_wheelTimerFree( tr_wheelTimer * timer );
+
+/* @} */
+#endif
@@ -42,6 +42,7 @@ struct tr_ctor
     bool                    isSet_delete;
     tr_benc                 metainfo;
     char *                  sourceFile;
+    tr_torrent_prefetch *   prefetch;
 
     struct optional_args    optionalArgs[2];
 
@@ -81,6 +82,7 @@ clearMetainfo( tr_ctor * ctor )
         tr_bencFree( &ctor->metainfo );
     }
 
+    ctor->prefetch = NULL;
     setSourceFile( ctor, NULL );
 }
 
@@ -186,6 +188,19 @@ tr_ctorSetMetainfoFromHash( tr_ctor *    ctor,
     return err;
 }
 
+void
+tr_ctorSetPrefetch( tr_ctor * ctor, tr_torrent_prefetch * prefetch )
+{
+    clearMetainfo( ctor );
+    ctor->prefetch = prefetch;
+}
+
+tr_torrent_prefetch*
+tr_ctorGetPrefetch( const tr_ctor * ctor )
+{
+    return ctor->prefetch;
+}
+
 /***
 ****
 ***/
@@ -50,6 +50,7 @@
 #include "session.h"
 #include "torrent.h"
 #include "torrent-magnet.h"
+#include "tr-dht.h" /* tr_dhtTorrentStarted() */
 #include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 #include "verify.h"
@@ -83,41 +84,124 @@ tr_torrentId( const tr_torrent * tor )
     return tor->uniqueId;
 }
 
-tr_torrent*
-tr_torrentFindFromId( tr_session * session, int id )
+/***
+****  The session keeps its torrents sorted by id, hash, and obfuscated hash
+****  so that RPC requests and incoming peers don't have to walk the list.
+***/
+
+static int
+compareTorrentToId( const void * va, const void * vb )
 {
-    tr_torrent * tor = NULL;
+    const tr_torrent * a = va;
+    const int b = *(const int*)vb;
 
-    while(( tor = tr_torrentNext( session, tor )))
-        if( tor->uniqueId == id )
-            return tor;
+    if( a->uniqueId != b )
+        return a->uniqueId < b ? -1 : 1;
+
+    return 0;
+}
+
+static int
+compareTorrentsById( const void * va, const void * vb )
+{
+    const tr_torrent * b = vb;
+    return compareTorrentToId( va, &b->uniqueId );
+}
+
+static int
+compareTorrentToHash( const void * va, const void * vb )
+{
+    const tr_torrent * a = va;
+    return memcmp( a->info.hash, vb, SHA_DIGEST_LENGTH );
+}
+
+static int
+compareTorrentsByHash( const void * va, const void * vb )
+{
+    const tr_torrent * b = vb;
+    return compareTorrentToHash( va, b->info.hash );
+}
+
+static int
+compareTorrentToObfuscatedHash( const void * va, const void * vb )
+{
+    const tr_torrent * a = va;
+    return memcmp( a->obfuscatedHash, vb, SHA_DIGEST_LENGTH );
+}
+
+static int
+compareTorrentsByObfuscatedHash( const void * va, const void * vb )
+{
+    const tr_torrent * b = vb;
+    return compareTorrentToObfuscatedHash( va, b->obfuscatedHash );
+}
+
+static void
+sessionAddTorrent( tr_session * session, tr_torrent * tor )
+{
+    /* ids only go up, so the torrent with the highest id is the last one */
+    tr_torrent * last = tr_ptrArrayBack( &session->torrentsById );
+
+    assert( last == NULL || last->uniqueId < tor->uniqueId );
+    assert( tr_ptrArrayFindSorted( &session->torrentsByHash, tor->info.hash, compareTorrentToHash ) == NULL );
+
+    if( last == NULL )
+        session->torrentList = tor;
+    else
+        last->next = tor;
+    session->torrentCount++;
+
+    tr_ptrArrayAppend( &session->torrentsById, tor );
+    tr_ptrArrayInsertSorted( &session->torrentsByHash, tor, compareTorrentsByHash );
+    tr_ptrArrayInsertSorted( &session->torrentsByObfuscatedHash, tor, compareTorrentsByObfuscatedHash );
+}
+
+static void
+sessionRemoveTorrent( tr_session * session, tr_torrent * tor )
+{
+    bool found;
+    const int pos = tr_ptrArrayLowerBound( &session->torrentsById, tor, compareTorrentsById, &found );
+
+    assert( found );
+
+    if( pos == 0 )
+        session->torrentList = tor->next;
+    else {
+        tr_torrent * prev = tr_ptrArrayNth( &session->torrentsById, pos - 1 );
+        prev->next = tor->next;
+    }
+
+    assert( session->torrentCount >= 1 );
+    session->torrentCount--;
+
+    tr_ptrArrayRemove( &session->torrentsById, pos );
+    tr_ptrArrayRemoveSorted( &session->torrentsByHash, tor, compareTorrentsByHash );
+    tr_ptrArrayRemoveSorted( &session->torrentsByObfuscatedHash, tor, compareTorrentsByObfuscatedHash );
+}
 
-    return NULL;
+tr_torrent*
+tr_torrentFindFromId( tr_session * session, int id )
+{
+    return tr_ptrArrayFindSorted( &session->torrentsById, &id, compareTorrentToId );
 }
 
 tr_torrent*
 tr_torrentFindFromHashString( tr_session *  session, const char * str )
 {
-    tr_torrent * tor = NULL;
+    uint8_t hash[SHA_DIGEST_LENGTH];
 
-    while(( tor = tr_torrentNext( session, tor )))
-        if( !evutil_ascii_strcasecmp( str, tor->info.hashString ) )
-            return tor;
+    if( ( strlen( str ) != SHA_DIGEST_LENGTH * 2 )
+        || ( strspn( str, "0123456789abcdefABCDEF" ) != SHA_DIGEST_LENGTH * 2 ) )
+        return NULL;
 
-    return NULL;
+    tr_hex_to_sha1( hash, str );
+    return tr_torrentFindFromHash( session, hash );
 }
 
 tr_torrent*
 tr_torrentFindFromHash( tr_session * session, const uint8_t * torrentHash )
 {
-    tr_torrent * tor = NULL;
-
-    while(( tor = tr_torrentNext( session, tor )))
-        if( *tor->info.hash == *torrentHash )
-            if( !memcmp( tor->info.hash, torrentHash, SHA_DIGEST_LENGTH ) )
-                return tor;
-
-    return NULL;
+    return tr_ptrArrayFindSorted( &session->torrentsByHash, torrentHash, compareTorrentToHash );
 }
 
 tr_torrent*
@@ -139,14 +223,9 @@ tr_torrent*
 tr_torrentFindFromObfuscatedHash( tr_session * session,
                                   const uint8_t * obfuscatedTorrentHash )
 {
-    tr_torrent * tor = NULL;
-
-    while(( tor = tr_torrentNext( session, tor )))
-        if( !memcmp( tor->obfuscatedHash, obfuscatedTorrentHash,
-                     SHA_DIGEST_LENGTH ) )
-            return tor;
-
-    return NULL;
+    return tr_ptrArrayFindSorted( &session->torrentsByObfuscatedHash,
+                                  obfuscatedTorrentHash,
+                                  compareTorrentToObfuscatedHash );
 }
 
 bool
@@ -179,7 +258,10 @@ tr_torrentSetSpeedLimit_Bps( tr_torrent * tor, tr_direction dir, unsigned int Bp
     assert( tr_isDirection( dir ) );
 
     if( tr_bandwidthSetDesiredSpeed_Bps( &tor->bandwidth, dir, Bps ) )
+    {
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
+    }
 }
 void
 tr_torrentSetSpeedLimit_KBps( tr_torrent * tor, tr_direction dir, unsigned int KBps )
@@ -208,7 +290,10 @@ tr_torrentUseSpeedLimit( tr_torrent * tor, tr_direction dir, bool do_use )
     assert( tr_isDirection( dir ) );
 
     if( tr_bandwidthSetLimited( &tor->bandwidth, dir, do_use ) )
+    {
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
+    }
 }
 
 bool
@@ -231,7 +316,10 @@ tr_torrentUseSessionLimits( tr_torrent * tor, bool doUse )
     changed |= tr_bandwidthHonorParentLimits( &tor->bandwidth, TR_DOWN, doUse );
 
     if( changed )
+    {
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
+    }
 }
 
 bool
@@ -257,6 +345,7 @@ tr_torrentSetRatioMode( tr_torrent *  tor, tr_ratiolimit mode )
         tor->ratioLimitMode = mode;
 
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     }
 }
 
@@ -278,6 +367,7 @@ tr_torrentSetRatioLimit( tr_torrent * tor, double desiredRatio )
         tor->desiredRatio = desiredRatio;
 
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     }
 }
 
@@ -362,6 +452,7 @@ tr_torrentSetIdleMode( tr_torrent *  tor, tr_idlelimit mode )
         tor->idleLimitMode = mode;
 
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     }
 }
 
@@ -383,6 +474,7 @@ tr_torrentSetIdleLimit( tr_torrent * tor, uint16_t idleMinutes )
         tor->idleLimitMinutes = idleMinutes;
 
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     }
 }
 
@@ -459,6 +551,7 @@ tr_torrentCheckSeedLimit( tr_torrent * tor )
 
         tor->isStopping = true;
         tor->finishedSeedingByIdle = true;
+        tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 
         /* maybe notify the client */
         if( tor->idle_limit_hit_func != NULL )
@@ -482,6 +575,7 @@ tr_torrentSetLocalError( tr_torrent * tor, const char * fmt, ... )
     tor->errorTracker[0] = '\0';
     evutil_vsnprintf( tor->errorString, sizeof( tor->errorString ), fmt, ap );
     va_end( ap );
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 
     tr_torerr( tor, "%s", tor->errorString );
 
@@ -495,6 +589,7 @@ tr_torrentClearError( tr_torrent * tor )
     tor->error = TR_STAT_OK;
     tor->errorString[0] = '\0';
     tor->errorTracker[0] = '\0';
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 }
 
 static void
@@ -524,6 +619,7 @@ onTrackerResponse( tr_torrent * tor, const tr_tracker_event * event, void * unus
             tor->error = TR_STAT_TRACKER_WARNING;
             tr_strlcpy( tor->errorTracker, event->tracker, sizeof( tor->errorTracker ) );
             tr_strlcpy( tor->errorString, event->text, sizeof( tor->errorString ) );
+            tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
             break;
 
         case TR_TRACKER_ERROR:
@@ -531,6 +627,7 @@ onTrackerResponse( tr_torrent * tor, const tr_tracker_event * event, void * unus
             tor->error = TR_STAT_TRACKER_ERROR;
             tr_strlcpy( tor->errorTracker, event->tracker, sizeof( tor->errorTracker ) );
             tr_strlcpy( tor->errorString, event->text, sizeof( tor->errorString ) );
+            tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
             break;
 
         case TR_TRACKER_ERROR_CLEAR:
@@ -748,6 +845,8 @@ void
 tr_torrentGotNewInfoDict( tr_torrent * tor )
 {
     torrentInitFromInfo( tor );
+    tr_torrentMarkChanged( tor, TR_CHANGED_INFO );
+    tr_torrentMarkChanged( tor, TR_CHANGED_PROGRESS );
 
     tr_peerMgrOnTorrentGotMetainfo( tor );
 
@@ -783,6 +882,7 @@ setLocalErrorIfFilesDisappeared( tr_torrent * tor )
 static void
 torrentInit( tr_torrent * tor, const tr_ctor * ctor )
 {
+    int i;
     int doStart;
     uint64_t loaded;
     const char * dir;
@@ -866,15 +966,11 @@ torrentInit( tr_torrent * tor, const tr_ctor * ctor )
     }
 
     /* add the torrent to tr_session.torrentList */
-    session->torrentCount++;
-    if( session->torrentList == NULL )
-        session->torrentList = tor;
-    else {
-        tr_torrent * it = session->torrentList;
-        while( it->next != NULL )
-            it = it->next;
-        it->next = tor;
-    }
+    sessionAddTorrent( session, tor );
+
+    /* everything about a new torrent is news to torrent-get's "since" */
+    for( i=0; i<TR_CHANGED_COUNT; ++i )
+        tr_torrentMarkChanged( tor, i );
 
     /* if we don't have a local .torrent file already, assume the torrent is new */
     isNewTorrent = stat( tor->info.torrent, &st );
@@ -918,17 +1014,35 @@ torrentParseImpl( const tr_ctor * ctor, tr_info * setmeInfo,
     tr_info         tmp;
     const tr_benc * metainfo;
     tr_session    * session = tr_ctorGetSession( ctor );
+    tr_torrent_prefetch * prefetch = tr_ctorGetPrefetch( ctor );
     tr_parse_result result = TR_PARSE_OK;
 
     if( setmeInfo == NULL )
         setmeInfo = &tmp;
     memset( setmeInfo, 0, sizeof( tr_info ) );
 
-    if( tr_ctorGetMetainfo( ctor, &metainfo ) )
-        return TR_PARSE_ERR;
+    if( prefetch != NULL )
+    {
+        /* it's already been parsed; take it over from the prefetch */
+        didParse = prefetch->isParsed;
+        if( didParse )
+        {
+            *setmeInfo = prefetch->info;
+            hasInfo = prefetch->hasInfo;
+            if( dictLength != NULL )
+                *dictLength = prefetch->infoDictLength;
+            prefetch->isParsed = false;
+        }
+    }
+    else
+    {
+        if( tr_ctorGetMetainfo( ctor, &metainfo ) )
+            return TR_PARSE_ERR;
+
+        didParse = tr_metainfoParse( session, metainfo, setmeInfo,
+                                     &hasInfo, dictLength );
+    }
 
-    didParse = tr_metainfoParse( session, metainfo, setmeInfo,
-                                 &hasInfo, dictLength );
     doFree = didParse && ( setmeInfo == &tmp );
 
     if( !didParse )
@@ -955,6 +1069,41 @@ tr_torrentParse( const tr_ctor * ctor, tr_info * setmeInfo )
     return torrentParseImpl( ctor, setmeInfo, NULL, NULL );
 }
 
+void
+tr_torrentPrefetch( const tr_session     * session,
+                    const char           * filename,
+                    tr_torrent_prefetch  * setme )
+{
+    const tr_benc * metainfo;
+    tr_ctor * ctor = tr_ctorNew( NULL ); /* NULL: don't read the session's settings */
+
+    memset( setme, 0, sizeof( tr_torrent_prefetch ) );
+
+    if( !tr_ctorSetMetainfoFromFile( ctor, filename )
+        && !tr_ctorGetMetainfo( ctor, &metainfo ) )
+        setme->isParsed = tr_metainfoParse( session, metainfo, &setme->info,
+                                            &setme->hasInfo,
+                                            &setme->infoDictLength );
+
+    if( setme->isParsed )
+        setme->hasResume = !tr_torrentReadResume( session, &setme->info,
+                                                  &setme->resume );
+
+    tr_ctorFree( ctor );
+}
+
+void
+tr_torrentPrefetchFree( tr_torrent_prefetch * prefetch )
+{
+    if( prefetch->isParsed )
+        tr_metainfoFree( &prefetch->info );
+    if( prefetch->hasResume )
+        tr_bencFree( &prefetch->resume );
+
+    prefetch->isParsed = false;
+    prefetch->hasResume = false;
+}
+
 tr_torrent *
 tr_torrentNew( const tr_ctor * ctor, int * setmeError )
 {
@@ -1002,6 +1151,7 @@ tr_torrentSetDownloadDir( tr_torrent * tor, const char * path )
         tr_free( tor->downloadDir );
         tor->downloadDir = tr_strdup( path );
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     }
 
     refreshCurrentDir( tor );
@@ -1084,6 +1234,7 @@ tr_torrentSetVerifyState( tr_torrent * tor, tr_verify_state state )
 
     tor->verifyState = state;
     tor->anyDate = tr_time( );
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 }
 
 static tr_torrent_activity
@@ -1164,6 +1315,67 @@ getVerifyProgress( const tr_torrent * tor )
     return d;
 }
 
+static int
+torrentGetEta( tr_torrent          * tor,
+               tr_torrent_activity   activity,
+               uint64_t              now,
+               double                pieceDownloadSpeed_KBps,
+               double                pieceUploadSpeed_KBps,
+               uint64_t              leftUntilDone,
+               uint64_t              desiredAvailable,
+               bool                  seedRatioApplies,
+               uint64_t              seedRatioBytesLeft )
+{
+    int eta;
+
+    switch( activity )
+    {
+        /* etaXLSpeed exists because if we use the piece speed directly,
+         * brief fluctuations cause the ETA to jump all over the place.
+         * so, etaXLSpeed is a smoothed-out version of the piece speed
+         * to dampen the effect of fluctuations */
+
+        case TR_STATUS_DOWNLOAD:
+            if( ( tor->etaDLSpeedCalculatedAt + 800 ) < now ) {
+                tor->etaDLSpeed_KBps = ( ( tor->etaDLSpeedCalculatedAt + 4000 ) < now )
+                    ? pieceDownloadSpeed_KBps /* if no recent previous speed, no need to smooth */
+                    : ((tor->etaDLSpeed_KBps*4.0) + pieceDownloadSpeed_KBps)/5.0; /* smooth across 5 readings */
+                tor->etaDLSpeedCalculatedAt = now;
+            }
+
+            if( leftUntilDone > desiredAvailable )
+                eta = TR_ETA_NOT_AVAIL;
+            else if( tor->etaDLSpeed_KBps < 1 )
+                eta = TR_ETA_UNKNOWN;
+            else
+                eta = leftUntilDone / toSpeedBytes(tor->etaDLSpeed_KBps);
+            break;
+
+        case TR_STATUS_SEED:
+            if( !seedRatioApplies )
+                eta = TR_ETA_NOT_AVAIL;
+            else {
+                if( ( tor->etaULSpeedCalculatedAt + 800 ) < now ) {
+                    tor->etaULSpeed_KBps = ( ( tor->etaULSpeedCalculatedAt + 4000 ) < now )
+                        ? pieceUploadSpeed_KBps /* if no recent previous speed, no need to smooth */
+                        : ((tor->etaULSpeed_KBps*4.0) + pieceUploadSpeed_KBps)/5.0; /* smooth across 5 readings */
+                    tor->etaULSpeedCalculatedAt = now;
+                }
+                if( tor->etaULSpeed_KBps < 1 )
+                    eta = TR_ETA_UNKNOWN;
+                else
+                    eta = seedRatioBytesLeft / toSpeedBytes(tor->etaULSpeed_KBps);
+            }
+            break;
+
+        default:
+            eta = TR_ETA_NOT_AVAIL;
+            break;
+    }
+
+    return eta;
+}
+
 const tr_stat *
 tr_torrentStat( tr_torrent * tor )
 {
@@ -1233,59 +1445,16 @@ tr_torrentStat( tr_torrent * tor )
     seedRatioApplies = tr_torrentGetSeedRatioBytes( tor, &seedRatioBytesLeft,
                                                          &seedRatioBytesGoal );
 
-    switch( s->activity )
-    {
-        /* etaXLSpeed exists because if we use the piece speed directly,
-         * brief fluctuations cause the ETA to jump all over the place.
-         * so, etaXLSpeed is a smoothed-out version of the piece speed
-         * to dampen the effect of fluctuations */
-
-        case TR_STATUS_DOWNLOAD:
-            if( ( tor->etaDLSpeedCalculatedAt + 800 ) < now ) {
-                tor->etaDLSpeed_KBps = ( ( tor->etaDLSpeedCalculatedAt + 4000 ) < now )
-                    ? s->pieceDownloadSpeed_KBps /* if no recent previous speed, no need to smooth */
-                    : ((tor->etaDLSpeed_KBps*4.0) + s->pieceDownloadSpeed_KBps)/5.0; /* smooth across 5 readings */
-                tor->etaDLSpeedCalculatedAt = now;
-            }
+    s->eta = torrentGetEta( tor, s->activity, now,
+                            s->pieceDownloadSpeed_KBps, s->pieceUploadSpeed_KBps,
+                            s->leftUntilDone, s->desiredAvailable,
+                            seedRatioApplies, seedRatioBytesLeft );
 
-            if( s->leftUntilDone > s->desiredAvailable )
-                s->eta = TR_ETA_NOT_AVAIL;
-            else if( tor->etaDLSpeed_KBps < 1 )
-                s->eta = TR_ETA_UNKNOWN;
-            else
-                s->eta = s->leftUntilDone / toSpeedBytes(tor->etaDLSpeed_KBps);
-
-            s->etaIdle = TR_ETA_NOT_AVAIL;
-            break;
-
-        case TR_STATUS_SEED: {
-            if( !seedRatioApplies )
-                s->eta = TR_ETA_NOT_AVAIL;
-            else {
-                if( ( tor->etaULSpeedCalculatedAt + 800 ) < now ) {
-                    tor->etaULSpeed_KBps = ( ( tor->etaULSpeedCalculatedAt + 4000 ) < now )
-                        ? s->pieceUploadSpeed_KBps /* if no recent previous speed, no need to smooth */
-                        : ((tor->etaULSpeed_KBps*4.0) + s->pieceUploadSpeed_KBps)/5.0; /* smooth across 5 readings */
-                    tor->etaULSpeedCalculatedAt = now;
-                }
-                if( tor->etaULSpeed_KBps < 1 )
-                    s->eta = TR_ETA_UNKNOWN;
-                else
-                    s->eta = seedRatioBytesLeft / toSpeedBytes(tor->etaULSpeed_KBps);
-            }
-
-            if( tor->etaULSpeed_KBps < 1 && tr_torrentGetSeedIdle( tor, &seedIdleMinutes ) )
-                s->etaIdle = seedIdleMinutes * 60 - s->idleSecs;
-            else
-                s->etaIdle = TR_ETA_NOT_AVAIL;
-            break;
-        }
-
-        default:
-            s->eta = TR_ETA_NOT_AVAIL;
-            s->etaIdle = TR_ETA_NOT_AVAIL;
-            break;
-    }
+    if( ( s->activity == TR_STATUS_SEED ) && ( tor->etaULSpeed_KBps < 1 )
+                                          && tr_torrentGetSeedIdle( tor, &seedIdleMinutes ) )
+        s->etaIdle = seedIdleMinutes * 60 - s->idleSecs;
+    else
+        s->etaIdle = TR_ETA_NOT_AVAIL;
 
     /* s->haveValid is here to make sure a torrent isn't marked 'finished'
      * when the user hits "uncheck all" prior to starting the torrent... */
@@ -1307,6 +1476,54 @@ tr_torrentStat( tr_torrent * tor )
     return s;
 }
 
+void
+tr_torrentCheckLiveStats( tr_torrent * tor )
+{
+    struct tr_live_stats l;
+    uint64_t seedRatioBytesLeft;
+    uint64_t seedRatioBytesGoal;
+    bool seedRatioApplies;
+    uint64_t leftUntilDone;
+    tr_torrent_activity activity;
+    const uint64_t now = tr_time_msec( );
+
+    assert( tr_isTorrent( tor ) );
+    tr_torrentLock( tor );
+
+    /* zeroed so that the padding compares equal too */
+    memset( &l, 0, sizeof( l ) );
+
+    activity = tr_torrentGetActivity( tor );
+    l.pieceSpeed_Bps[TR_UP] = tr_bandwidthGetPieceSpeed_Bps( &tor->bandwidth, now, TR_UP );
+    l.pieceSpeed_Bps[TR_DOWN] = tr_bandwidthGetPieceSpeed_Bps( &tor->bandwidth, now, TR_DOWN );
+    l.isStalled = tr_torrentIsStalled( tor );
+    tr_peerMgrTorrentStats( tor, &l.peersConnected,
+                                 &l.webseedsSendingToUs,
+                                 &l.peersSendingToUs,
+                                 &l.peersGettingFromUs,
+                                 l.peersFrom );
+
+    /* desiredAvailable only matters to the eta while downloading */
+    leftUntilDone = tr_cpLeftUntilDone( &tor->completion );
+    if( activity == TR_STATUS_DOWNLOAD )
+        l.desiredAvailable = tr_peerMgrGetDesiredAvailable( tor );
+    seedRatioApplies = tr_torrentGetSeedRatioBytes( tor, &seedRatioBytesLeft,
+                                                         &seedRatioBytesGoal );
+    l.eta = torrentGetEta( tor, activity, now,
+                           toSpeedKBps( l.pieceSpeed_Bps[TR_DOWN] ),
+                           toSpeedKBps( l.pieceSpeed_Bps[TR_UP] ),
+                           leftUntilDone, l.desiredAvailable,
+                           seedRatioApplies, seedRatioBytesLeft );
+
+    if( memcmp( &l, &tor->liveStats, sizeof( l ) ) )
+    {
+        tor->liveStats = l;
+        tr_torrentMarkChanged( tor, TR_CHANGED_TIME );
+    }
+
+    tr_torrentUnlock( tor );
+}
+
 /***
 ****
 ***/
@@ -1492,8 +1709,10 @@ tr_torrentSetHasPiece( tr_torrent *     tor,
 
     if( has )
         tr_cpPieceAdd( &tor->completion, pieceIndex );
-    else
+    else {
         tr_cpPieceRem( &tor->completion, pieceIndex );
+        tr_torrentResumePieceRemoved( tor, pieceIndex );
+    }
 }
 
 /***
@@ -1521,22 +1740,12 @@ freeTorrent( tr_torrent * tor )
     tr_announcerRemoveTorrent( session->announcer, tor );
 
     tr_cpDestruct( &tor->completion );
+    tr_torrentCloseResume( tor );
 
     tr_free( tor->downloadDir );
     tr_free( tor->incompleteDir );
 
-    if( tor == session->torrentList )
-        session->torrentList = tor->next;
-    else for( t = session->torrentList; t != NULL; t = t->next ) {
-        if( t->next == tor ) {
-            t->next = tor->next;
-            break;
-        }
-    }
-
-    /* decrement the torrent count */
-    assert( session->torrentCount >= 1 );
-    session->torrentCount--;
+    sessionRemoveTorrent( session, tor );
 
     /* resequence the queue positions */
     t = NULL;
@@ -1544,6 +1753,7 @@ freeTorrent( tr_torrent * tor )
         if( t->queuePosition > tor->queuePosition ) {
             t->queuePosition--;
             t->anyDate = now;
+            tr_torrentMarkChanged( t, TR_CHANGED_STATUS );
         }
     }
     assert( queueIsSequenced( session ) );
@@ -1580,13 +1790,13 @@ torrentStartImpl( void * vtor )
     tor->isRunning = true;
     tor->completeness = tr_cpGetStatus( &tor->completion );
     tor->startDate = tor->anyDate = now;
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
     tr_torrentClearError( tor );
     tor->finishedSeedingByIdle = false;
 
     tr_torrentResetTransferStats( tor );
     tr_announcerTorrentStarted( tor );
-    tor->dhtAnnounceAt = now + tr_cryptoWeakRandInt( 20 );
-    tor->dhtAnnounce6At = now + tr_cryptoWeakRandInt( 20 );
+    tr_dhtTorrentStarted( tor );
     tor->lpdAnnounceAt = now;
     tr_peerMgrStartTorrent( tor );
 
@@ -1677,6 +1887,7 @@ torrentStart( tr_torrent * tor, bool bypass_queue )
     tr_peerIdInit( tor->peer_id );
     tor->isRunning = 1;
     tr_torrentSetDirty( tor );
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
     tr_runInEventThread( tor->session, torrentStartImpl, tor );
 
     tr_sessionUnlock( tor->session );
@@ -1778,6 +1989,7 @@ stopTorrent( void * vtor )
     tr_peerMgrStopTorrent( tor );
     tr_announcerTorrentStopped( tor );
     tr_cacheFlushTorrent( tor->session->cache, tor );
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 
     tr_fdTorrentClose( tor->session, tor->uniqueId );
 
@@ -1799,6 +2011,7 @@ tr_torrentStop( tr_torrent * tor )
         tor->isRunning = 0;
         tor->isStopping = 0;
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
         tr_runInEventThread( tor->session, stopTorrent, tor );
 
         tr_sessionUnlock( tor->session );
@@ -1813,9 +2026,10 @@ closeTorrent( void * vtor )
 
     assert( tr_isTorrent( tor ) );
 
-    d = tr_bencListAddDict( &tor->session->removedTorrents, 2 );
+    d = tr_bencListAddDict( &tor->session->removedTorrents, 3 );
     tr_bencDictAddInt( d, "id", tor->uniqueId );
     tr_bencDictAddInt( d, "date", tr_time( ) );
+    tr_bencDictAddInt( d, "seq", tor->session->rpcChangeSeq );
 
     tr_torinf( tor, "%s", _( "Removing torrent" ) );
 
@@ -2050,6 +2264,7 @@ tr_torrentRecheckCompleteness( tr_torrent * tor )
         }
 
         tor->completeness = completeness;
+        tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
         tr_fdTorrentClose( tor->session, tor->uniqueId );
 
         if( tr_torrentIsSeed( tor ) )
@@ -2145,6 +2360,7 @@ tr_torrentSetFilePriorities( tr_torrent             * tor,
         if( files[i] < tor->info.fileCount )
             tr_torrentInitFilePriority( tor, files[i], priority );
     tr_torrentSetDirty( tor );
+    tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     tr_peerMgrRebuildRequests( tor );
 
     tr_torrentUnlock( tor );
@@ -2257,6 +2473,7 @@ tr_torrentSetFileDLs( tr_torrent             * tor,
 
     tr_torrentInitFileDLs( tor, files, fileCount, doDownload );
     tr_torrentSetDirty( tor );
+    tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     tr_peerMgrRebuildRequests( tor );
 
     tr_torrentUnlock( tor );
@@ -2285,6 +2502,7 @@ tr_torrentSetPriority( tr_torrent * tor, tr_priority_t priority )
         tor->bandwidth.priority = priority;
 
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     }
 }
 
@@ -2303,6 +2521,7 @@ tr_torrentSetPeerLimit( tr_torrent * tor,
         tor->maxConnectedPeers = maxConnectedPeers;
 
         tr_torrentSetDirty( tor );
+        tr_torrentMarkChanged( tor, TR_CHANGED_SETTINGS );
     }
 }
 
@@ -2585,6 +2804,7 @@ tr_torrentSetAnnounceList( tr_torrent             * tor,
 
             tr_metainfoFree( &tmpInfo );
             tr_bencToFile( &metainfo, TR_FMT_BENC, tor->info.torrent );
+            tr_torrentMarkChanged( tor, TR_CHANGED_INFO );
         }
 
         /* cleanup */
@@ -2628,6 +2848,7 @@ tr_torrentSetAddedDate( tr_torrent * tor,
 
     tor->addedDate = t;
     tor->anyDate = MAX( tor->anyDate, tor->addedDate );
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 }
 
 void
@@ -2637,6 +2858,7 @@ tr_torrentSetActivityDate( tr_torrent * tor, time_t t )
 
     tor->activityDate = t;
     tor->anyDate = MAX( tor->anyDate, tor->activityDate );
+    tr_torrentMarkChanged( tor, TR_CHANGED_TRANSFER );
 }
 
 void
@@ -2647,6 +2869,7 @@ tr_torrentSetDoneDate( tr_torrent * tor,
 
     tor->doneDate = t;
     tor->anyDate = MAX( tor->anyDate, tor->doneDate );
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 }
 
 /**
@@ -3236,6 +3459,7 @@ tr_torrentSetQueuePosition( tr_torrent * tor, int pos )
             if( ( old_pos <= walk->queuePosition ) && ( walk->queuePosition <= pos ) ) {
                 walk->queuePosition--;
                 walk->anyDate = now;
+                tr_torrentMarkChanged( walk, TR_CHANGED_STATUS );
             }
         }
 
@@ -3243,6 +3467,7 @@ tr_torrentSetQueuePosition( tr_torrent * tor, int pos )
             if( ( pos <= walk->queuePosition ) && ( walk->queuePosition < old_pos ) ) {
                 walk->queuePosition++;
                 walk->anyDate = now;
+                tr_torrentMarkChanged( walk, TR_CHANGED_STATUS );
             }
         }
 
@@ -3252,6 +3477,7 @@ tr_torrentSetQueuePosition( tr_torrent * tor, int pos )
 
     tor->queuePosition = MIN( pos, (back+1) );
     tor->anyDate = now;
+    tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
 
     assert( queueIsSequenced( tor->session ) );
 }
@@ -3310,6 +3536,7 @@ torrentSetQueued( tr_torrent * tor, bool queued )
     {
         tor->isQueued = queued;
         tor->anyDate = tr_time( );
+        tr_torrentMarkChanged( tor, TR_CHANGED_STATUS );
     }
 }
 
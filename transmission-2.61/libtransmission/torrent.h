@@ -38,6 +38,39 @@ void        tr_ctorInitTorrentPriorities( const tr_ctor * ctor, tr_torrent * tor
 
 void        tr_ctorInitTorrentWanted( const tr_ctor * ctor, tr_torrent * tor );
 
+/**
+ * The parts of loading a torrent that don't need the session lock:
+ * reading and parsing its .torrent and .resume files, and hashing its
+ * info dict. tr_sessionLoadTorrents() does these on worker threads and
+ * then hands the results to tr_torrentNew() via tr_ctorSetPrefetch().
+ */
+typedef struct tr_torrent_prefetch
+{
+    /* true if info was parsed and hasn't been handed off to a torrent yet */
+    bool        isParsed;
+    bool        hasInfo;
+    int         infoDictLength;
+    tr_info     info;
+
+    /* true if resume was read and hasn't been handed off to a torrent yet */
+    bool        hasResume;
+    tr_benc     resume;
+}
+tr_torrent_prefetch;
+
+/* this is safe to call from any thread */
+void        tr_torrentPrefetch( const tr_session     * session,
+                                const char           * filename,
+                                tr_torrent_prefetch  * setme );
+
+void        tr_torrentPrefetchFree( tr_torrent_prefetch * prefetch );
+
+/* tr_torrentNew() will take ownership of the prefetched info and resume
+   instead of parsing the ctor's metainfo. Pass NULL to clear it. */
+void        tr_ctorSetPrefetch( tr_ctor * ctor, tr_torrent_prefetch * prefetch );
+
+tr_torrent_prefetch* tr_ctorGetPrefetch( const tr_ctor * ctor );
+
 /**
 ***
 **/
@@ -129,7 +162,41 @@ void             tr_torrentSetVerifyState( tr_torrent      * tor,
 
 tr_torrent_activity tr_torrentGetActivity( tr_torrent * tor );
 
+/**
+ * The kinds of change that torrent-get's "since" argument tracks.
+ * Wherever one of these happens, tr_torrentMarkChanged() stamps it
+ * with the session's current change sequence number. See rpcimpl.c
+ */
+typedef enum
+{
+    TR_CHANGED_INFO,      /* the metainfo, trackers and webseeds */
+    TR_CHANGED_SETTINGS,  /* the things set by tr_torrentSet*() */
+    TR_CHANGED_STATUS,    /* activity, errors, queue position, dates */
+    TR_CHANGED_PROGRESS,  /* which blocks we have */
+    TR_CHANGED_TRANSFER,  /* the upload, download and corrupt totals */
+    TR_CHANGED_TRACKERS,  /* announce and scrape state */
+    TR_CHANGED_TIME,      /* the speeds, eta and peers, which change just by
+                             time passing. see tr_torrentCheckLiveStats() */
+    TR_CHANGED_COUNT
+}
+tr_torrent_change;
+
+/* the stats behind TR_CHANGED_TIME, as of the last time they were checked */
+struct tr_live_stats
+{
+    unsigned int  pieceSpeed_Bps[2];
+    int           eta;
+    bool          isStalled;
+    uint64_t      desiredAvailable;
+    int           peersConnected;
+    int           webseedsSendingToUs;
+    int           peersSendingToUs;
+    int           peersGettingFromUs;
+    int           peersFrom[TR_PEER_FROM__MAX];
+};
+
 struct tr_incomplete_metadata;
+struct tr_resume_store;
 
 /** @brief Torrent object */
 struct tr_torrent
@@ -190,6 +257,9 @@ struct tr_torrent
 
     struct tr_completion       completion;
 
+    /* the binary resume file, when that's in use. see resume-store.h */
+    struct tr_resume_store   * resumeStore;
+
     tr_completeness            completeness;
 
     struct tr_torrent_tiers  * tiers;
@@ -255,6 +325,10 @@ struct tr_torrent
     time_t                     lastStatTime;
     tr_stat                    stats;
 
+    /* when each kind of change last happened. see tr_torrentMarkChanged() */
+    uint32_t                   changeSeq[TR_CHANGED_COUNT];
+    struct tr_live_stats       liveStats;
+
     tr_torrent *               next;
 
     int                        uniqueId;
@@ -369,6 +443,24 @@ static inline bool tr_isTorrent( const tr_torrent * tor )
         && ( tr_isSession( tor->session ) );
 }
 
+/**
+ * Check whether the torrent's speeds, eta or peers have changed since the
+ * last check, and if so, stamp it with TR_CHANGED_TIME. This is called once
+ * a second for torrents that are running or that have just stopped, so that
+ * idle torrents don't look changed just because time's passed.
+ */
+void tr_torrentCheckLiveStats( tr_torrent * tor );
+
+/* note that some of the torrent's torrent-get fields have changed */
+static inline
+void tr_torrentMarkChanged( tr_torrent * tor, tr_torrent_change what )
+{
+    assert( tr_isTorrent( tor ) );
+    assert( what < TR_CHANGED_COUNT );
+
+    tor->changeSeq[what] = tor->session->rpcChangeSeq;
+}
+
 /* set a flag indicating that the torrent's .resume file
  * needs to be saved when the torrent is closed */
 static inline
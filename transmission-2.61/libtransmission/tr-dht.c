@@ -52,12 +52,14 @@
 #include "transmission.h"
 #include "bencode.h"
 #include "crypto.h"
+#include "heap.h"
 #include "net.h"
 #include "peer-mgr.h" /* tr_peerMgrCompactToPex() */
 #include "platform.h" /* tr_threadNew() */
 #include "session.h"
 #include "torrent.h" /* tr_torrentFindFromHash() */
 #include "tr-dht.h"
+#include "tr-udp.h"
 #include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 
@@ -258,6 +260,134 @@ dht_bootstrap(void *closure)
     tr_ndbg( "DHT", "Finished bootstrapping" );
 }
 
+/***
+****  Announce scheduling
+***/
+
+/* Instead of walking every torrent once a second, running torrents wait
+   in a heap ordered by when they're next due to announce.  Once due, they
+   move to a second heap that puts downloads and high priority torrents
+   first.  Announces are started from there at a steady pace: twice the
+   rate it takes to announce each torrent once per interval, so that a
+   restart's backlog is spread out rather than sent in one burst, and with
+   no more than half of the DHT's search slots in flight. */
+
+enum
+{
+    ANNOUNCE_INTERVAL_SEC = 25 * 60,
+    ANNOUNCE_JITTER_SEC = 3 * 60,
+    ANNOUNCE_RETRY_SEC = 5,
+    ANNOUNCE_MIN_PER_TICK = 4
+};
+
+struct announce_entry
+{
+    int torrentId;
+    int rank;      /* lower goes first.  only used once it's due */
+    time_t at;
+};
+
+/* heaps of struct announce_entry */
+struct announce_queue
+{
+    tr_heap waiting;
+    tr_heap due;
+};
+
+static int
+compareAnnounceTimes( const void * va, const void * vb )
+{
+    const struct announce_entry * a = va;
+    const struct announce_entry * b = vb;
+
+    if( a->at != b->at )
+        return a->at < b->at ? -1 : 1;
+
+    return 0;
+}
+
+static int
+compareAnnounceRanks( const void * va, const void * vb )
+{
+    const struct announce_entry * a = va;
+    const struct announce_entry * b = vb;
+
+    if( a->rank != b->rank )
+        return a->rank < b->rank ? -1 : 1;
+
+    return compareAnnounceTimes( a, b );
+}
+
+/* indexed by AF_INET, AF_INET6 */
+static struct announce_queue announce_queues[2] =
+{
+    { TR_HEAP_INIT( struct announce_entry, compareAnnounceTimes ),
+      TR_HEAP_INIT( struct announce_entry, compareAnnounceRanks ) },
+    { TR_HEAP_INIT( struct announce_entry, compareAnnounceTimes ),
+      TR_HEAP_INIT( struct announce_entry, compareAnnounceRanks ) }
+};
+
+static uint64_t announce_count = 0;
+static uint64_t announce_latency_sec = 0;
+static int announce_latency_max = 0;
+
+static struct announce_queue *
+getAnnounceQueue( int af )
+{
+    return &announce_queues[af == AF_INET ? 0 : 1];
+}
+
+static time_t*
+getAnnounceAt( tr_torrent * tor, int af )
+{
+    return af == AF_INET ? &tor->dhtAnnounceAt : &tor->dhtAnnounce6At;
+}
+
+static void
+scheduleAnnounce( tr_torrent * tor, int af, time_t at )
+{
+    struct announce_entry e;
+
+    /* if the DHT isn't running, tr_dhtInit() schedules it */
+    *getAnnounceAt( tor, af ) = at;
+    if( tor->session != session )
+        return;
+
+    e.torrentId = tr_torrentId( tor );
+    e.rank = 0;
+    e.at = at;
+    tr_heapPush( &getAnnounceQueue( af )->waiting, &e );
+}
+
+/* An entry is stale once its torrent has stopped or been rescheduled. */
+static tr_torrent *
+getAnnounceTorrent( const struct announce_entry * e, int af )
+{
+    tr_torrent * tor = tr_torrentFindFromId( session, e->torrentId );
+
+    if( ( tor == NULL ) || !tor->isRunning || ( *getAnnounceAt( tor, af ) != e->at ) )
+        return NULL;
+
+    return tor;
+}
+
+/* downloads before seeds, then by bandwidth priority */
+static int
+getAnnounceRank( const tr_torrent * tor )
+{
+    return ( tr_torrentIsSeed( tor ) ? 3 : 0 )
+         + ( TR_PRI_HIGH - tr_torrentGetPriority( tor ) );
+}
+
+void
+tr_dhtTorrentStarted( tr_torrent * tor )
+{
+    const time_t now = tr_time( );
+
+    scheduleAnnounce( tor, AF_INET, now + tr_cryptoWeakRandInt( 20 ) );
+    scheduleAnnounce( tor, AF_INET6, now + tr_cryptoWeakRandInt( 20 ) );
+}
+
 int
 tr_dhtInit(tr_session *ss)
 {
@@ -327,6 +457,13 @@ tr_dhtInit(tr_session *ss)
     dht_timer = evtimer_new( session->event_base, timer_callback, session );
     tr_timerAdd( dht_timer, 0, tr_cryptoWeakRandInt( 1000000 ) );
 
+    {
+        tr_torrent * tor = NULL;
+        while(( tor = tr_torrentNext( session, tor )))
+            if( tor->isRunning )
+                tr_dhtTorrentStarted( tor );
+    }
+
     tr_ndbg( "DHT", "DHT initialized" );
 
     return 1;
@@ -340,6 +477,8 @@ tr_dhtInit(tr_session *ss)
 void
 tr_dhtUninit(tr_session *ss)
 {
+    int i;
+
     if(session != ss)
         return;
 
@@ -392,6 +531,14 @@ tr_dhtUninit(tr_session *ss)
     dht_uninit();
     tr_ndbg("DHT", "Done uninitializing DHT");
 
+    for( i=0; i<2; ++i ) {
+        tr_heapDestruct( &announce_queues[i].waiting );
+        tr_heapDestruct( &announce_queues[i].due );
+    }
+    announce_count = 0;
+    announce_latency_sec = 0;
+    announce_latency_max = 0;
+
     session = NULL;
 }
 
@@ -451,6 +598,69 @@ tr_dhtStatus( tr_session * session, int af, int * nodes_return )
     return closure.status;
 }
 
+struct getstats_closure
+{
+    tr_dht_stats * stats;
+    sig_atomic_t done;
+};
+
+static void
+getstats( void * cl )
+{
+    struct getstats_closure * closure = cl;
+    tr_dht_stats * stats = closure->stats;
+    struct dht_stats st;
+    int i;
+
+    dht_get_stats( &st );
+
+    stats->bucketCount = st.buckets + st.buckets6;
+    stats->hashCount = st.hashes;
+    stats->hashLimit = st.max_hashes;
+    stats->peerCount = st.peers;
+    stats->peersPerHashLimit = st.max_peers;
+    stats->searchCount = st.searches;
+    stats->searchLimit = st.max_searches;
+    for( i=0; i<TR_DHT_MSG_KIND_COUNT; ++i ) {
+        stats->messageCount[i] = st.messages[i];
+        stats->messageUsec[i] = st.usecs[i];
+    }
+
+    stats->announcesInFlight = st.searching;
+    for( i=0; i<2; ++i ) {
+        stats->announcesWaiting += tr_heapSize( &announce_queues[i].waiting );
+        stats->announcesDue += tr_heapSize( &announce_queues[i].due );
+    }
+    stats->announceCount = announce_count;
+    stats->announceLatencySec = announce_latency_sec;
+    stats->announceLatencyMax = announce_latency_max;
+
+    closure->done = true;
+}
+
+bool
+tr_dhtGetStats( tr_session * session, tr_dht_stats * setme )
+{
+    struct getstats_closure closure = { setme, false };
+
+    memset( setme, 0, sizeof( tr_dht_stats ) );
+
+    if( !tr_dhtEnabled( session ) )
+        return false;
+
+    tr_runInEventThread( session, getstats, &closure );
+    while( !closure.done )
+        tr_wait_msec( 50 /*msec*/ );
+
+    return true;
+}
+
+void
+tr_dhtSetLimits( tr_session * ss )
+{
+    dht_set_limits( ss->dhtMaxHashes, 0, ss->dhtMaxSearches );
+}
+
 tr_port
 tr_dhtPort( tr_session *ss )
 {
@@ -550,15 +760,14 @@ callback( void *ignore UNUSED, int event,
 }
 
 static int
-tr_dhtAnnounce(tr_torrent *tor, int af, bool announce)
+tr_dhtAnnounce(tr_torrent *tor, int af, bool announce,
+               int status, int numnodes)
 {
-    int rc, status, numnodes, ret = 0;
+    int rc, ret = 0;
 
     if( !tr_torrentAllowsDHT( tor ) )
         return -1;
 
-    status = tr_dhtStatus( tor->session, af, &numnodes );
-
     if( status == TR_DHT_STOPPED ) {
         /* Let the caller believe everything is all right. */
         return 1;
@@ -592,37 +801,75 @@ tr_dhtAnnounce(tr_torrent *tor, int af, bool announce)
     return ret;
 }
 
-void
-tr_dhtUpkeep( tr_session * session )
+static void
+announceUpkeep( int af, time_t now, int * budget )
 {
-    tr_torrent * tor = NULL;
-    const time_t now = tr_time( );
+    int numnodes, started = 0, perTick;
+    struct announce_entry e;
+    const struct announce_entry * next;
+    struct announce_queue * q = getAnnounceQueue( af );
+    const int status = tr_dhtStatus( session, af, &numnodes );
+
+    /* not ready yet, so leave everything due until it is */
+    if( status != TR_DHT_STOPPED && status < TR_DHT_POOR )
+        return;
 
-    while(( tor = tr_torrentNext( session, tor )))
+    while(( next = tr_heapPeek( &q->waiting )) && ( next->at <= now ))
     {
-        if( !tor->isRunning || !tr_torrentAllowsDHT( tor ) )
-            continue;
+        tr_torrent * tor;
+        tr_heapPop( &q->waiting, &e );
+        if(( tor = getAnnounceTorrent( &e, af ))) {
+            e.rank = getAnnounceRank( tor );
+            tr_heapPush( &q->due, &e );
+        }
+    }
 
-        if( tor->dhtAnnounceAt <= now )
-        {
-            const int rc = tr_dhtAnnounce(tor, AF_INET, 1);
+    perTick = MAX( ANNOUNCE_MIN_PER_TICK,
+                   2 * ( tr_heapSize( &q->waiting ) + tr_heapSize( &q->due ) ) / ANNOUNCE_INTERVAL_SEC );
 
-            tor->dhtAnnounceAt = now + ((rc == 0)
-                                     ? 5 + tr_cryptoWeakRandInt( 5 )
-                                     : 25 * 60 + tr_cryptoWeakRandInt( 3*60 ));
-        }
+    while( ( started < perTick ) && ( *budget > 0 ) && tr_heapPop( &q->due, &e ) )
+    {
+        int rc;
+        tr_torrent * tor = getAnnounceTorrent( &e, af );
 
-        if( tor->dhtAnnounce6At <= now )
-        {
-            const int rc = tr_dhtAnnounce(tor, AF_INET6, 1);
+        if( tor == NULL )
+            continue;
+
+        rc = tr_dhtAnnounce( tor, af, 1, status, numnodes );
 
-            tor->dhtAnnounce6At = now + ((rc == 0)
-                                      ? 5 + tr_cryptoWeakRandInt( 5 )
-                                      : 25 * 60 + tr_cryptoWeakRandInt( 3*60 ));
+        if( ( rc > 0 ) && ( status != TR_DHT_STOPPED ) )
+        {
+            const int latency = now - e.at;
+            ++started;
+            --*budget;
+            ++announce_count;
+            announce_latency_sec += latency;
+            announce_latency_max = MAX( announce_latency_max, latency );
         }
+
+        scheduleAnnounce( tor, af, now + ((rc == 0)
+                        ? ANNOUNCE_RETRY_SEC + tr_cryptoWeakRandInt( ANNOUNCE_RETRY_SEC )
+                        : ANNOUNCE_INTERVAL_SEC + tr_cryptoWeakRandInt( ANNOUNCE_JITTER_SEC )));
     }
 }
 
+void
+tr_dhtUpkeep( tr_session * session )
+{
+    int budget;
+    struct dht_stats st;
+    const time_t now = tr_time( );
+
+    if( !tr_dhtEnabled( session ) )
+        return;
+
+    dht_get_stats( &st );
+    budget = st.max_searches / 2 - st.searching;
+
+    announceUpkeep( AF_INET, now, &budget );
+    announceUpkeep( AF_INET6, now, &budget );
+}
+
 void
 tr_dhtCallback(unsigned char *buf, int buflen,
                struct sockaddr *from, socklen_t fromlen,
@@ -690,3 +937,10 @@ dht_random_bytes( void * buf, size_t size )
     tr_cryptoRandBuf( buf, size );
     return size;
 }
+
+int
+dht_sendto( int sockfd, const void * buf, int len, int flags,
+            const struct sockaddr * to, int tolen )
+{
+    return tr_udpSendTo( session, sockfd, buf, len, flags, to, tolen );
+}
@@ -41,9 +41,56 @@ void tr_dhtUninit( tr_session * );
 bool tr_dhtEnabled( const tr_session * );
 tr_port tr_dhtPort ( tr_session * );
 int tr_dhtStatus( tr_session *, int af, int * setme_nodeCount );
+
+enum
+{
+    TR_DHT_MSG_IGNORED,     /* unparseable, rate-limited, ... */
+    TR_DHT_MSG_REPLY,
+    TR_DHT_MSG_PING,
+    TR_DHT_MSG_FIND_NODE,
+    TR_DHT_MSG_GET_PEERS,
+    TR_DHT_MSG_ANNOUNCE_PEER,
+    TR_DHT_MSG_KIND_COUNT
+};
+
+typedef struct tr_dht_stats
+{
+    int bucketCount;        /* IPv4 and IPv6 routing table buckets */
+    int hashCount;          /* info hashes we store peers for */
+    int hashLimit;
+    int peerCount;          /* peers stored for all of those hashes */
+    int peersPerHashLimit;
+    int searchCount;
+    int searchLimit;
+
+    /* messages received since the DHT started, and the time spent
+       processing them */
+    uint64_t messageCount[TR_DHT_MSG_KIND_COUNT];
+    uint64_t messageUsec[TR_DHT_MSG_KIND_COUNT];
+
+    /* torrents waiting for their next announce, announces that are due
+       but haven't been started, and announces still running */
+    int announcesWaiting;
+    int announcesDue;
+    int announcesInFlight;
+
+    /* announces started, and how late they were in total and at worst */
+    uint64_t announceCount;
+    uint64_t announceLatencySec;
+    int announceLatencyMax;
+}
+tr_dht_stats;
+
+/** @brief fill in `setme' with the DHT's table sizes and message costs.
+    @return false if the DHT isn't running */
+bool tr_dhtGetStats( tr_session *, tr_dht_stats * setme );
+
+/** @brief apply the session's dhtMaxHashes and dhtMaxSearches */
+void tr_dhtSetLimits( tr_session * );
 const char *tr_dhtPrintableStatus(int status);
 int tr_dhtAddNode( tr_session *, const tr_address *, tr_port, bool bootstrap );
 void tr_dhtUpkeep( tr_session * );
+void tr_dhtTorrentStarted( tr_torrent * );
 void tr_dhtCallback(unsigned char *buf, int buflen,
                     struct sockaddr *from, socklen_t fromlen,
                     void *sv);
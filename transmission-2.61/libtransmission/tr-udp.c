@@ -21,7 +21,12 @@ THE SOFTWARE.
 
 */
 
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+ #define _GNU_SOURCE /* glibc's sys/socket.h needs this for recvmmsg/sendmmsg */
+#endif
+
 #include <assert.h>
+#include <errno.h>
 #include <string.h> /* memcmp(), memcpy(), memset() */
 #include <stdlib.h> /* malloc(), free() */
 
@@ -37,6 +42,8 @@ THE SOFTWARE.
 #include "tr-dht.h"
 #include "tr-utp.h"
 #include "tr-udp.h"
+#include "trevent.h" /* tr_amInEventThread() */
+#include "utils.h" /* tr_new0(), tr_free() */
 
 /* Since we use a single UDP socket in order to implement multiple
    uTP sockets, try to set up huge buffers. */
@@ -186,6 +193,201 @@ rebind_ipv6(tr_session *ss, bool force)
     }
 }
 
+/* Outgoing datagrams are queued while we handle an event and sent
+   together, so that a busy wakeup costs a single sendmmsg() rather than
+   one sendto() per packet.  The queue is flushed when we're done reading
+   a socket, when it fills up, and otherwise from a zero-length timer, so
+   a packet never waits for more than one pass through the event loop.
+   The queue belongs to the event thread; other threads, like the DHT's
+   bootstrap thread, send their packets directly. */
+
+#define UDP_SEND_BATCH 32
+#define UDP_SEND_SLOT 2048
+
+struct tr_udp_queue {
+    int count;
+    struct event *flush_event;
+    int sockets[UDP_SEND_BATCH];
+    size_t lens[UDP_SEND_BATCH];
+    socklen_t tolens[UDP_SEND_BATCH];
+    struct sockaddr_storage tos[UDP_SEND_BATCH];
+    unsigned char bufs[UDP_SEND_BATCH][UDP_SEND_SLOT];
+};
+
+/* Send the n queued packets starting at first, which all go to socket s. */
+static void
+send_run(struct tr_udp_queue *q, int s, int first, int n)
+{
+    int i;
+
+#ifdef HAVE_SENDMMSG
+    struct iovec iovs[UDP_SEND_BATCH];
+    struct mmsghdr msgs[UDP_SEND_BATCH];
+    int rc;
+
+    memset(msgs, 0, n * sizeof(msgs[0]));
+    for(i = 0; i < n; i++) {
+        iovs[i].iov_base = q->bufs[first + i];
+        iovs[i].iov_len = q->lens[first + i];
+        msgs[i].msg_hdr.msg_name = &q->tos[first + i];
+        msgs[i].msg_hdr.msg_namelen = q->tolens[first + i];
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    i = 0;
+    while(i < n) {
+        rc = sendmmsg(s, msgs + i, n - i, 0);
+        if(rc > 0)
+            i += rc;
+        else if(rc < 0 && errno == ENOSYS)
+            break;
+        else
+            i++; /* drop it, just like a failed sendto() would */
+    }
+
+    /* fall back to sendto() if the kernel doesn't have sendmmsg() */
+    first += i;
+    n -= i;
+#endif
+
+    for(i = first; i < first + n; i++)
+        sendto(s, q->bufs[i], q->lens[i], 0,
+               (struct sockaddr*)&q->tos[i], q->tolens[i]);
+}
+
+static void
+flush_queue(tr_session *ss)
+{
+    struct tr_udp_queue *q = ss->udp_queue;
+    int i, j;
+
+    if(q == NULL || q->count == 0)
+        return;
+
+    for(i = 0; i < q->count; i = j) {
+        for(j = i + 1; j < q->count; j++)
+            if(q->sockets[j] != q->sockets[i])
+                break;
+        send_run(q, q->sockets[i], i, j - i);
+    }
+
+    q->count = 0;
+    evtimer_del(q->flush_event);
+}
+
+static void
+flush_callback(int s UNUSED, short type UNUSED, void *sv)
+{
+    flush_queue(sv);
+}
+
+int
+tr_udpSendTo(tr_session *ss, int s, const void *buf, size_t len, int flags,
+             const struct sockaddr *to, socklen_t tolen)
+{
+    struct tr_udp_queue *q = ss->udp_queue;
+
+    if(!tr_amInEventThread(ss))
+        return sendto(s, buf, len, flags, to, tolen);
+
+    if(q == NULL || flags != 0 || len > UDP_SEND_SLOT ||
+       tolen > sizeof(struct sockaddr_storage)) {
+        /* don't let this one overtake the packets already queued */
+        flush_queue(ss);
+        return sendto(s, buf, len, flags, to, tolen);
+    }
+
+    if(q->count == UDP_SEND_BATCH)
+        flush_queue(ss);
+
+    if(q->count == 0) {
+        const struct timeval tv = { 0, 0 };
+        evtimer_add(q->flush_event, &tv);
+    }
+
+    q->sockets[q->count] = s;
+    q->lens[q->count] = len;
+    q->tolens[q->count] = tolen;
+    memcpy(&q->tos[q->count], to, tolen);
+    memcpy(q->bufs[q->count], buf, len);
+    q->count++;
+
+    return len;
+}
+
+/* Since most packets we receive here are ÂµTP, make quick inline
+   checks for the other protocols.  The logic is as follows:
+   - all DHT packets start with 'd';
+   - all UDP tracker packets start with a 32-bit (!) "action", which
+     is between 0 and 3;
+   - the above cannot be ÂµTP packets, since these start with a 4-bit
+     version number (1).
+   buf must have room for one more byte after the packet. */
+static void
+handle_packet(tr_session *ss, unsigned char *buf, int rc,
+              struct sockaddr *from, socklen_t fromlen)
+{
+    if( buf[0] == 'd' ) {
+        if( tr_sessionAllowsDHT( ss ) ) {
+            buf[rc] = '\0'; /* required by the DHT code */
+            tr_dhtCallback(buf, rc, from, fromlen, ss);
+        }
+    } else if( rc >= 8 &&
+               buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3 ) {
+        rc = tau_handle_message( ss, buf, rc );
+        if( !rc )
+            tr_ndbg("UDP", "Couldn't parse UDP tracker packet.");
+    } else {
+        if( tr_sessionIsUTPEnabled( ss ) ) {
+            rc = tr_utpPacket(buf, rc, from, fromlen, ss);
+            if( !rc )
+                tr_ndbg("UDP", "Unexpected UDP packet");
+        }
+    }
+}
+
+#ifdef HAVE_RECVMMSG
+
+/* The most datagrams we pick up per wakeup.  Under load, a single
+   recvmmsg() is much cheaper than one recvfrom() per packet. */
+#define UDP_BATCH 32
+
+/* Returns the number of packets handled, or -1 with errno set. */
+static int
+read_batch(int s, tr_session *ss)
+{
+    /* only ever used from the libtransmission thread,
+       and every packet is handled before we return */
+    static unsigned char bufs[UDP_BATCH][4096];
+    static struct sockaddr_storage froms[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    struct mmsghdr msgs[UDP_BATCH];
+    int i, n;
+
+    memset(msgs, 0, sizeof(msgs));
+    for(i = 0; i < UDP_BATCH; i++) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = 4096 - 1;
+        msgs[i].msg_hdr.msg_name = &froms[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(froms[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    n = recvmmsg(s, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+
+    for(i = 0; i < n; i++)
+        if(msgs[i].msg_len > 0)
+            handle_packet(ss, bufs[i], msgs[i].msg_len,
+                          (struct sockaddr*)&froms[i],
+                          msgs[i].msg_hdr.msg_namelen);
+
+    return n;
+}
+
+#endif
+
 static void
 event_callback(int s, short type UNUSED, void *sv)
 {
@@ -198,36 +400,22 @@ event_callback(int s, short type UNUSED, void *sv)
     assert(tr_isSession(sv));
     assert(type == EV_READ);
 
+#ifdef HAVE_RECVMMSG
+    /* fall back to recvfrom() if the kernel doesn't have recvmmsg() */
+    if(read_batch(s, ss) >= 0 || errno != ENOSYS) {
+        flush_queue(ss);
+        return;
+    }
+#endif
+
     fromlen = sizeof(from);
     rc = recvfrom(s, buf, 4096 - 1, 0,
                   (struct sockaddr*)&from, &fromlen);
 
-    /* Since most packets we receive here are ÂµTP, make quick inline
-       checks for the other protocols.  The logic is as follows:
-       - all DHT packets start with 'd';
-       - all UDP tracker packets start with a 32-bit (!) "action", which
-         is between 0 and 3;
-       - the above cannot be ÂµTP packets, since these start with a 4-bit
-         version number (1). */
-    if(rc > 0) {
-        if( buf[0] == 'd' ) {
-            if( tr_sessionAllowsDHT( ss ) ) {
-                buf[rc] = '\0'; /* required by the DHT code */
-                tr_dhtCallback(buf, rc, (struct sockaddr*)&from, fromlen, sv);
-            }
-        } else if( rc >= 8 &&
-                   buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3 ) {
-            rc = tau_handle_message( ss, buf, rc );
-            if( !rc )
-                tr_ndbg("UDP", "Couldn't parse UDP tracker packet.");
-        } else {
-            if( tr_sessionIsUTPEnabled( ss ) ) {
-                rc = tr_utpPacket(buf, rc, (struct sockaddr*)&from, fromlen, ss);
-                if( !rc )
-                    tr_ndbg("UDP", "Unexpected UDP packet");
-            }
-        }
-    }
+    if(rc > 0)
+        handle_packet(ss, buf, rc, (struct sockaddr*)&from, fromlen);
+
+    flush_queue(ss);
 }
 
 void
@@ -283,6 +471,15 @@ tr_udpInit(tr_session *ss)
 
     tr_udpSetSocketBuffers(ss);
 
+    ss->udp_queue = tr_new0(struct tr_udp_queue, 1);
+    ss->udp_queue->flush_event =
+        evtimer_new(ss->event_base, flush_callback, ss);
+    if(ss->udp_queue->flush_event == NULL) {
+        tr_nerr("UDP", "Couldn't allocate send queue event");
+        tr_free(ss->udp_queue);
+        ss->udp_queue = NULL;
+    }
+
     if(ss->isDHTEnabled)
         tr_dhtInit(ss);
 
@@ -297,6 +494,13 @@ tr_udpUninit(tr_session *ss)
 {
     tr_dhtUninit(ss);
 
+    if(ss->udp_queue) {
+        flush_queue(ss);
+        event_free(ss->udp_queue->flush_event);
+        tr_free(ss->udp_queue);
+        ss->udp_queue = NULL;
+    }
+
     if(ss->udp_socket >= 0) {
         tr_netCloseSocket( ss->udp_socket );
         ss->udp_socket = -1;
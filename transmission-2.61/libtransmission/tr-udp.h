@@ -32,6 +32,14 @@ void tr_udpInit( tr_session * );
 void tr_udpUninit( tr_session * );
 void tr_udpSetSocketBuffers(tr_session *);
 
+/* Queue a datagram on one of the session's UDP sockets.  Queued packets
+   are sent in batches before control returns to the event loop.  Returns
+   len once the packet is queued, or sendto()'s result if it was sent
+   right away. */
+int tr_udpSendTo( tr_session * session, int s,
+                  const void * buf, size_t len, int flags,
+                  const struct sockaddr * to, socklen_t tolen );
+
 bool tau_handle_message( tr_session * session,
                          const uint8_t  * msg, size_t msglen );
 
@@ -32,6 +32,7 @@ THE SOFTWARE.
 #include "session.h"
 #include "crypto.h" /* tr_cryptoWeakRandInt() */
 #include "peer-mgr.h"
+#include "tr-udp.h"
 #include "tr-utp.h"
 #include "utils.h"
 
@@ -95,8 +96,14 @@ void tr_utpSendTo(void *closure UNUSED,
 
 #define UTP_INTERVAL_US 50000
 
+/* how long to sleep when libutp has nothing due sooner */
+#define UTP_IDLE_INTERVAL_US 500000
+
 static struct event *utp_timer = NULL;
 
+/* true if utp_timer was set for longer than UTP_INTERVAL_US */
+static bool utp_timer_is_idle = false;
+
 static void
 incoming(void *closure, struct UTPSocket *s)
 {
@@ -123,6 +130,8 @@ incoming(void *closure, struct UTPSocket *s)
     tr_peerMgrAddIncoming(ss->peerMgr, &addr, port, -1, s);
 }
 
+static void wake_timer(tr_session *ss);
+
 void
 tr_utpSendTo(void *closure, const unsigned char *buf, size_t buflen,
              const struct sockaddr *to, socklen_t tolen)
@@ -130,9 +139,11 @@ tr_utpSendTo(void *closure, const unsigned char *buf, size_t buflen,
     tr_session *ss = closure;
 
     if(to->sa_family == AF_INET && ss->udp_socket)
-        sendto(ss->udp_socket, buf, buflen, 0, to, tolen);
+        tr_udpSendTo(ss, ss->udp_socket, buf, buflen, 0, to, tolen);
     else if(to->sa_family == AF_INET6 && ss->udp_socket)
-        sendto(ss->udp6_socket, buf, buflen, 0, to, tolen);
+        tr_udpSendTo(ss, ss->udp6_socket, buf, buflen, 0, to, tolen);
+
+    wake_timer( ss );
 }
 
 static void
@@ -140,9 +151,18 @@ reset_timer(tr_session *ss)
 {
     int sec;
     int usec;
+    utp_timer_is_idle = false;
     if( tr_sessionIsUTPEnabled( ss ) ) {
+        const uint32_t msec = UTP_GetNextTimeout( );
         sec = 0;
-        usec = UTP_INTERVAL_US / 2 + tr_cryptoWeakRandInt(UTP_INTERVAL_US);
+        if( msec < UTP_INTERVAL_US / 1000 ) {
+            usec = UTP_INTERVAL_US / 2 + tr_cryptoWeakRandInt(UTP_INTERVAL_US);
+        } else {
+            /* no socket needs us before then. tr_utpSendTo() and
+               tr_utpPacket() will wake us if that changes */
+            usec = MIN( msec, UTP_IDLE_INTERVAL_US / 1000 ) * 1000;
+            utp_timer_is_idle = true;
+        }
     } else {
         /* If somebody has disabled uTP, then we still want to run
            UTP_CheckTimeouts, in order to let closed sockets finish
@@ -155,6 +175,14 @@ reset_timer(tr_session *ss)
     tr_timerAdd( utp_timer, sec, usec );
 }
 
+/* a socket has something to do now; stop sleeping if we are */
+static void
+wake_timer(tr_session *ss)
+{
+    if( utp_timer && utp_timer_is_idle )
+        reset_timer( ss );
+}
+
 static void
 timer_callback(int s UNUSED, short type UNUSED, void *closure)
 {
@@ -168,6 +196,8 @@ tr_utpPacket(const unsigned char *buf, size_t buflen,
              const struct sockaddr *from, socklen_t fromlen,
              tr_session *ss)
 {
+    int ret;
+
     if( !ss->isClosed && !utp_timer )
     {
         utp_timer = evtimer_new( ss->event_base, timer_callback, ss );
@@ -176,8 +206,10 @@ tr_utpPacket(const unsigned char *buf, size_t buflen,
         reset_timer( ss );
     }
 
-    return UTP_IsIncomingUTP(incoming, tr_utpSendTo, ss,
-                             buf, buflen, from, fromlen);
+    ret = UTP_IsIncomingUTP(incoming, tr_utpSendTo, ss,
+                            buf, buflen, from, fromlen);
+    wake_timer( ss );
+    return ret;
 }
 
 void
@@ -187,6 +219,7 @@ tr_utpClose( tr_session * session UNUSED )
     {
         evtimer_del( utp_timer );
         utp_timer = NULL;
+        utp_timer_is_idle = false;
     }
 }
 
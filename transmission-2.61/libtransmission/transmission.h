@@ -163,12 +163,15 @@ const char* tr_getDefaultDownloadDir( void );
 #define TR_PREFS_KEY_ALT_SPEED_TIME_ENABLED             "alt-speed-time-enabled"
 #define TR_PREFS_KEY_ALT_SPEED_TIME_END                 "alt-speed-time-end"
 #define TR_PREFS_KEY_ALT_SPEED_TIME_DAY                 "alt-speed-time-day"
+#define TR_PREFS_KEY_BINARY_RESUME_ENABLED              "binary-resume-enabled"
 #define TR_PREFS_KEY_BIND_ADDRESS_IPV4                  "bind-address-ipv4"
 #define TR_PREFS_KEY_BIND_ADDRESS_IPV6                  "bind-address-ipv6"
 #define TR_PREFS_KEY_BLOCKLIST_ENABLED                  "blocklist-enabled"
 #define TR_PREFS_KEY_BLOCKLIST_URL                      "blocklist-url"
 #define TR_PREFS_KEY_MAX_CACHE_SIZE_MB                  "cache-size-mb"
 #define TR_PREFS_KEY_DHT_ENABLED                        "dht-enabled"
+#define TR_PREFS_KEY_DHT_MAX_HASHES                     "dht-max-hashes"
+#define TR_PREFS_KEY_DHT_MAX_SEARCHES                   "dht-max-searches"
 #define TR_PREFS_KEY_UTP_ENABLED                        "utp-enabled"
 #define TR_PREFS_KEY_LPD_ENABLED                        "lpd-enabled"
 #define TR_PREFS_KEY_DOWNLOAD_QUEUE_SIZE                "download-queue-size"
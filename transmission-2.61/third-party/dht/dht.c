@@ -176,6 +176,8 @@ struct search {
     struct search_node nodes[SEARCH_NODES];
     int numnodes;
     struct search *next;
+    struct search *tid_next;    /* hash chains, see hash_search */
+    struct search *id_next;
 };
 
 struct peer {
@@ -210,6 +212,7 @@ struct storage {
     int numpeers, maxpeers;
     struct peer *peers;
     struct storage *next;
+    struct storage *hash_next;
 };
 
 static void flush_search_node(struct search_node *n, struct search *sr);
@@ -295,11 +298,38 @@ static struct bucket *buckets = NULL;
 static struct bucket *buckets6 = NULL;
 static struct storage *storage;
 static int numstorage;
+static int numstoredpeers;
 
 static struct search *searches = NULL;
 static int numsearches;
 static unsigned short search_id;
 
+/* Storage and searches are also kept in hash tables, so that a node that
+   tracks many hashes doesn't walk a list for every message it receives.
+   The hash is seeded at random, since remote nodes choose the info hashes
+   we store. */
+static unsigned hash_seed;
+static struct storage **storage_table;
+static int storage_table_size;
+static struct search **search_tid_table;
+static struct search **search_id_table;
+static int search_table_size;
+
+/* Both bucket lists, sorted by first, for bisecting in find_bucket.  If
+   allocating one fails, we fall back to walking the list. */
+#define AF_INDEX(af) ((af) == AF_INET ? 0 : 1)
+static struct bucket **bucket_index[2];
+static int numbuckets[2];
+
+static int max_hashes = DHT_MAX_HASHES;
+static int max_peers = DHT_MAX_PEERS;
+static int max_searches = DHT_MAX_SEARCHES;
+
+/* Indexed by message type; messages we couldn't parse or never looked at
+   are counted as ERROR. */
+static unsigned long message_count[ANNOUNCE_PEER + 1];
+static unsigned long message_usecs[ANNOUNCE_PEER + 1];
+
 /* The maximum number of nodes that we snub.  There is probably little
    reason to increase this value. */
 #ifndef DHT_MAX_BLACKLISTED
@@ -461,6 +491,50 @@ in_bucket(const unsigned char *id, struct bucket *b)
         (b->next == NULL || id_cmp(id, b->next->first) < 0);
 }
 
+static void
+index_buckets(int af)
+{
+    struct bucket *b = af == AF_INET ? buckets : buckets6;
+    struct bucket **index;
+    int i = AF_INDEX(af), n = 0;
+
+    while(b) {
+        n++;
+        b = b->next;
+    }
+
+    index = n > 0 ? realloc(bucket_index[i], n * sizeof(struct bucket*)) : NULL;
+    if(index == NULL) {
+        free(bucket_index[i]);
+        bucket_index[i] = NULL;
+        numbuckets[i] = 0;
+        return;
+    }
+
+    bucket_index[i] = index;
+    numbuckets[i] = n;
+    n = 0;
+    for(b = af == AF_INET ? buckets : buckets6; b; b = b->next)
+        index[n++] = b;
+}
+
+/* The position in bucket_index of the bucket that id falls into. */
+static int
+bucket_position(const unsigned char *id, int af)
+{
+    struct bucket **index = bucket_index[AF_INDEX(af)];
+    int lo = 0, hi = numbuckets[AF_INDEX(af)] - 1;
+
+    while(lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if(id_cmp(index[mid]->first, id) <= 0)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
 static struct bucket *
 find_bucket(unsigned const char *id, int af)
 {
@@ -469,6 +543,9 @@ find_bucket(unsigned const char *id, int af)
     if(b == NULL)
         return NULL;
 
+    if(bucket_index[AF_INDEX(af)])
+        return bucket_index[AF_INDEX(af)][bucket_position(id, af)];
+
     while(1) {
         if(b->next == NULL)
             return b;
@@ -486,6 +563,11 @@ previous_bucket(struct bucket *b)
     if(b == p)
         return NULL;
 
+    if(bucket_index[AF_INDEX(b->af)]) {
+        int i = bucket_position(b->first, b->af);
+        return i > 0 ? bucket_index[AF_INDEX(b->af)][i - 1] : NULL;
+    }
+
     while(1) {
         if(p->next == NULL)
             return NULL;
@@ -729,6 +811,7 @@ split_bucket(struct bucket *b)
     b->count = 0;
     new->next = b->next;
     b->next = new;
+    index_buckets(b->af);
     while(nodes) {
         struct node *n;
         n = nodes;
@@ -916,14 +999,114 @@ expire_buckets(struct bucket *b)
    a unique transaction id, a short (and hence small enough to fit in the
    transaction id of the protocol packets). */
 
+static unsigned
+hash_id(const unsigned char *id)
+{
+    unsigned h = hash_seed;
+    int i;
+
+    for(i = 0; i < 20; i++)
+        h = (h ^ id[i]) * 16777619;
+    return h;
+}
+
+static void
+unhash_search(struct search *sr)
+{
+    struct search **p;
+
+    if(search_table_size == 0)
+        return;
+
+    p = &search_tid_table[sr->tid & (search_table_size - 1)];
+    while(*p && *p != sr)
+        p = &(*p)->tid_next;
+    if(*p)
+        *p = sr->tid_next;
+
+    p = &search_id_table[hash_id(sr->id) & (search_table_size - 1)];
+    while(*p && *p != sr)
+        p = &(*p)->id_next;
+    if(*p)
+        *p = sr->id_next;
+}
+
+static void
+link_search(struct search *sr)
+{
+    int mask = search_table_size - 1;
+
+    sr->tid_next = search_tid_table[sr->tid & mask];
+    search_tid_table[sr->tid & mask] = sr;
+    sr->id_next = search_id_table[hash_id(sr->id) & mask];
+    search_id_table[hash_id(sr->id) & mask] = sr;
+}
+
+/* Add a search to the hash tables, which are kept at least as large as
+   the number of searches.  A search that isn't hashed can't be found,
+   so if we run out of memory its replies are simply ignored. */
+static void
+hash_search(struct search *sr)
+{
+    if(numsearches > search_table_size) {
+        int size = search_table_size > 0 ? search_table_size : 64;
+        struct search **tids, **ids, *s;
+
+        while(size < numsearches)
+            size *= 2;
+
+        tids = calloc(size, sizeof(struct search*));
+        ids = calloc(size, sizeof(struct search*));
+        if(tids == NULL || ids == NULL) {
+            free(tids);
+            free(ids);
+        } else {
+            free(search_tid_table);
+            free(search_id_table);
+            search_tid_table = tids;
+            search_id_table = ids;
+            search_table_size = size;
+            /* sr is in the list already, but isn't hashed yet */
+            for(s = searches; s; s = s->next)
+                if(s != sr)
+                    link_search(s);
+        }
+    }
+
+    if(search_table_size > 0)
+        link_search(sr);
+}
+
 static struct search *
 find_search(unsigned short tid, int af)
 {
-    struct search *sr = searches;
+    struct search *sr;
+
+    if(search_table_size == 0)
+        return NULL;
+
+    sr = search_tid_table[tid & (search_table_size - 1)];
     while(sr) {
         if(sr->tid == tid && sr->af == af)
             return sr;
-        sr = sr->next;
+        sr = sr->tid_next;
+    }
+    return NULL;
+}
+
+static struct search *
+find_search_by_id(const unsigned char *id, int af)
+{
+    struct search *sr;
+
+    if(search_table_size == 0)
+        return NULL;
+
+    sr = search_id_table[hash_id(id) & (search_table_size - 1)];
+    while(sr) {
+        if(sr->af == af && id_cmp(sr->id, id) == 0)
+            return sr;
+        sr = sr->id_next;
     }
     return NULL;
 }
@@ -1013,6 +1196,7 @@ expire_searches(void)
                 previous->next = next;
             else
                 searches = next;
+            unhash_search(sr);
             free(sr);
             numsearches--;
         } else {
@@ -1144,21 +1328,9 @@ new_search(void)
 {
     struct search *sr, *oldest = NULL;
 
-    /* Find the oldest done search */
-    sr = searches;
-    while(sr) {
-        if(sr->done &&
-           (oldest == NULL || oldest->step_time > sr->step_time))
-            oldest = sr;
-        sr = sr->next;
-    }
-
-    /* The oldest slot is expired. */
-    if(oldest && oldest->step_time < now.tv_sec - DHT_SEARCH_EXPIRE_TIME)
-        return oldest;
-
-    /* Allocate a new slot. */
-    if(numsearches < DHT_MAX_SEARCHES) {
+    /* Allocate a new slot.  Expired searches are freed by expire_searches,
+       so only go looking for one to reuse when we're at the limit. */
+    if(numsearches < max_searches) {
         sr = calloc(1, sizeof(struct search));
         if(sr != NULL) {
             sr->next = searches;
@@ -1168,7 +1340,17 @@ new_search(void)
         }
     }
 
-    /* Oh, well, never mind.  Reuse the oldest slot. */
+    /* Oh, well, never mind.  Reuse the oldest done slot. */
+    sr = searches;
+    while(sr) {
+        if(sr->done &&
+           (oldest == NULL || oldest->step_time > sr->step_time))
+            oldest = sr;
+        sr = sr->next;
+    }
+
+    if(oldest)
+        unhash_search(oldest);
     return oldest;
 }
 
@@ -1199,12 +1381,7 @@ dht_search(const unsigned char *id, int port, int af,
         return -1;
     }
 
-    sr = searches;
-    while(sr) {
-        if(sr->af == af && id_cmp(sr->id, id) == 0)
-            break;
-        sr = sr->next;
-    }
+    sr = find_search_by_id(id, af);
 
     if(sr) {
         /* We're reusing data from an old search.  Reusing the same tid
@@ -1237,6 +1414,7 @@ dht_search(const unsigned char *id, int port, int af,
         memcpy(sr->id, id, 20);
         sr->done = 0;
         sr->numnodes = 0;
+        hash_search(sr);
     }
 
     sr->port = port;
@@ -1264,16 +1442,58 @@ dht_search(const unsigned char *id, int port, int af,
 static struct storage *
 find_storage(const unsigned char *id)
 {
-    struct storage *st = storage;
+    struct storage *st;
+
+    if(storage_table_size == 0)
+        return NULL;
 
+    st = storage_table[hash_id(id) & (storage_table_size - 1)];
     while(st) {
         if(id_cmp(id, st->id) == 0)
             break;
-        st = st->next;
+        st = st->hash_next;
     }
     return st;
 }
 
+/* Grow the storage hash table to at least size buckets. */
+static int
+resize_storage_table(int size)
+{
+    struct storage **table, *st;
+    int n = storage_table_size > 0 ? storage_table_size : 64;
+
+    while(n < size)
+        n *= 2;
+
+    table = calloc(n, sizeof(struct storage*));
+    if(table == NULL)
+        return -1;
+
+    for(st = storage; st; st = st->next) {
+        unsigned h = hash_id(st->id) & (n - 1);
+        st->hash_next = table[h];
+        table[h] = st;
+    }
+
+    free(storage_table);
+    storage_table = table;
+    storage_table_size = n;
+    return 1;
+}
+
+static void
+unhash_storage(struct storage *st)
+{
+    struct storage **p =
+        &storage_table[hash_id(st->id) & (storage_table_size - 1)];
+
+    while(*p && *p != st)
+        p = &(*p)->hash_next;
+    if(*p)
+        *p = st->hash_next;
+}
+
 static int
 storage_store(const unsigned char *id,
               const struct sockaddr *sa, unsigned short port)
@@ -1297,13 +1517,22 @@ storage_store(const unsigned char *id,
     st = find_storage(id);
 
     if(st == NULL) {
-        if(numstorage >= DHT_MAX_HASHES)
+        unsigned h;
+        if(numstorage >= max_hashes)
+            return -1;
+        /* A full table just gets longer chains if it can't grow. */
+        if(numstorage >= storage_table_size &&
+           resize_storage_table(numstorage + 1) < 0 &&
+           storage_table_size == 0)
             return -1;
         st = calloc(1, sizeof(struct storage));
         if(st == NULL) return -1;
         memcpy(st->id, id, 20);
         st->next = storage;
         storage = st;
+        h = hash_id(id) & (storage_table_size - 1);
+        st->hash_next = storage_table[h];
+        storage_table[h] = st;
         numstorage++;
     }
 
@@ -1323,10 +1552,10 @@ storage_store(const unsigned char *id,
             /* Need to expand the array. */
             struct peer *new_peers;
             int n;
-            if(st->maxpeers >= DHT_MAX_PEERS)
+            if(st->maxpeers >= max_peers)
                 return 0;
             n = st->maxpeers == 0 ? 2 : 2 * st->maxpeers;
-            n = MIN(n, DHT_MAX_PEERS);
+            n = MIN(n, max_peers);
             new_peers = realloc(st->peers, n * sizeof(struct peer));
             if(new_peers == NULL)
                 return -1;
@@ -1334,6 +1563,7 @@ storage_store(const unsigned char *id,
             st->maxpeers = n;
         }
         p = &st->peers[st->numpeers++];
+        numstoredpeers++;
         p->time = now.tv_sec;
         p->len = len;
         memcpy(p->ip, ip, len);
@@ -1353,12 +1583,14 @@ expire_storage(void)
                 if(i != st->numpeers - 1)
                     st->peers[i] = st->peers[st->numpeers - 1];
                 st->numpeers--;
+                numstoredpeers--;
             } else {
                 i++;
             }
         }
 
         if(st->numpeers == 0) {
+            unhash_storage(st);
             free(st->peers);
             if(previous)
                 previous->next = st->next;
@@ -1614,6 +1846,11 @@ dht_init(int s, int s6, const unsigned char *id, const unsigned char *v)
 
     storage = NULL;
     numstorage = 0;
+    numstoredpeers = 0;
+
+    rc = dht_random_bytes(&hash_seed, sizeof(hash_seed));
+    if(rc < 0)
+        return -1;
 
     if(s >= 0) {
         buckets = calloc(sizeof(struct bucket), 1);
@@ -1637,6 +1874,9 @@ dht_init(int s, int s6, const unsigned char *id, const unsigned char *v)
             goto fail;
     }
 
+    index_buckets(AF_INET);
+    index_buckets(AF_INET6);
+
     memcpy(myid, id, 20);
     if(v) {
         memcpy(my_v, "1:v4:", 5);
@@ -1725,6 +1965,57 @@ dht_uninit()
         free(sr);
     }
 
+    index_buckets(AF_INET);
+    index_buckets(AF_INET6);
+
+    free(storage_table);
+    storage_table = NULL;
+    storage_table_size = 0;
+
+    free(search_tid_table);
+    free(search_id_table);
+    search_tid_table = search_id_table = NULL;
+    search_table_size = 0;
+
+    return 1;
+}
+
+void
+dht_set_limits(int hashes, int peers, int nsearches)
+{
+    if(hashes > 0)
+        max_hashes = hashes;
+    if(peers > 0)
+        max_peers = peers;
+    if(nsearches > 0)
+        max_searches = nsearches;
+}
+
+int
+dht_get_stats(struct dht_stats *stats)
+{
+    struct search *sr;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    stats->buckets = numbuckets[0];
+    stats->buckets6 = numbuckets[1];
+    stats->hashes = numstorage;
+    stats->peers = numstoredpeers;
+    stats->searches = numsearches;
+    for(sr = searches; sr; sr = sr->next)
+        if(!sr->done)
+            stats->searching++;
+    stats->max_hashes = max_hashes;
+    stats->max_peers = max_peers;
+    stats->max_searches = max_searches;
+
+    for(i = 0; i <= ANNOUNCE_PEER; i++) {
+        stats->messages[i] = message_count[i];
+        stats->usecs[i] = message_usecs[i];
+    }
+
     return 1;
 }
 
@@ -1869,10 +2160,11 @@ dht_periodic(const void *buf, size_t buflen,
              time_t *tosleep,
              dht_callback *callback, void *closure)
 {
+    int message = ERROR;
+
     gettimeofday(&now, NULL);
 
     if(buflen > 0) {
-        int message;
         unsigned char tid[16], id[20], info_hash[20], target[20];
         unsigned char nodes[256], nodes6[1024], token[128];
         int tid_len = 16, token_len = 128;
@@ -2114,6 +2406,18 @@ dht_periodic(const void *buf, size_t buflen,
     }
 
  dontread:
+    if(buflen > 0) {
+        struct timeval done;
+        long usecs;
+        if(message < ERROR || message > ANNOUNCE_PEER)
+            message = ERROR;
+        gettimeofday(&done, NULL);
+        usecs = (done.tv_sec - now.tv_sec) * 1000000 +
+            (done.tv_usec - now.tv_usec);
+        message_count[message]++;
+        message_usecs[message] += MAX(usecs, 0);
+    }
+
     if(now.tv_sec >= rotate_secrets_time)
         rotate_secrets();
 
@@ -2335,7 +2639,7 @@ dht_send(const void *buf, size_t len, int flags,
         return -1;
     }
 
-    return sendto(s, buf, len, flags, sa, salen);
+    return dht_sendto(s, buf, len, flags, sa, salen);
 }
 
 int
@@ -49,6 +49,23 @@ int dht_get_nodes(struct sockaddr_in *sin, int *num,
                   struct sockaddr_in6 *sin6, int *num6);
 int dht_uninit(void);
 
+struct dht_stats {
+    int buckets, buckets6;
+    int hashes, peers;          /* stored info hashes and their peers */
+    int searches;
+    int searching;              /* searches that aren't done yet */
+    int max_hashes, max_peers, max_searches;
+    /* Messages received and the time spent on them, indexed by kind:
+       unparseable or ignored, reply, ping, find_node, get_peers and
+       announce_peer. */
+    unsigned long messages[6];
+    unsigned long usecs[6];
+};
+
+/* Values that are not positive leave the corresponding limit unchanged. */
+void dht_set_limits(int max_hashes, int max_peers, int max_searches);
+int dht_get_stats(struct dht_stats *stats);
+
 /* This must be provided by the user. */
 int dht_blacklisted(const struct sockaddr *sa, int salen);
 void dht_hash(void *hash_return, int hash_size,
@@ -56,3 +73,5 @@ void dht_hash(void *hash_return, int hash_size,
               const void *v2, int len2,
               const void *v3, int len3);
 int dht_random_bytes(void *buf, size_t size);
+int dht_sendto(int sockfd, const void *buf, int len, int flags,
+               const struct sockaddr *to, int tolen);
@@ -360,6 +360,60 @@ struct SizableCircularBuffer {
 
 static struct UTPGlobalStats _global_stats;
 
+// Outgoing packets and out-of-order incoming ones are allocated as
+// fixed-size buffers big enough for any packet up to the ethernet MTU,
+// which covers get_packet_size() for every socket. Freed buffers are
+// kept on g_packet_pool, up to PACKET_POOL_LIMIT of them, and reused.
+// Anything bigger is malloc()ed and freed as usual.
+#define PACKET_BUFFER_SIZE (sizeof(OutgoingPacket) - 1 + 1500)
+#define PACKET_POOL_LIMIT 1024
+
+union PacketBufferHeader {
+	size_t capacity;
+	uint64 align;
+};
+
+Array<PacketBufferHeader*> g_packet_pool;
+
+static void *packet_alloc(size_t size)
+{
+	PacketBufferHeader *h;
+	const size_t count = g_packet_pool.GetCount();
+	if (size <= PACKET_BUFFER_SIZE && count > 0) {
+		h = g_packet_pool[count - 1];
+		g_packet_pool.SetCount(count - 1);
+		_global_stats._npool_hit++;
+	} else {
+		const size_t capacity = max<size_t>(size, PACKET_BUFFER_SIZE);
+		h = (PacketBufferHeader*)malloc(sizeof(PacketBufferHeader) + capacity);
+		h->capacity = capacity;
+		_global_stats._npool_miss++;
+	}
+	return h + 1;
+}
+
+static void *packet_realloc(void *p, size_t size)
+{
+	PacketBufferHeader *h = (PacketBufferHeader*)p - 1;
+	if (size <= h->capacity)
+		return p;
+	h = (PacketBufferHeader*)realloc(h, sizeof(PacketBufferHeader) + size);
+	h->capacity = size;
+	return h + 1;
+}
+
+static void packet_free(void *p)
+{
+	if (p == NULL)
+		return;
+	PacketBufferHeader *h = (PacketBufferHeader*)p - 1;
+	if (h->capacity == PACKET_BUFFER_SIZE && g_packet_pool.GetCount() < PACKET_POOL_LIMIT) {
+		g_packet_pool.Append(h);
+	} else {
+		free(h);
+	}
+}
+
 // Item contains the element we want to make space for
 // index is the index in the list.
 void SizableCircularBuffer::grow(size_t item, size_t index)
@@ -559,6 +613,12 @@ struct UTPSocket {
 	PackedSockAddr addr;
 
 	size_t idx;
+	// next socket in the same g_utp_hash bucket
+	UTPSocket *hash_next;
+	// position in g_utp_timeouts
+	size_t timeout_idx;
+	// when UTP_CheckTimeouts next needs to look at this socket
+	uint32 next_check;
 
 	uint16 reorder_count;
 	byte duplicate_ack;
@@ -782,6 +842,8 @@ struct UTPSocket {
 
 	void check_timeouts();
 
+	uint32 get_next_check();
+
 	int ack_packet(uint16 seq);
 
 	size_t selective_ack_bytes(uint base, const byte* mask, byte len, int64& min_rtt);
@@ -795,6 +857,176 @@ struct UTPSocket {
 
 Array<RST_Info> g_rst_info;
 Array<UTPSocket*> g_utp_sockets;
+// g_utp_sockets hashed by (addr, conn_id_recv), so incoming packets don't
+// have to scan every socket. Buckets are chained through hash_next, and
+// there are always at least as many buckets as sockets.
+Array<UTPSocket*> g_utp_hash;
+
+static uint32 UTP_HashKey(const PackedSockAddr &addr, uint32 conn_id_recv)
+{
+	// FNV-1a
+	const byte *p = (const byte*)&addr;
+	uint32 h = 2166136261u;
+	for (size_t i = 0; i != sizeof(PackedSockAddr); i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	for (size_t i = 0; i != 4; i++) {
+		h = (h ^ byte(conn_id_recv >> (i * 8))) * 16777619u;
+	}
+	return h;
+}
+
+static void UTP_HashLink(UTPSocket *conn)
+{
+	const size_t b = UTP_HashKey(conn->addr, conn->conn_id_recv) & (g_utp_hash.GetCount() - 1);
+	conn->hash_next = g_utp_hash[b];
+	g_utp_hash[b] = conn;
+}
+
+static void UTP_HashUnlink(UTPSocket *conn)
+{
+	const size_t b = UTP_HashKey(conn->addr, conn->conn_id_recv) & (g_utp_hash.GetCount() - 1);
+	UTPSocket **p = &g_utp_hash[b];
+	while (*p != conn) {
+		assert(*p != NULL);
+		p = &(*p)->hash_next;
+	}
+	*p = conn->hash_next;
+}
+
+// Add a socket that was just appended to g_utp_sockets
+static void UTP_HashInsert(UTPSocket *conn)
+{
+	const size_t count = g_utp_sockets.GetCount();
+	if (count <= g_utp_hash.GetCount()) {
+		UTP_HashLink(conn);
+		return;
+	}
+
+	// Double the bucket count and rehash everything, including conn
+	size_t buckets = max<size_t>(64, g_utp_hash.GetCount());
+	while (buckets < count) buckets *= 2;
+	g_utp_hash.Resize(buckets);
+	g_utp_hash.SetCount(buckets);
+	for (size_t i = 0; i != buckets; i++) {
+		g_utp_hash[i] = NULL;
+	}
+	for (size_t i = 0; i != count; i++) {
+		UTP_HashLink(g_utp_sockets[i]);
+	}
+}
+
+// g_utp_sockets as a min-heap ordered by next_check, so UTP_CheckTimeouts
+// only has to look at the sockets that have something due.
+Array<UTPSocket*> g_utp_timeouts;
+
+static inline bool UTP_CheckIsBefore(const UTPSocket *a, const UTPSocket *b)
+{
+	return (int)(a->next_check - b->next_check) < 0;
+}
+
+static void UTP_TimeoutsSet(size_t i, UTPSocket *conn)
+{
+	g_utp_timeouts[i] = conn;
+	conn->timeout_idx = i;
+}
+
+static void UTP_TimeoutsSiftUp(size_t i)
+{
+	UTPSocket *conn = g_utp_timeouts[i];
+	while (i > 0) {
+		const size_t parent = (i - 1) / 2;
+		if (!UTP_CheckIsBefore(conn, g_utp_timeouts[parent]))
+			break;
+		UTP_TimeoutsSet(i, g_utp_timeouts[parent]);
+		i = parent;
+	}
+	UTP_TimeoutsSet(i, conn);
+}
+
+static void UTP_TimeoutsSiftDown(size_t i)
+{
+	const size_t count = g_utp_timeouts.GetCount();
+	UTPSocket *conn = g_utp_timeouts[i];
+	for (;;) {
+		size_t child = i * 2 + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && UTP_CheckIsBefore(g_utp_timeouts[child + 1], g_utp_timeouts[child]))
+			child++;
+		if (!UTP_CheckIsBefore(g_utp_timeouts[child], conn))
+			break;
+		UTP_TimeoutsSet(i, g_utp_timeouts[child]);
+		i = child;
+	}
+	UTP_TimeoutsSet(i, conn);
+}
+
+static void UTP_TimeoutsInsert(UTPSocket *conn)
+{
+	UTP_TimeoutsSet(g_utp_timeouts.Append(conn), conn);
+	UTP_TimeoutsSiftUp(conn->timeout_idx);
+}
+
+static void UTP_TimeoutsRemove(UTPSocket *conn)
+{
+	const size_t i = conn->timeout_idx;
+	assert(g_utp_timeouts[i] == conn);
+	UTPSocket *last = g_utp_timeouts[g_utp_timeouts.GetCount() - 1];
+	g_utp_timeouts.SetCount(g_utp_timeouts.GetCount() - 1);
+	if (last != conn) {
+		UTP_TimeoutsSet(i, last);
+		UTP_TimeoutsSiftUp(i);
+		UTP_TimeoutsSiftDown(last->timeout_idx);
+	}
+}
+
+static void UTP_ScheduleCheck(UTPSocket *conn, uint32 when)
+{
+	const bool sooner = (int)(when - conn->next_check) < 0;
+	conn->next_check = when;
+	if (sooner)
+		UTP_TimeoutsSiftUp(conn->timeout_idx);
+	else
+		UTP_TimeoutsSiftDown(conn->timeout_idx);
+}
+
+// Have the next UTP_CheckTimeouts look at this socket. Called whenever
+// something from outside may have given the socket new work to do.
+static void UTP_MarkDue(UTPSocket *conn)
+{
+	if ((int)(conn->next_check - g_current_ms) > 0)
+		UTP_ScheduleCheck(conn, g_current_ms);
+}
+
+static void UTP_SetConnIdRecv(UTPSocket *conn, uint32 conn_id_recv)
+{
+	UTP_HashUnlink(conn);
+	conn->conn_id_recv = conn_id_recv;
+	UTP_HashLink(conn);
+}
+
+// Of the sockets for addr with this conn_id_recv (and, if it's given,
+// conn_id_send), return whichever comes first in g_utp_sockets, or `best'
+// if that comes earlier still. This keeps the lookups below choosing the
+// same socket the old linear scans did when several match.
+static UTPSocket *UTP_HashLookup(const PackedSockAddr &addr, uint32 conn_id_recv,
+								 const uint32 *conn_id_send, UTPSocket *best)
+{
+	if (g_utp_hash.GetCount() == 0)
+		return best;
+
+	const size_t b = UTP_HashKey(addr, conn_id_recv) & (g_utp_hash.GetCount() - 1);
+	for (UTPSocket *conn = g_utp_hash[b]; conn != NULL; conn = conn->hash_next) {
+		if (conn->conn_id_recv != conn_id_recv || conn->addr != addr)
+			continue;
+		if (conn_id_send && conn->conn_id_send != *conn_id_send)
+			continue;
+		if (!best || conn->idx < best->idx)
+			best = conn;
+	}
+	return best;
+}
 
 static void UTP_RegisterSentPacket(size_t length) {
 	if (length <= PACKET_SIZE_MID) {
@@ -1147,19 +1379,19 @@ void UTPSocket::write_outgoing_packet(size_t payload, uint flags)
 		if (payload && pkt && !pkt->transmissions && pkt->payload < packet_size) {
 			// Use the previous unsent packet
 			added = min(payload + pkt->payload, max<size_t>(packet_size, pkt->payload)) - pkt->payload;
-			pkt = (OutgoingPacket*)realloc(pkt,
-										   (sizeof(OutgoingPacket) - 1) +
-										   header_size +
-										   pkt->payload + added);
+			pkt = (OutgoingPacket*)packet_realloc(pkt,
+												  (sizeof(OutgoingPacket) - 1) +
+												  header_size +
+												  pkt->payload + added);
 			outbuf.put(seq_nr - 1, pkt);
 			append = false;
 			assert(!pkt->need_resend);
 		} else {
 			// Create the packet to send.
 			added = payload;
-			pkt = (OutgoingPacket*)malloc((sizeof(OutgoingPacket) - 1) +
-										  header_size +
-										  added);
+			pkt = (OutgoingPacket*)packet_alloc((sizeof(OutgoingPacket) - 1) +
+												header_size +
+												added);
 			pkt->payload = 0;
 			pkt->transmissions = 0;
 			pkt->need_resend = false;
@@ -1392,6 +1624,55 @@ void UTPSocket::check_timeouts()
 	if (send_quota > limit) send_quota = limit;
 }
 
+static inline uint32 earliest(uint32 a, uint32 b) { return (int)(a - b) < 0 ? a : b; }
+
+// When check_timeouts() next has something to do, assuming nothing else
+// happens to the socket in the meantime.
+uint32 UTPSocket::get_next_check()
+{
+	const uint32 next_tick = g_current_ms + 1;
+
+	// Anything with packets in flight or queued, or whose send quota is
+	// still filling up, is paced by check_timeouts() on every tick.
+	const int32 limit = max<int32>((int32)max_window / 2, 5 * (int32)get_packet_size()) * 100;
+	if (cur_window_packets > 0 || send_quota < limit ||
+		state == CS_CONNECTED_FULL || state == CS_DESTROY) {
+		return next_tick;
+	}
+
+	uint32 next = g_current_ms + 0x70000000;
+
+	switch (state) {
+	case CS_SYN_SENT:
+	case CS_CONNECTED_FULL:
+	case CS_CONNECTED:
+	case CS_FIN_SENT:
+		if (max_window_user == 0)
+			next = earliest(next, zerowindow_time);
+		if (!(USE_PACKET_PACING) && rto_timeout > 0)
+			next = earliest(next, rto_timeout);
+		if (state >= CS_CONNECTED) {
+			if (bytes_since_ack > DELAYED_ACK_BYTE_THRESHOLD)
+				return next_tick;
+			next = earliest(next, ack_time);
+			next = earliest(next, last_sent_packet + KEEPALIVE_INTERVAL);
+		}
+		break;
+	case CS_GOT_FIN:
+	case CS_DESTROY_DELAY:
+		next = earliest(next, rto_timeout);
+		break;
+	case CS_IDLE:
+	case CS_RESET:
+	case CS_DESTROY:
+		break;
+	}
+
+	if ((int)(next - next_tick) < 0)
+		next = next_tick;
+	return next;
+}
+
 // returns:
 // 0: the packet was acked.
 // 1: it means that the packet had already been acked
@@ -1450,7 +1731,7 @@ int UTPSocket::ack_packet(uint16 seq)
 		assert(cur_window >= pkt->payload);
 		cur_window -= pkt->payload;
 	}
-	free(pkt);
+	packet_free(pkt);
 	return 0;
 }
 
@@ -2197,7 +2478,7 @@ size_t UTP_ProcessIncoming(UTPSocket *conn, const byte *packet, size_t len, bool
 			conn->bytes_since_ack += count;
 
 			// Free the element from the reorder buffer
-			free(p);
+			packet_free(p);
 			assert(conn->reorder_count > 0);
 			conn->reorder_count--;
 		}
@@ -2244,7 +2525,7 @@ size_t UTP_ProcessIncoming(UTPSocket *conn, const byte *packet, size_t len, bool
 		}
 
 		// Allocate memory to fit the packet that needs to re-ordered
-		byte *mem = (byte*)malloc((packet_end - data) + sizeof(uint));
+		byte *mem = (byte*)packet_alloc((packet_end - data) + sizeof(uint));
 		*(uint*)mem = (uint)(packet_end - data);
 		memcpy(mem + sizeof(uint), data, packet_end - data);
 
@@ -2295,6 +2576,9 @@ void UTP_Free(UTPSocket *conn)
 	assert(conn->idx < g_utp_sockets.GetCount());
 	assert(g_utp_sockets[conn->idx] == conn);
 
+	UTP_HashUnlink(conn);
+	UTP_TimeoutsRemove(conn);
+
 	// Unlink object from the global list
 	assert(g_utp_sockets.GetCount() > 0);
 
@@ -2312,10 +2596,10 @@ void UTP_Free(UTPSocket *conn)
 
 	// Free all memory occupied by the socket object.
 	for (size_t i = 0; i <= conn->inbuf.mask; i++) {
-		free(conn->inbuf.elements[i]);
+		packet_free(conn->inbuf.elements[i]);
 	}
 	for (size_t i = 0; i <= conn->outbuf.mask; i++) {
-		free(conn->outbuf.elements[i]);
+		packet_free(conn->outbuf.elements[i]);
 	}
 	free(conn->inbuf.elements);
 	free(conn->outbuf.elements);
@@ -2371,6 +2655,9 @@ UTPSocket *UTP_Create(SendToProc *send_to_proc, void *send_to_userdata, const st
 	conn->inbuf.elements = (void**)calloc(16, sizeof(void*));
 
 	conn->idx = g_utp_sockets.Append(conn);
+	UTP_HashInsert(conn);
+	conn->next_check = g_current_ms;
+	UTP_TimeoutsInsert(conn);
 
 	LOG_UTPV("0x%08x: UTP_Create", conn);
 
@@ -2436,6 +2723,7 @@ void UTP_Connect(UTPSocket *conn)
 	conn->state = CS_SYN_SENT;
 
 	g_current_ms = UTP_GetMilliseconds();
+	UTP_MarkDue(conn);
 
 	// Create and send a connect message
 	uint32 conn_seed = UTP_Random();
@@ -2459,7 +2747,7 @@ void UTP_Connect(UTPSocket *conn)
 	conn->last_rcv_win = conn->get_rcv_window();
 
 	conn->conn_seed = conn_seed;
-	conn->conn_id_recv = conn_seed;
+	UTP_SetConnIdRecv(conn, conn_seed);
 	conn->conn_id_send = conn_seed+1;
 	// if you need compatibiltiy with 1.8.1, use this. it increases attackability though.
 	//conn->seq_nr = 1;
@@ -2468,7 +2756,7 @@ void UTP_Connect(UTPSocket *conn)
 	// Create the connect packet.
 	const size_t header_ext_size = conn->get_header_extensions_size();
 
-	OutgoingPacket *pkt = (OutgoingPacket*)malloc(sizeof(OutgoingPacket) - 1 + header_ext_size);
+	OutgoingPacket *pkt = (OutgoingPacket*)packet_alloc(sizeof(OutgoingPacket) - 1 + header_ext_size);
 
 	PacketFormatExtensions* p = (PacketFormatExtensions*)pkt->data;
 	PacketFormatExtensionsV1* p1 = (PacketFormatExtensionsV1*)pkt->data;
@@ -2512,6 +2800,39 @@ void UTP_Connect(UTPSocket *conn)
 	conn->send_packet(pkt);
 }
 
+#ifdef _DEBUG
+// The linear scan that UTP_FindSocket replaced, kept to cross-check it
+static UTPSocket *UTP_FindSocketLinear(const PackedSockAddr &addr, uint32 id, bool reset)
+{
+	for (size_t i = 0; i < g_utp_sockets.GetCount(); i++) {
+		UTPSocket *conn = g_utp_sockets[i];
+		if (conn->addr != addr)
+			continue;
+		if (conn->conn_id_recv == id || (reset && conn->conn_id_send == id))
+			return conn;
+	}
+	return NULL;
+}
+#endif
+
+// Find the socket that a packet from addr with connection id `id' is for.
+// RST packets may carry either of the socket's ids, everything else
+// carries conn_id_recv.
+static UTPSocket *UTP_FindSocket(const PackedSockAddr &addr, uint32 id, bool reset)
+{
+	UTPSocket *conn = UTP_HashLookup(addr, id, NULL, NULL);
+	if (reset) {
+		// conn_id_send is always conn_id_recv + 1 on the side that sent
+		// the SYN, and conn_id_recv - 1 on the side that received it
+		conn = UTP_HashLookup(addr, id - 1, &id, conn);
+		conn = UTP_HashLookup(addr, id + 1, &id, conn);
+	}
+#ifdef _DEBUG
+	assert(conn == UTP_FindSocketLinear(addr, id, reset));
+#endif
+	return conn;
+}
+
 bool UTP_IsIncomingUTP(UTPGotIncomingConnection *incoming_proc,
 					   SendToProc *send_to_proc, void *send_to_userdata,
 					   const byte *buffer, size_t len, const struct sockaddr *to, socklen_t tolen)
@@ -2552,39 +2873,35 @@ bool UTP_IsIncomingUTP(UTPGotIncomingConnection *incoming_proc,
 
 	const byte flags = version == 0 ? pf->flags : pf1->type();
 
-	for (size_t i = 0; i < g_utp_sockets.GetCount(); i++) {
-		UTPSocket *conn = g_utp_sockets[i];
-		//LOG_UTPV("Examining UTPSocket %s for %s and (seed:%u s:%u r:%u) for %u",
-		//		addrfmt(conn->addr, addrbuf), addrfmt(addr, addrbuf2), conn->conn_seed, conn->conn_id_send, conn->conn_id_recv, id);
-		if (conn->addr != addr)
-			continue;
+	UTPSocket *conn = flags == ST_SYN ? NULL : UTP_FindSocket(addr, id, flags == ST_RESET);
+	if (conn)
+		UTP_MarkDue(conn);
 
-		if (flags == ST_RESET && (conn->conn_id_send == id || conn->conn_id_recv == id)) {
-			LOG_UTPV("0x%08x: recv RST for existing connection", conn);
-			if (!conn->userdata || conn->state == CS_FIN_SENT) {
-				conn->state = CS_DESTROY;
-			} else {
-				conn->state = CS_RESET;
-			}
-			if (conn->userdata) {
-				conn->func.on_overhead(conn->userdata, false, len + conn->get_udp_overhead(),
-									   close_overhead);
-				const int err = conn->state == CS_SYN_SENT ?
-					ECONNREFUSED :
-					ECONNRESET;
-				conn->func.on_error(conn->userdata, err);
-			}
-			return true;
-		} else if (flags != ST_SYN && conn->conn_id_recv == id) {
-			LOG_UTPV("0x%08x: recv processing", conn);
-			const size_t read = UTP_ProcessIncoming(conn, buffer, len);
-			if (conn->userdata) {
-				conn->func.on_overhead(conn->userdata, false,
-					(len - read) + conn->get_udp_overhead(),
-					header_overhead);
-			}
-			return true;
+	if (conn && flags == ST_RESET) {
+		LOG_UTPV("0x%08x: recv RST for existing connection", conn);
+		if (!conn->userdata || conn->state == CS_FIN_SENT) {
+			conn->state = CS_DESTROY;
+		} else {
+			conn->state = CS_RESET;
+		}
+		if (conn->userdata) {
+			conn->func.on_overhead(conn->userdata, false, len + conn->get_udp_overhead(),
+								   close_overhead);
+			const int err = conn->state == CS_SYN_SENT ?
+				ECONNREFUSED :
+				ECONNRESET;
+			conn->func.on_error(conn->userdata, err);
 		}
+		return true;
+	} else if (conn) {
+		LOG_UTPV("0x%08x: recv processing", conn);
+		const size_t read = UTP_ProcessIncoming(conn, buffer, len);
+		if (conn->userdata) {
+			conn->func.on_overhead(conn->userdata, false,
+				(len - read) + conn->get_udp_overhead(),
+				header_overhead);
+		}
+		return true;
 	}
 
 	if (flags == ST_RESET) {
@@ -2630,7 +2947,7 @@ bool UTP_IsIncomingUTP(UTPGotIncomingConnection *incoming_proc,
 		// This is value that identifies this connection for them.
 		conn->conn_id_send = id;
 		// This is value that identifies this connection for us.
-		conn->conn_id_recv = id+1;
+		UTP_SetConnIdRecv(conn, id+1);
 		conn->ack_nr = seq_nr;
 		conn->seq_nr = UTP_Random();
 		conn->fast_resend_seq_nr = conn->seq_nr;
@@ -2674,28 +2991,26 @@ bool UTP_HandleICMP(const byte* buffer, size_t len, const struct sockaddr *to, s
 	const byte version = UTP_IsV1(p1);
 	const uint32 id = (version == 0) ? p->connid : uint32(p1->connid);
 
-	for (size_t i = 0; i < g_utp_sockets.GetCount(); ++i) {
-		UTPSocket *conn = g_utp_sockets[i];
-		if (conn->addr == addr &&
-			conn->conn_id_recv == id) {
-			// Don't pass on errors for idle/closed connections
-			if (conn->state != CS_IDLE) {
-				if (!conn->userdata || conn->state == CS_FIN_SENT) {
-					LOG_UTPV("0x%08x: icmp packet causing socket destruction", conn);
-					conn->state = CS_DESTROY;
-				} else {
-					conn->state = CS_RESET;
-				}
-				if (conn->userdata) {
-					const int err = conn->state == CS_SYN_SENT ?
-						ECONNREFUSED :
-						ECONNRESET;
-					LOG_UTPV("0x%08x: icmp packet causing error on socket:%d", conn, err);
-					conn->func.on_error(conn->userdata, err);
-				}
+	UTPSocket *conn = UTP_FindSocket(addr, id, false);
+	if (conn) {
+		UTP_MarkDue(conn);
+		// Don't pass on errors for idle/closed connections
+		if (conn->state != CS_IDLE) {
+			if (!conn->userdata || conn->state == CS_FIN_SENT) {
+				LOG_UTPV("0x%08x: icmp packet causing socket destruction", conn);
+				conn->state = CS_DESTROY;
+			} else {
+				conn->state = CS_RESET;
+			}
+			if (conn->userdata) {
+				const int err = conn->state == CS_SYN_SENT ?
+					ECONNREFUSED :
+					ECONNRESET;
+				LOG_UTPV("0x%08x: icmp packet causing error on socket:%d", conn, err);
+				conn->func.on_error(conn->userdata, err);
 			}
-			return true;
 		}
+		return true;
 	}
 	return false;
 }
@@ -2716,6 +3031,7 @@ bool UTP_Write(UTPSocket *conn, size_t bytes)
 	}
 
 	g_current_ms = UTP_GetMilliseconds();
+	UTP_MarkDue(conn);
 
 	conn->update_send_quota();
 
@@ -2752,6 +3068,8 @@ void UTP_RBDrained(UTPSocket *conn)
 {
 	assert(conn);
 
+	UTP_MarkDue(conn);
+
 	const size_t rcvwin = conn->get_rcv_window();
 
 	if (rcvwin > conn->last_rcv_win) {
@@ -2778,19 +3096,33 @@ void UTP_CheckTimeouts()
 		g_rst_info.Compact();
 	}
 
-	for (size_t i = 0; i != g_utp_sockets.GetCount(); i++) {
-		UTPSocket *conn = g_utp_sockets[i];
+	while (g_utp_timeouts.GetCount() > 0) {
+		UTPSocket *conn = g_utp_timeouts[0];
+		if ((int)(conn->next_check - g_current_ms) > 0)
+			break;
+
 		conn->check_timeouts();
 
 		// Check if the object was deleted
 		if (conn->state == CS_DESTROY) {
 			LOG_UTPV("0x%08x: Destroying", conn);
 			UTP_Free(conn);
-			i--;
+			continue;
 		}
+
+		UTP_ScheduleCheck(conn, conn->get_next_check());
 	}
 }
 
+uint32 UTP_GetNextTimeout()
+{
+	if (g_utp_timeouts.GetCount() == 0)
+		return 0x70000000;
+
+	const int32 msec = (int32)(g_utp_timeouts[0]->next_check - UTP_GetMilliseconds());
+	return msec > 0 ? (uint32)msec : 0;
+}
+
 size_t UTP_GetPacketSize(UTPSocket *socket)
 {
 	return socket->get_packet_size();
@@ -2840,6 +3172,8 @@ void UTP_Close(UTPSocket *conn)
 
 	LOG_UTPV("0x%08x: UTP_Close in state:%s", conn, statenames[conn->state]);
 
+	UTP_MarkDue(conn);
+
 	switch(conn->state) {
 	case CS_CONNECTED:
 	case CS_CONNECTED_FULL:
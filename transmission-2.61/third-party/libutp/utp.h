@@ -121,6 +121,11 @@ void UTP_RBDrained(struct UTPSocket *socket);
 // Call periodically to process timeouts and other periodic events
 void UTP_CheckTimeouts(void);
 
+// Returns how many milliseconds UTP_CheckTimeouts can wait before it has
+// anything to do, or 0 if it should be called on the next tick. Receiving
+// packets or calling any of the socket functions above can make it sooner.
+uint32 UTP_GetNextTimeout(void);
+
 // Retrieves the peer address of the specified socket, stores this address in the
 // sockaddr structure pointed to by the addr argument, and stores the length of this
 // address in the object pointed to by the addrlen argument.
@@ -154,6 +159,8 @@ void UTP_Close(struct UTPSocket *socket);
 struct UTPGlobalStats {
 	uint32 _nraw_recv[5];	// total packets recieved less than 300/600/1200/MTU bytes fpr all connections (global)
 	uint32 _nraw_send[5];	// total packets sent less than 300/600/1200/MTU bytes for all connections (global)
+	uint32 _npool_hit;	// packet buffers reused from the pool
+	uint32 _npool_miss;	// packet buffers that had to be allocated
 };
 
 void UTP_GetGlobalStats(struct UTPGlobalStats *stats);
@@ -94,10 +94,22 @@ tr_getcwd( void )
     return tr_strdup( buf );
 }
 
+/* how fast the files were read and hashed */
+static void
+printRate( const tr_metainfo_builder * b, uint64_t msec )
+{
+    const double GB = b->totalSize / 1e9;
+    const double seconds = MAX( msec, 1 ) / 1000.0;
+
+    printf( " (%.2f GB in %.1f seconds, %.2f GB/s)", GB, seconds, GB / seconds );
+}
+
 int
 main( int argc, char * argv[] )
 {
+    int i;
     char * out2 = NULL;
+    uint64_t begin;
     tr_metainfo_builder * b = NULL;
 
     tr_setMessageLevel( TR_MSG_ERR );
@@ -145,17 +157,20 @@ main( int argc, char * argv[] )
     printf( "Creating torrent \"%s\" ...", outfile );
     fflush( stdout );
 
+    begin = tr_time_msec( );
     b = tr_metaInfoBuilderCreate( infile );
     tr_makeMetaInfo( b, outfile, trackers, trackerCount, comment, isPrivate );
-    while( !b->isDone ) {
-        tr_wait_msec( 500 );
-        putc( '.', stdout );
-        fflush( stdout );
+    for( i=1; !b->isDone; ++i ) {
+        tr_wait_msec( 50 );
+        if( !( i % 10 ) ) {
+            putc( '.', stdout );
+            fflush( stdout );
+        }
     }
 
     putc( ' ', stdout );
     switch( b->result ) {
-        case TR_MAKEMETA_OK:        printf( "done!" ); break;
+        case TR_MAKEMETA_OK:        printf( "done!" ); printRate( b, tr_time_msec( ) - begin ); break;
         case TR_MAKEMETA_URL:       printf( "bad announce URL: \"%s\"", b->errfile ); break;
         case TR_MAKEMETA_IO_READ:   printf( "error reading \"%s\": %s", b->errfile, tr_strerror(b->my_errno) ); break;
         case TR_MAKEMETA_IO_WRITE:  printf( "error writing \"%s\": %s", b->errfile, tr_strerror(b->my_errno) ); break;